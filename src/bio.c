@@ -12,6 +12,12 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * breadahead starts reading blocks that are about to be bread,
+//     and bawrite writes a buffer out and releases it once it is,
+//     both without waiting; under a blk_start_plug they go to the
+//     disk as one request where the sectors are adjacent.
+// * bdirect moves whole sectors between memory and the disk without
+//     going through the cache at all, for O_DIRECT and the raw disk.
 
 
 #include "include/types.h"
@@ -23,6 +29,14 @@
 #include "include/printf.h"
 #include "include/disk.h"
 #include "include/fat32.h"
+#include "include/trace.h"
+#include "include/blkstat.h"
+#include "include/blk.h"
+#include "include/kalloc.h"
+#include "include/proc.h"
+#include "include/vm.h"
+#include "include/pm.h"
+#include "include/copy.h"
 
 struct cache{
   struct spinlock lock;
@@ -32,6 +46,8 @@ struct cache{
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+  int ahead;    // buffers being read ahead
+  int behind;   // buffers being written behind
 } corrupt,bcache;
 
 extern struct fs FatFs[FSNUM];
@@ -78,6 +94,9 @@ bget(uint dev, uint sectorno)
     if(b->dev == dev && b->sectorno == sectorno){
       b->refcnt++;
       release(&bcache.lock);
+      // its I/O may be held in our plug
+      if(holdingsleep(&b->lock))
+        blk_flush_plug();
       acquiresleep(&b->lock);
       return b;
     }
@@ -99,15 +118,131 @@ bget(uint dev, uint sectorno)
   panic("bget: no buffers");
 }
 
+// A buf not yet cached, to read ahead into: locked, or NULL if the
+// block is cached already or there is no buffer to spare.
+static struct buf*
+bget_ahead(uint dev, uint sectorno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->sectorno == sectorno){
+      release(&bcache.lock);
+      return NULL;
+    }
+  }
+  // leave most of the cache to bget(), which can't do without
+  if(bcache.ahead < NBUF / 3){
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+      if(b->refcnt == 0) {
+        b->dev = dev;
+        b->sectorno = sectorno;
+        b->valid = 0;
+        b->refcnt = 1;
+        bcache.ahead++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+  }
+  release(&bcache.lock);
+  return NULL;
+}
+
+// The disk is done with a breadahead or bawrite.
+static void
+bio_end_io(struct blkreq *r)
+{
+  struct buf *b = r->private;
+  int write = r->write;
+
+  trace(TRACE_BIO_COMPLETE, b->sectorno, b->dev | (uint64)write << 32);
+  if (!write && !r->error)
+    b->valid = 1;
+  if (write && r->error) {
+    // write() returned long ago; at least don't go on serving data
+    // the disk doesn't have
+    __debug_warn("[bio_end_io] write of sector %d failed\n", b->sectorno);
+    b->valid = 0;
+  }
+  kfree(r);
+  acquire(&bcache.lock);
+  if (write)
+    bcache.behind--;
+  else
+    bcache.ahead--;
+  release(&bcache.lock);
+  brelse(b);
+}
+
+static void
+bio_submit(uint dev, struct buf *b, int write)
+{
+  struct blkreq *r = kmalloc(sizeof(struct blkreq));
+
+  if (r == NULL) {
+    // nothing was started; a bread will read it
+    if (!write) {
+      acquire(&bcache.lock);
+      bcache.ahead--;
+      release(&bcache.lock);
+      brelse(b);
+    } else {
+      acquire(&bcache.lock);
+      bcache.behind--;
+      release(&bcache.lock);
+      bwrite(dev, b);
+      brelse(b);
+    }
+    return;
+  }
+  trace(TRACE_BIO_SUBMIT, b->sectorno, dev | (uint64)write << 32);
+  blk_initreq(r, write, b->sectorno, bio_end_io, b);
+  blk_addsect(r, b->data);
+  blk_submit(FatFs[dev].queue, r);
+}
+
+// b to or from the disk, through the block layer if dev has a queue
+// and else its driver, which is synchronous. Returns 0 or -1.
+static int
+brw(uint dev, struct buf *b, int write)
+{
+  struct blkqueue *q = FatFs[dev].queue;
+  struct blkreq r;
+
+  if (q == NULL) {
+    uint64 submit = blkstat_submit(dev);
+    if (write)
+      FatFs[dev].disk_write(b,FatFs[dev].image);
+    else
+      FatFs[dev].disk_read(b,FatFs[dev].image);
+    blkstat_done(dev, write ? BLK_WRITE : BLK_READ, 1, submit, submit);
+    return 0;
+  }
+  blk_initreq(&r, write, b->sectorno, NULL, NULL);
+  blk_addsect(&r, b->data);
+  blk_submit(q, &r);
+  blk_wait(&r);
+  return r.error ? -1 : 0;
+}
+
 // Return a locked buf with the contents of the indicated block.
+// kind says what the block holds, for blkstat.
 struct buf* 
-bread(uint dev, uint sectorno) {
+bread(uint dev, uint sectorno, int kind) {
   struct buf *b;
   b = bget(dev, sectorno);
 
   if (!b->valid) {
-    FatFs[dev].disk_read(b,FatFs[dev].image);
-    b->valid = 1;
+    blkstat_cache(dev, kind, 0);
+    trace(TRACE_BIO_SUBMIT, sectorno, dev);
+    if (brw(dev, b, 0) == 0)
+      b->valid = 1;
+    trace(TRACE_BIO_COMPLETE, sectorno, dev);
+  } else {
+    blkstat_cache(dev, kind, 1);
   }
   
   return b;
@@ -120,7 +255,162 @@ bwrite(uint dev, struct buf *b) {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
 
-  FatFs[dev].disk_write(b,FatFs[dev].image);
+  trace(TRACE_BIO_SUBMIT, b->sectorno, dev | 1ul << 32);
+  brw(dev, b, 1);
+  trace(TRACE_BIO_COMPLETE, b->sectorno, dev | 1ul << 32);
+}
+
+// Start reading up to BREADAHEAD blocks from sectorno, and don't wait:
+// a bread of one waits for it. Blocks already cached are skipped, and
+// so are all of them on a device without a queue, or when the buffers
+// for it can't be spared.
+void
+breadahead(uint dev, uint sectorno, int n)
+{
+  struct blkplug plug;
+  struct buf *b;
+
+  if (FatFs[dev].queue == NULL)
+    return;
+  if (n > BREADAHEAD)
+    n = BREADAHEAD;
+  blk_start_plug(&plug);
+  for (int i = 0; i < n; i++) {
+    if ((b = bget_ahead(dev, sectorno + i)) != NULL)
+      bio_submit(dev, b, 0);
+  }
+  blk_finish_plug(&plug);
+}
+
+// Write b out and release it once it is written, without waiting.
+// The caller gives b up as with brelse. Like breadahead, it holds no
+// more than NBUF / 3 buffers at once, and past that it waits for the
+// write as bwrite does.
+void
+bawrite(uint dev, struct buf *b)
+{
+  int async = 0;
+
+  if(!holdingsleep(&b->lock))
+    panic("bawrite");
+
+  if (FatFs[dev].queue != NULL) {
+    acquire(&bcache.lock);
+    if (bcache.behind < NBUF / 3) {
+      bcache.behind++;
+      async = 1;
+    }
+    release(&bcache.lock);
+  }
+  if (!async) {
+    bwrite(dev, b);
+    brelse(b);
+    return;
+  }
+  bio_submit(dev, b, 1);
+}
+
+// A cached copy of a sector bdirect() is doing: wait for any I/O on
+// it, and once a write is done, drop it so the next bread reads what
+// was written.
+static void
+bdirect_sync(uint dev, uint sectorno, int drop)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->sectorno == sectorno){
+      b->refcnt++;
+      release(&bcache.lock);
+      if(holdingsleep(&b->lock))
+        blk_flush_plug();
+      acquiresleep(&b->lock);
+      if(drop)
+        b->valid = 0;
+      brelse(b);
+      return;
+    }
+  }
+  release(&bcache.lock);
+}
+
+// bdirect() on a device without a queue, whose driver only knows bufs.
+static int
+bdirect_cached(uint dev, int write, int user, uint64 addr, uint sectorno, uint n)
+{
+  struct buf *b;
+  uint tot;
+  int r;
+
+  for(tot = 0; tot < n; tot += BSIZE, addr += BSIZE, sectorno++){
+    b = bread(dev, sectorno, BIO_DATA);
+    if(!b->valid)
+      r = -1;
+    else if(write){
+      if((r = either_copyin(user, b->data, addr, BSIZE)) == 0)
+        bwrite(dev, b);
+    } else
+      r = either_copyout(user, addr, b->data, BSIZE);
+    brelse(b);
+    if(r < 0)
+      break;
+  }
+  return tot ? tot : -1;
+}
+
+// n bytes between addr and the disk from sectorno on, around the
+// cache; addr and n are multiples of BSIZE, so no sector crosses a
+// page. Up to BLK_MAXSECT sectors go as one request, with the user
+// pages they use pinned until it is done. Returns the bytes done, or
+// -1 if none were.
+int
+bdirect(uint dev, int write, int user, uint64 addr, uint sectorno, uint n)
+{
+  struct blkqueue *q = FatFs[dev].queue;
+  uchar *data[BLK_MAXSECT];
+  struct blkreq r;
+  uint64 va, pa;
+  uint tot;
+  int i, nsect;
+
+  if(q == NULL)
+    return bdirect_cached(dev, write, user, addr, sectorno, n);
+  for(tot = 0; tot < n; tot += nsect * BSIZE, sectorno += nsect){
+    for(nsect = 0; nsect < BLK_MAXSECT && tot + nsect * BSIZE < n; nsect++){
+      va = addr + tot + nsect * BSIZE;
+      if(user){
+        // the disk reads the page for a write, and writes it for a read
+        if(write)
+          pa = walkaddr_read(myproc()->pagetable, PGROUNDDOWN(va));
+        else
+          pa = walkaddr_write(myproc()->pagetable, PGROUNDDOWN(va));
+        if(pa == NULL)
+          break;
+        pagedup((void*)pa);
+        va = pa + va % PGSIZE;
+      }
+      data[nsect] = (uchar*)va;
+      bdirect_sync(dev, sectorno + nsect, 0);
+    }
+    if(nsect == 0)
+      break;
+    blk_initreq(&r, write, sectorno, NULL, NULL);
+    for(i = 0; i < nsect; i++)
+      blk_addsect(&r, data[i]);
+    blk_submit(q, &r);
+    blk_wait(&r);
+    // r.data may have taken in others merged into it: unpin from data[]
+    for(i = 0; i < nsect; i++){
+      if(write)
+        bdirect_sync(dev, sectorno + i, 1);
+      if(user)
+        freepage((void*)PGROUNDDOWN((uint64)data[i]));
+    }
+    if(r.error)
+      break;
+  }
+  return tot ? tot : -1;
 }
 
 // Release a locked buffer.
@@ -162,4 +452,24 @@ bunpin(struct buf *b) {
   release(&bcache.lock);
 }
 
+// Cache hits and misses over every device and kind of block.
+void
+bstat(uint64 *hits, uint64 *misses)
+{
+  struct blkstat bs;
 
+  *hits = *misses = 0;
+  for(int dev = 0; dev < FSNUM; dev++){
+    blkstat_get(dev, &bs);
+    for(int k = 0; k < BIO_NKIND; k++){
+      *hits += bs.hits[k];
+      *misses += bs.misses[k];
+    }
+  }
+}
+
+void
+bstat_reset(void)
+{
+  blkstat_reset_cache();
+}
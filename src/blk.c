@@ -0,0 +1,265 @@
+//
+// blk -- per-device request queues that merge and sort, per-process
+// plugging, and completion callbacks for the drivers; see blk.h.
+//
+// blkstat sees a request from the time it reaches its queue: one that
+// was merged there, or while plugged, counts as a merge and not an I/O.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/blkstat.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/blk.h"
+
+// done, and sleeping on it in blk_wait()
+static struct spinlock donelock;
+
+void
+blk_init(void)
+{
+  initlock(&donelock, "blk_done");
+}
+
+void
+blk_initqueue(struct blkqueue *q, char *name, uint dev, void (*run)(struct blkqueue *))
+{
+  initlock(&q->lock, name);
+  q->dev = dev;
+  q->head = NULL;
+  q->last = 0;
+  q->run = run;
+}
+
+void
+blk_initreq(struct blkreq *r, int write, uint sector, void (*end_io)(struct blkreq *), void *private)
+{
+  r->write = write;
+  r->sector = sector;
+  r->nsect = 0;
+  r->error = 0;
+  r->end_io = end_io;
+  r->private = private;
+  r->done = 0;
+  r->q = NULL;
+  r->next = NULL;
+  r->merged = NULL;
+}
+
+// Add the next sector. -1 if the request is full.
+int
+blk_addsect(struct blkreq *r, uchar *data)
+{
+  if (r->nsect == BLK_MAXSECT)
+    return -1;
+  r->data[r->nsect++] = data;
+  return 0;
+}
+
+// Fold r into a request on the list that it continues or that
+// continues it. Returns 1 if it was.
+static int
+merge(struct blkreq *list, struct blkreq *r)
+{
+  struct blkreq *m, *t;
+
+  for (m = list; m; m = m->next) {
+    if (m->q != r->q || m->write != r->write || m->nsect + r->nsect > BLK_MAXSECT)
+      continue;
+    if (m->sector + m->nsect == r->sector) {
+      memmove(m->data + m->nsect, r->data, r->nsect * sizeof(r->data[0]));
+    } else if (r->sector + r->nsect == m->sector) {
+      memmove(m->data + r->nsect, m->data, m->nsect * sizeof(m->data[0]));
+      memmove(m->data, r->data, r->nsect * sizeof(r->data[0]));
+      m->sector = r->sector;
+    } else {
+      continue;
+    }
+    m->nsect += r->nsect;
+    // r brings along what was merged into it while plugged
+    for (t = r; t->merged; t = t->merged)
+      ;
+    t->merged = m->merged;
+    m->merged = r;
+    blkstat_merge(r->q->dev, r->write ? BLK_WRITE : BLK_READ);
+    return 1;
+  }
+  return 0;
+}
+
+static void
+insert(struct blkreq **pp, struct blkreq *r)
+{
+  while (*pp && (*pp)->sector <= r->sector)
+    pp = &(*pp)->next;
+  r->next = *pp;
+  *pp = r;
+}
+
+static void
+enqueue(struct blkqueue *q, struct blkreq *r)
+{
+  acquire(&q->lock);
+  if (!merge(q->head, r)) {
+    r->submit = blkstat_submit(q->dev);
+    insert(&q->head, r);
+  }
+  release(&q->lock);
+}
+
+static void
+kick(struct blkqueue *q)
+{
+  wakeup(q);
+  if (q->run)
+    q->run(q);
+}
+
+// Send r to q, or hold it back in the caller's plug. It completes
+// through r->end_io or blk_wait().
+void
+blk_submit(struct blkqueue *q, struct blkreq *r)
+{
+  struct proc *p = myproc();
+
+  r->q = q;
+  if (p && p->plug) {
+    if (!merge(p->plug->head, r))
+      insert(&p->plug->head, r);
+    return;
+  }
+  enqueue(q, r);
+  kick(q);
+}
+
+static void
+flush(struct blkplug *plug)
+{
+  struct blkqueue *q = NULL;
+  struct blkreq *r;
+
+  while ((r = plug->head) != NULL) {
+    plug->head = r->next;
+    if (q && r->q != q)
+      kick(q);
+    q = r->q;
+    enqueue(q, r);
+  }
+  if (q)
+    kick(q);
+}
+
+// A plug inside another one is a no-op: what is submitted is held
+// until the outer one finishes.
+void
+blk_start_plug(struct blkplug *plug)
+{
+  struct proc *p = myproc();
+
+  plug->head = NULL;
+  if (p && p->plug == NULL)
+    p->plug = plug;
+}
+
+void
+blk_finish_plug(struct blkplug *plug)
+{
+  struct proc *p = myproc();
+
+  if (p && p->plug == plug) {
+    flush(plug);
+    p->plug = NULL;
+  }
+}
+
+// Let go of what the caller's plug holds, before it waits for any of
+// it; the plug stays.
+void
+blk_flush_plug(void)
+{
+  struct proc *p = myproc();
+
+  if (p && p->plug && p->plug->head)
+    flush(p->plug);
+}
+
+// For a request without end_io.
+void
+blk_wait(struct blkreq *r)
+{
+  blk_flush_plug();
+  acquire(&donelock);
+  while (!r->done) {
+    if (myproc() == NULL)
+      panic("blk_wait: no process to sleep");
+    sleep(r, &donelock);
+  }
+  release(&donelock);
+}
+
+// Next after the last one dispatched, or the lowest if none is.
+static struct blkreq *
+take(struct blkqueue *q)
+{
+  struct blkreq **pp, *r;
+
+  for (pp = &q->head; *pp && (*pp)->sector < q->last; pp = &(*pp)->next)
+    ;
+  if (*pp == NULL)
+    pp = &q->head;
+  if ((r = *pp) == NULL)
+    return NULL;
+  *pp = r->next;
+  r->next = NULL;
+  q->last = r->sector + r->nsect;
+  r->dispatch = r_time();
+  return r;
+}
+
+struct blkreq *
+blk_fetch(struct blkqueue *q)
+{
+  struct blkreq *r;
+
+  acquire(&q->lock);
+  r = take(q);
+  release(&q->lock);
+  return r;
+}
+
+struct blkreq *
+blk_fetch_wait(struct blkqueue *q)
+{
+  struct blkreq *r;
+
+  acquire(&q->lock);
+  while ((r = take(q)) == NULL)
+    sleep(q, &q->lock);
+  release(&q->lock);
+  return r;
+}
+
+// The driver is done with r and everything merged into it.
+void
+blk_end(struct blkreq *r, int error)
+{
+  struct blkreq *next;
+
+  blkstat_done(r->q->dev, r->write ? BLK_WRITE : BLK_READ, r->nsect, r->submit, r->dispatch);
+  for (; r; r = next) {
+    next = r->merged;
+    r->error = error;
+    if (r->end_io) {
+      r->end_io(r);
+      continue;
+    }
+    acquire(&donelock);
+    r->done = 1;
+    wakeup(r);
+    release(&donelock);
+  }
+}
@@ -0,0 +1,211 @@
+//
+// blkstat -- per-device block I/O counters and latency histograms,
+// and buffer cache hits split by FAT, directory and file data.
+//
+// bio accounts each request it sends a driver: blkstat_submit() when
+// it goes out, blkstat_done() when it is back. A request is queued
+// from submit to dispatch and serviced from dispatch to completion.
+// SD card requests wait in the disk queue until its thread takes them;
+// the ramdisk and images are synchronous, and dispatch is submit.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/fat32.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/seqbuf.h"
+#include "include/blkstat.h"
+#include "include/utils/bitops.h"
+
+static struct {
+  struct spinlock lock;     // in_flight and the times, not the cache counts
+  struct blkstat s;
+} blkstats[FSNUM];
+
+static char *kindname[BIO_NKIND] = {
+  [BIO_FAT]   "fat",
+  [BIO_DIR]   "dir",
+  [BIO_DATA]  "data",
+};
+
+void
+blkstat_init(void)
+{
+  for (int i = 0; i < FSNUM; i++) {
+    initlock(&blkstats[i].lock, "blkstat");
+    memset(&blkstats[i].s, 0, sizeof(blkstats[i].s));
+  }
+}
+
+void
+blkstat_cache(uint dev, int kind, int hit)
+{
+  struct blkstat *bs = &blkstats[dev].s;
+
+  if (hit)
+    __sync_fetch_and_add(&bs->hits[kind], 1);
+  else
+    __sync_fetch_and_add(&bs->misses[kind], 1);
+}
+
+// Fold the time since the last change of in_flight into busy and
+// weighted time. Caller holds the device's lock.
+static void
+blkstat_round(struct blkstat *bs, uint64 now)
+{
+  if (bs->in_flight) {
+    bs->busy_time += now - bs->stamp;
+    bs->weighted_time += (now - bs->stamp) * bs->in_flight;
+  }
+  bs->stamp = now;
+}
+
+// A request for dev is going out; returns its submit time.
+uint64
+blkstat_submit(uint dev)
+{
+  struct blkstat *bs = &blkstats[dev].s;
+  uint64 now = r_time();
+
+  acquire(&blkstats[dev].lock);
+  blkstat_round(bs, now);
+  bs->in_flight++;
+  release(&blkstats[dev].lock);
+  return now;
+}
+
+void
+blkstat_done(uint dev, int rw, int nsect, uint64 submit, uint64 dispatch)
+{
+  struct blkstat *bs = &blkstats[dev].s;
+  uint64 now = r_time();
+  uint64 us = TICK_TO_US(now - submit);
+  int b = us ? ilog2_64(us) + 1 : 0;
+
+  if (b >= BLK_NLAT)
+    b = BLK_NLAT - 1;
+  acquire(&blkstats[dev].lock);
+  blkstat_round(bs, now);
+  bs->in_flight--;
+  bs->ios[rw]++;
+  bs->sectors[rw] += nsect;
+  bs->queue_time[rw] += dispatch - submit;
+  bs->service_time[rw] += now - dispatch;
+  bs->lat[rw][b]++;
+  release(&blkstats[dev].lock);
+}
+
+// A request was merged into one already on its way.
+void
+blkstat_merge(uint dev, int rw)
+{
+  __sync_fetch_and_add(&blkstats[dev].s.merges[rw], 1);
+}
+
+void
+blkstat_get(uint dev, struct blkstat *bs)
+{
+  acquire(&blkstats[dev].lock);
+  // bring busy time up to now for a device that is busy right now
+  blkstat_round(&blkstats[dev].s, r_time());
+  *bs = blkstats[dev].s;
+  release(&blkstats[dev].lock);
+}
+
+// Only the cache counts go, what went to the disks stays.
+void
+blkstat_reset_cache(void)
+{
+  for (int i = 0; i < FSNUM; i++) {
+    memset(blkstats[i].s.hits, 0, sizeof(blkstats[i].s.hits));
+    memset(blkstats[i].s.misses, 0, sizeof(blkstats[i].s.misses));
+  }
+}
+
+// The boot disk, or an image file mounted like a loop device.
+void
+blkstat_devname(uint dev, char *name, int len)
+{
+  if (FatFs[dev].image == NULL)
+    snprintf(name, len, "mmcblk%d", dev);
+  else
+    snprintf(name, len, "loop%d", dev);
+}
+
+static int
+is_blkdev(int dev)
+{
+  return FatFs[dev].valid && !FatFs[dev].synthetic;
+}
+
+// As in Linux's /proc/diskstats, which iostat reads; times in ms.
+void
+blkstat_diskstats(struct seqbuf *sq)
+{
+  for (int i = 0; i < FSNUM; i++) {
+    struct blkstat bs;
+    char name[16];
+
+    if (!is_blkdev(i))
+      continue;
+    blkstat_get(i, &bs);
+    blkstat_devname(i, name, sizeof(name));
+    seq_printf(sq, "%4d %7d %s %lu %lu %lu %lu %lu %lu %lu %lu %d %lu %lu\n",
+               FatFs[i].image ? 7 : 179, i, name,
+               bs.ios[BLK_READ], bs.merges[BLK_READ], bs.sectors[BLK_READ],
+               TICK_TO_MS(bs.queue_time[BLK_READ] + bs.service_time[BLK_READ]),
+               bs.ios[BLK_WRITE], bs.merges[BLK_WRITE], bs.sectors[BLK_WRITE],
+               TICK_TO_MS(bs.queue_time[BLK_WRITE] + bs.service_time[BLK_WRITE]),
+               bs.in_flight, TICK_TO_MS(bs.busy_time), TICK_TO_MS(bs.weighted_time));
+  }
+}
+
+void
+blkstat_report(struct seqbuf *sq)
+{
+  static char *rwname[2] = { "read", "write" };
+
+  seq_printf(sq, "%-8s %-5s %10s %10s %8s %10s %10s  %s\n", "dev", "op", "ios",
+             "sectors", "merges", "avgq_us", "avgsvc_us", "log2(us)+1:n");
+  for (int i = 0; i < FSNUM; i++) {
+    struct blkstat bs;
+    char name[16];
+
+    if (!is_blkdev(i))
+      continue;
+    blkstat_get(i, &bs);
+    blkstat_devname(i, name, sizeof(name));
+    for (int rw = BLK_READ; rw <= BLK_WRITE; rw++) {
+      uint64 n = bs.ios[rw];
+      seq_printf(sq, "%-8s %-5s %10lu %10lu %8lu %10lu %10lu ", name, rwname[rw], n,
+                 bs.sectors[rw], bs.merges[rw],
+                 n ? TICK_TO_US(bs.queue_time[rw] / n) : 0,
+                 n ? TICK_TO_US(bs.service_time[rw] / n) : 0);
+      for (int b = 0; b < BLK_NLAT; b++) {
+        if (bs.lat[rw][b])
+          seq_printf(sq, " %d:%lu", b, bs.lat[rw][b]);
+      }
+      seq_printf(sq, "\n");
+    }
+  }
+
+  seq_printf(sq, "\n%-8s %-5s %10s %10s %5s\n", "dev", "kind", "hits", "misses", "hit%");
+  for (int i = 0; i < FSNUM; i++) {
+    struct blkstat bs;
+    char name[16];
+
+    if (!is_blkdev(i))
+      continue;
+    blkstat_get(i, &bs);
+    blkstat_devname(i, name, sizeof(name));
+    for (int k = 0; k < BIO_NKIND; k++) {
+      uint64 tot = bs.hits[k] + bs.misses[k];
+      seq_printf(sq, "%-8s %-5s %10lu %10lu %5lu\n", name, kindname[k], bs.hits[k],
+                 bs.misses[k], tot ? bs.hits[k] * 100 / tot : 0);
+    }
+  }
+}
@@ -17,7 +17,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkaddr_write(pagetable, va0);
     if(pa0 == NULL)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -53,7 +53,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkaddr_read(pagetable, va0);
     if(pa0 == NULL)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -91,7 +91,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkaddr_read(pagetable, va0);
     if(pa0 == NULL)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -157,7 +157,7 @@ zero_out(uint64 dstva, uint64 len)
   pagetable_t pagetable = myproc()->pagetable;
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkaddr_write(pagetable, va0);
     if(pa0 == NULL)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -6,6 +6,16 @@
 #include"include/dev.h"
 #include"include/sbi.h"
 #include"include/riscv.h"
+#include"include/uart.h"
+#include"include/kprof.h"
+#include"include/trace.h"
+#include"include/sysstat.h"
+#include"include/schedstat.h"
+#include"include/memstat.h"
+#include"include/disk.h"
+#ifdef KBENCH
+#include"include/kbench.h"
+#endif
 
 struct dirent* dev;
 int devnum;
@@ -43,6 +53,16 @@ int devinit()
   allocdev("console",consoleread,consolewrite);
   allocdev("null",nullread,nullwrite);
   allocdev("zero",zeroread,zerowrite);
+  allocdev("kprof",kprofread,kprofwrite);
+  allocdev("trace",traceread,tracewrite);
+  allocdev_readat("sysstat",sysstatread,sysstatwrite);
+  allocdev_readat("schedstat",schedstatread,schedstatwrite);
+  allocdev_readat("meminfo",meminforead,meminfowrite);
+  allocdev_at(DISK_DEVNAME,diskreadat,diskwriteat,disksize);
+#ifdef KBENCH
+  kbench_init();
+  allocdev_readat("kbench",kbenchread,kbenchwrite);
+#endif
   return 0;
 }
 
@@ -64,6 +84,51 @@ allocdev(char* name,int (*devread)(int, uint64, int),int (*devwrite)(int, uint64
   return 0;
 }
 
+// A device whose reads depend on the file offset, like a generated
+// text file. devread() passes the offset and moves it on.
+int
+allocdev_readat(char* name,int (*devreadat)(int, uint64, uint64, int),int (*devwrite)(int, uint64, int)){
+  if(allocdev(name,NULL,devwrite) < 0)
+    return -1;
+  devsw[devnum-1].readat = devreadat;
+  return 0;
+}
+
+// A device read and written at the file offset, like a disk, and
+// devsize bytes long.
+int
+allocdev_at(char* name,int (*devreadat)(int, uint64, uint64, int),int (*devwriteat)(int, uint64, uint64, int),uint64 (*devsize)(void)){
+  if(allocdev_readat(name,devreadat,NULL) < 0)
+    return -1;
+  devsw[devnum-1].writeat = devwriteat;
+  devsw[devnum-1].size = devsize;
+  return 0;
+}
+
+int
+devread(int major,int user_dst,uint64 addr,uint64* off,int n){
+  int r;
+  if(devsw[major].readat){
+    r = devsw[major].readat(user_dst,addr,*off,n);
+    if(r > 0)
+      *off += r;
+    return r;
+  }
+  return devsw[major].read(user_dst,addr,n);
+}
+
+int
+devwrite(int major,int user_src,uint64 addr,uint64* off,int n){
+  int r;
+  if(devsw[major].writeat){
+    r = devsw[major].writeat(user_src,addr,*off,n);
+    if(r > 0)
+      *off += r;
+    return r;
+  }
+  return devsw[major].write(user_src,addr,n);
+}
+
 int 
 devlookup(char *name)
 {
@@ -108,13 +173,15 @@ consoleread(int user_dst,uint64 addr,int n){
     int len = MIN(n,CONSOLE_BUF_LEN);
     int i;
     for(i=0;i<len;i++){
-      char c = 0;
-      while((c=sbi_console_getchar())==255);
+      int c = uartgetc();
+      if(c < 0)
+        return ret ? ret : -1;
       c = c==13?10:c;
       readbuf[i] = c;
-      consputc(c);
+      uartputc(c);
       if(c == 10){
         interp = 1;
+        i++;
         break;
       }
     }
@@ -130,21 +197,7 @@ consoleread(int user_dst,uint64 addr,int n){
 
 int
 consolewrite(int user_dst,uint64 addr,int n){
-  char writebuf[CONSOLE_BUF_LEN];
-  int ret = 0;
-  while(n){
-    int len = MIN(n,CONSOLE_BUF_LEN);
-    if(either_copyin(user_dst,writebuf,addr,len)<0){
-      return ret;
-    }
-    for(int i=0;i<len;i++){
-      consputc(writebuf[i]);
-    }
-    n -= len;
-    ret += len;
-    addr += len;
-  }
-  return ret;
+  return uartwrite(user_dst,addr,n);
 }
 
 int 
@@ -2,14 +2,115 @@
 #include "include/param.h"
 #include "include/memlayout.h"
 #include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
 #include "include/printf.h"
 #include "include/buf.h"
+#include "include/blk.h"
+#include "include/blkstat.h"
+#include "include/copy.h"
+#include "include/disk.h"
+#include "include/errno.h"
 
+struct blkqueue disk_queue;
 
-#ifdef SD
-#include "include/diskio.h"
-#else
+#ifdef RAM
 #include "include/ramdisk.h"
+
+// The ramdisk is memory: its requests are done as soon as they are
+// queued, by the submitter.
+static void ramdisk_run(struct blkqueue *q)
+{
+    struct blkreq *r;
+    int error;
+
+    while ((r = blk_fetch(q)) != NULL) {
+        error = 0;
+        for (int i = 0; i < r->nsect && !error; i++)
+            error = ramdisk_rw(r->sector + i, r->data[i], r->write);
+        blk_end(r, error);
+    }
+}
+#else
+#include "sifive/platform.h"
+#include "include/spi.h"
+#include "include/sd.h"
+#include "include/diskio.h"
+
+// The SD card's queue is for the sdio kernel thread, which alone
+// drives the SPI bus. Before there are processes to sleep (fs_init()
+// at boot) the submitter does the requests itself.
+
+#define SDIO_RETRIES        1
+// At an SCK this slow (under 1MHz from the 500MHz input clock) a byte
+// takes 8us or more, long enough to sleep on the SPI interrupt for.
+#define SDIO_SLEEP_SCKDIV   249
+
+static struct {
+    struct proc *thread;
+    struct spinlock irqlock;    // the SPI interrupt enable, and sleeping on it
+} sdio;
+
+static spi_ctrl *sdspi = (spi_ctrl *)SPI2_CTRL_ADDR;
+
+static int sdio_rw(struct blkreq *r)
+{
+    if (r->write)
+        return sd_write_blocksv(sdspi, r->data, r->sector, r->nsect);
+    return sd_read_blocksv(sdspi, r->data, r->sector, r->nsect);
+}
+
+// Do r, initializing the card again and retrying if it fails.
+// Returns 0 or -1.
+static int sdio_do(struct blkreq *r)
+{
+    for (int i = 0; sdio_rw(r) != 0; i++) {
+        if (i == SDIO_RETRIES) {
+            __debug_warn("[sdio_do] %s of %d sectors at %d failed\n",
+                         r->write ? "write" : "read", r->nsect, r->sector);
+            return -1;
+        }
+        disk_initialize(0);
+    }
+    return 0;
+}
+
+static void sdio_thread(void *arg)
+{
+    struct blkreq *r;
+
+    for (;;) {
+        r = blk_fetch_wait(&disk_queue);
+        blk_end(r, sdio_do(r));
+    }
+}
+
+static void sdio_run(struct blkqueue *q)
+{
+    struct blkreq *r;
+
+    if (sdio.thread && myproc())
+        return;     // blk_submit() woke it
+    while ((r = blk_fetch(q)) != NULL)
+        blk_end(r, sdio_do(r));
+}
+
+// spi_rx_wait: the sdio thread sleeps for bytes that are slow to come,
+// as they are at the 400kHz of card initialization. Anyone else, or at
+// the full clock, spins.
+static void sdio_rx_wait(spi_ctrl *spi)
+{
+    struct proc *p = myproc();
+
+    if (p == NULL || p != sdio.thread || spi->sckdiv < SDIO_SLEEP_SCKDIV)
+        return;
+    acquire(&sdio.irqlock);
+    spi->ie.raw_bits = ((spi_reg_ie) { .rxwm = 1 }).raw_bits;
+    while (!spi->ip.rxwm)
+        sleep(&sdio.irqlock, &sdio.irqlock);
+    spi->ie.raw_bits = 0;
+    release(&sdio.irqlock);
+}
 #endif
 
 int disk_init_flag;
@@ -19,32 +120,118 @@ void disk_init(void)
     else disk_init_flag = 1;
     #ifdef RAM
     ramdisk_init();
+    blk_initqueue(&disk_queue, "ramdisk", 0, ramdisk_run);
     #else
     disk_initialize(0);
+    initlock(&sdio.irqlock, "sdio_irq");
+    blk_initqueue(&disk_queue, "sdio", 0, sdio_run);
+    spi_rx_wait = sdio_rx_wait;
+    if ((sdio.thread = kthread_create("sdio", sdio_thread, NULL)) == NULL)
+        __debug_warn("[disk_init] no sdio thread, sd requests stay synchronous\n");
     #endif
 }
 
+// b through disk_queue, waiting for it.
+static void vdisk_rw(struct buf *b, int write)
+{
+    struct blkreq r;
+
+    blk_initreq(&r, write, b->sectorno, NULL, NULL);
+    blk_addsect(&r, b->data);
+    blk_submit(&disk_queue, &r);
+    blk_wait(&r);
+}
+
 void vdisk_read(struct buf *b)
 {
-    #ifdef RAM    
-	ramdisk_rw(b, 0);
-    #else 
-	disk_read(0,b->data, b->sectorno,1);
-    #endif
+    vdisk_rw(b, 0);
 }
 
 void vdisk_write(struct buf *b)
+{
+    vdisk_rw(b, 1);
+}
+
+// Bytes on the disk. An SD card whose CSD couldn't be read is taken to
+// be as big as a 32-bit sector number can reach.
+static uint64 disk_bytes(void)
 {
     #ifdef RAM
-    	ramdisk_rw(b, 1);
-    #else 
-	disk_write(0,b->data, b->sectorno,1);
+    return (uint64)FSSIZE * BSIZE;
+    #else
+    uint64 nsect = sd_size();
+
+    if (nsect == 0 || nsect > 0x100000000UL)
+        nsect = 0x100000000UL;
+    return nsect * BSIZE;
     #endif
 }
 
+// The raw disk, /dev/DISK_DEVNAME, at byte offset off. Whole sectors
+// to or from memory that lines up with them go around the buffer
+// cache, a request at a time; a partial sector is read, and written
+// back, through it. A request running past the end is cut short. One
+// starting at or past the end reads nothing, and a write there fails
+// with -EINVAL. Returns the bytes done, or -1 if none were.
+static int disk_rw_at(int write, int user, uint64 addr, uint64 off, int n)
+{
+    uint64 size = disk_bytes();
+    struct buf *b;
+    int tot, m, r;
+
+    if (n < 0 || off >= size)
+        return n < 0 || write ? -EINVAL : 0;
+    if (n > size - off)
+        n = size - off;
+    for (tot = 0; tot < n; tot += m, off += m, addr += m) {
+        if (off % BSIZE == 0 && addr % BSIZE == 0 && n - tot >= BSIZE) {
+            m = (n - tot) / BSIZE * BSIZE;
+            if ((r = bdirect(0, write, user, addr, off / BSIZE, m)) != m) {
+                if (r > 0)
+                    tot += r;
+                break;
+            }
+            continue;
+        }
+        m = MIN(BSIZE - off % BSIZE, n - tot);
+        b = bread(0, off / BSIZE, BIO_DATA);
+        if (!b->valid)
+            r = -1;
+        else if (write) {
+            if ((r = either_copyin(user, b->data + off % BSIZE, addr, m)) == 0)
+                bwrite(0, b);
+        } else
+            r = either_copyout(user, addr, b->data + off % BSIZE, m);
+        brelse(b);
+        if (r < 0)
+            break;
+    }
+    return tot || n == 0 ? tot : -1;
+}
+
+int diskreadat(int user_dst, uint64 addr, uint64 off, int n)
+{
+    return disk_rw_at(0, user_dst, addr, off, n);
+}
+
+int diskwriteat(int user_src, uint64 addr, uint64 off, int n)
+{
+    return disk_rw_at(1, user_src, addr, off, n);
+}
+
+uint64 disksize(void)
+{
+    return disk_bytes();
+}
+
+// The SD card's SPI: rxwm is up for sdio_rx_wait(). Mask it, or it
+// stays up until the bytes are read, and wake the thread to read them.
 void disk_intr(void)
 {
-    #ifdef SD
-        // dmac_intr(DMAC_CHANNEL0);
+    #ifndef RAM
+    acquire(&sdio.irqlock);
+    sdspi->ie.raw_bits = 0;
+    wakeup(&sdio.irqlock);
+    release(&sdio.irqlock);
     #endif
 }
@@ -9,18 +9,39 @@
 #include"include/kalloc.h"
 #include"include/file.h"
 #include"include/string.h"
+#include"include/memstat.h"
 #define SELF_LOAD 
 
-//read and check elf header
-//return 0 on success,-1 on failure
-static int
-readelfhdr(struct dirent* ep,struct elfhdr* elf){
+//read and check elf header and program headers, or find them on ep
+//from the last time it was run
+//return them on success, NULL on failure
+//ep must be locked
+static struct elfcache*
+readelfhdr(struct dirent* ep){
+  struct elfhdr elf;
+  struct elfcache *ec;
+  uint sz;
+
+  if(ep->elfcache)
+    return ep->elfcache;
   // Check ELF header
-  if(eread(ep, 0, (uint64)elf, 0, sizeof(struct elfhdr)) != sizeof(struct elfhdr))
-    return -1;
-  if(elf->magic != ELF_MAGIC)
-    return -1;
-  return 0;
+  if(eread(ep, 0, (uint64)&elf, 0, sizeof(struct elfhdr)) != sizeof(struct elfhdr))
+    return NULL;
+  if(elf.magic != ELF_MAGIC)
+    return NULL;
+  sz = sizeof(struct elfcache) + elf.phnum * sizeof(struct proghdr);
+  if(sz > KMALLOC_MAX || (ec = kmalloc(sz)) == NULL){
+    __debug_warn("[exec] %d program headers too many\n", elf.phnum);
+    return NULL;
+  }
+  ec->elf = elf;
+  sz -= sizeof(struct elfcache);
+  if(eread(ep, 0, (uint64)ec->ph, elf.phoff, sz) != sz){
+    kfree(ec);
+    return NULL;
+  }
+  ep->elfcache = ec;
+  return ec;
 }
 
 // Load a program segment into pagetable at virtual address va.
@@ -65,19 +86,20 @@ loadseg(pagetable_t pagetable, uint64 va, struct dirent *ep, uint offset, uint s
 }
 
 
-// Load a program elf into pagetable
+// Load a program elf into mm
 // Returns sz on success, -1 on failure.
 // ep must be locked.
 static uint64
-loadelf(struct proc* p, struct dirent *ep,struct elfhdr* elf,struct proghdr* phdr,uint64 base)
+loadelf(struct mm *mm, struct dirent *ep,struct elfcache* ec,struct proghdr* phdr,uint64 base)
 {
+  struct elfhdr *elf = &ec->elf;
   struct proghdr ph;
   int getphdr = 0;
+  int perm;
   //struct elfhdr  linkelf;
-  pagetable_t pagetable = p->pagetable;
-  for(int i=0, off=elf->phoff; i<elf->phnum; i++, off+=sizeof(ph)){
-    if(eread(ep, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
-      return -1;
+  pagetable_t pagetable = mm->pagetable;
+  for(int i=0; i<elf->phnum; i++){
+    ph = ec->ph[i];
     if(ph.type == ELF_PROG_LOAD){
       if(ph.memsz < ph.filesz){
         __debug_warn("[exec]load memsz>filesz\n");
@@ -90,8 +112,24 @@ loadelf(struct proc* p, struct dirent *ep,struct elfhdr* elf,struct proghdr* phd
       if(!getphdr&&phdr&&ph.off == 0){ 
         phdr->vaddr = elf->phoff + ph.vaddr;
       }
+      perm = PTE_U;
+      if(ph.flags & ELF_PROG_FLAG_READ)
+        perm |= PTE_R;
+      if(ph.flags & ELF_PROG_FLAG_WRITE)
+        perm |= PTE_R | PTE_W;
+      if(ph.flags & ELF_PROG_FLAG_EXEC)
+        perm |= PTE_X;
       uint64 load_start = ph.vaddr+base;
-      if(alloc_load_vma(p, load_start, ph.memsz, PTE_R|PTE_W|PTE_X|PTE_U)== NULL){
+      // file pages can only be mapped if they line up with the segment's;
+      // those that do are faulted in when first touched
+      if((ph.off - load_start) % PGSIZE == 0){
+        if(alloc_file_vma(mm, load_start, ph.memsz, perm, ep, ph.off, ph.filesz) == NULL){
+          __debug_warn("[exec]grow space failed\n");
+          return -1;
+        }
+        continue;
+      }
+      if(mm_alloc_vma(mm, LOAD, load_start, ph.memsz, perm, 1, NULL)== NULL){
         __debug_warn("[exec]grow space failed\n");
         return -1;
       }
@@ -111,14 +149,44 @@ loadelf(struct proc* p, struct dirent *ep,struct elfhdr* elf,struct proghdr* phd
   return elf->entry;
 }
 
-void swap(void* a,void* b,int len){
-  char c;
-  char *sa = a,*sb = b;
-  for(int i = 0;i<len;i++){
-    c = sa[i];
-    sa[i] = sb[i];
-    sb[i] = c;
-  }
+// The top of the new stack, assembled in a page of the kernel's and
+// copied out in one go: strings, highest first, then the vectors.
+// top is the user address the end of buf stands for.
+struct ustack {
+  char *buf;
+  uint64 top;
+  uint64 used;
+};
+
+// Put len bytes of data below what is there, at an address that is a
+// multiple of align. Returns the user address, or 0 if the page is full.
+static uint64
+ustack_push(struct ustack *us, void *data, uint64 len, uint64 align)
+{
+  uint64 used = us->used + len;
+
+  used = (used + align - 1) & ~(align - 1);
+  if(used > PGSIZE)
+    return 0;
+  us->used = used;
+  memmove(us->buf + PGSIZE - used, data, len);
+  return us->top - used;
+}
+
+// Push a string for a vector: vec[0] counts the entries, which end in 0.
+static int
+ustack_pushstr(struct ustack *us, uint64 *vec, char *str)
+{
+  uint64 argc = ++vec[0];
+  uint64 va;
+
+  if(argc > MAXARG + 1)
+    return -1;
+  if((va = ustack_push(us, str, strlen(str) + 1, 16)) == 0)
+    return -1;
+  vec[argc] = va;
+  vec[argc+1] = 0;
+  return 0;
 }
 
 void
@@ -133,81 +201,103 @@ auxalloc(uint64* aux,uint64 atid,uint64 value)
   aux[0]++;
 }
 
-uint64
-loadaux(pagetable_t pagetable,uint64 sp,uint64 stackbase,uint64* aux){
-  int argc = aux[0];
-  if(!argc)return sp;
-  /*
-  printf("aux argc:%d\n",argc);
-  for(int i=1;i<=2*argc+2;i++){
-    printf("final raw aux[%d] = %p\n",i,aux[i]);
-  }
-  */
-  sp -= (2*argc+2) * sizeof(uint64);
-  if(sp < stackbase){
-    return -1;
+// Lay out the new stack below its top: argc, argv[], envp[] and the
+// auxiliary vector, with the strings they point to above them, then
+// copy it all to mm's stack. Returns the stack pointer, 0 on failure.
+static uint64
+ustack_build(struct mm *mm, struct ustack *us, char **argv, char **env, char *path,
+             int shflag, int interp, struct elfhdr *elf, struct proghdr *phdr, uint64 *argc)
+{
+  static uint64 random[2] = { 0xcde142a16cb93072, 0x128a39c127d8bbf2 };
+  uint64 ustack[MAXARG+3], environ[MAXARG+3];
+  uint64 aux[AUX_CNT*2+3] = {0};
+  uint64 *vec, va, n, i;
+
+  ustack[0] = environ[0] = 0;
+  if(ustack_pushstr(us, environ, "LD_LIBRARY_PATH=/") < 0)
+    return 0;
+#ifndef SELFLOAD
+  if(interp && ustack_pushstr(us, ustack, path) < 0)
+    return 0;
+#endif
+  if((va = ustack_push(us, random, sizeof(random), 16)) == 0)
+    return 0;
+
+  //auxalloc(aux,AT_HWCAP, 0x112d);
+  auxalloc(aux,AT_PAGESZ,PGSIZE);
+  auxalloc(aux,AT_PHDR, phdr->vaddr);
+  auxalloc(aux,AT_PHENT, elf->phentsize);
+  auxalloc(aux,AT_PHNUM, elf->phnum);
+  auxalloc(aux,AT_UID, 0);
+  auxalloc(aux,AT_EUID, 0);
+  auxalloc(aux,AT_GID, 0);
+  auxalloc(aux,AT_EGID, 0);
+  auxalloc(aux,AT_SECURE, 0);
+  auxalloc(aux,AT_EGID, 0);
+  auxalloc(aux,AT_RANDOM, va);
+
+  if(shflag && ustack_pushstr(us, ustack, "sh") < 0)
+    return 0;
+  for(i = 0; argv[i]; i++) {
+    if(ustack_pushstr(us, ustack, argv[i]) < 0){
+      __debug_warn("[exec]push argv string bad\n");
+      return 0;
+    }
   }
-  aux[0] = 0;
-  if(copyout(pagetable, sp, (char *)(aux+1), (2*argc+2)*sizeof(uint64)) < 0){
-    return -1;
+  for(i = 0; env[i]; i++) {
+    if(ustack_pushstr(us, environ, env[i]) < 0){
+      __debug_warn("[exec]push env string bad\n");
+      return 0;
+    }
   }
-  return sp;
-}
 
-uint64 
-ustackpushstr(pagetable_t pagetable,uint64* ustack,char* str,uint64 sp,uint64 stackbase)
-{
-  uint64 argc = ++ustack[0];
-  if(argc>MAXARG+1)return -1;
-  //printf("[exec]push %s\n",str);
-  sp -= strlen(str) + 1;
-  sp -= sp % 16; // riscv sp must be 16-byte aligned
-  if(sp < stackbase)
-      return -1;
-  if(copyout(pagetable, sp, str, strlen(str) + 1) < 0)
-      return -1;
-  ustack[argc] = sp;
-  ustack[argc+1] = 0;
-  return sp;
-}
+  // argc, argv[] and 0, envp[] and 0, the aux pairs and a 0 pair,
+  // at a 16-byte aligned sp
+  n = 1 + (ustack[0] + 1) + (environ[0] + 1) + (aux[0] * 2 + 2);
+  us->used = (us->used + n * sizeof(uint64) + 15) & ~15UL;
+  if(us->used > PGSIZE){
+    __debug_warn("[exec]arguments too long\n");
+    return 0;
+  }
+  vec = (uint64 *)(us->buf + PGSIZE - us->used);
+  *vec++ = ustack[0];
+  for(i = 1; i <= ustack[0] + 1; i++)
+    *vec++ = ustack[i];
+  for(i = 1; i <= environ[0] + 1; i++)
+    *vec++ = environ[i];
+  for(i = 1; i <= aux[0] * 2 + 2; i++)
+    *vec++ = aux[i];
 
-void
-stackdisplay(pagetable_t pagetable,uint64 sp,uint64 sz)
-{
-  for(uint64 i = sp;i<sz;i+=8){
-    uint64 *pa = (void*)kwalkaddr1(pagetable,i);
-    if(pa)printf("addr %p value %p\n",i,*pa);
-    else printf("addr %p value (nil)\n",i);
+  va = us->top - us->used;
+  if(copyout(mm->pagetable, va, us->buf + PGSIZE - us->used, us->used) < 0){
+    __debug_warn("[exec]stack copy bad\n");
+    return 0;
   }
+  *argc = ustack[0];
+  return va;
 }
-  
 
 int
 exec(char *path, char **argv, char **env)
 {
   int shflag = 0;
-  uint64 sp,stackbase,entry;
-  uint64 argc,envnum;
-  uint64 aux[AUX_CNT*2+3] = {0,0,0};
-  uint64 environ[10]={0};
-  uint64 ustack[MAXARG+2];
+  uint64 sp,entry,argc;
   char *last,*s;
   struct proc* p = myproc();
-  struct proc* np = kmalloc(sizeof(struct proc));
+  struct mm mm;
+  struct ustack us;
   struct elfhdr elf;
+  struct elfcache *ec;
+  struct proghdr phdr = {0};
   struct dirent *ep;
-  np->trapframe = allocpage();
-  memcpy(np->trapframe,p->trapframe,sizeof(struct trapframe));
-  //__debug_warn("[exec] exec %s\n",path);
-  /*
-  for(int aaa = 0;argv[aaa];aaa++){
-    __debug_warn("[exec] exec argv[%d] %s\n",aaa,argv[aaa]);
-  }
-  */
-  if ((proc_pagetable(np, 0, 0)) == NULL) {
+
+  // The new image is built in mm, away from the process, and only
+  // replaces its address space once nothing can fail.
+  if(mm_init(&mm) < 0){
     __debug_warn("[exec]vma init bad\n");
-    goto bad;
+    return -1;
   }
+  memcpy(mm.trapframe,p->trapframe,sizeof(struct trapframe));
 
   if((ep = ename(NULL,path,0)) == NULL) {
     __debug_warn("[exec] %s not found\n", path);
@@ -230,149 +320,59 @@ exec(char *path, char **argv, char **env)
   
   
   // Check ELF header
-  if(readelfhdr(ep,&elf)<0){
+  if((ec = readelfhdr(ep)) == NULL){
     __debug_warn("[exec] %s is not a elf\n", path);
-    goto bad;
-  }
-  struct proghdr phdr = {0};
-  entry = loadelf(np,ep,&elf,&phdr,0);
-  if(entry==-1){
     eunlock(ep);
-    __debug_warn("[exec]load elf bad\n");
+    eput(ep);
     goto bad;
   }
+  elf = ec->elf;
+  entry = loadelf(&mm,ep,ec,&phdr,0);
   eunlock(ep);
   eput(ep);
-  //print_vma_info(p);
-  //print_vma_info(np);
-  struct vma* stack_vma = type_locate_vma(np->vma,STACK);
-  sp = stack_vma->end;
-  stackbase = stack_vma->addr;
-  ustack[0] = environ[0] =0;
-  if((sp = ustackpushstr(np->pagetable,environ,"LD_LIBRARY_PATH=/",sp,stackbase))==-1){
-      goto bad;
-  }
-  if(entry!=elf.entry){
-    //("elf.entry:%p\n",elf.entry);
-    //printf("progentry:%p\n",progentry);
-#ifndef SELFLOAD   
-    if((sp = ustackpushstr(np->pagetable,ustack,path,sp,stackbase))==-1){
-      goto bad;
-    }
-#endif
-  }
-  uint64 random[2] = { 0xcde142a16cb93072, 0x128a39c127d8bbf2 };
-  sp -= 16;
-  if (sp < stackbase || copyout(np->pagetable, sp, (char *)random, 16) < 0) {
-    __debug_warn("[exec] random copy bad\n");
+  if(entry==-1){
+    __debug_warn("[exec]load elf bad\n");
     goto bad;
   }
 
-
-  //auxalloc(aux,AT_HWCAP, 0x112d);
-  auxalloc(aux,AT_PAGESZ,PGSIZE);
-  auxalloc(aux,AT_PHDR, phdr.vaddr);
-  auxalloc(aux,AT_PHENT, elf.phentsize);
-  auxalloc(aux,AT_PHNUM, elf.phnum);
-  auxalloc(aux,AT_UID, 0);
-  auxalloc(aux,AT_EUID, 0);
-  auxalloc(aux,AT_GID, 0);
-  auxalloc(aux,AT_EGID, 0);
-  auxalloc(aux,AT_SECURE, 0);
-  auxalloc(aux,AT_EGID, 0);		
-  auxalloc(aux,AT_RANDOM, sp);
-
-  //printf("[exec]push argv\n");
-  // Push argument strings, prepare rest of stack in ustack.
-  
-  if(shflag){
-    if((sp = ustackpushstr(np->pagetable,ustack,"sh",sp,stackbase))==-1){
-      __debug_warn("[exec]push argv string bad\n");
-      goto bad;
-    }
-  }
-  for(argc = 0; argv[argc]; argc++) {
-    if((sp = ustackpushstr(np->pagetable,ustack,argv[argc],sp,stackbase))==-1){
-      __debug_warn("[exec]push argv string bad\n");
-      goto bad;
-    }
-  }
-  //printf("[exec]push env\n");
-  for(envnum = 0; env[envnum]; envnum++) {
-    if((sp = ustackpushstr(np->pagetable,environ,env[envnum],sp,stackbase))==-1){
-      __debug_warn("[exec]push env string bad\n");
-      goto bad;
-    }
-  }
-  //printf("[exec]push end\n");
-  if((environ[0]+ustack[0]+1)%2){sp -= 8;}//16 aligned
-  //load aux
-  if((sp = loadaux(np->pagetable,sp,stackbase,aux))<0){
-    __debug_warn("[exec]pass aux too many\n");
+  struct vma* stack_vma = type_locate_vma(mm.vma,STACK);
+  if((us.buf = allocpage()) == NULL)
     goto bad;
-  }
-  
-  argc = environ[0];
-  if(argc){
-    // push the array of argv[] pointers.
-    sp -= (argc+1) * sizeof(uint64);
-    if(sp < stackbase){
-      __debug_warn("[exec]env address vec too long\n");
-      goto bad;
-    }
-    if(copyout(np->pagetable, sp, (char *)(environ+1), (argc+1)*sizeof(uint64)) < 0){
-      __debug_warn("[exec]env address copy bad\n");
-      goto bad;
-    }
-  }
-  
-  argc = ustack[0];
-  //printf("[exec]argc:%d\n",argc);
-  // push the array of argv[] pointers.
-  sp -= (argc+2) * sizeof(uint64);
-  if(sp < stackbase){
-    __debug_warn("[exec]ustack address vec too long\n");
+  us.top = stack_vma->end;
+  us.used = 0;
+  sp = ustack_build(&mm, &us, argv, env, path, shflag, entry != elf.entry, &elf, &phdr, &argc);
+  freepage(us.buf);
+  if(sp == 0)
     goto bad;
-  }
 
-  if(copyout(np->pagetable, sp, (char *)ustack, (argc+2)*sizeof(uint64)) < 0){
-    __debug_warn("[exec]ustack address copy bad\n");
-    goto bad;
-  }
-  //stackdisplay(pagetable,sp,sz);
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
   // value, which goes in a0.
-  np->trapframe->a0 = argc;
-  np->trapframe->a1 = sp+8;
+  mm.trapframe->a0 = argc;
+  mm.trapframe->a1 = sp+8;
+  mm.trapframe->sp = sp;
+  mm.trapframe->epc = entry;
   
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  strncpy(p->name, last, sizeof(p->name));
-  
-  np->trapframe->sp = sp;
-  np->trapframe->epc = entry;
-  swap(&(p->pagetable),&(np->pagetable),sizeof(p->pagetable));
-  swap(&(p->vma),&(np->vma),sizeof(p->vma));
-  swap(&(p->trapframe),&(np->trapframe),sizeof(p->trapframe));
-  for(int fd = 0; fd < NOFILEMAX(p); fd++){
-    struct file* f = p->ofile[fd];
-    if(f&&p->exec_close[fd]){
-      //__debug_warn("[exec]close %d\n",fd);
-      fileclose(f);
-      p->ofile[fd] = 0;
-      p->exec_close[fd]=0;
-    }
+  // the last thing that can fail: the new image must not keep sharing
+  // handlers with the old one
+  if(sighand_exec(p) < 0){
+    __debug_warn("[exec] fail to reset signal actions\n");
+    goto bad;
   }
-  w_satp(MAKE_SATP(p->pagetable));
-  
-  sfence_vma();
-  //printf("[exec]argc:%d a0:%p\n",argc,p->trapframe->a0);
-  uvmfree(np);
+  strncpy(p->name, last, sizeof(p->name));
+
+  mm_install(p, &mm);
+  memstat_rss(p);
+  fdt_close_on_exec(&p->fdt);
+  // mm has the old address space now
+  mm_free(&mm);
   return argc;
+
 bad:
-  uvmfree(np);
+  mm_free(&mm);
   __debug_warn("[exec]exec bad\n");
   return -1;
 }
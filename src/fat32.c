@@ -4,6 +4,7 @@
 #include "include/spinlock.h"
 #include "include/sleeplock.h"
 #include "include/buf.h"
+#include "include/disk.h"
 #include "include/copy.h"
 #include "include/proc.h"
 #include "include/stat.h"
@@ -15,6 +16,11 @@
 #include "include/fcntl.h"
 #include "include/vm.h"
 #include "include/image.h"
+#include "include/trace.h"
+#include "include/procfs.h"
+#include "include/blkstat.h"
+#include "include/pagecache.h"
+#include "include/blk.h"
 
 /* fields that start with "_" are something we don't use */
 
@@ -72,12 +78,14 @@ int fs_init()
       FatFs[i].valid = 0;
       FatFs[i].devno = i;
       FatFs[i].image = NULL;
+      FatFs[i].queue = NULL;
     }
     rootfs = FatFs;
     FatFs[0].image = NULL;
     FatFs[0].disk_init = (void*)disk_init;
     FatFs[0].disk_read = (void*)vdisk_read;
     FatFs[0].disk_write = (void*)vdisk_write;
+    FatFs[0].queue = &disk_queue;
     FatFs[0].devno = 0;
     return fat32_init(&FatFs[0]);
 }
@@ -96,7 +104,7 @@ int fat32_init(struct fs* self_fs)
     if(self_fs->valid)return -1;
     else self_fs->valid = 1;
     self_fs->disk_init(self_fs->image);
-    struct buf *b = bread(self_fs->devno, 0);
+    struct buf *b = bread(self_fs->devno, 0, BIO_FAT);
     #ifdef DEBUG
     #endif
     if (strncmp((char const*)(b->data + 82), "FAT32", 5))
@@ -147,6 +155,7 @@ int fat32_init(struct fs* self_fs)
         de->dirty = 0;
         de->mnt = 0;
         de->parent = 0;
+        pcache_drop(de);
         de->next = self_fs->root.next;
         de->prev = &self_fs->root;
         initsleeplock(&de->lock, "entry");
@@ -173,6 +182,7 @@ struct fs* fat32_img(struct dirent* img){
    FatFs[devno].disk_init = image_init;
    FatFs[devno].disk_read = image_read;
    FatFs[devno].disk_write = image_write;
+   FatFs[devno].queue = NULL;
    fat32_init(FatFs+devno);
    return FatFs+devno;
 }
@@ -218,7 +228,7 @@ static uint32 read_fat(struct fs * self_fs, uint32 cluster)
     }
     uint32 fat_sec = fat_sec_of_clus(self_fs, cluster, 1);
     // here should be a cache layer for FAT table, but not implemented yet.
-    struct buf *b = bread(self_fs->devno, fat_sec);
+    struct buf *b = bread(self_fs->devno, fat_sec, BIO_FAT);
     uint32 next_clus = *(uint32 *)(b->data + fat_offset_of_clus(self_fs, cluster));
     brelse(b);
     return next_clus;
@@ -235,7 +245,7 @@ static int write_fat(struct fs * self_fs, uint32 cluster, uint32 content)
         return -1;
     }
     uint32 fat_sec = fat_sec_of_clus(self_fs, cluster, 1);
-    struct buf *b = bread(self_fs->devno, fat_sec);
+    struct buf *b = bread(self_fs->devno, fat_sec, BIO_FAT);
     uint off = fat_offset_of_clus(self_fs, cluster);
     *(uint32 *)(b->data + off) = content;
     bwrite(self_fs->devno, b);
@@ -248,7 +258,7 @@ static void zero_clus(struct fs * self_fs, uint32 cluster)
     uint32 sec = first_sec_of_clus(self_fs, cluster);
     struct buf *b;
     for (int i = 0; i < self_fs->fat.bpb.sec_per_clus; i++) {
-        b = bread(self_fs->devno, sec++);
+        b = bread(self_fs->devno, sec++, BIO_DATA);
         memset(b->data, 0, BSIZE);
         bwrite(self_fs->devno, b);
         brelse(b);
@@ -262,7 +272,7 @@ static uint32 alloc_clus(struct fs * self_fs, uint8 dev)
     uint32 sec = self_fs->fat.bpb.rsvd_sec_cnt;
     uint32 const ent_per_sec = self_fs->fat.bpb.byts_per_sec / sizeof(uint32);
     for (uint32 i = 0; i < self_fs->fat.bpb.fat_sz; i++, sec++) {
-        b = bread(self_fs->devno, sec);
+        b = bread(self_fs->devno, sec, BIO_FAT);
         for (uint32 j = 0; j < ent_per_sec; j++) {
             if (((uint32 *)(b->data))[j] == 0) {
                 ((uint32 *)(b->data))[j] = FAT32_EOC + 7;
@@ -283,18 +293,28 @@ static void free_clus(struct fs * self_fs, uint32 cluster)
     write_fat(self_fs, cluster, 0);
 }
 
-static uint rw_clus(struct fs * self_fs, uint32 cluster, int write, int user, uint64 data, uint off, uint n)
+// kind is BIO_DIR or BIO_DATA, whichever the cluster holds.
+static uint rw_clus(struct fs * self_fs, uint32 cluster, int write, int user, uint64 data, uint off, uint n, int kind)
 {
     if (off + n > self_fs->fat.byts_per_clus)
         panic("offset out of range");
     uint tot, m;
     struct buf *bp;
+    struct blkplug plug;
     uint sec = first_sec_of_clus(self_fs, cluster) + off / self_fs->fat.bpb.byts_per_sec;
     off = off % self_fs->fat.bpb.byts_per_sec;
+    uint nsec = (off + n + BSIZE - 1) / BSIZE;
 
     int bad = 0;
-    for (tot = 0; tot < n; tot += m, off += m, data += m, sec++) {
-        bp = bread(self_fs->devno, sec);
+    trace(TRACE_FAT32_RW_START, cluster, n | (uint64)write << 32);
+    // The sectors are adjacent: read them ahead a few at a time, and let
+    // the writes gather, so the disk sees them as multi-block commands.
+    blk_start_plug(&plug);
+    for (uint i = tot = 0; tot < n; tot += m, off += m, data += m, sec++, i++) {
+        if (i % BREADAHEAD == 0) {
+            breadahead(self_fs->devno, sec, nsec - i);
+        }
+        bp = bread(self_fs->devno, sec, kind);
         m = BSIZE - off % BSIZE;
         if (n - tot < m) {
             m = n - tot;
@@ -302,19 +322,50 @@ static uint rw_clus(struct fs * self_fs, uint32 cluster, int write, int user, ui
         
         if (write) {
             if ((bad = either_copyin(user, bp->data + (off % BSIZE), data, m)) != -1) {
-                bwrite(self_fs->devno, bp);
+                bawrite(self_fs->devno, bp);
+                bp = NULL;
             }
         } else {
             bad = either_copyout(user, data, bp->data + (off % BSIZE), m);
         }
-        brelse(bp);
+        if (bp) {
+            brelse(bp);
+        }
         if (bad == -1) {
             break;
         }
     }
+    blk_finish_plug(&plug);
+    trace(TRACE_FAT32_RW_END, cluster, tot);
     return tot;
 }
 
+// rw_clus() for O_DIRECT: the whole sectors go straight between data
+// and the disk if data lines up with them, and the rest through the
+// buffer cache.
+static uint direct_clus(struct fs * self_fs, uint32 cluster, int write, int user, uint64 data, uint off, uint n)
+{
+    uint head = (BSIZE - off % BSIZE) % BSIZE;
+    uint mid, tail;
+    int r;
+
+    if (head > n)
+        head = n;
+    mid = (n - head) / BSIZE * BSIZE;
+    tail = n - head - mid;
+    if (mid == 0 || (data + head) % BSIZE != 0)
+        return rw_clus(self_fs, cluster, write, user, data, off, n, BIO_DATA);
+    if (head && rw_clus(self_fs, cluster, write, user, data, off, head, BIO_DATA) != head)
+        return 0;
+    r = bdirect(self_fs->devno, write, user, data + head,
+                first_sec_of_clus(self_fs, cluster) + (off + head) / self_fs->fat.bpb.byts_per_sec, mid);
+    if (r != mid)
+        return head + (r > 0 ? r : 0);
+    if (tail && rw_clus(self_fs, cluster, write, user, data + head + mid, off + head + mid, tail, BIO_DATA) != tail)
+        return head + mid;
+    return n;
+}
+
 /**
  * for the given entry, relocate the cur_clus field based on the off
  * @param   entry       modify its cur_clus field
@@ -355,8 +406,8 @@ static int reloc_clus(struct fs * self_fs, struct dirent *entry, uint off, int a
 }
 
 /* like the original readi, but "reade" is odd, let alone "writee" */
-// Caller must hold entry->lock.
-int eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n)
+// direct is for O_DIRECT, see direct_clus().
+static int do_eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n, int direct)
 {
     struct fs * self_fs = &FatFs[entry->dev];
     if (off > entry->file_size || off + n < off || (entry->attribute & ATTR_DIRECTORY)) {
@@ -373,21 +424,25 @@ int eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n)
         if (n - tot < m) {
             m = n - tot;
         }
-        if (rw_clus(self_fs, entry->cur_clus, 0, user_dst, dst, off % self_fs->fat.byts_per_clus, m) != m) {
+        if (direct) {
+            if (direct_clus(self_fs, entry->cur_clus, 0, user_dst, dst, off % self_fs->fat.byts_per_clus, m) != m) {
+                break;
+            }
+        } else if (rw_clus(self_fs, entry->cur_clus, 0, user_dst, dst, off % self_fs->fat.byts_per_clus, m, BIO_DATA) != m) {
             break;
         }
     }
     return tot;
 }
 
-// Caller must hold entry->lock.
-int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
+static int do_ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n, int direct)
 {
     struct fs * self_fs = &FatFs[entry->dev];
     if (off > entry->file_size || off + n < off || (uint64)off + n > 0xffffffff
         || (entry->attribute & ATTR_READ_ONLY)) {
         return -1;
     }
+    pcache_drop(entry);
     if (entry->first_clus == 0) {   // so file_size if 0 too, which requests off == 0
         entry->cur_clus = entry->first_clus = alloc_clus(self_fs, entry->dev);
         entry->clus_cnt = 0;
@@ -400,7 +455,11 @@ int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
         if (n - tot < m) {
             m = n - tot;
         }
-        if (rw_clus(self_fs, entry->cur_clus, 1, user_src, src, off % self_fs->fat.byts_per_clus, m) != m) {
+        if (direct) {
+            if (direct_clus(self_fs, entry->cur_clus, 1, user_src, src, off % self_fs->fat.byts_per_clus, m) != m) {
+                break;
+            }
+        } else if (rw_clus(self_fs, entry->cur_clus, 1, user_src, src, off % self_fs->fat.byts_per_clus, m, BIO_DATA) != m) {
             break;
         }
     }
@@ -413,6 +472,30 @@ int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
     return tot;
 }
 
+// Caller must hold entry->lock.
+int eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n)
+{
+    return do_eread(entry, user_dst, dst, off, n, 0);
+}
+
+// Caller must hold entry->lock.
+int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
+{
+    return do_ewrite(entry, user_src, src, off, n, 0);
+}
+
+// eread() and ewrite() for a file opened O_DIRECT: sector-aligned
+// data skips the buffer cache. Caller must hold entry->lock.
+int eread_direct(struct dirent *entry, uint64 dst, uint off, uint n)
+{
+    return do_eread(entry, 1, dst, off, n, 1);
+}
+
+int ewrite_direct(struct dirent *entry, uint64 src, uint off, uint n)
+{
+    return do_ewrite(entry, 1, src, off, n, 1);
+}
+
 // Returns a dirent struct. If name is given, check self_fs->ecache. It is difficult to cache entries
 // by their whole path. But when parsing a path, we open all the directories through it, 
 // which forms a linked list from the final file to the self_fs->root. Thus, we use the "parent" pointer 
@@ -437,18 +520,30 @@ static struct dirent *eget(struct dirent *parent, char *name)
             }
         }
     }
+    // Programs and libraries keep their pages while anything else can
+    // go: the least recently used entry with nothing cached, if any.
+    struct dirent *victim = NULL;
     for (ep = self_fs->root.prev; ep != &self_fs->root; ep = ep->prev) {              // LRU algo
         if (ep->ref == 0) {
-            ep->ref = 1;
-            ep->dev = parent->dev;
-            ep->off = 0;
-            ep->valid = 0;
-            ep->mnt = 0;
-            ep->dirty = 0;
-            release(&self_fs->ecache.lock);
-            return ep;
+            if (ep->pcache == NULL && ep->elfcache == NULL) {
+                victim = ep;
+                break;
+            }
+            if (victim == NULL)
+                victim = ep;
         }
     }
+    if ((ep = victim) != NULL) {
+        pcache_drop(ep);
+        ep->ref = 1;
+        ep->dev = parent->dev;
+        ep->off = 0;
+        ep->valid = 0;
+        ep->mnt = 0;
+        ep->dirty = 0;
+        release(&self_fs->ecache.lock);
+        return ep;
+    }
     panic("eget: insufficient self_fs->ecache");
     return 0;
 }
@@ -552,7 +647,7 @@ void emake(struct dirent *dp, struct dirent *ep, uint off)
         de.sne.fst_clus_lo = (uint16)(ep->first_clus & 0xffff);       // low 16 bits
         de.sne.file_size = 0;                                       // filesize is updated in eupdate()
         off = reloc_clus(self_fs, dp, off, 1);
-        rw_clus(self_fs, dp->cur_clus, 1, 0, (uint64)&de, off, sizeof(de));
+        rw_clus(self_fs, dp->cur_clus, 1, 0, (uint64)&de, off, sizeof(de), BIO_DIR);
     } else {
         int entcnt = (strlen(ep->filename) + CHAR_LONG_NAME - 1) / CHAR_LONG_NAME;   // count of l-n-entries, rounds up
         char shortname[CHAR_SHORT_NAME + 1];
@@ -583,7 +678,7 @@ void emake(struct dirent *dp, struct dirent *ep, uint off)
                 }
             }
             uint off2 = reloc_clus(self_fs, dp, off, 1);
-            rw_clus(self_fs, dp->cur_clus, 1, 0, (uint64)&de, off2, sizeof(de));
+            rw_clus(self_fs, dp->cur_clus, 1, 0, (uint64)&de, off2, sizeof(de), BIO_DIR);
             off += sizeof(de);
         }
         memset(&de, 0, sizeof(de));
@@ -593,7 +688,7 @@ void emake(struct dirent *dp, struct dirent *ep, uint off)
         de.sne.fst_clus_lo = (uint16)(ep->first_clus & 0xffff);     // low 16 bits
         de.sne.file_size = ep->file_size;                         // filesize is updated in eupdate()
         off = reloc_clus(self_fs, dp, off, 1);
-        rw_clus(self_fs, dp->cur_clus, 1, 0, (uint64)&de, off, sizeof(de));
+        rw_clus(self_fs, dp->cur_clus, 1, 0, (uint64)&de, off, sizeof(de), BIO_DIR);
     }
 }
 
@@ -660,15 +755,15 @@ void eupdate(struct dirent *entry)
     if (!entry->dirty || entry->valid != 1) { return; }
     uint entcnt = 0;
     uint32 off = reloc_clus(self_fs, entry->parent, entry->off, 0);
-    rw_clus(self_fs, entry->parent->cur_clus, 0, 0, (uint64) &entcnt, off, 1);
+    rw_clus(self_fs, entry->parent->cur_clus, 0, 0, (uint64) &entcnt, off, 1, BIO_DIR);
     entcnt &= ~LAST_LONG_ENTRY;
     off = reloc_clus(self_fs, entry->parent, entry->off + (entcnt << 5), 0);
     union dentry de;
-    rw_clus(self_fs, entry->parent->cur_clus, 0, 0, (uint64)&de, off, sizeof(de));
+    rw_clus(self_fs, entry->parent->cur_clus, 0, 0, (uint64)&de, off, sizeof(de), BIO_DIR);
     de.sne.fst_clus_hi = (uint16)(entry->first_clus >> 16);
     de.sne.fst_clus_lo = (uint16)(entry->first_clus & 0xffff);
     de.sne.file_size = entry->file_size;
-    rw_clus(self_fs, entry->parent->cur_clus, 1, 0, (uint64)&de, off, sizeof(de));
+    rw_clus(self_fs, entry->parent->cur_clus, 1, 0, (uint64)&de, off, sizeof(de), BIO_DIR);
     entry->dirty = 0;
 }
 
@@ -682,11 +777,11 @@ void eremove(struct dirent *entry)
     uint entcnt = 0;
     uint32 off = entry->off;
     uint32 off2 = reloc_clus(self_fs, entry->parent, off, 0);
-    rw_clus(self_fs, entry->parent->cur_clus, 0, 0, (uint64) &entcnt, off2, 1);
+    rw_clus(self_fs, entry->parent->cur_clus, 0, 0, (uint64) &entcnt, off2, 1, BIO_DIR);
     entcnt &= ~LAST_LONG_ENTRY;
     uint8 flag = EMPTY_ENTRY;
     for (int i = 0; i <= entcnt; i++) {
-        rw_clus(self_fs, entry->parent->cur_clus, 1, 0, (uint64) &flag, off2, 1);
+        rw_clus(self_fs, entry->parent->cur_clus, 1, 0, (uint64) &flag, off2, 1, BIO_DIR);
         off += 32;
         off2 = reloc_clus(self_fs, entry->parent, off, 0);
     }
@@ -698,6 +793,7 @@ void eremove(struct dirent *entry)
 void etrunc(struct dirent *entry)
 {
     struct fs * self_fs = &FatFs[entry->dev];
+    pcache_drop(entry);
     for (uint32 clus = entry->first_clus; clus >= 2 && clus < FAT32_EOC; ) {
         uint32 next = read_fat(self_fs, clus);
         free_clus(self_fs, clus);
@@ -715,6 +811,14 @@ void elock(struct dirent *entry)
     acquiresleep(&entry->lock);
 }
 
+// elock() if no one holds entry. Returns 1 if it was locked, 0 if not.
+int etrylock(struct dirent *entry)
+{
+    if (entry == 0 || entry->ref < 1)
+        panic("etrylock");
+    return tryacquiresleep(&entry->lock);
+}
+
 void eunlock(struct dirent *entry)
 {
     if (entry == 0 || !holdingsleep(&entry->lock) || entry->ref < 1)
@@ -845,7 +949,7 @@ int enext(struct dirent *dp, struct dirent *ep, uint off, int *count)
     memset(ep->filename, 0, FAT32_MAX_FILENAME + 1);
 
     for (int off2; (off2 = reloc_clus(self_fs, dp, off, 0)) != -1; off += 32) {
-        if (rw_clus(self_fs, dp->cur_clus, 0, 0, (uint64)&de, off2, 32) != 32 || de.lne.order == END_OF_ENTRY) {//?????
+        if (rw_clus(self_fs, dp->cur_clus, 0, 0, (uint64)&de, off2, 32, BIO_DIR) != 32 || de.lne.order == END_OF_ENTRY) {//?????
             return -1;
         }
         if (de.lne.order == EMPTY_ENTRY) {
@@ -983,6 +1087,14 @@ static struct dirent *lookup_path(struct dirent* env,char *path, int parent, cha
           *devno = devlookup(name);
           return entry;
         }
+        if(entry->mnt&&FatFs[entry->dev].synthetic){
+          // hand the rest of the path to procfs, the disk has none of it
+          eunlock(entry);
+          if(devno&&!parent&&(*devno = procfs_lookup(name,path)) >= 0)
+            return entry;
+          eput(entry);
+          return NULL;
+        }
         if (!(entry->attribute & ATTR_DIRECTORY)) {
             eunlock(entry);
             eput(entry);
@@ -1006,6 +1118,8 @@ static struct dirent *lookup_path(struct dirent* env,char *path, int parent, cha
         eput(entry);
         return NULL;
     }
+    if(devno&&entry->mnt&&FatFs[entry->dev].synthetic)
+        *devno = PROCFS_ROOT;
     return entry;
 }
 
@@ -1154,6 +1268,12 @@ create(struct dirent* env, char *path, short type, int mode)
   {
     elock(dp);
   }
+  if (dp->mnt && FatFs[dp->dev].synthetic) {
+    // nothing can be created in /proc
+    eunlock(dp);
+    eput(dp);
+    return NULL;
+  }
   
   if ((ep = ealloc(dp, name, mode)) == NULL) {
     eunlock(dp);
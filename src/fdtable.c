@@ -0,0 +1,224 @@
+//
+// Per-process file descriptor tables.
+//
+// The fd -> file array starts out empty and is doubled whenever
+// an fd beyond its end is handed out, up to one page of slots.
+// Which fds are in use is tracked by the `open_fds` bitmap, so
+// finding the lowest free fd or walking the open ones only
+// touches a handful of words instead of every slot.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/fdtable.h"
+#include "include/file.h"
+#include "include/kalloc.h"
+#include "include/pm.h"
+#include "include/string.h"
+#include "include/errno.h"
+#include "include/utils/bitops.h"
+
+static struct file**
+fdt_arralloc(int n)
+{
+  uint64 sz = n * sizeof(struct file*);
+  // a full page is beyond what kmalloc() hands out
+  return sz >= PGSIZE ? allocpage() : kmalloc(sz);
+}
+
+static void
+fdt_arrfree(struct file **arr, int n)
+{
+  if(n * sizeof(struct file*) >= PGSIZE)
+    freepage(arr);
+  else
+    kfree(arr);
+}
+
+// Make sure slot `fd` exists, growing the table if needed.
+static int
+fdt_expand(struct fdtable *fdt, int fd)
+{
+  int n;
+  struct file **arr;
+
+  if(fd < fdt->max)
+    return 0;
+  if(fd >= FDT_MAX)
+    return -EMFILE;
+  for(n = fdt->max ? fdt->max : FDT_MIN; n <= fd; n <<= 1)
+    ;
+  if((arr = fdt_arralloc(n)) == NULL)
+    return -ENOMEM;
+  memset(arr, 0, n * sizeof(struct file*));
+  if(fdt->fd){
+    memmove(arr, fdt->fd, fdt->max * sizeof(struct file*));
+    fdt_arrfree(fdt->fd, fdt->max);
+  }
+  fdt->fd = arr;
+  fdt->max = n;
+  return 0;
+}
+
+void
+fdt_init(struct fdtable *fdt)
+{
+  memset(fdt, 0, sizeof(struct fdtable));
+}
+
+// Release the slot array. Files must have been closed already.
+void
+fdt_free(struct fdtable *fdt)
+{
+  if(fdt->fd)
+    fdt_arrfree(fdt->fd, fdt->max);
+  fdt_init(fdt);
+}
+
+// Lowest open fd that is >= `fd`, or -1.
+int
+fdt_next(struct fdtable *fdt, int fd)
+{
+  int i;
+  uint64 w;
+
+  if(fd < 0)
+    fd = 0;
+  for(i = fd / NFDBITS; i < FDT_WORDS && i * NFDBITS < fdt->max; i++){
+    w = fdt->open_fds[i];
+    if(i == fd / NFDBITS)
+      w &= ~0ul << (fd % NFDBITS);
+    if(w)
+      return i * NFDBITS + ctz64(w);
+  }
+  return -1;
+}
+
+// Duplicate every open fd of `src` into the empty table `dst`.
+int
+fdt_copy(struct fdtable *dst, struct fdtable *src)
+{
+  int fd, last = -1;
+
+  fdt_for_each(fd, src)
+    last = fd;
+  if(last < 0)
+    return 0;
+  if(fdt_expand(dst, last) < 0)
+    return -ENOMEM;
+  fdt_for_each(fd, src)
+    dst->fd[fd] = filedup(src->fd[fd]);
+  memmove(dst->open_fds, src->open_fds, sizeof(src->open_fds));
+  memmove(dst->close_on_exec, src->close_on_exec, sizeof(src->close_on_exec));
+  return 0;
+}
+
+// Install `f` at the lowest free fd that is >= `start` and < `limit`.
+// Takes over the file reference on success. A `start` outside the
+// limit is -EINVAL, as F_DUPFD wants; no free fd is -EMFILE.
+int
+fdt_alloc(struct fdtable *fdt, struct file *f, int start, int limit)
+{
+  int i, fd, err;
+  uint64 w;
+
+  if(limit > FDT_MAX)
+    limit = FDT_MAX;
+  if(start < 0 || start >= limit)
+    return -EINVAL;
+  fd = -1;
+  for(i = start / NFDBITS; i < FDT_WORDS; i++){
+    w = ~fdt->open_fds[i];
+    if(i == start / NFDBITS)
+      w &= ~0ul << (start % NFDBITS);
+    if(w){
+      fd = i * NFDBITS + ctz64(w);
+      break;
+    }
+  }
+  if(fd < 0 || fd >= limit)
+    return -EMFILE;
+  if((err = fdt_expand(fdt, fd)) < 0)
+    return err;
+  fdt->fd[fd] = f;
+  bitmap_set(fdt->open_fds, fd);
+  bitmap_clear(fdt->close_on_exec, fd);
+  return fd;
+}
+
+// Put `f` at exactly `fd`. The caller deals with whatever was there.
+int
+fdt_install(struct fdtable *fdt, int fd, struct file *f, int limit)
+{
+  int err;
+
+  if(fd < 0)
+    return -EBADF;
+  if(fd >= limit || fd >= FDT_MAX)
+    return -EMFILE;
+  if((err = fdt_expand(fdt, fd)) < 0)
+    return err;
+  fdt->fd[fd] = f;
+  bitmap_set(fdt->open_fds, fd);
+  bitmap_clear(fdt->close_on_exec, fd);
+  return 0;
+}
+
+// Detach the file at `fd` and return it, the caller closes it.
+struct file*
+fdt_remove(struct fdtable *fdt, int fd)
+{
+  struct file *f;
+
+  if((f = fdt_get(fdt, fd)) == NULL)
+    return NULL;
+  fdt->fd[fd] = NULL;
+  bitmap_clear(fdt->open_fds, fd);
+  bitmap_clear(fdt->close_on_exec, fd);
+  return f;
+}
+
+void
+fdt_set_cloexec(struct fdtable *fdt, int fd, int on)
+{
+  if(fdt_get(fdt, fd) == NULL)
+    return;
+  if(on)
+    bitmap_set(fdt->close_on_exec, fd);
+  else
+    bitmap_clear(fdt->close_on_exec, fd);
+}
+
+int
+fdt_get_cloexec(struct fdtable *fdt, int fd)
+{
+  if(fdt_get(fdt, fd) == NULL)
+    return 0;
+  return bitmap_test(fdt->close_on_exec, fd);
+}
+
+void
+fdt_close_all(struct fdtable *fdt)
+{
+  int fd;
+
+  fdt_for_each(fd, fdt)
+    fileclose(fdt_remove(fdt, fd));
+}
+
+void
+fdt_close_on_exec(struct fdtable *fdt)
+{
+  int i, fd;
+  uint64 w;
+
+  for(i = 0; i < FDT_WORDS; i++){
+    w = fdt->open_fds[i] & fdt->close_on_exec[i];
+    while(w){
+      fd = i * NFDBITS + ctz64(w);
+      w &= w - 1;
+      fileclose(fdt_remove(fdt, fd));
+    }
+  }
+}
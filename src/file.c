@@ -17,10 +17,15 @@
 #include "include/string.h"
 #include "include/vm.h"
 #include "include/copy.h"
+#include "include/kalloc.h"
+#include "include/perf.h"
+#include "include/procfs.h"
 
+// File structures are kmalloc()ed on demand, the lock only
+// guards their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  int nfile;          // number of live file structures
 } ftable;
 
 extern int disk_init_flag;
@@ -30,10 +35,7 @@ fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
   disk_init_flag = 0;
-  struct file *f;
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    memset(f, 0, sizeof(struct file));
-  }
+  ftable.nfile = 0;
   #ifdef DEBUG
   printf("fileinit\n");
   #endif
@@ -45,16 +47,15 @@ filealloc(void)
 {
   struct file *f;
 
+  if((f = kmalloc(sizeof(struct file))) == NULL)
+    return NULL;
+  memset(f, 0, sizeof(struct file));
+  f->type = FD_NONE;
+  f->ref = 1;
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
+  ftable.nfile++;
   release(&ftable.lock);
-  return NULL;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -83,9 +84,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kfree(f);
 
   if(ff.type == FD_PIPE){
     //pipeclose(ff.pipe, ff.writable);
@@ -93,6 +94,8 @@ fileclose(struct file *f)
     eput(ff.ep);
   } else if (ff.type == FD_DEVICE) {
 
+  } else if (ff.type == FD_PERF) {
+    perf_event_close(ff.perf);
   }
 }
 
@@ -100,9 +103,11 @@ int fileillegal(struct file* f){
   switch (f->type) {
     case FD_PIPE:
     case FD_DEVICE:
-        if(f->major < 0 || f->major >= getdevnum() || !devsw[f->major].read || !devsw[f->major].write)
+        if(f->major < 0 || f->major >= getdevnum() || !DEV_READABLE(f->major) || !DEV_WRITABLE(f->major))
           return 1;
     case FD_ENTRY:
+    case FD_PERF:
+    case FD_PROC:
         break;
     default:
       panic("fileillegal");
@@ -122,6 +127,12 @@ void print_f_info(struct file* f){
     case FD_ENTRY:
         printf("[file]ENTRY name:%s\n",f->ep->filename);
         break;
+    case FD_PERF:
+        printf("[file]PERF\n");
+        break;
+    case FD_PROC:
+        printf("[file]PROC node:%p\n",f->node);
+        break;
     case FD_NONE:
         printf("[file]NONE\n");
     	return;
@@ -132,14 +143,16 @@ void print_f_info(struct file* f){
 void fileiolock(struct file* f){
   switch (f->type) {
     case FD_PIPE:
-        acquire(&f->pipe->lock);
+        // piperead() and pipewrite() lock for themselves
         break;
     case FD_DEVICE:
-        acquire(&(devsw + f->major)->lk);
+        // drivers lock for themselves
         break;
     case FD_ENTRY:
         elock(f->ep);
         break;
+    case FD_PERF:
+    case FD_PROC:
     case FD_NONE:
     	return;
   }
@@ -148,14 +161,14 @@ void fileiolock(struct file* f){
 void fileiounlock(struct file* f){
   switch (f->type) {
     case FD_PIPE:
-        release(&f->pipe->lock);
         break;
     case FD_DEVICE:
-        release(&(devsw + f->major)->lk);
         break;
     case FD_ENTRY:
         eunlock(f->ep);
         break;
+    case FD_PERF:
+    case FD_PROC:
     case FD_NONE:
     	return;
   }
@@ -169,11 +182,18 @@ fileinput(struct file* f, int user, uint64 addr, int n, uint64 off){
         r = piperead(f->pipe, user, addr, n);
         break;
     case FD_DEVICE:
-        r = (devsw + f->major)->read(user, addr, n);
+        // off is the caller's to move on, not f->off
+        r = devread(f->major, user, addr, &off, n);
         break;
     case FD_ENTRY:
         r = eread(f->ep, user, addr, off, n);
         break;
+    case FD_PERF:
+        r = perf_event_read(f->perf, user, addr, n);
+        break;
+    case FD_PROC:
+        r = procfs_read(f->node, user, addr, off, n);
+        break;
     case FD_NONE:
     	return 0;
   }
@@ -188,11 +208,15 @@ fileoutput(struct file* f, int user, uint64 addr, int n, uint64 off){
         r = pipewrite(f->pipe, user, addr, n);
         break;
     case FD_DEVICE:
-        r = (devsw + f->major)->write(user, addr, n);
+        r = devwrite(f->major, user, addr, &off, n);
         break;
     case FD_ENTRY:
         r = ewrite(f->ep, user, addr, off, n);
         break;
+    case FD_PERF:
+    case FD_PROC:
+        r = -1;
+        break;
     case FD_NONE:
     	return 0;
   }
@@ -242,12 +266,15 @@ filekstat(struct file *f, uint64 addr)
     if(kst.st_mtime_nsec == 0x0000000100000000)kst.st_mtime_sec = 0x0000000100000000;
     if(kst.st_atime_nsec == 0x0000000100000000)kst.st_atime_sec = 0x0000000100000000;
   }else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= getdevnum() || !devsw[f->major].read)
+    if(f->major < 0 || f->major >= getdevnum() || !DEV_READABLE(f->major))
           return -1;
     struct devsw* mydev = devsw + f->major;
     acquire(&mydev->lk);
     devkstat(mydev,&kst);
     release(&mydev->lk);
+  }else if(f->type == FD_PROC){
+    if(procfs_kstat(f->node, &kst) < 0)
+      return -1;
   }else {
     return -1;
   }    
@@ -269,24 +296,38 @@ fileread(struct file *f, uint64 addr, int n)
 
   switch (f->type) {
     case FD_PIPE:
-        acquire(&f->pipe->lock);
         r = piperead(f->pipe, 1, addr, n);
-        release(&f->pipe->lock);
         break;
     case FD_DEVICE:
-        if(f->major < 0 || f->major >= getdevnum() || !devsw[f->major].read)
+        if(f->major < 0 || f->major >= getdevnum() || !DEV_READABLE(f->major))
           return -1;
-        struct devsw* mydev = devsw + f->major;
-        acquire(&mydev->lk);
-        r = mydev->read(1, addr, n);
-        release(&mydev->lk);
+        // drivers lock for themselves, and may sleep
+        r = devread(f->major, 1, addr, &f->off, n);
         break;
     case FD_ENTRY:
+        // a page of another file faulted in under f->ep's lock would
+        // need that file's lock too, so fault the buffer in first
+        if(n > 0)
+          uvm_prefault(myproc()->pagetable, addr, n, 1);
         elock(f->ep);
-        if((r = eread(f->ep, 1, addr, f->off, n)) > 0)
+        myproc()->elocked = f->ep;
+        if(f->direct)
+          r = eread_direct(f->ep, addr, f->off, n);
+        else
+          r = eread(f->ep, 1, addr, f->off, n);
+        if(r > 0)
           f->off += r;
+        myproc()->elocked = NULL;
         eunlock(f->ep);
         break;
+    case FD_PERF:
+        r = perf_event_read(f->perf, 1, addr, n);
+        break;
+    case FD_PROC:
+        // generated afresh on every read, nothing to lock
+        if((r = procfs_read(f->node, 1, addr, f->off, n)) > 0)
+          f->off += r;
+        break;
     default:
       panic("fileread");
   }
@@ -303,26 +344,30 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE){
-    acquire(&f->pipe->lock);
     ret = pipewrite(f->pipe, 1, addr, n);
-    release(&f->pipe->lock);
   } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= getdevnum() || !devsw[f->major].write)
+    if(f->major < 0 || f->major >= getdevnum() || !DEV_WRITABLE(f->major))
       return -1;
-    struct devsw* mydev = devsw + f->major;
-    struct spinlock* dlk = &(mydev->lk);
-    acquire(dlk);
-    ret = mydev->write(1, addr, n);
-    release(dlk);
+    ret = devwrite(f->major, 1, addr, &f->off, n);
   } else if(f->type == FD_ENTRY){
+    // as in fileread()
+    if(n > 0)
+      uvm_prefault(myproc()->pagetable, addr, n, 0);
     elock(f->ep);
-    if (ewrite(f->ep, 1, addr, f->off, n) == n) {
-      ret = n;
+    myproc()->elocked = f->ep;
+    if(f->direct)
+      ret = ewrite_direct(f->ep, addr, f->off, n);
+    else
+      ret = ewrite(f->ep, 1, addr, f->off, n);
+    if (ret == n) {
       f->off += n;
     } else {
       ret = -1;
     }
+    myproc()->elocked = NULL;
     eunlock(f->ep);
+  } else if(f->type == FD_PROC){
+    ret = -1;
   } else {
     panic("filewrite");
   }
@@ -350,22 +395,22 @@ filesend(struct file* fin,struct file* fout,uint64 addr,uint64 n){
   }
   //printf("[filesend]want send n:%p\n",n);
   //printf("[filesend]before send fout off:%p\n",fout->off);
-  print_f_info(fin);
-  print_f_info(fout);
+  //print_f_info(fin);
+  //print_f_info(fout);
   fileiolock(fin);
   fileiolock(fout);
   while(n){
     char buf[512];
     rlen = MIN(n,512);
     rlen = fileinput(fin,0,(uint64)&buf,rlen,off);
-    printf("[filesend] send rlen %p\n",rlen);
+    //printf("[filesend] send rlen %p\n",rlen);
     off += rlen;
     n -= rlen;
     if(!rlen){
       break;
     }
     wlen = fileoutput(fout,0,(uint64)&buf,rlen,fout->off);
-    printf("[filesend] send wlen:%p\n",rlen,wlen);
+    //printf("[filesend] send wlen:%p\n",wlen);
     fout->off += wlen;
     ret += wlen;
   }
@@ -422,16 +467,18 @@ findfile(char* path)
   struct proc* p = myproc();
   if(ep == NULL)return NULL;
   elock(ep);
-  for(int i = 0;i<NOFILEMAX(p);i++){
-    if(p->ofile[i]->type==FD_ENTRY&&p->ofile[i]->ep==ep){
+  int fd;
+  fdt_for_each(fd, &p->fdt){
+    struct file *f = p->fdt.fd[fd];
+    if(f->type==FD_ENTRY&&f->ep==ep){
       eunlock(ep);
       eput(ep);
-      return p->ofile[i];
+      return f;
     }
-    if(p->ofile[i]->type==FD_DEVICE&&p->ofile[i]->major==dev){
+    if(f->type==FD_DEVICE&&f->major==dev){
       eunlock(ep);
       eput(ep);
-      return p->ofile[i];
+      return f;
     }
   }
   eunlock(ep);
@@ -443,6 +490,8 @@ findfile(char* path)
 int
 dirent_next(struct file *f, uint64 addr, int n)
 {
+  if(f->type == FD_PROC)
+    return procfs_getdents(f, addr, n);
   if(f->readable == 0 || !(f->ep->attribute & ATTR_DIRECTORY))
     return -1;
   //printf("[dirent next]addr:%p n:%p\n",addr,n);
@@ -534,6 +583,39 @@ filelseek(struct file *f, uint64 offset, int whence)
     }
     release(&f->pipe->lock);
     break;
+  case FD_PROC:
+    switch (whence)
+    {
+      case SEEK_SET:
+        ret = f->off = offset;
+        break;
+      case SEEK_CUR:
+        ret = (f->off += offset);
+        break;
+      default:
+        break;
+    }
+    break;
+  case FD_DEVICE:
+    // only devices read at an offset can seek
+    if(f->major < 0 || f->major >= getdevnum() || !devsw[f->major].readat)
+      break;
+    switch (whence)
+    {
+      case SEEK_SET:
+        ret = f->off = offset;
+        break;
+      case SEEK_CUR:
+        ret = (f->off += offset);
+        break;
+      case SEEK_END:
+        if(devsw[f->major].size)
+          ret = f->off = devsw[f->major].size() + offset;
+        break;
+      default:
+        break;
+    }
+    break;
   default:
     break;
   }
@@ -0,0 +1,76 @@
+#ifndef __BLK_H
+#define __BLK_H
+
+#include "types.h"
+#include "spinlock.h"
+
+// The block layer, between the buffer cache and the disk drivers.
+// Requests queue per device, sorted by sector, and one that continues
+// or precedes a queued one is merged into it, for one multi-block
+// command. A driver takes them from its queue in sector order, going
+// round from the lowest once past the highest, and hands each back to
+// blk_end().
+//
+// Between blk_start_plug() and blk_finish_plug() the requests a
+// process submits are held back and merged among themselves, then go
+// to their queues together. Waiting for a request with blk_wait()
+// lets the held ones go first.
+//
+// Once merged, a request's sector, nsect and data describe the whole
+// command, not what was submitted with it; private is untouched, for
+// end_io to find its own.
+
+#define BLK_MAXSECT     32      // sectors in a request
+
+struct blkqueue;
+
+struct blkreq {
+  int write;
+  uint sector;                  // the first
+  int nsect;
+  uchar *data[BLK_MAXSECT];     // where each sector comes from or goes to
+  int error;
+  // Called once it is done, in the driver's context, where it may not
+  // sleep; then the request is the callback's. Without one, done is
+  // set and blk_wait() returns.
+  void (*end_io)(struct blkreq *r);
+  void *private;
+  int done;
+  struct blkqueue *q;
+  uint64 submit;                // blkstat times
+  uint64 dispatch;
+  struct blkreq *next;          // in a queue or a plug
+  struct blkreq *merged;        // folded into this one, ended with it
+};
+
+struct blkqueue {
+  struct spinlock lock;
+  uint dev;                     // for blkstat
+  struct blkreq *head;          // by sector
+  uint last;                    // the sector after the last dispatched
+  // Called when requests were added, without the lock. A driver with a
+  // thread of its own sleeps in blk_fetch_wait() instead, and may leave
+  // it NULL.
+  void (*run)(struct blkqueue *q);
+};
+
+struct blkplug {
+  struct blkreq *head;          // by sector
+};
+
+void            blk_init(void);
+void            blk_initqueue(struct blkqueue *q, char *name, uint dev, void (*run)(struct blkqueue *));
+void            blk_initreq(struct blkreq *r, int write, uint sector, void (*end_io)(struct blkreq *), void *private);
+int             blk_addsect(struct blkreq *r, uchar *data);
+void            blk_submit(struct blkqueue *q, struct blkreq *r);
+void            blk_wait(struct blkreq *r);
+void            blk_start_plug(struct blkplug *plug);
+void            blk_finish_plug(struct blkplug *plug);
+void            blk_flush_plug(void);
+
+// for drivers
+struct blkreq*  blk_fetch(struct blkqueue *q);
+struct blkreq*  blk_fetch_wait(struct blkqueue *q);
+void            blk_end(struct blkreq *r, int error);
+
+#endif
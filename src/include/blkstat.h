@@ -0,0 +1,47 @@
+#ifndef __BLKSTAT_H
+#define __BLKSTAT_H
+
+#include "types.h"
+
+// Block I/O accounting, per device (FatFs slot). /proc/diskstats has
+// it in the form iostat(1) reads, /proc/blkstat the latency histograms
+// and the buffer cache hits by what the block held. Times are in
+// r_time() ticks (TICK_FREQ).
+
+#define BLK_NLAT    16      // log2 buckets of latency in us, last takes the rest
+
+enum { BLK_READ, BLK_WRITE };
+
+// what a block holds, as told to bread()
+enum { BIO_FAT, BIO_DIR, BIO_DATA, BIO_NKIND };
+
+struct blkstat {
+  uint64 ios[2];            // requests completed, by BLK_READ/BLK_WRITE
+  uint64 sectors[2];
+  uint64 merges[2];         // requests folded into one already queued
+  uint64 queue_time[2];     // submit to dispatch
+  uint64 service_time[2];   // dispatch to completion
+  uint64 lat[2][BLK_NLAT];  // submit to completion
+  int in_flight;
+  uint64 busy_time;         // time with something in flight
+  uint64 weighted_time;     // in_flight summed over time
+  uint64 stamp;             // when in_flight last changed
+  // the buffer cache in front of the device
+  uint64 hits[BIO_NKIND];
+  uint64 misses[BIO_NKIND];
+};
+
+struct seqbuf;
+
+void            blkstat_init(void);
+void            blkstat_cache(uint dev, int kind, int hit);
+uint64          blkstat_submit(uint dev);
+void            blkstat_done(uint dev, int rw, int nsect, uint64 submit, uint64 dispatch);
+void            blkstat_merge(uint dev, int rw);
+void            blkstat_get(uint dev, struct blkstat *bs);
+void            blkstat_reset_cache(void);
+void            blkstat_devname(uint dev, char *name, int len);
+void            blkstat_diskstats(struct seqbuf *sq);
+void            blkstat_report(struct seqbuf *sq);
+
+#endif
@@ -2,6 +2,7 @@
 #define __BUF_H
 
 #define BSIZE 512
+#define BREADAHEAD 8    // blocks a breadahead reads at most
 
 #include "sleeplock.h"
 
@@ -18,8 +19,13 @@ struct buf {
 };
 
 void            binit(void);
-struct buf*     bread(uint, uint);
+struct buf*     bread(uint, uint, int);
 void            brelse(struct buf*);
 void            bwrite(uint, struct buf*);
+void            breadahead(uint, uint, int);
+void            bawrite(uint, struct buf*);
+int             bdirect(uint dev, int write, int user, uint64 addr, uint sectorno, uint n);
+void            bstat(uint64 *hits, uint64 *misses);
+void            bstat_reset(void);
 
 #endif
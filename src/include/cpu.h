@@ -32,6 +32,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 softirq_pending;     // Raised softirqs, one bit each.
+  int in_softirq;             // Running softirqs, don't yield.
 };
 
 extern struct cpu cpus[NCPU];
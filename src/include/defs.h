@@ -16,7 +16,7 @@ struct kstat;
 // enum spi_frame_format_t;
 // bio.c
 void            binit(void);
-struct buf*     bread(uint, uint);
+struct buf*     bread(uint, uint, int);
 void            brelse(struct buf*);
 void            bwrite(uint, struct buf*);
 void            bpin(struct buf*);
@@ -175,6 +175,7 @@ void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -243,7 +244,7 @@ void            virtio_disk_intr(void);
 
 // ramdisk.c
 void		ramdisk_init();
-void		ramdisk_rw(struct buf *b, int write);
+int		ramdisk_rw(uint sectorno, uchar *data, int write);
 
 // plic.c
 void            plicinit(void);
@@ -13,19 +13,31 @@ extern struct dirent* dev;
 // #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
 // map major device number to device functions.
+// read and write are called without lk held; a driver does its own
+// locking and may sleep.
 struct devsw {
   char name[DEV_NAME_MAX+1];
   struct spinlock lk;
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*readat)(int, uint64, uint64, int);  // read from the file offset
+  int (*writeat)(int, uint64, uint64, int); // write at the file offset
+  uint64 (*size)(void);                     // bytes, for SEEK_END
 };
 
+#define DEV_READABLE(m) (devsw[m].read || devsw[m].readat)
+#define DEV_WRITABLE(m) (devsw[m].write || devsw[m].writeat)
+
 extern struct devsw devsw[];
 
 int devinit();
 int devlookup(char* name);
 int getdevnum();
 int allocdev(char* name,int (*devread)(int, uint64, int),int (*devwrite)(int, uint64, int));
+int allocdev_readat(char* name,int (*devreadat)(int, uint64, uint64, int),int (*devwrite)(int, uint64, int));
+int allocdev_at(char* name,int (*devreadat)(int, uint64, uint64, int),int (*devwriteat)(int, uint64, uint64, int),uint64 (*devsize)(void));
+int devread(int major,int user_dst,uint64 addr,uint64* off,int n);
+int devwrite(int major,int user_src,uint64 addr,uint64* off,int n);
 int nullread(int user_dst,uint64 addr,int n);
 int nullwrite(int user_dst,uint64 addr,int n);
 int zeroread(int user_dst,uint64 addr,int n);
@@ -3,9 +3,24 @@
 
 #include "buf.h"
 
+struct blkqueue;
+
+// the SD card or the ramdisk, whichever the kernel was built for
+extern struct blkqueue disk_queue;
+
+// its raw device under /dev
+#ifdef RAM
+#define DISK_DEVNAME "ram0"
+#else
+#define DISK_DEVNAME "mmcblk0"
+#endif
+
 void disk_init(void);
 void vdisk_read(struct buf *b);
 void vdisk_write(struct buf *b);
 void disk_intr(void);
+int diskreadat(int user_dst, uint64 addr, uint64 off, int n);
+int diskwriteat(int user_src, uint64 addr, uint64 off, int n);
+uint64 disksize(void);
 
 #endif
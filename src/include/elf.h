@@ -38,6 +38,13 @@ struct proghdr {
   uint64 align;
 };
 
+// An executable's headers as exec() read them, kept on its dirent
+// until the file changes, so running it again reads nothing.
+struct elfcache {
+  struct elfhdr elf;
+  struct proghdr ph[];    // elf.phnum of them
+};
+
 struct sechdr{
   uint32 name;
   uint32 type;
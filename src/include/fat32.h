@@ -64,6 +64,8 @@ struct dirent {
     struct dirent *next;
     struct dirent *prev;
     struct sleeplock    lock;
+    uint64  **pcache;       // pagecache.c: the file's pages processes map
+    struct elfcache *elfcache;  // exec.c: its ELF headers, if it has been run
 };
 
 struct linux_dirent64 {
@@ -101,6 +103,7 @@ struct entry_cache {
 struct fs{
     uint devno;
     int  valid;
+    int  synthetic;     // nothing on disk, lookups below the mount go to procfs
     struct dirent* image;
     struct Fat fat;
     struct entry_cache ecache;
@@ -108,6 +111,7 @@ struct fs{
     void (*disk_init)(struct dirent*image);
     void (*disk_read)(struct buf* b,struct dirent* image);
     void (*disk_write)(struct buf* b,struct dirent* image);
+    struct blkqueue *queue;     // bio goes through it if set, else disk_read/disk_write
 };
 
 typedef struct __fsid_t {
@@ -144,12 +148,15 @@ void                estat(struct dirent *de, struct stat *st);
 void                ekstat(struct dirent *de, struct kstat *st);
 void                estatfs(struct dirent *de, struct statfs *st);
 void                elock(struct dirent *entry);
+int                 etrylock(struct dirent *entry);
 void                eunlock(struct dirent *entry);
 int                 enext(struct dirent *dp, struct dirent *ep, uint off, int *count);
 struct dirent *     ename(struct dirent* env,char* path,int *devno);
 struct dirent *     enameparent(struct dirent* env, char* path, char* name,int *devno);
 int                 eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n);
 int                 ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n);
+int                 eread_direct(struct dirent *entry, uint64 dst, uint off, uint n);
+int                 ewrite_direct(struct dirent *entry, uint64 src, uint off, uint n);
 int                 emount(struct fs* fatfs,char* mnt);
 int                 eumount(char* mnt);
 int                 isdirempty(struct dirent *dp);
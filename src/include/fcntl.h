@@ -4,6 +4,7 @@
 #define O_CREATE  0x040
 #define O_TRUNC   0x200
 #define O_APPEND  0x400
+#define O_DIRECT  0x4000
 #define O_DIRECTORY 0x010000
 #define O_CLOEXEC 0x80000
 #define AT_FDCWD  -100
@@ -14,5 +15,7 @@
 #define F_GETFL  3
 #define F_SETFL  4
 
+#define FD_CLOEXEC 1
+
 #define F_DUPFD_CLOEXEC 1030
 
@@ -0,0 +1,48 @@
+#ifndef __FDTABLE_H
+#define __FDTABLE_H
+
+#include "types.h"
+#include "riscv.h"
+
+struct file;
+
+#define NFDBITS     64
+#define FDT_MIN     64                                // slots in the first table
+#define FDT_MAX     ((int)(PGSIZE / sizeof(struct file*)))  // a table never outgrows a page
+#define FDT_WORDS   (FDT_MAX / NFDBITS)
+
+// Per-process file descriptor table.
+// `fd` is allocated lazily and doubled on demand, the bitmaps
+// are always sized for FDT_MAX so they never have to move.
+struct fdtable {
+  int max;                          // number of slots in `fd`
+  struct file **fd;                 // fd -> file, NULL if closed
+  uint64 open_fds[FDT_WORDS];       // bit set for every fd in use
+  uint64 close_on_exec[FDT_WORDS];  // bit set for every fd closed by exec
+};
+
+void            fdt_init(struct fdtable *fdt);
+void            fdt_free(struct fdtable *fdt);
+int             fdt_copy(struct fdtable *dst, struct fdtable *src);
+int             fdt_alloc(struct fdtable *fdt, struct file *f, int start, int limit);
+int             fdt_install(struct fdtable *fdt, int fd, struct file *f, int limit);
+struct file*    fdt_remove(struct fdtable *fdt, int fd);
+int             fdt_next(struct fdtable *fdt, int fd);
+void            fdt_set_cloexec(struct fdtable *fdt, int fd, int on);
+int             fdt_get_cloexec(struct fdtable *fdt, int fd);
+void            fdt_close_all(struct fdtable *fdt);
+void            fdt_close_on_exec(struct fdtable *fdt);
+
+static inline struct file*
+fdt_get(struct fdtable *fdt, int fd)
+{
+  if(fd < 0 || fd >= fdt->max)
+    return NULL;
+  return fdt->fd[fd];
+}
+
+// iterate over open fds only
+#define fdt_for_each(fd, fdt) \
+  for((fd) = fdt_next((fdt), 0); (fd) >= 0; (fd) = fdt_next((fdt), (fd) + 1))
+
+#endif
@@ -12,14 +12,17 @@ struct iovec {
 
 
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_ENTRY, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_ENTRY, FD_DEVICE, FD_PERF, FD_PROC } type;
   int ref; // reference count
   char readable;
   char writable;
+  char direct;       // FD_ENTRY opened O_DIRECT: data skips the buffer cache
   struct pipe *pipe; // FD_PIPE
   struct dirent *ep;
-  uint64 off;          // FD_ENTRY
+  uint64 off;          // FD_ENTRY, FD_PROC, and devices with readat
   short major;       // FD_DEVICE
+  struct perf_event *perf; // FD_PERF
+  int node;          // FD_PROC, see procfs.h
   uint64 t0_sec;
   uint64 t0_nsec;
   uint64 t1_sec;
@@ -3,9 +3,15 @@
 
 #include "types.h"
 
+/*
+ * the largest object kmalloc() hands out: a page less the header of
+ * the kmem_node it is carved from
+ */
+#define KMALLOC_MAX		4048
+
 void 			kmallocinit(void);
 /* 
- * allocate a range of mem of wanted size 
+ * allocate a range of mem of wanted size, at most KMALLOC_MAX
  */
 void*           kmalloc(uint size);
 
@@ -14,5 +20,17 @@ void*           kmalloc(uint size);
  */
 void            kfree(void *addr);
 
+/*
+ * a snapshot of one size class, for statistics
+ */
+struct kmalloc_class {
+	uint obj_size;
+	uint npages;
+	uint nobjs;
+	uint capa;		// objects per page
+};
+
+int             kmalloc_classes(struct kmalloc_class *out, int max);
+
 
 #endif
@@ -0,0 +1,14 @@
+#ifndef __KBENCH_H
+#define __KBENCH_H
+
+#include "types.h"
+
+// Kernel microbenchmarks, only in kernels built with `make KBENCH=1`.
+// Writing "run" to /dev/kbench times each primitive in the writer's
+// context; reading it prints the percentiles of the last run.
+
+void            kbench_init(void);
+int             kbenchread(int user_dst, uint64 addr, uint64 off, int n);
+int             kbenchwrite(int user_dst, uint64 addr, int n);
+
+#endif
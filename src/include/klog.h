@@ -0,0 +1,81 @@
+#ifndef __KLOG_H
+#define __KLOG_H
+
+#include "types.h"
+
+// log levels, same meaning as the syslog(2) ones
+#define KLOG_EMERG    0
+#define KLOG_ALERT    1
+#define KLOG_CRIT     2
+#define KLOG_ERR      3
+#define KLOG_WARNING  4
+#define KLOG_NOTICE   5
+#define KLOG_INFO     6
+#define KLOG_DEBUG    7
+
+// records with a level below this reach the console
+#define KLOG_CONSOLE_DEFAULT  8
+
+#define KLOG_NREC     128     // records per hart, a power of 2
+#define KLOG_TEXT     104     // text bytes per record
+
+struct klog_rec {
+  uint64 seq;           // global order, 0 while being written
+  uint64 time;          // r_time() when it was logged
+  uint8 level;
+  uint8 hart;
+  uint8 cont;           // carries on the previous record of this hart
+  uint8 len;
+  char text[KLOG_TEXT];
+};
+
+void            klog_init(void);
+
+// Append `len` bytes of text. Never sleeps nor spins on a lock,
+// so it's safe from any context.
+void            klog_write(int level, char *text, int len);
+
+// Print records that haven't reached the console yet.
+void            klog_drain(void);
+
+// After boot, records are printed by idle harts instead of the
+// writer. klog_sync() switches back to printing right away.
+void            klog_async(void);
+void            klog_sync(void);
+
+// klog_sync(), then wait until every record has been printed, by this
+// hart or by one that was draining already. For shutdown.
+void            klog_flush(void);
+
+// Hand pending records to a kworker, from the timer softirq.
+void            klog_kick(void);
+
+int             klog_console_level(int level);
+
+// syslog(2) backends, `buf` is a user address
+int             klog_read(uint64 buf, int len);
+int             klog_read_all(uint64 buf, int len, int clear);
+void            klog_clear(void);
+int             klog_size_unread(void);
+int             klog_size_buffer(void);
+
+// Allow at most `burst` messages per `interval` ticks.
+struct ratelimit {
+  uint64 begin;
+  int printed;
+  int missed;
+};
+
+#define RATELIMIT_INTERVAL  (5 * 1000000)   // 5 seconds of r_time()
+#define RATELIMIT_BURST     10
+
+int             __ratelimit(struct ratelimit *rs);
+
+// __debug_warn() for paths that can fire in a tight loop
+#define __debug_warn_ratelimited(fmt, ...) do { \
+  static struct ratelimit __rs; \
+  if (__ratelimit(&__rs)) \
+    __debug_warn(fmt, ##__VA_ARGS__); \
+} while (0)
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __KPROF_H
+#define __KPROF_H
+
+#include "types.h"
+
+// Sampling profiler. Each timer interrupt records where the hart was;
+// samples are drained by reading /dev/kprof and turned into reports on
+// the host by tools/kprof.py. Writing "start", "stop" or "reset" to
+// /dev/kprof controls it.
+
+#define KPROF_DEPTH     6       // return addresses kept per sample
+#define KPROF_NSAMPLE   1024    // samples per hart, a power of 2
+#define KPROF_BATCH     16      // samples a read takes per trip through the lock
+
+// The binary record read from /dev/kprof, 64 bytes.
+struct kprof_sample {
+  uint64 pc;                    // sepc when the timer fired
+  uint32 pid;                   // 0 if the hart was idle
+  uint8 hart;
+  uint8 user;                   // interrupted user mode
+  uint8 depth;                  // valid entries in callchain
+  uint8 pad;
+  uint64 callchain[KPROF_DEPTH];  // kernel return addresses, innermost first
+};
+
+void            kprof_init(void);
+
+// Called from the timer interrupt. `fp` is the interrupted kernel
+// frame pointer, used to walk the call chain.
+void            kprof_tick(int user, uint64 pc, uint64 fp);
+
+int             kprofread(int user_dst, uint64 addr, int n);
+int             kprofwrite(int user_dst, uint64 addr, int n);
+
+#endif
@@ -57,8 +57,8 @@
 #define TRAMPOLINE (USER_TOP - PGSIZE)  // virtual address
 #define SIG_TRAMPOLINE 	(TRAMPOLINE - PGSIZE)
 
-// qemu puts UART registers here in physical memory.
-#define UART0 0x10000000L   // 256 MB
+// sifive_u puts UART registers here in physical memory.
+#define UART0 0x10010000L
 #define UART0_V                  (UART0 + VIRT_OFFSET)
 
 // local interrupt controller, which contains the timer.
@@ -69,17 +69,18 @@
 #define VIRTIO0 0x10001000
 #define VIRTIO0_V               (VIRTIO0 + VIRT_OFFSET)
 
-// qemu puts platform-level interrupt controller (PLIC) here.
+// platform-level interrupt controller (PLIC).
+// On sifive_u hart 0 is the E51 monitor core with an M-mode
+// context only, so hart n's S-mode context is 2 * n.
 #define PLIC 0x0c000000L       // 192 MB
+#define PLIC_SIZE               0x400000L
 #define PLIC_V                  (PLIC + VIRT_OFFSET)
+#define PLIC_SCONTEXT(hart)     ((hart) * 2)
 #define PLIC_PRIORITY (PLIC_V + 0x0)
 #define PLIC_PENDING (PLIC_V + 0x1000)
-#define PLIC_MENABLE(hart) (PLIC_V + 0x1f80 + (hart)*0x100)
-#define PLIC_SENABLE(hart) (PLIC_V + 0x2000 + (hart)*0x100)
-#define PLIC_MPRIORITY(hart) (PLIC_V + 0x1ff000 + (hart)*0x2000)
-#define PLIC_SPRIORITY(hart) (PLIC_V + 0x200000 + (hart)*0x2000)
-#define PLIC_MCLAIM(hart) (PLIC_V + 0x1ff004 + (hart)*0x2000)
-#define PLIC_SCLAIM(hart) (PLIC_V + 0x200004 + (hart)*0x2000)
+#define PLIC_SENABLE(hart) (PLIC_V + 0x2000 + PLIC_SCONTEXT(hart)*0x80)
+#define PLIC_SPRIORITY(hart) (PLIC_V + 0x200000 + PLIC_SCONTEXT(hart)*0x1000)
+#define PLIC_SCLAIM(hart) (PLIC_V + 0x200004 + PLIC_SCONTEXT(hart)*0x1000)
 
 #define TRAPFRAME 	(MAXUVA - PGSIZE) // virtual address
 #define USER_STACK_BOTTOM (MAXUVA - (2*PGSIZE))   // stack lower address 
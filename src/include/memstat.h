@@ -0,0 +1,51 @@
+#ifndef __MEMSTAT_H
+#define __MEMSTAT_H
+
+#include "types.h"
+
+// Memory accounting. /dev/meminfo has the system-wide numbers, the
+// kmalloc size classes and every process's VSZ/RSS; getrusage(2) and
+// sysinfo(2) take theirs from here too. Writing "reset" to it clears
+// the buffer cache hit counts.
+
+// Per process, kept in struct proc. Sizes are in pages.
+struct proc_memstat {
+  uint64 minflt;        // page faults served without I/O
+  uint64 majflt;        // page faults that had to read a file
+  uint64 rss;           // pages mapped, counted up as they are mapped
+  uint64 maxrss;        // largest RSS seen
+  // reaped children, for RUSAGE_CHILDREN
+  uint64 c_minflt;
+  uint64 c_majflt;
+  uint64 c_maxrss;
+};
+
+struct proc;
+struct rusage;
+struct sysinfo;
+
+// Fault handlers call this once a user fault is resolved.
+static inline void memstat_fault(struct proc_memstat *ms, int major) {
+  if (major)
+    ms->majflt++;
+  else
+    ms->minflt++;
+}
+
+// Call when npages more pages are mapped into the process.
+static inline void memstat_map(struct proc_memstat *ms, uint64 npages) {
+  ms->rss += npages;
+  if (ms->rss > ms->maxrss)
+    ms->maxrss = ms->rss;
+}
+
+uint64          memstat_rss(struct proc *p);
+uint64          memstat_vsz(struct proc *p);
+void            memstat_reap(struct proc *p, struct proc *child);
+void            memstat_rusage(struct proc *p, int who, struct rusage *ru);
+void            memstat_sysinfo(struct sysinfo *info);
+void            memstat_kmalloc(uint64 *pages, uint64 *bytes);
+int             meminforead(int user_dst, uint64 addr, uint64 off, int n);
+int             meminfowrite(int user_dst, uint64 addr, int n);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __PAGECACHE_H
+#define __PAGECACHE_H
+
+#include "types.h"
+
+// File pages ELF segments and private file mappings map: read on the
+// first fault, then shared by every process running the same binary or
+// library. They hang off the file's dirent and go when it is written,
+// truncated or reused for another file, which eget() puts off while
+// entries with nothing cached are left.
+
+struct dirent;
+
+uint64          pcache_get(struct dirent *ep, uint pgno, int *miss);
+void            pcache_drop(struct dirent *ep);
+void            pcache_stat(uint64 *pages, uint64 *hits, uint64 *misses);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __PERF_H
+#define __PERF_H
+
+#include "types.h"
+#include "utils/list.h"
+
+// Per-process hardware counters, through the SBI PMU extension.
+// perf_event_open(2) gives back an fd; read() on it returns the
+// event's count as a uint64, for the time its process spent running.
+
+#define PERF_TYPE_HARDWARE      0
+
+enum perf_hw_id {
+  PERF_COUNT_HW_CPU_CYCLES = 0,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_REFERENCES,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+  PERF_COUNT_HW_BRANCH_MISSES,
+  PERF_COUNT_HW_MAX,
+};
+
+// The head of Linux's struct perf_event_attr, as far as we look.
+struct perf_event_attr {
+  uint32 type;
+  uint32 size;
+  uint64 config;
+  uint64 sample_period;
+  uint64 sample_type;
+  uint64 read_format;
+  uint64 flags;
+};
+
+#define PERF_ATTR_DISABLED        (1 << 0)
+#define PERF_ATTR_INHERIT         (1 << 1)
+#define PERF_ATTR_EXCLUDE_USER    (1 << 4)
+#define PERF_ATTR_EXCLUDE_KERNEL  (1 << 5)
+
+#define PERF_EVENT_IOC_ENABLE     0x2400
+#define PERF_EVENT_IOC_DISABLE    0x2401
+#define PERF_EVENT_IOC_RESET      0x2403
+
+struct perf_event {
+  struct list entry;    // on owner->perf, under perf_lock
+  struct proc *owner;   // NULL once it has exited
+  int hw;               // enum perf_hw_id
+  int enabled;
+  int running;          // start is valid, owner is on a hart
+  uint64 count;
+  uint64 start;
+};
+
+struct proc;
+struct file;
+
+void            perf_init(void);
+void            perf_proc_init(struct proc *p);
+void            perf_proc_exit(struct proc *p);
+void            perf_switch_in(struct proc *p);
+void            perf_switch_out(struct proc *p);
+int             perf_event_alloc(struct perf_event_attr *attr, struct proc *owner, struct file **f);
+void            perf_event_close(struct perf_event *ev);
+int             perf_event_read(struct perf_event *ev, int user_dst, uint64 addr, int n);
+int             perf_event_ioctl(struct perf_event *ev, uint64 request);
+
+#endif
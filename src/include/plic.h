@@ -79,13 +79,10 @@
  *
  */
 
-#ifdef QEMU     // QEMU 
+// sifive_u, qemu emulates the same machine 
 #define UART0_IRQ    4 
 #define UART1_IRQ    5
-#else           // k210 
-#define UART0_IRQ    4 
-#define UART1_IRQ    5
-#endif 
+#define SPI2_IRQ     6  // the SD card
 
 void plicinit(void);
 
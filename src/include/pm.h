@@ -16,8 +16,15 @@ void*           allocpage(void);
 /* free an allocated phyiscal page */
 void            freepage(void *);
 
+/* another reference to an allocated page, which freepage() drops */
+void            pagedup(void *);
+
+int             pageref(void *);
+
 uint64          idlepages(void);
 
+uint64          totalpages(void);
+
 void		checkmemlist(void* pa);
 
 #endif
@@ -27,4 +27,6 @@ void __debug_info(char *fmt, ...);
 void __debug_warn(char *fmt, ...);
 void __debug_error(char *fmt, ...);
 
+int snprintf(char *buf, int size, char *fmt, ...);
+
 #endif 
@@ -6,6 +6,7 @@
 #include "types.h"
 #include "spinlock.h"
 #include "file.h"
+#include "fdtable.h"
 #include "fat32.h"
 #include "trap.h"
 #include "signal.h"
@@ -14,6 +15,8 @@
 #include "utils/list.h"
 #include "vma.h"
 #include "mmap.h"
+#include "schedstat.h"
+#include "memstat.h"
 
 #define FUTEX_WAIT		0
 #define FUTEX_WAKE		1
@@ -145,9 +148,8 @@ struct proc {
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  int64 filelimit;
-  struct file **ofile;        // Open files
-  int *exec_close;        // Open files
+  int64 filelimit;             // RLIMIT_NOFILE
+  struct fdtable fdt;          // Open files
   struct dirent *cwd;          // Current directory
   char name[16];               // Process name (debugging)
   int tmask;                    // trace mask
@@ -157,16 +159,27 @@ struct proc {
   uint64 q;
   map_fix *mf;
   // signal
-  ksigaction_t *sig_act;//action
+  struct sighand *sighand;     // signal actions, shared under CLONE_SIGHAND
   __sigset_t sig_set;// proc_mask //ignore
   __sigset_t sig_pending;// pending xin hao deng dai dui lie
   struct sig_frame *sig_frame;// xin hao ban de trapframe
   uint64 set_child_tid;
   uint64 clear_child_tid;
   struct robust_list_head *robust_list;
+  struct blkplug *plug;        // block requests held back, see blk.h
+  struct dirent *elocked;      // locked across a copy to or from user memory, see vma_fault_file()
+  struct proc_sysstat *sysstat; // syscall counters, see sysstat.h
+  struct proc_schedstat sched; // scheduler accounting
+  struct proc_memstat mem;     // fault counts and peak RSS
+  struct list perf;            // perf_events counting this proc, see perf.h
+  // kernel thread
+  void (*kfn)(void *);         // kthread body, NULL for user processes
+  void *karg;
 };
 
-#define NOFILEMAX(p) (p->filelimit<NOFILE?p->filelimit:NOFILE)
+#define is_kthread(p) ((p)->kfn != NULL)
+
+#define NOFILEMAX(p) (p->filelimit<FDT_MAX?p->filelimit:FDT_MAX)
 
 void            exit(int);
 int             fork(void);
@@ -183,6 +196,8 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+struct proc*    kthread_create(char *name, void (*fn)(void *), void *arg);
+void            kthread_exit(void) __attribute__((noreturn));
 void            getcharinit(void);
 int             wait(uint64);
 int             wait4pid(int, uint64);
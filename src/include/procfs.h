@@ -0,0 +1,45 @@
+#ifndef __PROCFS_H
+#define __PROCFS_H
+
+#include "types.h"
+
+// /proc: statistics files generated on read, like the ones under
+// /dev. It takes a slot in FatFs and is emount()ed, but has nothing
+// on disk; lookup_path() hands whatever is below the mount point to
+// procfs_lookup(), and the node it names comes back through devno the
+// way /dev entries do. Opening one gives an FD_PROC file.
+
+#define PROCFS_NODE       (1 << 30)
+#define PROCFS_MKNODE(pid, type)  (PROCFS_NODE | (pid) << 5 | (type))
+#define PROCFS_PID(node)  (((node) & ~PROCFS_NODE) >> 5)
+#define PROCFS_TYPE(node) ((node) & 0x1f)
+#define IS_PROCFS(devno)  ((devno) >= 0 && ((devno) & PROCFS_NODE))
+#define PROCFS_ROOT       PROCFS_MKNODE(0, PROC_ROOT)
+
+enum {
+  PROC_ROOT,
+  PROC_MEMINFO,
+  PROC_STAT,
+  PROC_LOADAVG,
+  PROC_UPTIME,
+  PROC_INTERRUPTS,
+  PROC_DISKSTATS,
+  PROC_BLKSTAT,         // latency histograms and cache hits, see blkstat.h
+  PROC_PID,             // /proc/<pid>
+  PROC_PID_STAT,
+  PROC_PID_STATUS,
+  PROC_PID_MAPS,
+  PROC_PID_FD,          // lists the open fds
+  PROC_NTYPES,
+};
+
+struct file;
+struct kstat;
+
+int             procfs_init(void);
+int             procfs_lookup(char *name, char *path);
+int             procfs_read(int node, int user_dst, uint64 addr, uint64 off, int n);
+int             procfs_getdents(struct file *f, uint64 addr, int n);
+int             procfs_kstat(int node, struct kstat *st);
+
+#endif
@@ -10,11 +10,13 @@ typedef struct{
   void* chan;
   struct spinlock lk;
   struct list head;
+  int len;
 }queue;
 
 static inline void queue_init(queue *q,void* chan) {
 	initlock(&q->lk,"queue");
 	list_init(&q->head);
+	q->len = 0;
 	q->chan = chan;
 }
 
@@ -33,9 +35,15 @@ static inline int queue_empty(queue *q) {
 	return ret;
 }
 
+// Racy, for statistics only.
+static inline int queue_len(queue *q) {
+	return q->len;
+}
+
 static inline void queue_push(queue* q,struct proc* p){
 	qlock(q);
 	list_add_before(&q->head,&p->dlist);
+	q->len++;
 	p->q = (uint64)q;
 	qunlock(q);
 }
@@ -47,6 +55,7 @@ static inline struct proc* queue_pop(queue* q){
 		struct list* l = list_next(&q->head);
 		list_del(l);
 		p = dlist_entry(l, struct proc, dlist);
+		q->len--;
 		p->q = 0;
 		qunlock(q);
 	}
@@ -59,6 +68,7 @@ static inline int queue_del(struct proc* p){
 	if(q){
 		qlock(q);
 		list_del(l);
+		q->len--;
 		p->q = 0;
 		qunlock(q);	
 		return 1;	
@@ -1,9 +1,9 @@
 #if !defined(RAMDISK_H)
 #define RAMDISK_H
 
-struct buf;
+#include "types.h"
 
 void ramdisk_init();
-void ramdisk_rw(struct buf *b, int write);
+int ramdisk_rw(uint sectorno, uchar *data, int write);
 
 #endif // RAMDISK_H
@@ -0,0 +1,16 @@
+#ifndef __REBOOT_H
+#define __REBOOT_H
+
+// reboot(2)'s magic numbers and commands, as Linux has them.
+
+#define LINUX_REBOOT_MAGIC1         0xfee1dead
+#define LINUX_REBOOT_MAGIC2         672274793
+#define LINUX_REBOOT_MAGIC2A        85072278
+#define LINUX_REBOOT_MAGIC2B        369367448
+#define LINUX_REBOOT_MAGIC2C        537993216
+
+#define LINUX_REBOOT_CMD_RESTART    0x01234567
+#define LINUX_REBOOT_CMD_HALT       0xcdef0123
+#define LINUX_REBOOT_CMD_POWER_OFF  0x4321fedc
+
+#endif
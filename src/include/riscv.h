@@ -251,6 +251,25 @@ r_mcounteren()
   return x;
 }
 
+// cycles since reset, readable from S-mode since the SBI
+// opens mcounteren
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r" (x) );
+  return x;
+}
+
+// instructions retired, same deal as r_cycle()
+static inline uint64
+r_instret()
+{
+  uint64 x;
+  asm volatile("rdinstret %0" : "=r" (x) );
+  return x;
+}
+
 // supervisor-mode cycle counter
 static inline uint64
 r_time()
@@ -352,6 +371,8 @@ sfence_vma()
 #define PTE_D (1L << 7)
 #define PTE_RSW1 (1L << 8)  // reserved for supervisor software 1
 #define PTE_RSW2 (1L << 9)  // 2
+#define PTE_COW     PTE_RSW1    // shared until written, copied on a store
+#define PTE_SHARED  PTE_RSW2    // a page cache page, never written
 
 
 // shift a physical address to the right place for a PTE.
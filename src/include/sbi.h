@@ -87,6 +87,75 @@ static inline void send_ipi(uint64 mask) {
     a_sbi_ecall(0x735049, 0, mask,0,0,0,0,0);
 }
 
+#define SBI_EXT_BASE  0x10
+#define SBI_EXT_BASE_PROBE_EXT  3
+
+// Non-zero if the SBI implements extension `ext`.
+static inline long sbi_probe_extension(long ext) {
+    struct sbiret ret = a_sbi_ecall(SBI_EXT_BASE, SBI_EXT_BASE_PROBE_EXT, ext, 0, 0, 0, 0, 0);
+    return ret.error ? 0 : ret.value;
+}
+
+// Performance monitoring unit, SBI v0.3 chapter 11.
+#define SBI_EXT_PMU   0x504D55
+
+enum sbi_ext_pmu_fid {
+	SBI_EXT_PMU_NUM_COUNTERS = 0,
+	SBI_EXT_PMU_COUNTER_GET_INFO,
+	SBI_EXT_PMU_COUNTER_CFG_MATCH,
+	SBI_EXT_PMU_COUNTER_START,
+	SBI_EXT_PMU_COUNTER_STOP,
+	SBI_EXT_PMU_COUNTER_FW_READ,
+};
+
+// counter_get_info value
+#define SBI_PMU_INFO_CSR(info)      ((info) & 0xfff)
+#define SBI_PMU_INFO_WIDTH(info)    ((((info) >> 12) & 0x3f) + 1)
+#define SBI_PMU_INFO_FW(info)       ((uint64)(info) >> 63)
+
+// counter_config_matching flags
+#define SBI_PMU_CFG_FLAG_SKIP_MATCH   (1 << 0)
+#define SBI_PMU_CFG_FLAG_CLEAR_VALUE  (1 << 1)
+#define SBI_PMU_CFG_FLAG_AUTO_START   (1 << 2)
+
+// counter_start / counter_stop flags
+#define SBI_PMU_START_FLAG_SET_INIT_VALUE  (1 << 0)
+#define SBI_PMU_STOP_FLAG_RESET            (1 << 0)
+
+// event_idx of the hardware general events, type 0
+#define SBI_PMU_HW_CPU_CYCLES           1
+#define SBI_PMU_HW_INSTRUCTIONS         2
+#define SBI_PMU_HW_CACHE_REFERENCES     3
+#define SBI_PMU_HW_CACHE_MISSES         4
+#define SBI_PMU_HW_BRANCH_INSTRUCTIONS  5
+#define SBI_PMU_HW_BRANCH_MISSES        6
+
+static inline struct sbiret sbi_pmu_num_counters(void) {
+    return a_sbi_ecall(SBI_EXT_PMU, SBI_EXT_PMU_NUM_COUNTERS, 0, 0, 0, 0, 0, 0);
+}
+
+static inline struct sbiret sbi_pmu_counter_get_info(unsigned long idx) {
+    return a_sbi_ecall(SBI_EXT_PMU, SBI_EXT_PMU_COUNTER_GET_INFO, idx, 0, 0, 0, 0, 0);
+}
+
+// Find a counter among [base, base + 64) selected by mask that can count
+// event_idx on the calling hart, and configure it. Returns its index.
+static inline struct sbiret sbi_pmu_counter_config_matching(unsigned long base,
+			unsigned long mask, unsigned long flags,
+			unsigned long event_idx, uint64 event_data) {
+    return a_sbi_ecall(SBI_EXT_PMU, SBI_EXT_PMU_COUNTER_CFG_MATCH, base, mask,
+                       flags, event_idx, event_data, 0);
+}
+
+static inline struct sbiret sbi_pmu_counter_stop(unsigned long base,
+			unsigned long mask, unsigned long flags) {
+    return a_sbi_ecall(SBI_EXT_PMU, SBI_EXT_PMU_COUNTER_STOP, base, mask, flags, 0, 0, 0);
+}
+
+static inline struct sbiret sbi_pmu_counter_fw_read(unsigned long idx) {
+    return a_sbi_ecall(SBI_EXT_PMU, SBI_EXT_PMU_COUNTER_FW_READ, idx, 0, 0, 0, 0, 0);
+}
+
 static inline int sbi_hsm_hart_status(unsigned long hart){
     struct sbiret ret;
     ret = a_sbi_ecall(0x48534D, 2, hart, 0, 0, 0, 0, 0);
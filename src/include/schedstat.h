@@ -0,0 +1,100 @@
+#ifndef __SCHEDSTAT_H
+#define __SCHEDSTAT_H
+
+#include "types.h"
+
+// Scheduler accounting. Times are in r_time() ticks (TICK_FREQ).
+// Per-process numbers go out through getrusage(2), /dev/schedstat and
+// /proc/<pid>/stat, per-hart numbers through /dev/schedstat and
+// /proc/stat.
+
+#define SCHED_NQLEN   8       // log2 buckets of readyq length, last takes the rest
+
+// Per process, kept in struct proc. Only the scheduler and the
+// process itself write these, with p->lock held or while running.
+struct proc_schedstat {
+  uint64 start_at;      // when it was created
+  uint64 ready_at;      // when it was last put on readyq
+  uint64 wake_at;       // when wakeup() made it runnable, 0 if not woken
+  uint64 run_at;        // when it was last switched in
+  uint64 user_at;       // when it last returned to user mode
+  uint64 run_time;      // time RUNNING, user and kernel
+  uint64 user_time;     // part of run_time spent in user mode
+  uint64 wait_time;     // time RUNNABLE on readyq
+  uint64 wakeups;
+  uint64 wakeup_lat;    // sum of wakeup-to-run latencies
+  uint64 wakeup_max;
+  uint64 nvcsw;         // gave up the cpu: sleep, exit
+  uint64 nivcsw;        // was preempted
+  uint64 nmigrations;   // ran on a different hart than last time
+  int last_hart;
+  // reaped children, for RUSAGE_CHILDREN
+  uint64 c_nvcsw;
+  uint64 c_nivcsw;
+};
+
+// Per hart, for /proc/stat.
+struct cpu_times {
+  uint64 user;
+  uint64 system;
+  uint64 idle;
+  uint64 switches;
+};
+
+// Load averages are fixed point with FSHIFT bits of fraction.
+#define FSHIFT        11
+#define FIXED_1       (1 << FSHIFT)
+#define LOAD_INT(x)   ((x) >> FSHIFT)
+#define LOAD_FRAC(x)  LOAD_INT(((x) & (FIXED_1 - 1)) * 100)
+
+struct timeval {
+  long tv_sec;
+  long tv_usec;
+};
+
+#define RUSAGE_SELF       0
+#define RUSAGE_CHILDREN   (-1)
+#define RUSAGE_THREAD     1
+
+struct rusage {
+  struct timeval ru_utime;
+  struct timeval ru_stime;
+  long ru_maxrss;
+  long ru_ixrss;
+  long ru_idrss;
+  long ru_isrss;
+  long ru_minflt;
+  long ru_majflt;
+  long ru_nswap;
+  long ru_inblock;
+  long ru_oublock;
+  long ru_msgsnd;
+  long ru_msgrcv;
+  long ru_nsignals;
+  long ru_nvcsw;
+  long ru_nivcsw;
+  long __reserved[16];
+};
+
+struct proc;
+
+void            schedstat_init(void);
+void            schedstat_fork(struct proc *p);
+void            schedstat_enqueue(struct proc *p);
+void            schedstat_wakeup(struct proc *p);
+void            schedstat_switch_in(struct proc *p, int qlen);
+void            schedstat_switch_out(struct proc *p);
+void            schedstat_idle_enter(void);
+void            schedstat_idle_exit(void);
+void            schedstat_user_enter(struct proc *p);
+void            schedstat_user_exit(struct proc *p);
+void            schedstat_tick(void);
+int             schedstat_nr_running(void);
+void            schedstat_loadavg(uint64 avg[3]);
+void            schedstat_cpu_times(int hart, struct cpu_times *ct);
+void            schedstat_reap(struct proc *p, struct proc *child);
+int             schedstat_rusage(struct proc *p, int who, struct rusage *ru);
+int             schedstatread(int user_dst, uint64 addr, uint64 off, int n);
+int             schedstatwrite(int user_dst, uint64 addr, int n);
+
+#endif
@@ -29,6 +29,11 @@
 int sd_init(spi_ctrl* spi, unsigned int input_clk_hz, int skip_sd_init_commands);
 int sd_read_blocks(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size);
 int sd_write_blocks(spi_ctrl* spi, void* src, uint32_t dst_lba, size_t size);
+// As above, block i to or from buf[i]
+int sd_read_blocksv(spi_ctrl* spi, uint8_t* const* buf, uint32_t src_lba, size_t size);
+int sd_write_blocksv(spi_ctrl* spi, uint8_t* const* buf, uint32_t dst_lba, size_t size);
+// In 512-byte sectors, 0 if the CSD couldn't be read
+uint64_t sd_size(void);
 
 //gpt_partition_range find_sd_gpt_partition(
 //        spi_ctrl* spictrl,
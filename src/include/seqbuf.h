@@ -0,0 +1,27 @@
+#ifndef __SEQBUF_H
+#define __SEQBUF_H
+
+#include "types.h"
+
+// Text generated on each read, for stats and status files. The reader
+// regenerates everything with seq_printf() and only the bytes in
+// [off, off + n) are copied out, so a file can be read in any number
+// of pieces without keeping state between reads.
+struct seqbuf {
+  int user_dst;
+  uint64 dst;
+  uint64 off;         // where the read starts in the generated text
+  int n;              // bytes asked for
+  uint64 pos;         // bytes generated so far
+  int copied;
+  int err;
+};
+
+#define SEQ_LINE_MAX  256   // longest line seq_printf() produces
+
+void            seq_init(struct seqbuf *s, int user_dst, uint64 dst, uint64 off, int n);
+void            seq_printf(struct seqbuf *s, char *fmt, ...);
+// bytes copied, or -1 if nothing could be copied out
+int             seq_result(struct seqbuf *s);
+
+#endif
@@ -3,7 +3,11 @@
 
 #include "types.h"
 #include "trap.h"
+#include "spinlock.h"
 
+struct proc;
+
+#define NSIG		64
 #define SIGRTMIN 	34
 #define SIGRTMAX	64
 
@@ -16,7 +20,16 @@
 #define SIGQUIT		3
 #define SIGILL		4
 #define SIGTRAP		5
+#define SIGBUS		7
+#define SIGUSR1		10
+#define SIGSEGV		11
+#define SIGUSR2		12
+#define SIGPIPE		13
+#define SIGALRM		14
 #define SIGCHLD		17
+#define SIGSTOP		19
+#define SIGURG		23
+#define SIGWINCH	28
 
 // Signal Flags
 #define SA_NOCLDSTOP	0x00000001
@@ -33,27 +46,37 @@
 
 typedef void (*__sighandler_t)(int);
 
+#define SIG_DFL		((__sighandler_t)0)
+#define SIG_IGN		((__sighandler_t)1)
+
 // #define SIGSET_LEN 		16
 #define SIGSET_LEN 		1
 typedef struct {
 	unsigned long __val[SIGSET_LEN];
 } __sigset_t;
 
+// bit of `sig` in a sigset, signals are numbered from 1 
+#define sigmask(sig)	(1ul << ((sig) - 1))
+
+// Same layout as the kernel's struct sigaction on risc-v, 
+// so rt_sigaction() can copy it in one go. 
 struct sigaction {
 	union {		// let's make it simple, only sa_handler is supported 
 		__sighandler_t sa_handler;
 		// void (*sa_sigaction)(int, siginfo_t *, void *);
 	} __sigaction_handler;
+	unsigned long sa_flags;
 	__sigset_t sa_mask;	// signals to be blocked during handling 
-	int sa_flags;
 	// void (*sa_restorer)(void);	// this field is not used on risc-v
 };
 
-typedef struct __ksigaction_t {
-	struct __ksigaction_t *next;
-	struct sigaction sigact;
-	int signum;
-} ksigaction_t;
+// Signal actions, indexed by signum - 1. 
+// Shared between procs cloned with CLONE_SIGHAND. 
+struct sighand {
+	struct spinlock lock;
+	int ref;
+	struct sigaction action[NSIG];
+};
 
 int set_sigaction(
 	int signum, 
@@ -69,17 +92,37 @@ int sigprocmask(
 
 struct sig_frame {
 	__sigset_t mask;
-	struct trapframe *tf;
+	struct trapframe tf;		// user registers when the signal came 
 	struct sig_frame *next;
 };
 
 // Free the list of sig_frame. 
 void sigframefree(struct sig_frame *head);
 
-// Free the list of sig_action. 
-void sigaction_free(ksigaction_t *head);
+// Duplicate the list of sig_frame. 
+struct sig_frame *sigframe_copy(struct sig_frame const *head);
+
+struct sighand *sighand_alloc(void);
+
+// Take another reference, for CLONE_SIGHAND. 
+struct sighand *sighand_get(struct sighand *sh);
+
+// A private copy of `sh`, for plain fork. 
+struct sighand *sighand_copy(struct sighand *sh);
+
+void sighand_put(struct sighand *sh);
+
+// Reset caught signals to SIG_DFL, as exec() requires. 
+int sighand_exec(struct proc *p);
+
+// Lowest pending signal that isn't blocked, 0 if none. 
+int sig_next(struct proc *p);
+
+// Whether `p` has a user handler for `sig` that it doesn't block. 
+int sig_catching(struct proc *p, int sig);
 
-int sigaction_copy(ksigaction_t **pdst, ksigaction_t const *src);
+// Mark `sig` pending on `p`, p->lock must be held. 
+void sig_raise(struct proc *p, int sig);
 
 void sighandle(void);
 
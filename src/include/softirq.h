@@ -0,0 +1,28 @@
+#ifndef __SOFTIRQ_H
+#define __SOFTIRQ_H
+
+#include "types.h"
+
+// Deferred halves of interrupt handlers. A handler raises its softirq
+// and returns; the softirq runs on the same hart once the trap has been
+// acknowledged, with interrupts enabled. Softirqs must not sleep, work
+// that needs to goes on a workqueue instead.
+enum {
+  TIMER_SOFTIRQ,
+  NR_SOFTIRQS
+};
+
+#define MAX_SOFTIRQ_RESTART   10
+
+void            open_softirq(int nr, void (*action)(void));
+
+// Interrupts must be disabled.
+void            raise_softirq(int nr);
+
+// Run this hart's pending softirqs. Called at the end of a trap,
+// with interrupts disabled.
+void            do_softirq(void);
+
+int             in_softirq(void);
+
+#endif
@@ -226,9 +226,16 @@ typedef volatile struct
 } spi_ctrl;
 
 
+// Entries in each of the TX and RX FIFOs
+#define SPI_FIFO_DEPTH 8
+
+
 void spi_tx(spi_ctrl* spictrl, uint8_t in);
 uint8_t spi_rx(spi_ctrl* spictrl);
 uint8_t spi_txrx(spi_ctrl* spictrl, uint8_t in);
+void spi_txrx_buf(spi_ctrl* spictrl, const uint8_t* tx, uint8_t* rx, uint32_t size);
+
+extern void (*spi_rx_wait)(spi_ctrl* spictrl);
 int spi_copy(spi_ctrl* spictrl, void* buf, uint32_t addr, uint32_t size);
 
 
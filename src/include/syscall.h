@@ -23,6 +23,7 @@ int argint(int n, int *ip);
 int argaddr(int n, uint64 *ip);
 int argstr(int n, char *buf, int max);
 void syscall(void);
+char *syscall_name(int num);
 int argfd(int n, int *pfd, struct file **pf);
 int argstruct(int n,void* st,int len);
 int argstrvec(int n,char** argv,int max);
@@ -3,8 +3,6 @@
 
 #include "types.h"
 
-#define BNUM 	2500
-
 
 struct sysinfo {
 	long uptime;             /* Seconds since boot */
@@ -23,8 +21,6 @@ struct sysinfo {
 							/* Padding to 64 bytes */
 };
 
-void logbufinit();
-
 #define SYSLOG_ACTION_CLOSE (0)
 #define SYSLOG_ACTION_OPEN (1)
 #define SYSLOG_ACTION_READ (2)
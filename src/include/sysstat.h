@@ -0,0 +1,51 @@
+#ifndef __SYSSTAT_H
+#define __SYSSTAT_H
+
+#include "types.h"
+#include "riscv.h"
+
+// Syscall counters and latency histograms, kept per hart and summed
+// when /dev/sysstat is read. Writing "on", "off", "reset" or "pid N"
+// (N = 0 for all processes) to /dev/sysstat controls them.
+//
+// The cycle counters of two harts needn't agree, so latency is only
+// taken from calls that end on the hart they started on, the timed
+// ones; a call that slept and woke elsewhere is counted but not timed.
+
+#define NSYSCALL          280     // above the highest syscall number
+#define SYSSTAT_NBUCKET   24      // log2(cycles), the last takes the rest
+
+struct sysstat {
+  uint64 calls;
+  uint64 errors;
+  uint64 timed;
+  uint64 cycles;                  // of the timed calls
+  uint32 hist[SYSSTAT_NBUCKET];
+};
+
+// Per process, allocated the first time it makes a syscall while
+// stats are on. Only timed calls are counted here, to keep it small
+// enough for kmalloc().
+struct proc_sysstat {
+  uint64 cycles[NSYSCALL];
+  uint32 calls[NSYSCALL];
+};
+
+struct proc;
+
+extern volatile int sysstat_on;
+
+void            sysstat_init(void);
+uint64          sysstat_start(int *hart);
+void            sysstat_end(struct proc *p, int num, uint64 ret, uint64 start, int hart);
+void            sysstat_free(struct proc *p);
+int             sysstatread(int user_dst, uint64 addr, uint64 off, int n);
+int             sysstatwrite(int user_dst, uint64 addr, int n);
+
+// Returns the start time to hand to sysstat_end() with *hart, 0 while
+// stats are off.
+static inline uint64 sysstat_begin(int *hart) {
+  return sysstat_on ? sysstat_start(hart) : 0;
+}
+
+#endif
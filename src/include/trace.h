@@ -0,0 +1,53 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "types.h"
+
+// Static tracepoints. Each one costs a load and a branch while its bit
+// in trace_mask is clear; built without -DTRACE they compile away.
+// Records are read from /dev/trace and decoded by tools/trace2json.py.
+enum trace_event {
+  TRACE_LOST,             // a0 = records dropped on this hart
+  TRACE_SCHED_SWITCH,     // a0 = next pid, a1 = prev pid, 0 is the idle loop
+  TRACE_SCHED_WAKEUP,     // a0 = woken pid
+  TRACE_SYSCALL_ENTER,    // a0 = number, a1 = first argument
+  TRACE_SYSCALL_EXIT,     // a0 = number, a1 = return value
+  TRACE_PAGE_FAULT,       // a0 = stval, a1 = scause
+  TRACE_BIO_SUBMIT,       // a0 = sector, a1 = dev | write << 32
+  TRACE_BIO_COMPLETE,     // a0 = sector, a1 = dev | write << 32
+  TRACE_FAT32_RW_START,   // a0 = cluster, a1 = bytes | write << 32
+  TRACE_FAT32_RW_END,     // a0 = cluster, a1 = bytes done
+  TRACE_NR_EVENTS
+};
+
+#define TRACE_NREC    2048    // records per hart, a power of 2
+#define TRACE_BATCH   32      // records a read takes per trip through the lock
+
+// The binary record read from /dev/trace, 32 bytes.
+struct trace_rec {
+  uint64 time;            // r_time()
+  uint32 pid;             // running process, 0 if none
+  uint16 event;
+  uint8 hart;
+  uint8 pad;
+  uint64 a0;
+  uint64 a1;
+};
+
+extern volatile uint64 trace_mask;
+
+void            trace_init(void);
+void            __trace(int event, uint64 a0, uint64 a1);
+int             traceread(int user_dst, uint64 addr, int n);
+int             tracewrite(int user_dst, uint64 addr, int n);
+
+#ifdef TRACE
+#define trace(ev, a0, a1) do { \
+  if (trace_mask & (1ul << (ev))) \
+    __trace((ev), (uint64)(a0), (uint64)(a1)); \
+} while (0)
+#else
+#define trace(ev, a0, a1) do { } while (0)
+#endif
+
+#endif
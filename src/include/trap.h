@@ -53,9 +53,13 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// interrupt sources counted per hart
+enum { INTR_STAT_TIMER, INTR_STAT_UART, INTR_STAT_SPI, INTR_STAT_OTHER, NINTR_STAT };
+
 void            trapinithart(void);
 void            usertrapret(void);
 void            trapframedump(struct trapframe *tf);
 int             kernel_handle_excp(uint64 scause);
+uint64          intr_count(int hart, int src);
 
 #endif
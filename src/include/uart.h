@@ -0,0 +1,22 @@
+#ifndef __UART_H
+#define __UART_H
+
+#include "types.h"
+
+#define UART_RX_BUF_SIZE  256
+#define UART_TX_BUF_SIZE  1024
+
+void            uartinit(void);
+void            uartintr(void);
+
+// blocking, returns -1 if the proc was killed while waiting
+int             uartgetc(void);
+
+// queue `n` bytes for sending, sleeps while the ring is full
+int             uartwrite(int user_src, uint64 src, int n);
+void            uartputc(int c);
+
+// spin until the tx ring and fifo are empty
+void            uartflush(void);
+
+#endif
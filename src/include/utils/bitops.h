@@ -0,0 +1,48 @@
+#ifndef __BITOPS_H
+#define __BITOPS_H
+
+#include "include/types.h"
+
+/**
+ * The kernel is linked without libgcc, so __builtin_ctzl() and
+ * friends can't be relied on. These helpers are branchy but small.
+ */
+
+// index of the lowest set bit, `x` must be non-zero
+static inline int ctz64(uint64 x) {
+	int n = 0;
+	if (!(x & 0xffffffff)) { n += 32; x >>= 32; }
+	if (!(x & 0xffff)) { n += 16; x >>= 16; }
+	if (!(x & 0xff)) { n += 8; x >>= 8; }
+	if (!(x & 0xf)) { n += 4; x >>= 4; }
+	if (!(x & 0x3)) { n += 2; x >>= 2; }
+	if (!(x & 0x1)) { n += 1; }
+	return n;
+}
+
+// index of the highest set bit, i.e. floor(log2(x)), `x` must be non-zero
+static inline int ilog2_64(uint64 x) {
+	int n = 0;
+	if (x >> 32) { n += 32; x >>= 32; }
+	if (x >> 16) { n += 16; x >>= 16; }
+	if (x >> 8) { n += 8; x >>= 8; }
+	if (x >> 4) { n += 4; x >>= 4; }
+	if (x >> 2) { n += 2; x >>= 2; }
+	if (x >> 1) { n += 1; }
+	return n;
+}
+
+static inline void bitmap_set(uint64 *map, int bit) {
+	map[bit / 64] |= 1ul << (bit % 64);
+}
+
+static inline void bitmap_clear(uint64 *map, int bit) {
+	map[bit / 64] &= ~(1ul << (bit % 64));
+}
+
+static inline int bitmap_test(uint64 *map, int bit) {
+	return (map[bit / 64] >> (bit % 64)) & 1;
+}
+
+
+#endif
@@ -5,6 +5,11 @@
 #include "riscv.h"
 #include "proc.h"
 
+// what a user page fault was doing, for handle_page_fault()
+#define FAULT_READ      0
+#define FAULT_WRITE     1
+#define FAULT_EXEC      2
+
 void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
@@ -39,8 +44,16 @@ int             copyin2(char *dst, uint64 srcva, uint64 len);
 int             copyinstr2(char *dst, uint64 srcva, uint64 max);
 void            vmprint(pagetable_t pagetable);
 pte_t *         walk(pagetable_t pagetable, uint64 va, int alloc);
-int             handle_page_fault(int kind, uint stval);
+uint64          uvmprivate(pagetable_t pagetable, uint64 va);
+uint64          walkaddr_read(pagetable_t pagetable, uint64 va);
+uint64          walkaddr_write(pagetable_t pagetable, uint64 va);
+void            uvm_prefault(pagetable_t pagetable, uint64 va, uint64 n, int write);
+uint64          uvmcow(pagetable_t pagetable, uint64 va);
+int             handle_page_fault(int kind, uint64 va);
 int             kernel_handle_page_fault(int kind, uint stval);
 int 		uvmcopy2(pagetable_t old, pagetable_t new, pagetable_t knew, uint sz);
 void        freewalk(pagetable_t pagetable);
+uint64          uvm_rss(pagetable_t pagetable);
+
+extern uint64 pgtbl_pages;
 #endif 
@@ -10,6 +10,7 @@
 #define ALIGNDOWN(x,align) ((x) & (- (align)))
 enum segtype {NONE, LOAD, TEXT, DATA, BSS, HEAP, MMAP, STACK, TRAP};
 
+struct dirent;
 
 struct vma {
     enum segtype type;
@@ -20,20 +21,49 @@ struct vma {
     int flags;
     int fd;
     uint64 f_off;
+    // an ELF segment or private file mapping paged in from ep: [f_start, f_end) is the file's
+    // from offset f_off, the rest of it zeroes
+    struct dirent *ep;
+    uint64 f_start;
+    uint64 f_end;
     struct vma *prev;
     struct vma *next;
 };
 
+// An address space on its own, not yet or no longer a process's.
+// lock, if not NULL, is held while the vma list or a vma in it
+// changes, as procfs walks the list of another process under it.
+struct mm {
+    pagetable_t pagetable;
+    struct vma *vma;
+    struct trapframe *trapframe;
+    struct spinlock *lock;
+};
+
+int mm_init(struct mm *mm);
+void mm_install(struct proc *p, struct mm *mm);
+void mm_free(struct mm *mm);
+struct vma *mm_alloc_vma(struct mm *mm, enum segtype type, uint64 addr, uint64 sz, int perm, int alloc, uint64 pa);
+
 struct vma *vma_list_init(struct proc *p);
 struct vma *alloc_vma(struct proc *p, enum segtype type, uint64 addr, uint64 sz, int perm, int alloc, uint64 pa);
 struct vma* type_locate_vma(struct vma *head, enum segtype type);
 struct vma *addr_locate_vma(struct vma*head, uint64 addr);
 struct vma *addr_sz_locate_vma(struct vma*head, uint64 addr, uint64 sz);
 struct vma *alloc_mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, int perm, int fd ,uint64 f_off);
+struct vma *alloc_file_mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, int perm, int fd, uint64 f_off, struct dirent *ep);
 struct vma *alloc_stack_vma(struct proc *p, uint64 addr, int perm);
 struct vma *alloc_addr_heap_vma(struct proc *p, uint64 addr, int perm);
 struct vma *alloc_sz_heap_vma(struct proc *p, uint64 sz, int perm);
 struct vma *alloc_load_vma(struct proc *p, uint64 addr, uint64 sz, int perm);
+struct vma *alloc_file_vma(struct mm *mm, uint64 addr, uint64 sz, int perm, struct dirent *ep, uint64 off, uint64 filesz);
+// How vma_fault_file() gets ep's lock: it may sleep for it, the caller
+// holds it, or the caller holds another entry's and it is only taken
+// if it is free, as sleeping for it then could deadlock.
+enum { EP_SLEEP, EP_HELD, EP_TRY };
+
+int vma_fault_file(pagetable_t pagetable, const struct vma *vma, uint64 va, int how);
+void vma_put_files(struct proc *p);
 struct vma *vma_copy(struct proc *np, struct vma *head);
 int free_vma_list(struct proc *p);
 int free_vma(struct proc *p, struct vma *del);
@@ -42,6 +72,7 @@ uint64 growprocsize(uint64 sz);
 void print_vma_info(struct proc* p);
 void print_single_vma(pagetable_t pagetable,struct vma* v);
 int vma_deep_mapping(pagetable_t old, pagetable_t new, const struct vma *vma);
+int vma_populate(struct proc *p);
 int vma_shallow_mapping(pagetable_t old, pagetable_t new, const struct vma *vma);
 #endif
 
@@ -0,0 +1,32 @@
+#ifndef __WORKQUEUE_H
+#define __WORKQUEUE_H
+
+#include "types.h"
+#include "utils/list.h"
+
+// A deferred call, run in process context by a kworker thread, so it
+// may sleep. A work item is queued at most once at a time.
+struct work_struct {
+  struct list entry;
+  void (*func)(struct work_struct *);
+  int pending;
+};
+
+#define DECLARE_WORK(n, f) \
+  struct work_struct n = { .func = (f) }
+
+static inline void INIT_WORK(struct work_struct *w, void (*func)(struct work_struct *)) {
+  w->func = func;
+  w->pending = 0;
+}
+
+// Start a kworker for each hart. Needs the process table.
+void            workqueue_init(void);
+
+// Queue `w` on hart `hart`'s workqueue, or the calling hart's.
+// Safe from interrupt and softirq context. Returns 0 if `w` was
+// already pending.
+int             queue_work_on(int hart, struct work_struct *w);
+int             schedule_work(struct work_struct *w);
+
+#endif
@@ -0,0 +1,508 @@
+//
+// kbench -- microbenchmarks of kernel primitives, built in only with
+// `make KBENCH=1`.
+//
+// Each benchmark takes up to KBENCH_N samples of one operation and
+// keeps the percentiles of the sorted samples. Samples are in cycles
+// when the operation stays on the hart it started on, which is made
+// sure of with interrupts off, or checked and the sample dropped if
+// it didn't. Ones that sleep and may wake up on another hart are in
+// time ticks, as the cycle counters of two harts needn't agree.
+// Throughputs are in KB/s, a sample per run of sectors.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/pm.h"
+#include "include/kalloc.h"
+#include "include/vm.h"
+#include "include/buf.h"
+#include "include/fat32.h"
+#include "include/blkstat.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/copy.h"
+#include "include/printf.h"
+#include "include/seqbuf.h"
+#include "include/kbench.h"
+
+#define KBENCH_N        512
+#define KBENCH_MISS_N   64          // bread misses go to the disk
+#define KBENCH_SEQ_RUN  64          // sectors in a seqread sample
+#define KBENCH_SEQ_N    32          // seqread samples
+#define KBENCH_MAX      24          // result rows
+#define KBENCH_VA       0x10000000L // where mappages() maps, in a scratch table
+
+#define PCT(n, p)       (((n) - 1) * (p) / 100)
+
+enum { CLK_CYCLE, CLK_TIME, CLK_RATE };
+
+struct kbench_result {
+  char name[20];
+  int clock;
+  int n;
+  uint64 min, p50, p90, p99, max;
+};
+
+static struct {
+  struct spinlock lock;     // the results; a run is kept alone by `running`
+  struct kbench_result res[KBENCH_MAX];
+  int nres;
+  uint64 mhz;               // cycles per time tick of 1us
+  int running;
+} kb;
+
+static uint64 samples[KBENCH_N];
+
+// the other side of the contended lock
+static struct {
+  struct spinlock lk;
+  volatile int started;
+  volatile int stop;
+  volatile int done;
+} hammer;
+
+// sleep/wakeup ping-pong, turn is 1 while the partner is to answer
+static struct {
+  struct spinlock lk;
+  int turn;
+  int stop;
+  int done;
+} pp;
+
+static const uint kmalloc_sizes[] = { 32, 64, 128, 256, 512, 1024, 2048, KMALLOC_MAX };
+
+extern pagetable_t kernel_pagetable;
+
+void
+kbench_init(void)
+{
+  initlock(&kb.lock, "kbench");
+  initlock(&hammer.lk, "kbench_hammer");
+  initlock(&pp.lk, "kbench_pp");
+}
+
+static void
+sort(uint64 *a, int n)
+{
+  for (int i = 1; i < n; i++) {
+    uint64 x = a[i];
+    int j;
+    for (j = i; j > 0 && a[j - 1] > x; j--)
+      a[j] = a[j - 1];
+    a[j] = x;
+  }
+}
+
+static void
+record(char *name, int clock, int n)
+{
+  struct kbench_result r;
+
+  if (n == 0) {
+    __debug_warn("[kbench] no samples\n");
+    return;
+  }
+  sort(samples, n);
+  safestrcpy(r.name, name, sizeof(r.name));
+  r.clock = clock;
+  r.n = n;
+  r.min = samples[0];
+  r.p50 = samples[PCT(n, 50)];
+  r.p90 = samples[PCT(n, 90)];
+  r.p99 = samples[PCT(n, 99)];
+  r.max = samples[n - 1];
+
+  acquire(&kb.lock);
+  if (kb.nres < KBENCH_MAX)
+    kb.res[kb.nres++] = r;
+  release(&kb.lock);
+}
+
+// For a sample that may sleep: where and when it starts, and whether
+// it ended on the same hart.
+static int
+sample_start(uint64 *t)
+{
+  int hart;
+
+  push_off();
+  hart = cpuid();
+  *t = r_cycle();
+  pop_off();
+  return hart;
+}
+
+static int
+sample_end(int hart, uint64 t, uint64 *out)
+{
+  uint64 now;
+  int same;
+
+  push_off();
+  now = r_cycle();
+  same = cpuid() == hart;
+  pop_off();
+  if (same)
+    *out = now - t;
+  return same;
+}
+
+static uint64
+cycles_per_us(void)
+{
+  uint64 t0, t1, c0, c1;
+
+  push_off();
+  t0 = r_time();
+  c0 = r_cycle();
+  while ((t1 = r_time()) - t0 < MS_TO_TICK(10))
+    ;
+  c1 = r_cycle();
+  pop_off();
+  return (c1 - c0) / TICK_TO_US(t1 - t0);
+}
+
+static void
+bench_allocpage(void)
+{
+  int i;
+
+  for (i = 0; i < KBENCH_N; i++) {
+    push_off();
+    uint64 t = r_cycle();
+    void *pa = allocpage();
+    samples[i] = r_cycle() - t;
+    pop_off();
+    if (pa == NULL)
+      break;
+    freepage(pa);
+  }
+  record("allocpage", CLK_CYCLE, i);
+}
+
+static void
+bench_kmalloc(void)
+{
+  char name[20];
+
+  for (int k = 0; k < NELEM(kmalloc_sizes); k++) {
+    int i;
+    for (i = 0; i < KBENCH_N; i++) {
+      push_off();
+      uint64 t = r_cycle();
+      void *p = kmalloc(kmalloc_sizes[k]);
+      samples[i] = r_cycle() - t;
+      pop_off();
+      if (p == NULL)
+        break;
+      kfree(p);
+    }
+    snprintf(name, sizeof(name), "kmalloc-%d", kmalloc_sizes[k]);
+    record(name, CLK_CYCLE, i);
+  }
+}
+
+static void
+bench_bread(void)
+{
+  uint dev = rootfs->devno;
+  uint hit = rootfs->fat.first_data_sec;
+  uint miss = rootfs->fat.bpb.tot_sec - 2 * NBUF;
+  struct buf *b;
+  int i, k;
+
+  brelse(bread(dev, hit, BIO_DATA));
+  for (i = k = 0; i < KBENCH_N; i++) {
+    uint64 t;
+    int hart = sample_start(&t);
+    b = bread(dev, hit, BIO_DATA);
+    k += sample_end(hart, t, &samples[k]);
+    brelse(b);
+  }
+  record("bread-hit", CLK_CYCLE, k);
+
+  // 2 * NBUF sectors in turn, so the ones read since a sector was last
+  // have pushed it out of the cache
+  for (i = 0; i < 2 * NBUF; i++)
+    brelse(bread(dev, miss + i, BIO_DATA));
+  for (i = 0; i < KBENCH_MISS_N; i++) {
+    uint64 t = r_time();
+    b = bread(dev, miss + i % (2 * NBUF), BIO_DATA);
+    samples[i] = r_time() - t;
+    brelse(b);
+  }
+  record("bread-miss", CLK_TIME, i);
+}
+
+// Sequential reads through bread(), the way a file read goes to the
+// disk. The runs together are far more than the cache holds, so each
+// one starts cold, again on the next kbench run.
+static void
+bench_seqread(void)
+{
+  uint dev = rootfs->devno;
+  uint start = rootfs->fat.bpb.tot_sec - KBENCH_SEQ_N * KBENCH_SEQ_RUN;
+  int i;
+
+  for (i = 0; i < KBENCH_SEQ_N; i++) {
+    uint sec = start + i * KBENCH_SEQ_RUN;
+    uint64 t = r_time();
+    for (int k = 0; k < KBENCH_SEQ_RUN; k++)
+      brelse(bread(dev, sec + k, BIO_DATA));
+    t = TICK_TO_US(r_time() - t);
+    samples[i] = (uint64)KBENCH_SEQ_RUN * BSIZE * 1000000 / 1024 / (t ? t : 1);
+  }
+  record("seqread", CLK_RATE, i);
+}
+
+static void
+bench_walk(void)
+{
+  int i;
+
+  for (i = 0; i < KBENCH_N; i++) {
+    push_off();
+    uint64 t = r_cycle();
+    walk(kernel_pagetable, KERNBASE + (uint64)i * PGSIZE, 0);
+    samples[i] = r_cycle() - t;
+    pop_off();
+  }
+  record("walk", CLK_CYCLE, i);
+}
+
+// mappages() into a table of our own, then copyout() through it.
+static void
+bench_mappages(void)
+{
+  pagetable_t pt;
+  char *pg, *src, name[20];
+  int i, m;
+
+  if ((pt = allocpage()) == NULL)
+    return;
+  memset(pt, 0, PGSIZE);
+  __sync_fetch_and_add(&pgtbl_pages, 1);    // freewalk() takes it back
+  pg = allocpage();
+  src = allocpage();
+  if (pg == NULL || src == NULL)
+    goto out;
+  memset(src, 0x5a, PGSIZE);
+
+  for (m = 0; m < KBENCH_N; m++) {
+    push_off();
+    uint64 t = r_cycle();
+    int r = mappages(pt, KBENCH_VA + (uint64)m * PGSIZE, PGSIZE, (uint64)pg,
+                     PTE_U | PTE_R | PTE_W);
+    samples[m] = r_cycle() - t;
+    pop_off();
+    if (r < 0)
+      break;
+  }
+  record("mappages", CLK_CYCLE, m);
+
+  // every page mapped is pg, so the copies cost the same wherever they go
+  for (int len = 64; m > 0 && len <= PGSIZE; len *= 64) {
+    for (i = 0; i < KBENCH_N; i++) {
+      push_off();
+      uint64 t = r_cycle();
+      copyout(pt, KBENCH_VA + (uint64)(i % m) * PGSIZE, src, len);
+      samples[i] = r_cycle() - t;
+      pop_off();
+    }
+    snprintf(name, sizeof(name), "copyout-%d", len);
+    record(name, CLK_CYCLE, i);
+  }
+  if (m > 0)
+    vmunmap(pt, KBENCH_VA, m, 0);
+
+out:
+  freewalk(pt);
+  if (pg)
+    freepage(pg);
+  if (src)
+    freepage(src);
+}
+
+static void
+lock_hammer(void *arg)
+{
+  hammer.started = 1;
+  while (!hammer.stop) {
+    acquire(&hammer.lk);
+    release(&hammer.lk);
+  }
+  hammer.done = 1;
+}
+
+static void
+time_lock(char *name)
+{
+  int i;
+
+  for (i = 0; i < KBENCH_N; i++) {
+    push_off();
+    uint64 t = r_cycle();
+    acquire(&hammer.lk);
+    release(&hammer.lk);
+    samples[i] = r_cycle() - t;
+    pop_off();
+  }
+  record(name, CLK_CYCLE, i);
+}
+
+// With a single hart the hammer only runs while we yield, and the
+// contended numbers are the uncontended ones.
+static void
+bench_lock(void)
+{
+  time_lock("acquire-release");
+
+  hammer.started = hammer.stop = hammer.done = 0;
+  if (kthread_create("kbench_hammer", lock_hammer, NULL) == NULL) {
+    __debug_warn("[kbench] no kthread for the contended lock\n");
+    return;
+  }
+  while (!hammer.started)
+    yield();
+  time_lock("acquire-contended");
+  hammer.stop = 1;
+  while (!hammer.done)
+    yield();
+}
+
+// Nothing else to run, a yield is two swtch()es through the scheduler.
+// Another hart's scheduler may pick us up; those samples are dropped.
+static void
+bench_yield(void)
+{
+  int i, k;
+
+  for (i = k = 0; i < KBENCH_N; i++) {
+    uint64 t;
+    int hart = sample_start(&t);
+    yield();
+    k += sample_end(hart, t, &samples[k]);
+  }
+  record("yield", CLK_CYCLE, k);
+}
+
+static void
+pingpong_partner(void *arg)
+{
+  acquire(&pp.lk);
+  for (;;) {
+    while (pp.turn == 0)
+      sleep(&pp.turn, &pp.lk);
+    if (pp.stop)
+      break;
+    pp.turn = 0;
+    wakeup(&pp.turn);
+  }
+  pp.done = 1;
+  wakeup(&pp.done);
+  release(&pp.lk);
+}
+
+static void
+bench_pingpong(void)
+{
+  int i;
+
+  pp.turn = pp.stop = pp.done = 0;
+  if (kthread_create("kbench_pp", pingpong_partner, NULL) == NULL) {
+    __debug_warn("[kbench] no kthread for the ping-pong\n");
+    return;
+  }
+  acquire(&pp.lk);
+  for (i = 0; i < KBENCH_N; i++) {
+    uint64 t = r_time();
+    pp.turn = 1;
+    wakeup(&pp.turn);
+    while (pp.turn == 1)
+      sleep(&pp.turn, &pp.lk);
+    samples[i] = r_time() - t;
+  }
+  pp.stop = 1;
+  pp.turn = 1;
+  wakeup(&pp.turn);
+  while (!pp.done)
+    sleep(&pp.done, &pp.lk);
+  release(&pp.lk);
+  record("sleep-wakeup", CLK_TIME, i);
+}
+
+static void
+kbench_run(void)
+{
+  acquire(&kb.lock);
+  kb.nres = 0;
+  release(&kb.lock);
+  kb.mhz = cycles_per_us();
+
+  bench_allocpage();
+  bench_kmalloc();
+  bench_bread();
+  bench_seqread();
+  bench_walk();
+  bench_mappages();
+  bench_lock();
+  bench_yield();
+  bench_pingpong();
+}
+
+int
+kbenchread(int user_dst, uint64 addr, uint64 off, int n)
+{
+  static char *clkname[] = { [CLK_CYCLE] "cyc", [CLK_TIME] "tick", [CLK_RATE] "KB/s" };
+  struct seqbuf sq;
+
+  seq_init(&sq, user_dst, addr, off, n);
+  seq_printf(&sq, "cycles/us: %lu, tick: 1us\n", kb.mhz);
+  seq_printf(&sq, "%-18s %-4s %5s %10s %10s %10s %10s %10s\n",
+             "name", "unit", "n", "min", "p50", "p90", "p99", "max");
+  for (int i = 0; ; i++) {
+    struct kbench_result r;
+
+    acquire(&kb.lock);
+    if (i >= kb.nres) {
+      release(&kb.lock);
+      break;
+    }
+    r = kb.res[i];
+    release(&kb.lock);
+    seq_printf(&sq, "%-18s %-4s %5d %10lu %10lu %10lu %10lu %10lu\n", r.name,
+               clkname[r.clock], r.n, r.min, r.p50, r.p90, r.p99, r.max);
+  }
+  return seq_result(&sq);
+}
+
+int
+kbenchwrite(int user_dst, uint64 addr, int n)
+{
+  char cmd[16];
+  int len = n < sizeof(cmd) - 1 ? n : sizeof(cmd) - 1;
+
+  if (either_copyin(user_dst, cmd, addr, len) < 0)
+    return -1;
+  cmd[len] = 0;
+  if (len > 0 && cmd[len - 1] == '\n')
+    cmd[len - 1] = 0;
+
+  if (strncmp(cmd, "run", sizeof(cmd)) != 0) {
+    __debug_warn("[kbench] unknown command %s\n", cmd);
+    return -1;
+  }
+  if (__sync_lock_test_and_set(&kb.running, 1)) {
+    __debug_warn("[kbench] already running\n");
+    return -1;
+  }
+  kbench_run();
+  __sync_lock_release(&kb.running);
+  return n;
+}
@@ -0,0 +1,403 @@
+//
+// kernel log -- per-hart rings of records, drained to the console
+// and read back through syslog(2).
+//
+// Each hart only ever writes its own ring, with interrupts off, so
+// writers need no lock. A global sequence number, taken once the
+// record is filled in, orders the records of all harts. Readers keep
+// their own position in every ring and merge them by sequence number;
+// a ring holds KLOG_NREC - 1 readable records, the last slot being the
+// one the writer fills next, and a reader that falls further behind
+// loses the oldest records instead of holding up the writers.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/sleeplock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/timer.h"
+#include "include/copy.h"
+#include "include/errno.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/workqueue.h"
+#include "include/klog.h"
+
+struct klog_cpu {
+  struct klog_rec rec[KLOG_NREC];
+  uint64 head;          // records ever written, only its hart moves it
+  int newline;          // the last record ended a line
+};
+
+struct klog_reader {
+  uint64 pos[NCPU];
+};
+
+static struct klog_cpu klog_cpus[NCPU];
+
+static struct {
+  uint64 seq;                 // last sequence number handed out
+  int async;
+  int console_level;
+  int draining;               // someone is printing to the console
+  struct klog_reader console; // owned by whoever holds `draining`
+  struct sleeplock rlock;     // guards the two below
+  struct klog_reader syslog;  // SYSLOG_ACTION_READ consumes from here
+  struct klog_reader cleared; // SYSLOG_ACTION_READ_ALL starts here
+} klog = {
+  .console_level = KLOG_CONSOLE_DEFAULT,
+};
+
+void
+klog_init(void)
+{
+  for (int i = 0; i < NCPU; i++)
+    klog_cpus[i].newline = 1;
+  initsleeplock(&klog.rlock, "klog");
+}
+
+void
+klog_write(int level, char *text, int len)
+{
+  push_off();
+  struct klog_cpu *kc = &klog_cpus[cpuid()];
+  while (len > 0) {
+    int n = len < KLOG_TEXT ? len : KLOG_TEXT;
+    struct klog_rec *r = &kc->rec[kc->head % KLOG_NREC];
+
+    r->seq = 0;
+    __sync_synchronize();
+    r->time = r_time();
+    r->level = level;
+    r->hart = cpuid();
+    r->cont = !kc->newline;
+    r->len = n;
+    memmove(r->text, text, n);
+    kc->newline = (text[n - 1] == '\n');
+    __sync_synchronize();
+    r->seq = __sync_add_and_fetch(&klog.seq, 1);
+    __sync_synchronize();
+    kc->head++;
+
+    text += n;
+    len -= n;
+  }
+  pop_off();
+
+  if (!klog.async)
+    klog_drain();
+}
+
+// Copy the oldest record `rd` hasn't seen into `out` and step past it.
+// Returns 0 when there's nothing left. Records lost because the writer
+// lapped the reader are added to `*dropped`.
+static int
+klog_next(struct klog_reader *rd, struct klog_rec *out, uint64 *dropped)
+{
+  for (;;) {
+    int best = -1;
+    uint64 bestseq = 0;
+    for (int c = 0; c < NCPU; c++) {
+      struct klog_cpu *kc = &klog_cpus[c];
+      uint64 head = __atomic_load_n(&kc->head, __ATOMIC_ACQUIRE);
+      // the slot at head - KLOG_NREC is the one the writer fills next
+      if (head - rd->pos[c] >= KLOG_NREC) {
+        if (dropped)
+          *dropped += head - (KLOG_NREC - 1) - rd->pos[c];
+        rd->pos[c] = head - (KLOG_NREC - 1);
+      }
+      if (rd->pos[c] == head)
+        continue;
+      uint64 seq = kc->rec[rd->pos[c] % KLOG_NREC].seq;
+      if (best < 0 || seq < bestseq) {
+        best = c;
+        bestseq = seq;
+      }
+    }
+    if (best < 0)
+      return 0;
+
+    struct klog_cpu *kc = &klog_cpus[best];
+    struct klog_rec *r = &kc->rec[rd->pos[best] % KLOG_NREC];
+    *out = *r;
+    __sync_synchronize();
+    // the writer may have reused the slot while we were copying it
+    if (out->seq == 0 || out->seq != bestseq
+        || __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != bestseq
+        || __atomic_load_n(&kc->head, __ATOMIC_ACQUIRE) - rd->pos[best] >= KLOG_NREC)
+      continue;
+    rd->pos[best]++;
+    return 1;
+  }
+}
+
+static int
+klog_pending(struct klog_reader *rd)
+{
+  for (int c = 0; c < NCPU; c++) {
+    if (__atomic_load_n(&klog_cpus[c].head, __ATOMIC_ACQUIRE) != rd->pos[c])
+      return 1;
+  }
+  return 0;
+}
+
+static void
+consputs(char *s)
+{
+  while (*s)
+    consputc(*s++);
+}
+
+void
+klog_drain(void)
+{
+  struct klog_rec r;
+  uint64 dropped;
+
+  // Whoever gets here first prints for everyone; the others return and
+  // leave their records to it.
+  do {
+    if (__sync_lock_test_and_set(&klog.draining, 1))
+      return;
+    dropped = 0;
+    while (klog_next(&klog.console, &r, &dropped)) {
+      if (dropped) {
+        consputs("[klog] records dropped\n");
+        dropped = 0;
+      }
+      if (r.level < klog.console_level) {
+        for (int i = 0; i < r.len; i++)
+          consputc(r.text[i]);
+      }
+    }
+    __sync_lock_release(&klog.draining);
+    // a record may have been added after the last klog_next()
+  } while (klog_pending(&klog.console));
+}
+
+void
+klog_flush(void)
+{
+  klog_sync();
+  // another hart may be draining, and klog_drain() left it to that one
+  while (__atomic_load_n(&klog.draining, __ATOMIC_ACQUIRE) ||
+         klog_pending(&klog.console))
+    klog_drain();
+}
+
+static void
+klog_work_fn(struct work_struct *w)
+{
+  klog_drain();
+}
+
+static DECLARE_WORK(klog_work, klog_work_fn);
+
+void
+klog_kick(void)
+{
+  if (klog.async && !klog.draining && klog_pending(&klog.console))
+    schedule_work(&klog_work);
+}
+
+void
+klog_async(void)
+{
+  klog.async = 1;
+}
+
+void
+klog_sync(void)
+{
+  klog.async = 0;
+  __sync_synchronize();
+  klog_drain();
+}
+
+int
+klog_console_level(int level)
+{
+  int old = klog.console_level;
+  klog.console_level = level;
+  return old;
+}
+
+static int
+fmtnum(char *buf, uint64 x, int width, char pad)
+{
+  char tmp[20];
+  int i = 0, n = 0;
+
+  do {
+    tmp[i++] = '0' + x % 10;
+  } while ((x /= 10) != 0);
+  while (width-- > i)
+    buf[n++] = pad;
+  while (i > 0)
+    buf[n++] = tmp[--i];
+  return n;
+}
+
+#define KLOG_LINE   (KLOG_TEXT + 40)
+
+// Lay a record out as syslog(2) does, "<level>[sec.usec] text". Records
+// that carry on a line get no prefix.
+static int
+klog_format(struct klog_rec *r, char *buf)
+{
+  int n = 0;
+
+  if (!r->cont) {
+    uint64 us = TICK_TO_US(r->time);
+    buf[n++] = '<';
+    n += fmtnum(buf + n, r->level, 0, 0);
+    buf[n++] = '>';
+    buf[n++] = '[';
+    n += fmtnum(buf + n, us / 1000000, 5, ' ');
+    buf[n++] = '.';
+    n += fmtnum(buf + n, us % 1000000, 6, '0');
+    buf[n++] = ']';
+    buf[n++] = ' ';
+  }
+  memmove(buf + n, r->text, r->len);
+  return n + r->len;
+}
+
+// Copy formatted records from `rd` to user `buf` until the next one
+// doesn't fit. `rd` is left at the first record not copied.
+static int
+klog_copyout(struct klog_reader *rd, uint64 buf, int len)
+{
+  char line[KLOG_LINE];
+  struct klog_rec r;
+  int n = 0;
+
+  for (;;) {
+    struct klog_reader save = *rd;
+    if (!klog_next(rd, &r, 0))
+      break;
+    int m = klog_format(&r, line);
+    if (n + m > len) {
+      if (n > 0) {
+        *rd = save;
+        break;
+      }
+      m = len;    // the first record alone is too long, cut it
+    }
+    if (either_copyout(1, buf + n, line, m) < 0)
+      return -EFAULT;
+    n += m;
+  }
+  return n;
+}
+
+static int
+klog_size(struct klog_reader *rd)
+{
+  char line[KLOG_LINE];
+  struct klog_rec r;
+  struct klog_reader tmp = *rd;
+  int n = 0;
+
+  while (klog_next(&tmp, &r, 0))
+    n += klog_format(&r, line);
+  return n;
+}
+
+int
+klog_read(uint64 buf, int len)
+{
+  int n;
+
+  if (len == 0)
+    return 0;
+
+  acquiresleep(&klog.rlock);
+  acquire(&tickslock);
+  while (!klog_pending(&klog.syslog)) {
+    if (myproc()->killed) {
+      release(&tickslock);
+      releasesleep(&klog.rlock);
+      return -EINTR;
+    }
+    sleep(&ticks, &tickslock);
+  }
+  release(&tickslock);
+  n = klog_copyout(&klog.syslog, buf, len);
+  releasesleep(&klog.rlock);
+  return n;
+}
+
+int
+klog_read_all(uint64 buf, int len, int clear)
+{
+  char line[KLOG_LINE];
+  struct klog_rec r;
+  struct klog_reader rd;
+  int n;
+
+  acquiresleep(&klog.rlock);
+  rd = klog.cleared;
+  // only the newest `len` bytes are wanted, skip the rest
+  n = klog_size(&rd);
+  while (n > len && klog_next(&rd, &r, 0))
+    n -= klog_format(&r, line);
+  n = klog_copyout(&rd, buf, len);
+  if (clear)
+    klog.cleared = rd;
+  releasesleep(&klog.rlock);
+  return n;
+}
+
+void
+klog_clear(void)
+{
+  acquiresleep(&klog.rlock);
+  for (int c = 0; c < NCPU; c++)
+    klog.cleared.pos[c] = __atomic_load_n(&klog_cpus[c].head, __ATOMIC_ACQUIRE);
+  releasesleep(&klog.rlock);
+}
+
+int
+klog_size_unread(void)
+{
+  int n;
+
+  acquiresleep(&klog.rlock);
+  n = klog_size(&klog.syslog);
+  releasesleep(&klog.rlock);
+  return n;
+}
+
+int
+klog_size_buffer(void)
+{
+  return NCPU * KLOG_NREC * KLOG_TEXT;
+}
+
+int
+__ratelimit(struct ratelimit *rs)
+{
+  uint64 now = r_time();
+
+  if (rs->begin == 0 || now - rs->begin > RATELIMIT_INTERVAL) {
+    if (rs->missed) {
+      char buf[40];
+      int n = fmtnum(buf, rs->missed, 0, 0);
+      memmove(buf + n, " messages suppressed\n", 21);
+      klog_write(KLOG_WARNING, buf, n + 21);
+    }
+    rs->begin = now;
+    rs->printed = 0;
+    rs->missed = 0;
+  }
+  if (rs->printed < RATELIMIT_BURST) {
+    rs->printed++;
+    return 1;
+  }
+  rs->missed++;
+  return 0;
+}
@@ -12,9 +12,10 @@
 #include "include/string.h"
 #include "include/pm.h"
 #include "include/printf.h"
+#include "include/klog.h"
 
 #define KMEM_OBJ_MIN_SIZE   ((uint64)32)
-#define KMEM_OBJ_MAX_SIZE 	((uint64)4048)
+#define KMEM_OBJ_MAX_SIZE 	((uint64)KMALLOC_MAX)
 #define KMEM_OBJ_MAX_COUNT  (PGSIZE / KMEM_OBJ_MIN_SIZE)
 
 #define TABLE_END 	255
@@ -151,7 +152,7 @@ static struct kmem_allocator *get_allocator(uint64 raw_size) {
 void *kmalloc(uint size) {
 	// border check for `size`
 	if (KMEM_OBJ_MIN_SIZE > size) {
-		__debug_warn("kmalloc size %d too small, reset to %d\n", size, KMEM_OBJ_MIN_SIZE);
+		__debug_warn_ratelimited("kmalloc size %d too small, reset to %d\n", size, KMEM_OBJ_MIN_SIZE);
 		size = KMEM_OBJ_MIN_SIZE;
 	}
 	else if (KMEM_OBJ_MAX_SIZE < size) {
@@ -278,3 +279,22 @@ void kfree(void *addr) {
 	// leave critical section `alloc`
 }
 
+// fill `out` with up to `max` size classes, return how many 
+int kmalloc_classes(struct kmalloc_class *out, int max) {
+	int n = 0;
+
+	for (int i = 0; i < KMEM_TABLE_SIZE; i++) {
+		for (struct kmem_allocator *a = kmem_table[i]; 
+				NULL != a && n < max; a = a->next) {
+			acquire(&(a->lock));
+			out[n].obj_size = a->obj_size;
+			out[n].npages = a->npages;
+			out[n].nobjs = a->nobjs;
+			out[n].capa = _calc_capa(a->obj_size);
+			release(&(a->lock));
+			n++;
+		}
+	}
+	return n;
+}
+
@@ -0,0 +1,156 @@
+//
+// kprof -- a statistical profiler driven by the timer interrupt.
+//
+// Each hart fills its own ring from its timer interrupt, so recording
+// a sample takes no lock. The reader drains all rings under kprof.lock.
+// When a ring is full new samples are dropped and counted.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/memlayout.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/copy.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/kprof.h"
+
+struct kprof_cpu {
+  struct kprof_sample ring[KPROF_NSAMPLE];
+  uint64 head;          // written by the hart's timer interrupt
+  uint64 tail;          // written by the reader
+  uint64 dropped;
+};
+
+static struct kprof_cpu kprof_cpus[NCPU];
+
+static struct {
+  struct spinlock lock;     // serializes readers and control writes
+  int enabled;
+} kprof;
+
+// Walk saved frame pointers the way backtrace() does, staying inside
+// the page holding the first frame.
+static int
+kprof_unwind(uint64 fp, uint64 *chain)
+{
+  uint64 bottom = PGROUNDUP(fp);
+  int depth = 0;
+
+  if (fp < KERNBASE || fp >= PHYSTOP)
+    return 0;
+  while (depth < KPROF_DEPTH && fp > bottom - PGSIZE && fp <= bottom && (fp & 7) == 0) {
+    uint64 *frame = (uint64 *)fp;
+    chain[depth++] = frame[-1] - 4;   // the call, not the return address
+    if (frame[-2] <= fp)
+      break;
+    fp = frame[-2];
+  }
+  return depth;
+}
+
+void
+kprof_tick(int user, uint64 pc, uint64 fp)
+{
+  if (!kprof.enabled)
+    return;
+
+  struct cpu *c = mycpu();
+  struct kprof_cpu *kc = &kprof_cpus[cpuid()];
+  if (kc->head - __atomic_load_n(&kc->tail, __ATOMIC_ACQUIRE) == KPROF_NSAMPLE) {
+    kc->dropped++;
+    return;
+  }
+
+  struct kprof_sample *s = &kc->ring[kc->head % KPROF_NSAMPLE];
+  s->pc = pc;
+  s->pid = c->proc ? c->proc->pid : 0;
+  s->hart = cpuid();
+  s->user = user;
+  s->pad = 0;
+  s->depth = user ? 0 : kprof_unwind(fp, s->callchain);
+  __atomic_store_n(&kc->head, kc->head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+kprof_reset(void)
+{
+  for (int i = 0; i < NCPU; i++) {
+    struct kprof_cpu *kc = &kprof_cpus[i];
+    kc->tail = __atomic_load_n(&kc->head, __ATOMIC_ACQUIRE);
+    kc->dropped = 0;
+  }
+}
+
+void
+kprof_init(void)
+{
+  initlock(&kprof.lock, "kprof");
+  kprof.enabled = 0;
+}
+
+// Hand out whole samples, oldest hart first. Returns the bytes copied.
+// Samples come off the rings under the lock, KPROF_BATCH at a time,
+// and are copied out after it is released, as the copy may fault in a
+// page and sleep; a batch that fails to copy is lost.
+int
+kprofread(int user_dst, uint64 addr, int n)
+{
+  struct kprof_sample batch[KPROF_BATCH];
+  int sz = sizeof(struct kprof_sample);
+  int ret = 0, k;
+
+  do {
+    k = 0;
+    acquire(&kprof.lock);
+    for (int i = 0; i < NCPU && k < KPROF_BATCH && n - ret - k * sz >= sz; i++) {
+      struct kprof_cpu *kc = &kprof_cpus[i];
+      uint64 head = __atomic_load_n(&kc->head, __ATOMIC_ACQUIRE);
+      while (kc->tail != head && k < KPROF_BATCH && n - ret - k * sz >= sz) {
+        batch[k++] = kc->ring[kc->tail % KPROF_NSAMPLE];
+        __atomic_store_n(&kc->tail, kc->tail + 1, __ATOMIC_RELEASE);
+      }
+    }
+    release(&kprof.lock);
+    if (k && either_copyout(user_dst, addr + ret, batch, k * sz) < 0)
+      return ret ? ret : -1;
+    ret += k * sz;
+  } while (k);
+  return ret;
+}
+
+int
+kprofwrite(int user_dst, uint64 addr, int n)
+{
+  char cmd[16];
+  int len = n < sizeof(cmd) - 1 ? n : sizeof(cmd) - 1;
+
+  if (either_copyin(user_dst, cmd, addr, len) < 0)
+    return -1;
+  cmd[len] = 0;
+  if (len > 0 && cmd[len - 1] == '\n')
+    cmd[len - 1] = 0;
+
+  acquire(&kprof.lock);
+  if (strncmp(cmd, "start", sizeof(cmd)) == 0) {
+    kprof.enabled = 1;
+  } else if (strncmp(cmd, "stop", sizeof(cmd)) == 0) {
+    uint64 dropped = 0;
+    kprof.enabled = 0;
+    for (int i = 0; i < NCPU; i++)
+      dropped += kprof_cpus[i].dropped;
+    if (dropped)
+      __debug_warn("[kprof] %d samples dropped, read more often\n", (int)dropped);
+  } else if (strncmp(cmd, "reset", sizeof(cmd)) == 0) {
+    kprof_reset();
+  } else {
+    release(&kprof.lock);
+    __debug_warn("[kprof] unknown command %s\n", cmd);
+    return -1;
+  }
+  release(&kprof.lock);
+  return n;
+}
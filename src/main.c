@@ -17,6 +17,18 @@
 #include "include/buf.h"
 #include "include/dev.h"
 #include "include/sysinfo.h"
+#include "include/plic.h"
+#include "include/uart.h"
+#include "include/klog.h"
+#include "include/workqueue.h"
+#include "include/kprof.h"
+#include "include/trace.h"
+#include "include/sysstat.h"
+#include "include/schedstat.h"
+#include "include/perf.h"
+#include "include/procfs.h"
+#include "include/blkstat.h"
+#include "include/blk.h"
 static inline void inithartid(unsigned long hartid) {
   asm volatile("mv tp, %0" : : "r" (hartid));
 }
@@ -60,13 +72,24 @@ main(unsigned long hartid, unsigned long dtb_pa)
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     timerinit();     // init a lock for timer
+    kprof_init();    // sampling profiler, fed by the timer
+    trace_init();    // tracepoint rings, all events off
+    sysstat_init();  // syscall counters, off
+    schedstat_init();
+    perf_init();     // probe the SBI PMU
     trapinithart();  // install kernel trap vector, including interrupt handler
+    plicinit();      // set up interrupt controller
+    uartinit();      // console uart, before its irq is enabled
+    plicinithart();  // ask PLIC for device interrupts
     procinit();
+    workqueue_init(); // kworker threads
     binit();
+    blkstat_init();
+    blk_init();
     disk_init();
     fs_init();
-    logbufinit();
     devinit();
+    procfs_init();   // mount /proc
     fileinit();
     
     //for(int j =0;j<68;j++){
@@ -80,6 +103,7 @@ main(unsigned long hartid, unsigned long dtb_pa)
         }
     }
     started=1;
+    klog_async();    // from now on idle harts print the log
   }
   else
   {
@@ -89,6 +113,7 @@ main(unsigned long hartid, unsigned long dtb_pa)
     printf("hart %d enter main()...\n", hartid);
     kvminithart();
     trapinithart();  // install kernel trap vector, including interrupt handler
+    plicinithart();  // ask PLIC for device interrupts
     __sync_synchronize();
   }
   printf("hart %d scheduler!\n", hartid);
@@ -0,0 +1,223 @@
+//
+// memstat -- where the memory went: free/used pages, page tables,
+// the buffer cache, the page cache, kmalloc size classes and
+// per-process RSS.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/vma.h"
+#include "include/vm.h"
+#include "include/pm.h"
+#include "include/kalloc.h"
+#include "include/buf.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/copy.h"
+#include "include/printf.h"
+#include "include/sysinfo.h"
+#include "include/schedstat.h"
+#include "include/seqbuf.h"
+#include "include/memstat.h"
+#include "include/pagecache.h"
+
+#define PG_KB   (PGSIZE / 1024)
+
+#define MEMSTAT_NCLASS  32
+
+extern struct proc proc[NPROC];
+
+// Pages mapped into p's user address space right now, counted afresh.
+// memstat_map() only counts up, so this is called after pages go away
+// too, to bring p->mem.rss back down.
+uint64
+memstat_rss(struct proc *p)
+{
+  uint64 rss = uvm_rss(p->pagetable);
+
+  p->mem.rss = rss;
+  if (rss > p->mem.maxrss)
+    p->mem.maxrss = rss;
+  return rss;
+}
+
+// Pages p has asked for, mapped or not. p->lock must be held, as it
+// is while p's vmas change.
+uint64
+memstat_vsz(struct proc *p)
+{
+  uint64 sz = 0;
+
+  if (p->vma == NULL)
+    return 0;
+  for (struct vma *v = p->vma->next; v != p->vma; v = v->next) {
+    if (v->type != TRAP)
+      sz += v->sz;
+  }
+  return PGROUNDUP(sz) / PGSIZE;
+}
+
+// child is a zombie about to be freed, its page table still there.
+void
+memstat_reap(struct proc *p, struct proc *child)
+{
+  struct proc_memstat *ms = &p->mem, *cms = &child->mem;
+
+  memstat_rss(child);
+  ms->c_minflt += cms->minflt + cms->c_minflt;
+  ms->c_majflt += cms->majflt + cms->c_majflt;
+  if (cms->maxrss > ms->c_maxrss)
+    ms->c_maxrss = cms->maxrss;
+  if (cms->c_maxrss > ms->c_maxrss)
+    ms->c_maxrss = cms->c_maxrss;
+}
+
+void
+memstat_rusage(struct proc *p, int who, struct rusage *ru)
+{
+  struct proc_memstat *ms = &p->mem;
+
+  if (who == RUSAGE_CHILDREN) {
+    ru->ru_maxrss = ms->c_maxrss * PG_KB;
+    ru->ru_minflt = ms->c_minflt;
+    ru->ru_majflt = ms->c_majflt;
+  } else {
+    memstat_rss(p);
+    ru->ru_maxrss = ms->maxrss * PG_KB;
+    ru->ru_minflt = ms->minflt;
+    ru->ru_majflt = ms->majflt;
+  }
+}
+
+void
+memstat_sysinfo(struct sysinfo *info)
+{
+  info->totalram = totalpages() * PGSIZE;
+  info->freeram = idlepages() * PGSIZE;
+  info->sharedram = 0;
+  info->bufferram = NBUF * BSIZE;
+  info->totalswap = 0;
+  info->freeswap = 0;
+  info->procs = procnum();
+  info->mem_unit = 1;
+}
+
+// Pages kmalloc holds and the bytes handed out of them.
+void
+memstat_kmalloc(uint64 *pages, uint64 *bytes)
+{
+  struct kmalloc_class kc[MEMSTAT_NCLASS];
+  int n = kmalloc_classes(kc, MEMSTAT_NCLASS);
+
+  *pages = *bytes = 0;
+  for (int i = 0; i < n; i++) {
+    *pages += kc[i].npages;
+    *bytes += (uint64)kc[i].nobjs * kc[i].obj_size;
+  }
+}
+
+static void
+report_mem(struct seqbuf *sq)
+{
+  struct kmalloc_class kc[MEMSTAT_NCLASS];
+  uint64 total = totalpages(), free = idlepages();
+  uint64 kpages, kbytes, hits, misses, pcpages, pchits, pcmisses;
+  int n = kmalloc_classes(kc, MEMSTAT_NCLASS);
+
+  memstat_kmalloc(&kpages, &kbytes);
+  bstat(&hits, &misses);
+  pcache_stat(&pcpages, &pchits, &pcmisses);
+
+  seq_printf(sq, "MemTotal:     %10lu kB\n", total * PG_KB);
+  seq_printf(sq, "MemFree:      %10lu kB\n", free * PG_KB);
+  seq_printf(sq, "MemUsed:      %10lu kB\n", (total - free) * PG_KB);
+  seq_printf(sq, "PageTables:   %10lu kB\n", pgtbl_pages * PG_KB);
+  seq_printf(sq, "Kmalloc:      %10lu kB\n", kpages * PG_KB);
+  seq_printf(sq, "KmallocUsed:  %10lu kB\n", kbytes / 1024);
+  // the buffer cache is a static array, it isn't in MemUsed
+  seq_printf(sq, "Buffers:      %10lu kB\n", (uint64)NBUF * BSIZE / 1024);
+  seq_printf(sq, "BufferHits:   %10lu\n", hits);
+  seq_printf(sq, "BufferMisses: %10lu\n", misses);
+  seq_printf(sq, "BufferHit%%:   %10lu\n", hits + misses ? hits * 100 / (hits + misses) : 0);
+  seq_printf(sq, "PageCache:    %10lu kB\n", pcpages * PG_KB);
+  seq_printf(sq, "PageCacheHits:%10lu\n", pchits);
+  seq_printf(sq, "PageCacheMiss:%10lu\n", pcmisses);
+
+  // used% is how full the pages a class holds are, waste what the
+  // rest of them costs
+  seq_printf(sq, "\n%6s %8s %6s %6s %6s %10s\n",
+             "size", "objs", "pages", "capa", "used%", "waste_kB");
+  for (int i = 0; i < n; i++) {
+    uint64 slots = (uint64)kc[i].npages * kc[i].capa;
+    uint64 used = (uint64)kc[i].nobjs * kc[i].obj_size;
+    seq_printf(sq, "%6u %8u %6u %6u %6lu %10lu\n", kc[i].obj_size, kc[i].nobjs,
+               kc[i].npages, kc[i].capa, slots ? kc[i].nobjs * 100 / slots : 0,
+               ((uint64)kc[i].npages * PGSIZE - used) / 1024);
+  }
+}
+
+static void
+report_procs(struct seqbuf *sq)
+{
+  seq_printf(sq, "\n%-5s %-16s %10s %10s %10s %8s %8s\n",
+             "pid", "name", "vsz_kB", "rss_kB", "maxrss_kB", "minflt", "majflt");
+  for (struct proc *p = proc; p < &proc[NPROC]; p++) {
+    struct proc_memstat ms;
+    uint64 vsz, rss;
+    char name[16];
+    int pid;
+
+    // the walk doesn't sleep, and p->lock keeps p from being freed
+    acquire(&p->lock);
+    if (p->state == UNUSED || is_kthread(p)) {
+      release(&p->lock);
+      continue;
+    }
+    pid = p->pid;
+    vsz = memstat_vsz(p);
+    rss = memstat_rss(p);
+    ms = p->mem;
+    memmove(name, p->name, sizeof(name));
+    release(&p->lock);
+    name[sizeof(name) - 1] = 0;
+
+    seq_printf(sq, "%-5d %-16s %10lu %10lu %10lu %8lu %8lu\n", pid, name,
+               vsz * PG_KB, rss * PG_KB, ms.maxrss * PG_KB, ms.minflt, ms.majflt);
+  }
+}
+
+int
+meminforead(int user_dst, uint64 addr, uint64 off, int n)
+{
+  struct seqbuf sq;
+
+  seq_init(&sq, user_dst, addr, off, n);
+  report_mem(&sq);
+  report_procs(&sq);
+  return seq_result(&sq);
+}
+
+int
+meminfowrite(int user_dst, uint64 addr, int n)
+{
+  char cmd[16];
+  int len = n < sizeof(cmd) - 1 ? n : sizeof(cmd) - 1;
+
+  if (either_copyin(user_dst, cmd, addr, len) < 0)
+    return -1;
+  cmd[len] = 0;
+  if (len > 0 && cmd[len - 1] == '\n')
+    cmd[len - 1] = 0;
+
+  if (strncmp(cmd, "reset", sizeof(cmd)) == 0) {
+    bstat_reset();
+  } else {
+    __debug_warn("[meminfo] unknown command %s\n", cmd);
+    return -1;
+  }
+  return n;
+}
@@ -9,6 +9,8 @@
 #include "include/vm.h"
 #include "include/kalloc.h"
 #include "include/string.h"
+#include "include/file.h"
+#include "include/fat32.h"
 
 uint64 do_mmap_fix(uint64 start, uint64 len, int flags, int fd, off_t offset)
 {
@@ -43,7 +45,7 @@ uint64 do_mmap(uint64 start, uint64 len, int prot, int flags, int fd, off_t offs
         return -1;
     }
 
-    if(fd > NOFILEMAX(p))
+    if(fd >= NOFILEMAX(p))
     {
         __debug_warn("[do_mmap] fd illegal, fd(%d) > NOFILEMAX(%d)\n", fd, NOFILEMAX(p));
         return -1;
@@ -70,7 +72,7 @@ ignore_fd:
     if(prot & PROT_EXEC)
         perm  |= (PTE_X | PTE_A);
 
-    struct file *f = fd == -1 ? NULL : p->ofile[fd];
+    struct file *f = fd == -1 ? NULL : fdt_get(&p->fdt, fd);
     if(fd != -1 && f == NULL)
     {
         __debug_warn("[do_mmap] mmap file illegal\n");
@@ -83,13 +85,27 @@ ignore_fd:
         goto skip_vma;
     }
 
+    if(fd != -1 && (flags & MAP_PRIVATE) && f->type == FD_ENTRY && offset % PGSIZE == 0)
+    {
+        // shared libraries: the file's pages come from the page cache
+        // as they are touched, copy-on-write if the mapping is writable
+        struct vma *vma = alloc_file_mmap_vma(p, flags, start, len, perm, fd, offset, f->ep);
+        if(vma == NULL)
+        {
+            __debug_warn("[do_mmap] alloc mmap vma failed\n");
+            return -1;
+        }
+        filedup(f);
+        return vma->addr;
+    }
+
     struct vma *vma = alloc_mmap_vma(p, flags, start, len, perm, fd, offset);
-    start = vma->addr;
     if(vma == NULL)
     {
         __debug_warn("[do_mmap] alloc mmap vma failed\n");
         return -1;
     }
+    start = vma->addr;
 
     uint64 mmap_sz ;
 skip_vma:
@@ -113,7 +129,10 @@ skip_vma:
 
     for(int i = 0; i < page_n; ++i)
     {
-        uint64 pa = experm(p->pagetable, va, perm);
+        // a MAP_FIXED mapping can land on page cache pages
+        uint64 pa = uvmprivate(p->pagetable, va);
+        if(pa != NULL)
+            pa = experm(p->pagetable, va, perm);
         if(pa == NULL)
         {
             __debug_warn("[do_mmap] va = %p, pa not found\n", va);
@@ -170,7 +189,7 @@ uint64 do_munmap(struct proc* np,uint64 start, uint64 len)
         goto ignore_wb;
     }
 
-    struct file *f = p->ofile[vma->fd];
+    struct file *f = fdt_get(&p->fdt, vma->fd);
     if(f == NULL)
     {
         __debug_warn("[do_munmap] open file not found\n");
@@ -0,0 +1,113 @@
+//
+// The page cache behind ELF segments. A file's pages are found through
+// a two-level table off its dirent: a page of pointers to pages of
+// physical addresses, 512 file pages each. The cache holds one
+// reference to each page and every mapping another, so pages still
+// mapped outlive the cache dropping them.
+//
+// Callers hold ep's sleep lock, or ep->ref is 0 and nobody can.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/fat32.h"
+#include "include/pm.h"
+#include "include/kalloc.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/pagecache.h"
+
+#define PC_NENT   (PGSIZE / sizeof(uint64))
+
+static struct {
+  uint64 pages;
+  uint64 hits;
+  uint64 misses;
+} pcstat;
+
+// The physical address of page pgno of ep, read in if it wasn't
+// cached, with a reference for the caller to map or drop. *miss, if
+// miss isn't NULL, says whether it had to be read.
+// Bytes past the end of the file are 0. NULL if out of memory.
+uint64
+pcache_get(struct dirent *ep, uint pgno, int *miss)
+{
+  uint64 *leaf, pa;
+  uint n;
+
+  if (pgno >= PC_NENT * PC_NENT || (uint64)pgno * PGSIZE >= ep->file_size)
+    return NULL;
+  if (ep->pcache == NULL) {
+    if ((ep->pcache = allocpage()) == NULL)
+      return NULL;
+    memset(ep->pcache, 0, PGSIZE);
+  }
+  if ((leaf = ep->pcache[pgno / PC_NENT]) == NULL) {
+    if ((leaf = allocpage()) == NULL)
+      return NULL;
+    memset(leaf, 0, PGSIZE);
+    ep->pcache[pgno / PC_NENT] = leaf;
+  }
+
+  if ((pa = leaf[pgno % PC_NENT]) != NULL) {
+    __sync_fetch_and_add(&pcstat.hits, 1);
+    pagedup((void *)pa);
+    if (miss)
+      *miss = 0;
+    return pa;
+  }
+  __sync_fetch_and_add(&pcstat.misses, 1);
+  if ((pa = (uint64)allocpage()) == NULL)
+    return NULL;
+  n = eread(ep, 0, pa, pgno * PGSIZE, PGSIZE);
+  if (n == 0) {
+    __debug_warn("[pcache_get] read of page %d of %s failed\n", pgno, ep->filename);
+    freepage((void *)pa);
+    return NULL;
+  }
+  memset((void *)(pa + n), 0, PGSIZE - n);
+  leaf[pgno % PC_NENT] = pa;
+  __sync_fetch_and_add(&pcstat.pages, 1);
+  pagedup((void *)pa);
+  if (miss)
+    *miss = 1;
+  return pa;
+}
+
+// Forget ep's pages, and the headers exec() parsed, as the file has
+// changed or the dirent is going to another; processes that have the
+// pages mapped keep them.
+void
+pcache_drop(struct dirent *ep)
+{
+  uint64 *leaf;
+
+  if (ep->elfcache) {
+    kfree(ep->elfcache);
+    ep->elfcache = NULL;
+  }
+  if (ep->pcache == NULL)
+    return;
+  for (int i = 0; i < PC_NENT; i++) {
+    if ((leaf = ep->pcache[i]) == NULL)
+      continue;
+    for (int j = 0; j < PC_NENT; j++) {
+      if (leaf[j]) {
+        freepage((void *)leaf[j]);
+        __sync_fetch_and_sub(&pcstat.pages, 1);
+      }
+    }
+    freepage(leaf);
+  }
+  freepage(ep->pcache);
+  ep->pcache = NULL;
+}
+
+void
+pcache_stat(uint64 *pages, uint64 *hits, uint64 *misses)
+{
+  *pages = pcstat.pages;
+  *hits = pcstat.hits;
+  *misses = pcstat.misses;
+}
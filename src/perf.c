@@ -0,0 +1,347 @@
+//
+// perf -- per-process hardware counters on top of the SBI PMU
+// extension.
+//
+// Each hart configures a counter for an event the first time a
+// process that wants it runs there, and leaves it running from then
+// on. A process's events are virtualized by reading the counters
+// when it is switched in and folding the difference into the event
+// when it is switched out, so a context switch costs two counter
+// reads per event and no SBI calls.
+//
+// Without the PMU extension, cycles and instret are still available
+// straight from their CSRs.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/file.h"
+#include "include/kalloc.h"
+#include "include/copy.h"
+#include "include/errno.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/sbi.h"
+#include "include/perf.h"
+
+#define PMU_MAX_COUNTERS  64
+
+#define CSR_CYCLE         0xc00
+#define CSR_INSTRET       0xc02
+
+enum { SLOT_NONE, SLOT_CSR, SLOT_FW, SLOT_FAIL };
+
+// where an event is counted on one hart
+struct pmu_slot {
+  int state;
+  int idx;          // CSR number, or SBI counter index for SLOT_FW
+  uint64 mask;      // the counter's width
+};
+
+static struct {
+  int sbi;                          // the PMU extension is there
+  int ncounters;
+  uint64 info[PMU_MAX_COUNTERS];    // counter_get_info() of each
+} pmu;
+
+static struct pmu_slot pmu_slots[NCPU][PERF_COUNT_HW_MAX];
+
+// guards every proc's perf list and the events on it
+static struct spinlock perf_lock;
+
+static const int sbi_event[PERF_COUNT_HW_MAX] = {
+  [PERF_COUNT_HW_CPU_CYCLES]          SBI_PMU_HW_CPU_CYCLES,
+  [PERF_COUNT_HW_INSTRUCTIONS]        SBI_PMU_HW_INSTRUCTIONS,
+  [PERF_COUNT_HW_CACHE_REFERENCES]    SBI_PMU_HW_CACHE_REFERENCES,
+  [PERF_COUNT_HW_CACHE_MISSES]        SBI_PMU_HW_CACHE_MISSES,
+  [PERF_COUNT_HW_BRANCH_INSTRUCTIONS] SBI_PMU_HW_BRANCH_INSTRUCTIONS,
+  [PERF_COUNT_HW_BRANCH_MISSES]       SBI_PMU_HW_BRANCH_MISSES,
+};
+
+void
+perf_init(void)
+{
+  initlock(&perf_lock, "perf");
+  if (!sbi_probe_extension(SBI_EXT_PMU)) {
+    __debug_info("[perf_init] no SBI PMU, cycles and instret only\n");
+    return;
+  }
+
+  struct sbiret ret = sbi_pmu_num_counters();
+  if (ret.error)
+    return;
+  pmu.ncounters = ret.value < PMU_MAX_COUNTERS ? ret.value : PMU_MAX_COUNTERS;
+  for (int i = 0; i < pmu.ncounters; i++) {
+    ret = sbi_pmu_counter_get_info(i);
+    pmu.info[i] = ret.error ? 0 : ret.value;
+  }
+  pmu.sbi = 1;
+  __debug_info("[perf_init] SBI PMU, %d counters\n", pmu.ncounters);
+}
+
+// Find or set up this hart's counter for `hw`. Called with
+// interrupts off.
+static struct pmu_slot *
+pmu_slot(int hw)
+{
+  struct pmu_slot *s = &pmu_slots[cpuid()][hw];
+
+  if (s->state != SLOT_NONE)
+    return s;
+
+  s->state = SLOT_FAIL;
+  if (pmu.sbi) {
+    uint64 mask = pmu.ncounters >= 64 ? ~0UL : (1UL << pmu.ncounters) - 1;
+    struct sbiret ret = sbi_pmu_counter_config_matching(0, mask,
+                          SBI_PMU_CFG_FLAG_CLEAR_VALUE | SBI_PMU_CFG_FLAG_AUTO_START,
+                          sbi_event[hw], 0);
+    if (ret.error == 0 && ret.value < pmu.ncounters) {
+      uint64 info = pmu.info[ret.value];
+      int width = SBI_PMU_INFO_WIDTH(info);
+      if (SBI_PMU_INFO_FW(info)) {
+        s->state = SLOT_FW;
+        s->idx = ret.value;
+      } else {
+        s->state = SLOT_CSR;
+        s->idx = SBI_PMU_INFO_CSR(info);
+      }
+      s->mask = width >= 64 ? ~0UL : (1UL << width) - 1;
+      return s;
+    }
+  }
+
+  // these two are always there
+  if (hw == PERF_COUNT_HW_CPU_CYCLES || hw == PERF_COUNT_HW_INSTRUCTIONS) {
+    s->state = SLOT_CSR;
+    s->idx = hw == PERF_COUNT_HW_CPU_CYCLES ? CSR_CYCLE : CSR_INSTRET;
+    s->mask = ~0UL;
+  }
+  return s;
+}
+
+#define CSR_READ_CASE(n) \
+  case CSR_CYCLE + n: asm volatile("csrr %0, %1" : "=r" (x) : "i" (CSR_CYCLE + n)); break;
+
+// Read user-level counter CSR `csr`, cycle through hpmcounter31.
+static uint64
+read_counter_csr(int csr)
+{
+  uint64 x = 0;
+
+  switch (csr) {
+  CSR_READ_CASE(0)  CSR_READ_CASE(1)  CSR_READ_CASE(2)  CSR_READ_CASE(3)
+  CSR_READ_CASE(4)  CSR_READ_CASE(5)  CSR_READ_CASE(6)  CSR_READ_CASE(7)
+  CSR_READ_CASE(8)  CSR_READ_CASE(9)  CSR_READ_CASE(10) CSR_READ_CASE(11)
+  CSR_READ_CASE(12) CSR_READ_CASE(13) CSR_READ_CASE(14) CSR_READ_CASE(15)
+  CSR_READ_CASE(16) CSR_READ_CASE(17) CSR_READ_CASE(18) CSR_READ_CASE(19)
+  CSR_READ_CASE(20) CSR_READ_CASE(21) CSR_READ_CASE(22) CSR_READ_CASE(23)
+  CSR_READ_CASE(24) CSR_READ_CASE(25) CSR_READ_CASE(26) CSR_READ_CASE(27)
+  CSR_READ_CASE(28) CSR_READ_CASE(29) CSR_READ_CASE(30) CSR_READ_CASE(31)
+  }
+  return x;
+}
+
+static uint64
+pmu_read(struct pmu_slot *s)
+{
+  if (s->state == SLOT_CSR)
+    return read_counter_csr(s->idx);
+  if (s->state == SLOT_FW)
+    return sbi_pmu_counter_fw_read(s->idx).value;
+  return 0;
+}
+
+// Start counting ev on this hart. Caller holds perf_lock.
+static void
+ev_start(struct perf_event *ev)
+{
+  struct pmu_slot *s = pmu_slot(ev->hw);
+
+  if (s->state == SLOT_CSR || s->state == SLOT_FW) {
+    ev->start = pmu_read(s);
+    ev->running = 1;
+  }
+}
+
+// What ev counted since ev_start(), on the same hart.
+static uint64
+ev_delta(struct perf_event *ev)
+{
+  struct pmu_slot *s = pmu_slot(ev->hw);
+
+  return (pmu_read(s) - ev->start) & s->mask;
+}
+
+static void
+ev_stop(struct perf_event *ev)
+{
+  if (ev->running) {
+    ev->count += ev_delta(ev);
+    ev->running = 0;
+  }
+}
+
+void
+perf_proc_init(struct proc *p)
+{
+  list_init(&p->perf);
+}
+
+// p is going away; its events keep their counts for whoever still
+// has them open.
+void
+perf_proc_exit(struct proc *p)
+{
+  acquire(&perf_lock);
+  while (!list_empty(&p->perf)) {
+    struct list *l = list_next(&p->perf);
+    struct perf_event *ev = dlist_entry(l, struct perf_event, entry);
+    ev_stop(ev);
+    ev->owner = NULL;
+    list_del(l);
+  }
+  release(&perf_lock);
+}
+
+// The scheduler is about to run p on this hart.
+void
+perf_switch_in(struct proc *p)
+{
+  if (list_empty(&p->perf))
+    return;
+  acquire(&perf_lock);
+  for (struct list *l = list_next(&p->perf); l != &p->perf; l = list_next(l)) {
+    struct perf_event *ev = dlist_entry(l, struct perf_event, entry);
+    if (ev->enabled)
+      ev_start(ev);
+  }
+  release(&perf_lock);
+}
+
+// p just came back to the scheduler, on the hart it was switched in on.
+void
+perf_switch_out(struct proc *p)
+{
+  if (list_empty(&p->perf))
+    return;
+  acquire(&perf_lock);
+  for (struct list *l = list_next(&p->perf); l != &p->perf; l = list_next(l))
+    ev_stop(dlist_entry(l, struct perf_event, entry));
+  release(&perf_lock);
+}
+
+int
+perf_event_alloc(struct perf_event_attr *attr, struct proc *owner, struct file **f)
+{
+  struct perf_event *ev;
+  struct pmu_slot *s;
+
+  if (attr->type != PERF_TYPE_HARDWARE || attr->config >= PERF_COUNT_HW_MAX)
+    return -ENOENT;
+  // counters are shared by all processes on a hart, so they can't
+  // be told to skip a privilege level for one of them
+  if (attr->flags & (PERF_ATTR_EXCLUDE_USER | PERF_ATTR_EXCLUDE_KERNEL))
+    return -EOPNOTSUPP;
+
+  push_off();
+  s = pmu_slot(attr->config);
+  pop_off();
+  if (s->state == SLOT_FAIL)
+    return -ENOENT;
+
+  if ((ev = kmalloc(sizeof(struct perf_event))) == NULL)
+    return -ENOMEM;
+  if ((*f = filealloc()) == NULL) {
+    kfree(ev);
+    return -ENOMEM;
+  }
+  memset(ev, 0, sizeof(*ev));
+  ev->hw = attr->config;
+  ev->owner = owner;
+  ev->enabled = !(attr->flags & PERF_ATTR_DISABLED);
+
+  (*f)->type = FD_PERF;
+  (*f)->readable = 1;
+  (*f)->writable = 0;
+  (*f)->perf = ev;
+
+  acquire(&perf_lock);
+  list_add_before(&owner->perf, &ev->entry);
+  // the owner is us, and running right here
+  if (ev->enabled)
+    ev_start(ev);
+  release(&perf_lock);
+  return 0;
+}
+
+void
+perf_event_close(struct perf_event *ev)
+{
+  acquire(&perf_lock);
+  if (ev->owner)
+    list_del(&ev->entry);
+  release(&perf_lock);
+  kfree(ev);
+}
+
+// Only the owner can see the counts of the slice it's in; anyone
+// else gets them as of the owner's last switch.
+static uint64
+ev_count(struct perf_event *ev)
+{
+  uint64 count = ev->count;
+
+  if (ev->running && ev->owner == myproc())
+    count += ev_delta(ev);
+  return count;
+}
+
+int
+perf_event_read(struct perf_event *ev, int user_dst, uint64 addr, int n)
+{
+  uint64 count;
+
+  if (n < sizeof(count))
+    return -EINVAL;
+  acquire(&perf_lock);
+  count = ev_count(ev);
+  release(&perf_lock);
+  if (either_copyout(user_dst, addr, &count, sizeof(count)) < 0)
+    return -EFAULT;
+  return sizeof(count);
+}
+
+int
+perf_event_ioctl(struct perf_event *ev, uint64 request)
+{
+  int self;
+
+  acquire(&perf_lock);
+  self = ev->owner == myproc();
+  switch (request) {
+  case PERF_EVENT_IOC_ENABLE:
+    if (!ev->enabled && self)
+      ev_start(ev);
+    ev->enabled = 1;
+    break;
+  case PERF_EVENT_IOC_DISABLE:
+    if (self)
+      ev_stop(ev);
+    ev->enabled = 0;
+    break;
+  case PERF_EVENT_IOC_RESET:
+    ev->count = 0;
+    if (ev->running && self)
+      ev_start(ev);
+    break;
+  default:
+    release(&perf_lock);
+    return -ENOTTY;
+  }
+  release(&perf_lock);
+  return 0;
+}
@@ -66,39 +66,50 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// Data goes through a buffer on the stack, as either_copyin() and
+// either_copyout() may fault a page in and sleep, so they can't run
+// under pi->lock. The lock is held for one buffer at a time.
+#define PIPE_COPY 128
+
 int
 pipewrite(struct pipe *pi, int user, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i = 0, j, m;
+  char buf[PIPE_COPY];
   struct proc *pr = myproc();
   
-  printf("[pipe]nread %d nwrite %d n %p\n", pi->nread, pi->nwrite, n);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
+  //printf("[pipe]nread %d nwrite %d n %p\n", pi->nread, pi->nwrite, n);
+  while(i < n){
+    m = MIN(n - i, PIPE_COPY);
+    if(either_copyin(user, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; j++){
+      while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(pi->readopen == 0 || pr->killed){
+          release(&pi->lock);
+          return -1;
+        }
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      pi->data[pi->nwrite++ % PIPESIZE] = buf[j];
     }
-    // if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-    if(either_copyin(user,&ch, addr + i, 1) == -1)
-      break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
   return i;
 }
 
 int
 piperead(struct pipe *pi, int user, uint64 addr, int n)
 {
-  int i;
+  int i = 0, m;
+  char buf[PIPE_COPY];
   struct proc *pr = myproc();
-  char ch;
 
+  acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
@@ -106,15 +117,16 @@ piperead(struct pipe *pi, int user, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-   
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    // if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-    if(either_copyout(user, addr + i, &ch, 1) == -1)
-      break;
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    for(m = 0; m < PIPE_COPY && i + m < n && pi->nread != pi->nwrite; m++)
+      buf[m] = pi->data[pi->nread++ % PIPESIZE];
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    release(&pi->lock);
+    if(either_copyout(user, addr + i, buf, m) == -1)
+      return i;
+    i += m;
+    acquire(&pi->lock);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  release(&pi->lock);
   return i;
 }
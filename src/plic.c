@@ -0,0 +1,49 @@
+#include "include/types.h"
+#include "include/param.h"
+#include "include/memlayout.h"
+#include "include/riscv.h"
+#include "include/plic.h"
+#include "include/printf.h"
+
+//
+// the riscv Platform Level Interrupt Controller (PLIC).
+//
+
+void
+plicinit(void)
+{
+  // set desired IRQ priorities non-zero (otherwise disabled).
+  *(uint32*)(PLIC_V + UART0_IRQ*4) = 1;
+  *(uint32*)(PLIC_V + SPI2_IRQ*4) = 1;
+  __debug_info("plicinit\n");
+}
+
+void
+plicinithart(void)
+{
+  int hart = r_tp();
+
+  // set enable bits for this hart's S-mode
+  // for the uart and the sd card's spi.
+  *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << SPI2_IRQ);
+
+  // set this hart's S-mode priority threshold to 0.
+  *(uint32*)PLIC_SPRIORITY(hart) = 0;
+}
+
+// ask the PLIC what interrupt we should serve.
+int
+plic_claim(void)
+{
+  int hart = r_tp();
+  int irq = *(uint32*)PLIC_SCLAIM(hart);
+  return irq;
+}
+
+// tell the PLIC we've served this IRQ.
+void
+plic_complete(int irq)
+{
+  int hart = r_tp();
+  *(uint32*)PLIC_SCLAIM(hart) = irq;
+}
@@ -13,17 +13,26 @@
 #include "include/string.h"
 #include "include/printf.h"
 
+extern char kernel_end[]; // first address after kernel.
+
+// References to each page: allocpage() gives out the first, pagedup()
+// adds one for every other page table or cache that holds the page,
+// and freepage() only frees it when the last one goes.
+static uint32 pagerefs[(PHYSTOP - KERNBASE) / PGSIZE];
+
+#define PAGEREF(pa)	pagerefs[((uint64)(pa) - KERNBASE) / PGSIZE]
+
 static void
 freerange(void *pa_start, void *pa_end)
 {
 	char *p;
 	p = (char*)PGROUNDUP((uint64)pa_start);
-	for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+	for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+		PAGEREF(p) = 1;
 		freepage(p);
+	}
 }
 
-extern char kernel_end[]; // first address after kernel.
-
 struct run {
 	struct run *next;
 };
@@ -32,6 +41,7 @@ static struct {
 	struct spinlock lock;
 	struct run *freelist;
 	uint64 npage;
+	uint64 total;		// pages handed over by kpminit()
 } kmem;
 
 int frees;
@@ -45,6 +55,7 @@ kpminit()
 	kmem.npage = 0;
 	allocs = frees = 0;
 	freerange(kernel_end, (void*)PHYSTOP);
+	kmem.total = kmem.npage;
 	__debug_info("kpminit kernel_end: %p, phystop: %p, npage %d allocator:%p\n", kernel_end, (void*)PHYSTOP, kmem.npage,&kmem);
 }
 
@@ -60,6 +71,11 @@ freepage(void *pa)
 	if(((uint64)pa % PGSIZE) != 0 || (char*)pa < kernel_end || (uint64)pa >= PHYSTOP)
 		panic("freepage");
 
+	if(PAGEREF(pa) == 0)
+		panic("freepage: free already");
+	if(__sync_sub_and_fetch(&PAGEREF(pa), 1) != 0)
+		return;
+
 	// Fill with junk to catch dangling refs.
 	memset(pa, 1, PGSIZE);
 
@@ -86,6 +102,7 @@ allocpage(void)
 	if (r) {
 		kmem.freelist = r->next;
 		kmem.npage--;
+		PAGEREF(r) = 1;
 	}
 	release(&kmem.lock);
 
@@ -98,6 +115,21 @@ allocpage(void)
 	return (void*)r;
 }
 
+// One more reference to an allocated page.
+void
+pagedup(void *pa)
+{
+	if(((uint64)pa % PGSIZE) != 0 || (char*)pa < kernel_end || (uint64)pa >= PHYSTOP)
+		panic("pagedup");
+	__sync_fetch_and_add(&PAGEREF(pa), 1);
+}
+
+int
+pageref(void *pa)
+{
+	return PAGEREF(pa);
+}
+
 void
 checkmemlist(void* pa){
 	struct run* r = kmem.freelist;
@@ -115,3 +147,8 @@ idlepages(void)
 	return kmem.npage;
 }
 
+uint64
+totalpages(void)
+{
+	return kmem.total;
+}
@@ -11,6 +11,10 @@
 #include "include/console.h"
 #include "include/sbi.h"
 #include "include/printf.h"
+#include "include/klog.h"
+#include "include/copy.h"
+#include "include/seqbuf.h"
+#include "include/string.h"
 
 volatile int panicked = 0;
 
@@ -18,11 +22,16 @@ static char digits[] = "0123456789abcdef";
 static char warningstr[] = "[WARNING]";
 static char errorstr[] = "[ERROR]";
 
-// lock to avoid interleaving concurrent printf's.
-static struct {
-  struct spinlock lock;
-  int locking;
-} pr;
+// Formatted text is collected here and handed to the kernel log
+// a line, or a record's worth, at a time. With `str` set it goes to
+// that string instead, as snprintf() does.
+struct printbuf {
+  int level;
+  int len;
+  char buf[KLOG_TEXT];
+  char *str;
+  int size;
+};
 
 void consputc(int c) {
   if(c == BACKSPACE){
@@ -35,19 +44,43 @@ void consputc(int c) {
   }
 }
 
-void printstring(const char* s) {
-    while (*s)
-    {
-        consputc(*s++);
-    }
+static void
+flush(struct printbuf *pb)
+{
+  if(pb->len > 0)
+    klog_write(pb->level, pb->buf, pb->len);
+  pb->len = 0;
 }
 
 static void
-printint(int xx, int base, int sign)
+putch(struct printbuf *pb, int c)
 {
-  char buf[16];
-  int i;
-  uint x;
+  if(pb->str){
+    // count everything, keep what fits
+    if(pb->len < pb->size - 1)
+      pb->str[pb->len] = c;
+    pb->len++;
+    return;
+  }
+  pb->buf[pb->len++] = c;
+  if(pb->len == KLOG_TEXT || c == '\n')
+    flush(pb);
+}
+
+static void
+putstr(struct printbuf *pb, const char *s)
+{
+  while(*s)
+    putch(pb, *s++);
+}
+
+// Lay out x in base `base` at buf, returning its length.
+static int
+fmtint(char *buf, long xx, int base, int sign)
+{
+  char tmp[24];
+  int i, n;
+  uint64 x;
 
   if(sign && (sign = xx < 0))
     x = -xx;
@@ -56,92 +89,237 @@ printint(int xx, int base, int sign)
 
   i = 0;
   do {
-    buf[i++] = digits[x % base];
+    tmp[i++] = digits[x % base];
   } while((x /= base) != 0);
 
   if(sign)
-    buf[i++] = '-';
+    tmp[i++] = '-';
 
-  while(--i >= 0)
-    consputc(buf[i]);
+  for(n = 0; --i >= 0; n++)
+    buf[n] = tmp[i];
+  return n;
 }
 
-
 static void
-printptr(uint64 x)
+printptr(struct printbuf *pb, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  putch(pb, '0');
+  putch(pb, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putch(pb, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
-void
-printf(char *fmt, ...)
+// Put s, padded to `width`: on the right with '-', with zeros given '0'.
+static void
+putpad(struct printbuf *pb, const char *s, int len, int width, int left, int zero)
 {
-  va_list ap;
-  int i, c;
-  int locking;
+  int pad = width > len ? width - len : 0;
+
+  if(!left){
+    // a sign goes before the zeros
+    if(zero && len > 0 && *s == '-'){
+      putch(pb, *s++);
+      len--;
+    }
+    while(pad-- > 0)
+      putch(pb, zero ? '0' : ' ');
+  }
+  while(len-- > 0)
+    putch(pb, *s++);
+  while(left && pad-- > 0)
+    putch(pb, ' ');
+}
+
+// only understands %c, %d, %u, %x, %p, %s, with an optional 'l' for
+// 64 bits and a width with '-' or '0' flags, as in "%-16s" or "%08lx".
+static void
+vformat(struct printbuf *pb, char *fmt, va_list ap)
+{
+  int i, c, l, left, zero, width, len;
+  char num[24];
   char *s;
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-  
+
   if (fmt == 0)
     panic("null fmt");
 
-  va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      putch(pb, c);
       continue;
     }
     c = fmt[++i] & 0xff;
+    left = zero = width = 0;
+    for(; c == '-' || c == '0'; c = fmt[++i] & 0xff){
+      if(c == '-')
+        left = 1;
+      else
+        zero = 1;
+    }
+    for(; c >= '0' && c <= '9'; c = fmt[++i] & 0xff)
+      width = width * 10 + c - '0';
+    if((l = (c == 'l')))
+      c = fmt[++i] & 0xff;
     if(c == 0)
       break;
     switch(c){
     case 'c':
-      consputc(va_arg(ap, int));
+      putch(pb, va_arg(ap, int));
       break;
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      len = fmtint(num, l ? va_arg(ap, long) : va_arg(ap, int), 10, 1);
+      putpad(pb, num, len, width, left, zero);
+      break;
+    case 'u':
+      len = fmtint(num, l ? va_arg(ap, uint64) : va_arg(ap, uint), 10, 0);
+      putpad(pb, num, len, width, left, zero);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      if(l)
+        len = fmtint(num, va_arg(ap, uint64), 16, 0);
+      else
+        len = fmtint(num, va_arg(ap, int), 16, 1);
+      putpad(pb, num, len, width, left, zero);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      printptr(pb, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
-      for(; *s; s++)
-        consputc(*s);
+      putpad(pb, s, strlen(s), width, left, 0);
       break;
     case '%':
-      consputc('%');
+      putch(pb, '%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      putch(pb, '%');
+      putch(pb, c);
       break;
     }
-    
   }
-  if(locking)
-    release(&pr.lock);
-    
+}
+
+static void
+vprintk(int level, const char *prefix, char *fmt, va_list ap)
+{
+  struct printbuf pb;
+
+  pb.level = level;
+  pb.len = 0;
+  pb.str = 0;
+  if(prefix)
+    putstr(&pb, prefix);
+  vformat(&pb, fmt, ap);
+  flush(&pb);
+}
+
+// Format into buf, which always ends up NUL-terminated. Returns the
+// length the whole output would have had.
+static int
+vsnprintf(char *buf, int size, char *fmt, va_list ap)
+{
+  struct printbuf pb;
+
+  pb.str = buf;
+  pb.size = size;
+  pb.len = 0;
+  vformat(&pb, fmt, ap);
+  if(size > 0)
+    buf[pb.len < size ? pb.len : size - 1] = 0;
+  return pb.len;
+}
+
+int
+snprintf(char *buf, int size, char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+void
+seq_init(struct seqbuf *s, int user_dst, uint64 dst, uint64 off, int n)
+{
+  s->user_dst = user_dst;
+  s->dst = dst;
+  s->off = off;
+  s->n = n;
+  s->pos = 0;
+  s->copied = 0;
+  s->err = 0;
+}
+
+void
+seq_printf(struct seqbuf *s, char *fmt, ...)
+{
+  char line[SEQ_LINE_MAX];
+  va_list ap;
+  int len;
+
+  if(s->err || s->copied == s->n)
+    return;
+  va_start(ap, fmt);
+  len = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if(len > sizeof(line) - 1)
+    len = sizeof(line) - 1;
+
+  // copy the part of [pos, pos + len) that falls in [off + copied, off + n)
+  uint64 from = s->off + s->copied;
+  if(from < s->pos + len && from >= s->pos){
+    int m = s->pos + len - from;
+    if(m > s->n - s->copied)
+      m = s->n - s->copied;
+    if(either_copyout(s->user_dst, s->dst + s->copied, line + (from - s->pos), m) < 0){
+      s->err = 1;
+      return;
+    }
+    s->copied += m;
+  }
+  s->pos += len;
+}
+
+int
+seq_result(struct seqbuf *s)
+{
+  if(s->err && s->copied == 0)
+    return -1;
+  return s->copied;
+}
+
+static void
+printk(int level, const char *prefix, char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintk(level, prefix, fmt, ap);
+  va_end(ap);
+}
+
+// Print to the console through the kernel log.
+void
+printf(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintk(KLOG_NOTICE, 0, fmt, ap);
+  va_end(ap);
 }
 
 void
 panic(char *s)
 {
-  printf("panic: ");
-  printf(s);
-  printf("\n");
+  // print everything from here on right away, nobody else will
+  klog_sync();
+  printk(KLOG_EMERG, "panic: ", "%s\n", s);
   backtrace();
   panicked = 1; // freeze uart output from other CPUs
   for(;;)
@@ -164,115 +342,21 @@ void
 __debug_info(char *fmt, ...){
 #ifdef DEBUG
   va_list ap;
-  int i, c;
-  int locking;
-  char *s;
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-  
-  if (fmt == 0)
-    panic("null fmt");
 
   va_start(ap, fmt);
-  for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
-    if(c != '%'){
-      consputc(c);
-      continue;
-    }
-    c = fmt[++i] & 0xff;
-    if(c == 0)
-      break;
-    switch(c){
-    case 'c':
-      consputc(va_arg(ap, int));
-      break;
-    case 'd':
-      printint(va_arg(ap, int), 10, 1);
-      break;
-    case 'x':
-      printint(va_arg(ap, int), 16, 1);
-      break;
-    case 'p':
-      printptr(va_arg(ap, uint64));
-      break;
-    case 's':
-      if((s = va_arg(ap, char*)) == 0)
-        s = "(null)";
-      for(; *s; s++)
-        consputc(*s);
-      break;
-    case '%':
-      consputc('%');
-      break;
-    default:
-      // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
-      break;
-    }
-    
-  }
-  if(locking)
-    release(&pr.lock);
-#endif    
+  vprintk(KLOG_INFO, 0, fmt, ap);
+  va_end(ap);
+#endif
 }
 
 void
 __debug_warn(char *fmt, ...){
 #ifdef WARNING
   va_list ap;
-  int i, c;
-  int locking;
-  char *s;
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-  
-  if (fmt == 0)
-    panic("null fmt");
-  printstring(warningstr);
+
   va_start(ap, fmt);
-  for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
-    if(c != '%'){
-      consputc(c);
-      continue;
-    }
-    c = fmt[++i] & 0xff;
-    if(c == 0)
-      break;
-    switch(c){
-    case 'c':
-      consputc(va_arg(ap, int));
-      break;
-    case 'd':
-      printint(va_arg(ap, int), 10, 1);
-      break;
-    case 'x':
-      printint(va_arg(ap, int), 16, 1);
-      break;
-    case 'p':
-      printptr(va_arg(ap, uint64));
-      break;
-    case 's':
-      if((s = va_arg(ap, char*)) == 0)
-        s = "(null)";
-      for(; *s; s++)
-        consputc(*s);
-      break;
-    case '%':
-      consputc('%');
-      break;
-    default:
-      // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
-      break;
-    }
-    
-  }
-  if(locking)
-    release(&pr.lock);
+  vprintk(KLOG_WARNING, warningstr, fmt, ap);
+  va_end(ap);
 #endif
 }
 
@@ -280,72 +364,23 @@ void
 __debug_error(char *fmt, ...){
 #ifdef ERROR
   va_list ap;
-  int i, c;
-  int locking;
-  char *s;
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-  
-  if (fmt == 0)
-    panic("null fmt");
 
-  printstring(errorstr);
+  klog_sync();
   va_start(ap, fmt);
-  for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
-    if(c != '%'){
-      consputc(c);
-      continue;
-    }
-    c = fmt[++i] & 0xff;
-    if(c == 0)
-      break;
-    switch(c){
-    case 'c':
-      consputc(va_arg(ap, int));
-      break;
-    case 'd':
-      printint(va_arg(ap, int), 10, 1);
-      break;
-    case 'x':
-      printint(va_arg(ap, int), 16, 1);
-      break;
-    case 'p':
-      printptr(va_arg(ap, uint64));
-      break;
-    case 's':
-      if((s = va_arg(ap, char*)) == 0)
-        s = "(null)";
-      for(; *s; s++)
-        consputc(*s);
-      break;
-    case '%':
-      consputc('%');
-      break;
-    default:
-      // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
-      break;
-    }
-    
-  }
-  if(locking)
-    release(&pr.lock);
-  
+  vprintk(KLOG_ERR, errorstr, fmt, ap);
+  va_end(ap);
+
   backtrace();
   panicked = 1; // freeze uart output from other CPUs
   for(;;)
     ;
-    
 #endif
 }
 
 void
 printfinit(void)
 {
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;   // changed, used to be 1
+  klog_init();
 }
 
 #ifdef SIFIVE_U
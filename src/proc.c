@@ -8,6 +8,12 @@
 #include "include/intr.h"
 #include "include/kalloc.h"
 #include "include/printf.h"
+#include "include/klog.h"
+#include "include/trace.h"
+#include "include/sysstat.h"
+#include "include/schedstat.h"
+#include "include/perf.h"
+#include "include/memstat.h"
 #include "include/string.h"
 #include "include/copy.h"
 #include "include/file.h"
@@ -98,6 +104,7 @@ delwaitq(queue* q){
 
 void
 readyq_push(struct proc* p){
+  schedstat_enqueue(p);
   queue_push(&readyq,p);
 }
 
@@ -132,13 +139,22 @@ void scheduler(){
         // printf("[scheduler]found runnable proc with pid: %d\n", p->pid);
         p->state = RUNNING;
         c->proc = p;
-        w_satp(MAKE_SATP(p->pagetable));
-        sfence_vma();
+        schedstat_switch_in(p, queue_len(&readyq));
+        perf_switch_in(p);
+        trace(TRACE_SCHED_SWITCH, p->pid, 0);
+        // kernel threads stay on the kernel page table
+        if(p->pagetable){
+          w_satp(MAKE_SATP(p->pagetable));
+          sfence_vma();
+        }
         swtch(&c->context, &p->context);
         w_satp(MAKE_SATP(kernel_pagetable));
         sfence_vma();
         // Process is done running for now.
         // It should have changed its p->state before coming back.
+        perf_switch_out(p);
+        schedstat_switch_out(p);
+        trace(TRACE_SCHED_SWITCH, 0, p->pid);
         c->proc = 0;
 
         // found = 1;
@@ -146,7 +162,10 @@ void scheduler(){
       release(&p->lock);
     }else{
       intr_on();
+      klog_drain();
+      schedstat_idle_enter();
       asm volatile("wfi");
+      schedstat_idle_exit();
     }
   }
 }
@@ -175,11 +194,7 @@ freeproc(struct proc *p)
   p->trapframe = 0;
   if(p->mf)
     free_map_fix(p);
-  if(p->ofile)
-    kfree((void*)p->ofile);
-  if(p->ofile)
-    kfree((void*)p->exec_close);
-  p->ofile = 0;
+  fdt_free(&p->fdt);
   if(p->kstack)
     freepage((void *)p->kstack);
   if(p->pagetable)
@@ -189,6 +204,7 @@ freeproc(struct proc *p)
   p->vma = NULL;
   // how to handle robust_list?
   p->robust_list = NULL;
+  p->plug = NULL;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -199,10 +215,18 @@ freeproc(struct proc *p)
   p->state = UNUSED;
 
   // free signal 
-  sigaction_free(p->sig_act);
+  sighand_put(p->sighand);
+  p->sighand = NULL;
 
   // free the list of sig_frame 
   sigframefree(p->sig_frame);
+  p->sig_frame = NULL;
+
+  sysstat_free(p);
+  perf_proc_exit(p);
+
+  p->kfn = NULL;
+  p->karg = NULL;
 }
 
 // Look in the process table for an UNUSED proc.
@@ -230,12 +254,19 @@ found:
   p->mf = NULL;
   p->filelimit = NOFILE;
   p->robust_list = NULL;
+  p->plug = NULL;
+  p->elocked = NULL;
   p->clear_child_tid = NULL;
   p->set_child_tid = NULL;
   p->vma = NULL;
   p->uid = 0;
   p->gid = 0;
   p->q = NULL;
+  p->sysstat = NULL;
+  perf_proc_init(p);
+  p->kfn = NULL;
+  p->karg = NULL;
+  fdt_init(&p->fdt);
   // Allocate a trapframe page.
   if((p->trapframe = allocpage()) == NULL){
     release(&p->lock);
@@ -252,19 +283,6 @@ found:
     release(&p->lock);
     return NULL;
   }
-  p->ofile = kmalloc(NOFILE*sizeof(struct file*));
-  p->exec_close = kmalloc(NOFILE*sizeof(int));
-  
-  if(!p->ofile){
-    panic("proc ofile init\n");
-  }
-  
-  for(int fd = 0; fd < NOFILE; fd++){
-    p->ofile[fd] = NULL;
-    p->exec_close[fd] = 0;
-  }
-  
-  memset(p->ofile, 0, NOFILE*sizeof(struct file*));
 /*
   for(int i = 0; i < MMAPNUM; ++i){
     p->mmap_pool[i].used = 0;
@@ -280,11 +298,16 @@ found:
   p->proc_tms.stime = 0;
   p->proc_tms.cutime = 1;
   p->proc_tms.cstime = 1;
+  schedstat_fork(p);
+  memset(&p->mem, 0, sizeof(p->mem));
+  // what fork copied or shared counts from the start
+  memstat_rss(p);
 
-  p->sig_act = NULL;
+  p->sighand = NULL;
   p->sig_frame = NULL;
   for (int i = 0; i < SIGSET_LEN; i ++) {
 	p->sig_pending.__val[i] = 0;
+	p->sig_set.__val[i] = 0;
   }
   p->killed = 0;
   
@@ -400,18 +423,119 @@ userinit()
   readyq_push(p);//insert to ready queue
   p->tmask = 0;
   p->cwd = ename(NULL,"/",0);
+  if((p->sighand = sighand_alloc()) == NULL)
+    panic("userinit sighand");
 
   release(&p->lock);
   __debug_info("userinit\n");
 }
 
+// A kernel thread's very first scheduling swtches here.
+static void
+kthread_entry(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  intr_on();
+  p->kfn(p->karg);
+  kthread_exit();
+}
+
+// Start a kernel thread running fn(arg). It has a kernel stack and
+// nothing else: no user memory, no trapframe, no files, and it runs
+// on the kernel page table until fn returns.
+struct proc*
+kthread_create(char *name, void (*fn)(void *), void *arg)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if(p->state == UNUSED) {
+      goto found;
+    } else {
+      release(&p->lock);
+    }
+  }
+  return NULL;
+
+found:
+  if((p->kstack = (uint64)allocpage()) == NULL){
+    release(&p->lock);
+    return NULL;
+  }
+  p->pid = allocpid();
+  p->killed = 0;
+  p->mf = NULL;
+  p->filelimit = 0;
+  p->robust_list = NULL;
+  p->plug = NULL;
+  p->elocked = NULL;
+  p->clear_child_tid = NULL;
+  p->set_child_tid = NULL;
+  p->vma = NULL;
+  p->uid = 0;
+  p->gid = 0;
+  p->q = NULL;
+  p->trapframe = NULL;
+  p->pagetable = NULL;
+  p->sz = 0;
+  p->cwd = NULL;
+  p->tmask = 0;
+  p->parent = NULL;
+  p->sysstat = NULL;
+  perf_proc_init(p);
+  schedstat_fork(p);
+  memset(&p->mem, 0, sizeof(p->mem));
+  fdt_init(&p->fdt);
+  p->sighand = NULL;
+  p->sig_frame = NULL;
+  for (int i = 0; i < SIGSET_LEN; i ++) {
+	p->sig_pending.__val[i] = 0;
+	p->sig_set.__val[i] = 0;
+  }
+  memset(&p->proc_tms, 0, sizeof(p->proc_tms));
+
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)kthread_entry;
+  p->context.sp = p->kstack + PGSIZE;
+  p->kfn = fn;
+  p->karg = arg;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  p->state = RUNNABLE;
+  readyq_push(p);
+  release(&p->lock);
+  return p;
+}
+
+// Finish the calling kernel thread. init reaps it like an orphan.
+void
+kthread_exit(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  p->parent = initproc;
+  wakeup(initproc);
+  p->xstate = 0;
+  p->state = ZOMBIE;
+  sched();
+  panic("zombie kthread exit");
+}
+
 int clone(uint64 flag, uint64 stack, uint64 ptid, uint64 tls, uint64 ctid) {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
   
   if((flag & CLONE_THREAD) && (flag & CLONE_VM))
   {
+    // allocproc() can't read files with np->lock held
+    if(vma_populate(p) < 0)
+      return -1;
     // Allocate process.
     if((np = allocproc(p, 1)) == NULL){
       return -1;
@@ -440,10 +564,28 @@ int clone(uint64 flag, uint64 stack, uint64 ptid, uint64 tls, uint64 ctid) {
       p->trapframe->sp = stack;
     }
   }
+
+  // increment reference counts on open file descriptors.
+  np->filelimit = p->filelimit;
+  if(fdt_copy(&np->fdt, &p->fdt) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   
   // signal copy	
-  sigaction_copy(&np->sig_act, p->sig_act);
-  np->sig_frame = p->sig_frame;
+  if(flag & CLONE_SIGHAND)
+    np->sighand = sighand_get(p->sighand);
+  else
+    np->sighand = sighand_copy(p->sighand);
+  np->sig_frame = sigframe_copy(p->sig_frame);
+  if(np->sighand == NULL || (p->sig_frame && np->sig_frame == NULL)){
+    fdt_close_all(&np->fdt);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->sig_set = p->sig_set;
   for (int i = 0; i < SIGSET_LEN; i++) {
     np->sig_pending.__val[i] = p->sig_pending.__val[i];
   }
@@ -457,10 +599,6 @@ int clone(uint64 flag, uint64 stack, uint64 ptid, uint64 tls, uint64 ctid) {
   np->trapframe->a0 = 0;
   
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = edup(p->cwd);
   
   // np->parent = p;
@@ -502,6 +640,19 @@ forkret(void)
 }
 
 
+// Look up a live process by pid. The caller locks it if it needs to.
+struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for (p = proc; p < &proc[NPROC]; p++) {
+    if (p->state != UNUSED && p->pid == pid)
+      return p;
+  }
+  return NULL;
+}
+
 uint64
 procnum(void)
 {
@@ -552,17 +703,19 @@ sleep(void *chan, struct spinlock *lk)
   // so it's okay to release lk.
   if(lk != &p->lock){  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
   }
 
-  // Go to sleep.
+  // Go to sleep. Get on the wait queue before letting go of lk,
+  // so that a wakeup() issued right after can't miss us.
+  p->state = SLEEPING;
   queue* q = findwaitq(chan);
   if(!q)q = allocwaitq(chan);
   if(!q){
     __debug_error("waitq pool is full\n");
   }
   waitq_push(q,p);
-  p->state = SLEEPING;
+  if(lk != &p->lock)
+    release(lk);
   sched();
 
   // Tidy up.
@@ -584,6 +737,8 @@ wakeup(void *chan)
    if(q){
      struct proc* p;
      while((p = waitq_pop(q))!=NULL){
+       trace(TRACE_SCHED_WAKEUP, p->pid, 0);
+       schedstat_wakeup(p);
        p->state = RUNNABLE;
        readyq_push(p);
      }
@@ -675,7 +830,7 @@ int zombiecond(struct proc* p,int pid){
 int
 wait4pid(int pid,uint64 addr)
 {
-  int kidpid;
+  int kidpid, xstate;
   struct proc *p = myproc();
   struct proc* child;
   struct proc* chan = NULL;
@@ -691,16 +846,17 @@ wait4pid(int pid,uint64 addr)
       kidpid = child->pid;
       p->proc_tms.cstime += child->proc_tms.stime + child->proc_tms.cstime;
       p->proc_tms.cutime += child->proc_tms.utime + child->proc_tms.cutime;
-      child->xstate <<= 8;
-      if(addr != 0 && copyout(p->pagetable, addr, (char *)&child->xstate, sizeof(child->xstate)) < 0) {
-        release(&child->lock);
-        release(&p->lock);
-        __debug_warn("[wait4pid]pid%d:%s copyout bad\n",p->pid,p->name);
-        return -1;
-      }
+      schedstat_reap(p, child);
+      memstat_reap(p, child);
+      xstate = child->xstate << 8;
       freeproc(child);
       release(&child->lock);
       release(&p->lock);
+      // copyout() may fault the page in and sleep, so not under the locks
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0) {
+        __debug_warn("[wait4pid]pid%d:%s copyout bad\n",p->pid,p->name);
+        return -1;
+      }
       //__debug_info("[wait4pid]pid%d:%s kidpid:%p\n",p->pid,p->name,kidpid);
       return kidpid;
     }
@@ -724,13 +880,8 @@ exit(int n)
     //panic("init exiting");
   //__debug_warn("[exit]pid %d:%s exit %d\n",p->pid,p->name,n);
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  fdt_close_all(&p->fdt);
+  vma_put_files(p);
 
   eput(p->cwd);
   p->cwd = 0;
@@ -753,8 +904,11 @@ exit(int n)
 
 int kill(int pid,int sig){
 	struct proc* p;
+	if(sig < 0 || sig > NSIG)
+		return -EINVAL;
 	for(p = proc; p < &proc[NPROC]; p++){
-		if(p->pid == pid){
+		// kernel threads take no signals
+		if(p->pid == pid && !is_kthread(p)){
 			acquire(&p->lock);
 			if(p->state == SLEEPING){
 				// need to modify...
@@ -762,10 +916,8 @@ int kill(int pid,int sig){
 				readyq_push(p);
 				p->state = RUNNABLE;
 			}
-			p->sig_pending.__val[0] |= 1ul << sig;
-			if (0 == p->killed || sig < p->killed) {
-				p->killed = sig;
-			}
+			if (sig > 0)
+				sig_raise(p, sig);
 			release(&p->lock);
 			return 0;
 		}
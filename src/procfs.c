@@ -0,0 +1,604 @@
+//
+// procfs -- /proc, for ps, top and free.
+//
+// Every file is generated on read from counters the kernel already
+// keeps, with a seqbuf, so reading one costs a pass over those
+// counters and never goes near the buffer cache or the disk.
+// Per-process files look the process up again on each read and copy
+// what they need out under p->lock before printing.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/vma.h"
+#include "include/vm.h"
+#include "include/mmap.h"
+#include "include/pm.h"
+#include "include/buf.h"
+#include "include/fat32.h"
+#include "include/stat.h"
+#include "include/file.h"
+#include "include/fdtable.h"
+#include "include/timer.h"
+#include "include/trap.h"
+#include "include/copy.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/seqbuf.h"
+#include "include/schedstat.h"
+#include "include/memstat.h"
+#include "include/blkstat.h"
+#include "include/pagecache.h"
+#include "include/procfs.h"
+
+#define PG_KB           (PGSIZE / 1024)
+
+// what times in /proc are counted in, as on Linux
+#define USER_HZ         100
+#define TICK_TO_CLK(t)  ((t) / (TICK_FREQ / USER_HZ))
+
+extern struct proc proc[NPROC];
+extern int nextpid;
+
+static struct fs *procfs;
+
+struct proc_entry {
+  char *name;
+  int type;
+};
+
+static struct proc_entry root_entries[] = {
+  { "meminfo",    PROC_MEMINFO },
+  { "stat",       PROC_STAT },
+  { "loadavg",    PROC_LOADAVG },
+  { "uptime",     PROC_UPTIME },
+  { "interrupts", PROC_INTERRUPTS },
+  { "diskstats",  PROC_DISKSTATS },
+  { "blkstat",    PROC_BLKSTAT },
+};
+#define NROOT   (sizeof(root_entries) / sizeof(root_entries[0]))
+
+static struct proc_entry pid_entries[] = {
+  { "stat",       PROC_PID_STAT },
+  { "status",     PROC_PID_STATUS },
+  { "maps",       PROC_PID_MAPS },
+  { "fd",         PROC_PID_FD },
+};
+#define NPID    (sizeof(pid_entries) / sizeof(pid_entries[0]))
+
+static int
+is_dir(int type)
+{
+  return type == PROC_ROOT || type == PROC_PID || type == PROC_PID_FD;
+}
+
+// Take a FatFs slot nobody else can mount over and put it on /proc.
+int
+procfs_init(void)
+{
+  struct dirent *ep;
+  int i;
+
+  for (i = 0; i < FSNUM && FatFs[i].valid; i++)
+    ;
+  if (i == FSNUM) {
+    __debug_warn("[procfs_init] no free fs slot\n");
+    return -1;
+  }
+  procfs = &FatFs[i];
+  procfs->valid = 1;
+  procfs->synthetic = 1;
+
+  if ((ep = create(NULL, "/proc", T_DIR, 0)) == NULL) {
+    __debug_warn("[procfs_init] can't create /proc\n");
+    return -1;
+  }
+  eunlock(ep);
+  eput(ep);
+  if (emount(procfs, "/proc") < 0) {
+    __debug_warn("[procfs_init] mount failed\n");
+    return -1;
+  }
+  __debug_info("procfs_init\n");
+  return 0;
+}
+
+// The process with this pid, locked, or NULL if it is gone.
+static struct proc *
+proc_get(int pid)
+{
+  struct proc *p = findproc(pid);
+
+  if (p == NULL)
+    return NULL;
+  acquire(&p->lock);
+  if (p->pid != pid || p->state == UNUSED) {
+    release(&p->lock);
+    return NULL;
+  }
+  return p;
+}
+
+// What the per-process files print, copied out under p->lock.
+struct proc_snap {
+  int pid;
+  int ppid;
+  int uid;
+  int gid;
+  int state;
+  int fdmax;
+  char name[16];
+  struct proc_schedstat sched;
+  struct proc_memstat mem;
+  struct tms tms;
+  uint64 vsz;
+  uint64 rss;
+};
+
+static int
+proc_snap(int pid, struct proc_snap *ps)
+{
+  struct proc *p = proc_get(pid);
+
+  if (p == NULL)
+    return -1;
+  ps->pid = pid;
+  ps->ppid = p->parent ? p->parent->pid : 0;
+  ps->uid = p->uid;
+  ps->gid = p->gid;
+  ps->state = p->state;
+  ps->fdmax = p->fdt.max;
+  memmove(ps->name, p->name, sizeof(ps->name));
+  ps->sched = p->sched;
+  ps->tms = p->proc_tms;
+  if (is_kthread(p)) {
+    ps->vsz = ps->rss = 0;
+  } else {
+    ps->vsz = memstat_vsz(p);
+    ps->rss = memstat_rss(p);
+  }
+  ps->mem = p->mem;
+  release(&p->lock);
+  ps->name[sizeof(ps->name) - 1] = 0;
+  return 0;
+}
+
+static char statechar[] = {
+  [UNUSED]    '?',
+  [SLEEPING]  'S',
+  [RUNNABLE]  'R',
+  [RUNNING]   'R',
+  [ZOMBIE]    'Z',
+};
+
+static char *statename[] = {
+  [UNUSED]    "unused",
+  [SLEEPING]  "sleeping",
+  [RUNNABLE]  "running",
+  [RUNNING]   "running",
+  [ZOMBIE]    "zombie",
+};
+
+static int
+gen_meminfo(struct seqbuf *sq, int pid)
+{
+  uint64 total = totalpages(), free = idlepages();
+  uint64 kpages, kbytes, pcpages, pchits, pcmisses;
+
+  memstat_kmalloc(&kpages, &kbytes);
+  pcache_stat(&pcpages, &pchits, &pcmisses);
+  seq_printf(sq, "MemTotal:       %8lu kB\n", total * PG_KB);
+  seq_printf(sq, "MemFree:        %8lu kB\n", free * PG_KB);
+  seq_printf(sq, "MemAvailable:   %8lu kB\n", free * PG_KB);
+  seq_printf(sq, "Buffers:        %8lu kB\n", (uint64)NBUF * BSIZE / 1024);
+  seq_printf(sq, "Cached:         %8lu kB\n", pcpages * PG_KB);
+  seq_printf(sq, "SwapCached:     %8lu kB\n", 0UL);
+  seq_printf(sq, "Shmem:          %8lu kB\n", 0UL);
+  seq_printf(sq, "Slab:           %8lu kB\n", kpages * PG_KB);
+  seq_printf(sq, "PageTables:     %8lu kB\n", pgtbl_pages * PG_KB);
+  seq_printf(sq, "SwapTotal:      %8lu kB\n", 0UL);
+  seq_printf(sq, "SwapFree:       %8lu kB\n", 0UL);
+  return 0;
+}
+
+static int
+gen_stat(struct seqbuf *sq, int pid)
+{
+  struct cpu_times ct[NCPU], sum;
+  uint64 intr = 0;
+
+  memset(&sum, 0, sizeof(sum));
+  for (int c = 0; c < NCPU; c++) {
+    schedstat_cpu_times(c, &ct[c]);
+    sum.user += ct[c].user;
+    sum.system += ct[c].system;
+    sum.idle += ct[c].idle;
+    sum.switches += ct[c].switches;
+    for (int i = 0; i < NINTR_STAT; i++)
+      intr += intr_count(c, i);
+  }
+
+  // user nice system idle iowait irq softirq steal guest guest_nice
+  seq_printf(sq, "cpu  %lu 0 %lu %lu 0 0 0 0 0 0\n", TICK_TO_CLK(sum.user),
+             TICK_TO_CLK(sum.system), TICK_TO_CLK(sum.idle));
+  for (int c = 0; c < NCPU; c++)
+    seq_printf(sq, "cpu%d %lu 0 %lu %lu 0 0 0 0 0 0\n", c, TICK_TO_CLK(ct[c].user),
+               TICK_TO_CLK(ct[c].system), TICK_TO_CLK(ct[c].idle));
+  seq_printf(sq, "intr %lu\n", intr);
+  seq_printf(sq, "ctxt %lu\n", sum.switches);
+  seq_printf(sq, "btime 0\n");
+  seq_printf(sq, "processes %d\n", nextpid - 1);
+  seq_printf(sq, "procs_running %d\n", schedstat_nr_running());
+  seq_printf(sq, "procs_blocked 0\n");
+  return 0;
+}
+
+static int
+gen_loadavg(struct seqbuf *sq, int pid)
+{
+  uint64 avg[3];
+
+  schedstat_loadavg(avg);
+  seq_printf(sq, "%lu.%02lu %lu.%02lu %lu.%02lu %d/%lu %d\n",
+             LOAD_INT(avg[0]), LOAD_FRAC(avg[0]), LOAD_INT(avg[1]), LOAD_FRAC(avg[1]),
+             LOAD_INT(avg[2]), LOAD_FRAC(avg[2]), schedstat_nr_running(), procnum(),
+             nextpid - 1);
+  return 0;
+}
+
+static int
+gen_uptime(struct seqbuf *sq, int pid)
+{
+  uint64 up = r_time(), idle = 0;
+  struct cpu_times ct;
+
+  for (int c = 0; c < NCPU; c++) {
+    schedstat_cpu_times(c, &ct);
+    idle += ct.idle;
+  }
+  seq_printf(sq, "%lu.%02lu %lu.%02lu\n", up / TICK_FREQ, TICK_TO_CLK(up % TICK_FREQ),
+             idle / TICK_FREQ, TICK_TO_CLK(idle % TICK_FREQ));
+  return 0;
+}
+
+static int
+gen_interrupts(struct seqbuf *sq, int pid)
+{
+  static char *src[NINTR_STAT][2] = {
+    [INTR_STAT_TIMER] { "LOC", "Local timer interrupts" },
+    [INTR_STAT_UART]  { "UART", "uart0" },
+    [INTR_STAT_SPI]   { "SPI", "spi2 (sd)" },
+    [INTR_STAT_OTHER] { "ERR", "unexpected external" },
+  };
+
+  seq_printf(sq, "     ");
+  for (int c = 0; c < NCPU; c++)
+    seq_printf(sq, "       CPU%d", c);
+  seq_printf(sq, "\n");
+  for (int i = 0; i < NINTR_STAT; i++) {
+    seq_printf(sq, "%4s:", src[i][0]);
+    for (int c = 0; c < NCPU; c++)
+      seq_printf(sq, " %10lu", intr_count(c, i));
+    seq_printf(sq, "  %s\n", src[i][1]);
+  }
+  return 0;
+}
+
+static int
+gen_diskstats(struct seqbuf *sq, int pid)
+{
+  blkstat_diskstats(sq);
+  return 0;
+}
+
+static int
+gen_blkstat(struct seqbuf *sq, int pid)
+{
+  blkstat_report(sq);
+  return 0;
+}
+
+static int
+gen_pid_stat(struct seqbuf *sq, int pid)
+{
+  struct proc_snap ps;
+  uint64 stime;
+
+  if (proc_snap(pid, &ps) < 0)
+    return -1;
+  stime = ps.sched.run_time - ps.sched.user_time;
+  // the fields Linux has, up to processor; ours are zero where we
+  // keep nothing like them
+  seq_printf(sq, "%d (%s) %c %d %d %d 0 -1 0 %lu %lu %lu %lu ", pid, ps.name,
+             statechar[ps.state], ps.ppid, pid, pid,
+             ps.mem.minflt, ps.mem.c_minflt, ps.mem.majflt, ps.mem.c_majflt);
+  seq_printf(sq, "%lu %lu %lu %lu 20 0 1 0 %lu %lu %lu ",
+             TICK_TO_CLK(ps.sched.user_time), TICK_TO_CLK(stime),
+             TICK_TO_CLK(ps.tms.cutime), TICK_TO_CLK(ps.tms.cstime),
+             TICK_TO_CLK(ps.sched.start_at), ps.vsz * PGSIZE, ps.rss);
+  seq_printf(sq, "18446744073709551615 0 0 0 0 0 0 0 0 0 0 0 0 17 %d 0 0 0 0 0\n",
+             ps.sched.last_hart < 0 ? 0 : ps.sched.last_hart);
+  return 0;
+}
+
+static int
+gen_pid_status(struct seqbuf *sq, int pid)
+{
+  struct proc_snap ps;
+
+  if (proc_snap(pid, &ps) < 0)
+    return -1;
+  seq_printf(sq, "Name:\t%s\n", ps.name);
+  seq_printf(sq, "State:\t%c (%s)\n", statechar[ps.state], statename[ps.state]);
+  seq_printf(sq, "Tgid:\t%d\n", pid);
+  seq_printf(sq, "Pid:\t%d\n", pid);
+  seq_printf(sq, "PPid:\t%d\n", ps.ppid);
+  seq_printf(sq, "Uid:\t%d\t%d\t%d\t%d\n", ps.uid, ps.uid, ps.uid, ps.uid);
+  seq_printf(sq, "Gid:\t%d\t%d\t%d\t%d\n", ps.gid, ps.gid, ps.gid, ps.gid);
+  seq_printf(sq, "FDSize:\t%d\n", ps.fdmax);
+  seq_printf(sq, "VmSize:\t%8lu kB\n", ps.vsz * PG_KB);
+  seq_printf(sq, "VmHWM:\t%8lu kB\n", ps.mem.maxrss * PG_KB);
+  seq_printf(sq, "VmRSS:\t%8lu kB\n", ps.rss * PG_KB);
+  seq_printf(sq, "Threads:\t1\n");
+  seq_printf(sq, "voluntary_ctxt_switches:\t%lu\n", ps.sched.nvcsw);
+  seq_printf(sq, "nonvoluntary_ctxt_switches:\t%lu\n", ps.sched.nivcsw);
+  return 0;
+}
+
+static char *
+vma_name(struct vma *v)
+{
+  switch (v->type) {
+  case HEAP:  return "[heap]";
+  case STACK: return "[stack]";
+  default:    return v->ep ? v->ep->filename : "";
+  }
+}
+
+// The i'th mapping of pid and its name, copied out. 1 if there is one,
+// 0 past the last, -1 if the process is gone.
+static int
+vma_nth(int pid, int i, struct vma *out, char *name, int len)
+{
+  struct proc *p = proc_get(pid);
+  struct vma *v;
+  int found = 0;
+
+  if (p == NULL)
+    return -1;
+  if (p->vma != NULL) {
+    for (v = p->vma->next; v != p->vma; v = v->next) {
+      if (v->type == TRAP)
+        continue;
+      if (i-- == 0) {
+        *out = *v;
+        // munmap() may put v->ep as soon as the lock is dropped
+        safestrcpy(name, vma_name(v), len);
+        found = 1;
+        break;
+      }
+    }
+  }
+  release(&p->lock);
+  return found;
+}
+
+static int
+gen_pid_maps(struct seqbuf *sq, int pid)
+{
+  struct vma v;
+  char name[FAT32_MAX_FILENAME + 1];
+  int i, r;
+
+  // one mapping per lock, so nothing is copied out with p->lock held
+  for (i = 0; (r = vma_nth(pid, i, &v, name, sizeof(name))) > 0; i++) {
+    int shared = v.type == MMAP && (v.flags & MAP_SHARED);
+    seq_printf(sq, "%08lx-%08lx %c%c%c%c %08lx 00:00 0 %s\n", v.addr, v.end,
+               v.perm & PTE_R ? 'r' : '-', v.perm & PTE_W ? 'w' : '-',
+               v.perm & PTE_X ? 'x' : '-', shared ? 's' : 'p',
+               v.f_off, name);
+  }
+  return r < 0 && i == 0 ? -1 : 0;
+}
+
+static int (*generate[PROC_NTYPES])(struct seqbuf *, int) = {
+  [PROC_MEMINFO]    gen_meminfo,
+  [PROC_STAT]       gen_stat,
+  [PROC_LOADAVG]    gen_loadavg,
+  [PROC_UPTIME]     gen_uptime,
+  [PROC_INTERRUPTS] gen_interrupts,
+  [PROC_DISKSTATS]  gen_diskstats,
+  [PROC_BLKSTAT]    gen_blkstat,
+  [PROC_PID_STAT]   gen_pid_stat,
+  [PROC_PID_STATUS] gen_pid_status,
+  [PROC_PID_MAPS]   gen_pid_maps,
+};
+
+int
+procfs_read(int node, int user_dst, uint64 addr, uint64 off, int n)
+{
+  int (*gen)(struct seqbuf *, int) = generate[PROCFS_TYPE(node)];
+  struct seqbuf sq;
+
+  if (gen == NULL)
+    return -1;
+  seq_init(&sq, user_dst, addr, off, n);
+  if (gen(&sq, PROCFS_PID(node)) < 0)
+    return -1;
+  return seq_result(&sq);
+}
+
+// Parse a pid, 0 if name isn't one.
+static int
+atopid(char *name)
+{
+  int pid = 0;
+
+  for (char *s = name; *s; s++) {
+    if (*s < '0' || *s > '9' || pid >= (1 << 24))
+      return 0;
+    pid = pid * 10 + *s - '0';
+  }
+  return pid;
+}
+
+// Node for `name` inside directory node, -1 if there is none.
+static int
+proc_walk(int node, char *name)
+{
+  int type = PROCFS_TYPE(node), pid = PROCFS_PID(node);
+
+  if (strncmp(name, ".", 2) == 0)
+    return node;
+  if (type == PROC_ROOT) {
+    for (int i = 0; i < NROOT; i++) {
+      if (strncmp(name, root_entries[i].name, FAT32_MAX_FILENAME) == 0)
+        return PROCFS_MKNODE(0, root_entries[i].type);
+    }
+    if (strncmp(name, "self", 5) == 0)
+      return PROCFS_MKNODE(myproc()->pid, PROC_PID);
+    if ((pid = atopid(name)) > 0 && findproc(pid) != NULL)
+      return PROCFS_MKNODE(pid, PROC_PID);
+  } else if (type == PROC_PID) {
+    for (int i = 0; i < NPID; i++) {
+      if (strncmp(name, pid_entries[i].name, FAT32_MAX_FILENAME) == 0)
+        return PROCFS_MKNODE(pid, pid_entries[i].type);
+    }
+  }
+  return -1;
+}
+
+// Split the next element off path into name, as skipelem() does.
+static char *
+nextelem(char *path, char *name)
+{
+  int len = 0;
+
+  while (*path && *path != '/') {
+    if (len < FAT32_MAX_FILENAME)
+      name[len++] = *path;
+    path++;
+  }
+  name[len] = 0;
+  while (*path == '/')
+    path++;
+  return path;
+}
+
+// name is the first element below /proc and path what follows it.
+int
+procfs_lookup(char *name, char *path)
+{
+  char elem[FAT32_MAX_FILENAME + 1];
+  int node = proc_walk(PROCFS_ROOT, name);
+
+  while (node >= 0 && *path) {
+    path = nextelem(path, elem);
+    node = proc_walk(node, elem);
+  }
+  return node;
+}
+
+// Entry idx of directory node. Returns the index of the entry after
+// it, -1 if there are no more.
+static int
+proc_readdir(int node, int idx, char *name, int *dir)
+{
+  int pid = PROCFS_PID(node);
+  struct proc *p;
+
+  switch (PROCFS_TYPE(node)) {
+  case PROC_ROOT:
+    if (idx < NROOT) {
+      strncpy(name, root_entries[idx].name, FAT32_MAX_FILENAME);
+      *dir = is_dir(root_entries[idx].type);
+      return idx + 1;
+    }
+    if (idx == NROOT) {
+      strncpy(name, "self", FAT32_MAX_FILENAME);
+      *dir = 1;
+      return idx + 1;
+    }
+    for (int i = idx - NROOT - 1; i < NPROC; i++) {
+      if ((pid = proc[i].pid) > 0 && proc[i].state != UNUSED) {
+        snprintf(name, FAT32_MAX_FILENAME, "%d", pid);
+        *dir = 1;
+        return i + NROOT + 2;
+      }
+    }
+    return -1;
+  case PROC_PID:
+    if (idx >= NPID)
+      return -1;
+    strncpy(name, pid_entries[idx].name, FAT32_MAX_FILENAME);
+    *dir = is_dir(pid_entries[idx].type);
+    return idx + 1;
+  case PROC_PID_FD: {
+    int fd;
+    if ((p = proc_get(pid)) == NULL)
+      return -1;
+    // the bitmap never moves, even when the table grows
+    fd = idx < FDT_MAX ? fdt_next(&p->fdt, idx) : -1;
+    release(&p->lock);
+    if (fd < 0)
+      return -1;
+    snprintf(name, FAT32_MAX_FILENAME, "%d", fd);
+    *dir = 0;
+    return fd + 1;
+  }
+  }
+  return -1;
+}
+
+int
+procfs_getdents(struct file *f, uint64 addr, int n)
+{
+  struct linux_dirent64 lde;
+  int copysize = 0;
+  int next, dir;
+
+  while ((next = proc_readdir(f->node, f->off, lde.d_name, &dir)) >= 0) {
+    lde.d_ino = f->node ^ next;
+    lde.d_off = next;
+    lde.d_type = dir ? T_DIR : T_FILE;
+    // Size of this dent, varies from length of filename.
+    int size = sizeof(struct linux_dirent64) - sizeof(lde.d_name) + strlen(lde.d_name) + 1;
+    size += (sizeof(uint64) - (size % sizeof(uint64))) % sizeof(uint64); // Align to 8.
+    lde.d_reclen = size;
+    if (size > n)
+      break;
+    if (either_copyout(1, addr, (char *)&lde, size) < 0)
+      return -1;
+    addr += size;
+    n -= size;
+    copysize += size;
+    f->off = next;
+  }
+  return copysize;
+}
+
+int
+procfs_kstat(int node, struct kstat *st)
+{
+  int type = PROCFS_TYPE(node), pid = PROCFS_PID(node);
+  struct proc *p;
+
+  memset(st, 0, sizeof(*st));
+  if (pid) {
+    if ((p = proc_get(pid)) == NULL)
+      return -1;
+    st->st_uid = p->uid;
+    st->st_gid = p->gid;
+    st->st_ctime_sec = p->sched.start_at / TICK_FREQ;
+    release(&p->lock);
+  }
+  st->st_dev = procfs->devno;
+  st->st_ino = node;
+  st->st_nlink = 1;
+  st->st_blksize = PGSIZE;
+  st->st_mode = is_dir(type) ? S_IFDIR | 0555 : S_IFREG | 0444;
+  return 0;
+}
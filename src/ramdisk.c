@@ -28,22 +28,25 @@ ramdisk_init(void)
   __debug_info("ramdiskinit ram start:%p\n",ramdisk);
 }
 
-void 
-ramdisk_rw(struct buf *b, int write)
+// 0, or -1 past the end of the disk.
+int
+ramdisk_rw(uint sectorno, uchar *data, int write)
 {
+  if (sectorno >= FSSIZE)
+    return -1;
   acquire(&ramdisklock);
-  uint sectorno = b->sectorno;
 
   char *addr = ramdisk + sectorno * BSIZE;
   if (write)
   {
-    memmove((void*)addr, b->data, BSIZE);
+    memmove((void*)addr, data, BSIZE);
   }
   else
   {
-    memmove(b->data, (void*)addr, BSIZE);
+    memmove(data, (void*)addr, BSIZE);
   }
   release(&ramdisklock);
+  return 0;
 }
 
 void
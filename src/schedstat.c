@@ -0,0 +1,346 @@
+//
+// schedstat -- run-queue latency, run/wait time and context switch
+// counts per process, idle time and readyq length per hart.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/timer.h"
+#include "include/copy.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/seqbuf.h"
+#include "include/schedstat.h"
+#include "include/utils/bitops.h"
+
+extern struct proc proc[NPROC];
+
+struct cpu_schedstat {
+  uint64 idle_since;    // when it went into wfi, 0 while busy
+  uint64 idle_time;
+  uint64 nidle;         // times it went into wfi
+  uint64 queued_idle;   // processes made runnable while it sat in wfi
+  uint64 switches;
+  uint64 run_time;      // time some process was switched in
+  uint64 user_time;     // part of run_time spent in user mode
+  uint64 qlen[SCHED_NQLEN];
+};
+
+static struct cpu_schedstat schedstat_cpus[NCPU];
+
+// Load average, sampled from hart 0's timer tick the way Linux does
+// it: exponentially decayed counts of RUNNABLE and RUNNING processes.
+#define LOAD_FREQ   (5 * TICK_FREQ)
+#define EXP_1       1884              // FIXED_1 / exp(5s / 1min)
+#define EXP_5       2014
+#define EXP_15      2037
+
+static uint64 loadavg[3];
+static uint64 load_next;
+
+void
+schedstat_init(void)
+{
+  memset(schedstat_cpus, 0, sizeof(schedstat_cpus));
+}
+
+void
+schedstat_fork(struct proc *p)
+{
+  memset(&p->sched, 0, sizeof(p->sched));
+  p->sched.start_at = r_time();
+  p->sched.last_hart = -1;
+}
+
+void
+schedstat_enqueue(struct proc *p)
+{
+  p->sched.ready_at = r_time();
+  // There are no IPIs, so an idle hart only notices at its next tick.
+  for (int c = 0; c < NCPU; c++) {
+    if (schedstat_cpus[c].idle_since)
+      __sync_fetch_and_add(&schedstat_cpus[c].queued_idle, 1);
+  }
+}
+
+void
+schedstat_wakeup(struct proc *p)
+{
+  p->sched.wake_at = r_time();
+  p->sched.wakeups++;
+}
+
+// Called by the scheduler with p->lock held; qlen is what was left
+// on readyq after p was taken off.
+void
+schedstat_switch_in(struct proc *p, int qlen)
+{
+  struct proc_schedstat *ss = &p->sched;
+  struct cpu_schedstat *cs = &schedstat_cpus[cpuid()];
+  uint64 now = r_time();
+
+  if (ss->ready_at)
+    ss->wait_time += now - ss->ready_at;
+  ss->ready_at = 0;
+  if (ss->wake_at) {
+    uint64 lat = now - ss->wake_at;
+    ss->wakeup_lat += lat;
+    if (lat > ss->wakeup_max)
+      ss->wakeup_max = lat;
+    ss->wake_at = 0;
+  }
+  if (ss->last_hart >= 0 && ss->last_hart != cpuid())
+    ss->nmigrations++;
+  ss->last_hart = cpuid();
+  ss->run_at = now;
+
+  int b = qlen ? ilog2_64(qlen) + 1 : 0;
+  if (b >= SCHED_NQLEN)
+    b = SCHED_NQLEN - 1;
+  cs->qlen[b]++;
+  cs->switches++;
+}
+
+// Called by the scheduler with p->lock held, once p is back.
+void
+schedstat_switch_out(struct proc *p)
+{
+  struct proc_schedstat *ss = &p->sched;
+  uint64 delta = r_time() - ss->run_at;
+
+  ss->run_time += delta;
+  schedstat_cpus[cpuid()].run_time += delta;
+  // yield() leaves it RUNNABLE, everything else gave up the cpu
+  if (p->state == RUNNABLE)
+    ss->nivcsw++;
+  else
+    ss->nvcsw++;
+  p->proc_tms.utime = ss->user_time;
+  p->proc_tms.stime = ss->run_time - ss->user_time;
+}
+
+void
+schedstat_idle_enter(void)
+{
+  struct cpu_schedstat *cs = &schedstat_cpus[cpuid()];
+
+  cs->idle_since = r_time();
+  cs->nidle++;
+}
+
+void
+schedstat_idle_exit(void)
+{
+  struct cpu_schedstat *cs = &schedstat_cpus[cpuid()];
+
+  cs->idle_time += r_time() - cs->idle_since;
+  cs->idle_since = 0;
+}
+
+void
+schedstat_user_enter(struct proc *p)
+{
+  p->sched.user_at = r_time();
+}
+
+void
+schedstat_user_exit(struct proc *p)
+{
+  if (p->sched.user_at) {
+    uint64 delta = r_time() - p->sched.user_at;
+    p->sched.user_time += delta;
+    schedstat_cpus[cpuid()].user_time += delta;
+  }
+  p->sched.user_at = 0;
+}
+
+// Processes RUNNABLE or RUNNING right now. Nothing is locked, this
+// is a sample.
+int
+schedstat_nr_running(void)
+{
+  int n = 0;
+
+  for (struct proc *p = proc; p < &proc[NPROC]; p++) {
+    if (p->state == RUNNABLE || p->state == RUNNING)
+      n++;
+  }
+  return n;
+}
+
+static uint64
+calc_load(uint64 load, uint64 exp, uint64 active)
+{
+  return (load * exp + active * (FIXED_1 - exp)) >> FSHIFT;
+}
+
+// Called from every timer interrupt, with interrupts off.
+void
+schedstat_tick(void)
+{
+  uint64 now = r_time();
+  uint64 active;
+
+  if (cpuid() != 0 || now < load_next)
+    return;
+  load_next = now + LOAD_FREQ;
+  active = (uint64)schedstat_nr_running() * FIXED_1;
+  loadavg[0] = calc_load(loadavg[0], EXP_1, active);
+  loadavg[1] = calc_load(loadavg[1], EXP_5, active);
+  loadavg[2] = calc_load(loadavg[2], EXP_15, active);
+}
+
+void
+schedstat_loadavg(uint64 avg[3])
+{
+  avg[0] = loadavg[0];
+  avg[1] = loadavg[1];
+  avg[2] = loadavg[2];
+}
+
+// hart's time so far, the slice it is in the middle of left out
+void
+schedstat_cpu_times(int hart, struct cpu_times *ct)
+{
+  struct cpu_schedstat *cs = &schedstat_cpus[hart];
+  uint64 idle_since = cs->idle_since;
+
+  ct->user = cs->user_time;
+  ct->system = cs->run_time > cs->user_time ? cs->run_time - cs->user_time : 0;
+  ct->idle = cs->idle_time;
+  if (idle_since)
+    ct->idle += r_time() - idle_since;
+  ct->switches = cs->switches;
+}
+
+// Fold an exited child's switch counts into its parent. Times go
+// through proc_tms, as they always have.
+void
+schedstat_reap(struct proc *p, struct proc *child)
+{
+  p->sched.c_nvcsw += child->sched.nvcsw + child->sched.c_nvcsw;
+  p->sched.c_nivcsw += child->sched.nivcsw + child->sched.c_nivcsw;
+}
+
+static void
+tick_to_timeval(uint64 t, struct timeval *tv)
+{
+  tv->tv_sec = t / TICK_FREQ;
+  tv->tv_usec = TICK_TO_US(t % TICK_FREQ);
+}
+
+int
+schedstat_rusage(struct proc *p, int who, struct rusage *ru)
+{
+  memset(ru, 0, sizeof(*ru));
+  switch (who) {
+  case RUSAGE_SELF:
+  case RUSAGE_THREAD: {
+    // count the slice we're in the middle of
+    uint64 run = p->sched.run_time + r_time() - p->sched.run_at;
+    tick_to_timeval(p->sched.user_time, &ru->ru_utime);
+    tick_to_timeval(run - p->sched.user_time, &ru->ru_stime);
+    ru->ru_nvcsw = p->sched.nvcsw;
+    ru->ru_nivcsw = p->sched.nivcsw;
+    break;
+  }
+  case RUSAGE_CHILDREN:
+    tick_to_timeval(p->proc_tms.cutime, &ru->ru_utime);
+    tick_to_timeval(p->proc_tms.cstime, &ru->ru_stime);
+    ru->ru_nvcsw = p->sched.c_nvcsw;
+    ru->ru_nivcsw = p->sched.c_nivcsw;
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+static char *statename[] = {
+  [UNUSED]    "unused",
+  [SLEEPING]  "sleep",
+  [RUNNABLE]  "runble",
+  [RUNNING]   "run",
+  [ZOMBIE]    "zombie",
+};
+
+int
+schedstatread(int user_dst, uint64 addr, uint64 off, int n)
+{
+  struct seqbuf sq;
+
+  seq_init(&sq, user_dst, addr, off, n);
+
+  seq_printf(&sq, "%-4s %10s %8s %10s %10s  %s\n",
+             "hart", "idle_us", "wfi", "queued_idle", "switches", "log2(qlen)+1:n");
+  for (int c = 0; c < NCPU; c++) {
+    struct cpu_schedstat *cs = &schedstat_cpus[c];
+    seq_printf(&sq, "%-4d %10lu %8lu %10lu %10lu ", c, TICK_TO_US(cs->idle_time),
+               cs->nidle, cs->queued_idle, cs->switches);
+    for (int b = 0; b < SCHED_NQLEN; b++) {
+      if (cs->qlen[b])
+        seq_printf(&sq, " %d:%lu", b, cs->qlen[b]);
+    }
+    seq_printf(&sq, "\n");
+  }
+
+  seq_printf(&sq, "\n%-5s %-16s %-6s %10s %10s %10s %7s %10s %10s %7s %7s %5s\n",
+             "pid", "name", "state", "run_us", "user_us", "wait_us", "wakeups",
+             "avglat_us", "maxlat_us", "vcsw", "ivcsw", "migr");
+  for (struct proc *p = proc; p < &proc[NPROC]; p++) {
+    struct proc_schedstat ss;
+    char name[16];
+    int pid, state;
+
+    // copy it out so we don't copyout with p->lock held
+    acquire(&p->lock);
+    state = p->state;
+    pid = p->pid;
+    ss = p->sched;
+    memmove(name, p->name, sizeof(name));
+    release(&p->lock);
+    if (state == UNUSED)
+      continue;
+    name[sizeof(name) - 1] = 0;
+
+    seq_printf(&sq, "%-5d %-16s %-6s %10lu %10lu %10lu %7lu %10lu %10lu %7lu %7lu %5lu\n",
+               pid, name, statename[state], TICK_TO_US(ss.run_time),
+               TICK_TO_US(ss.user_time), TICK_TO_US(ss.wait_time), ss.wakeups,
+               ss.wakeups ? TICK_TO_US(ss.wakeup_lat / ss.wakeups) : 0,
+               TICK_TO_US(ss.wakeup_max), ss.nvcsw, ss.nivcsw, ss.nmigrations);
+  }
+  return seq_result(&sq);
+}
+
+int
+schedstatwrite(int user_dst, uint64 addr, int n)
+{
+  char cmd[16];
+  int len = n < sizeof(cmd) - 1 ? n : sizeof(cmd) - 1;
+
+  if (either_copyin(user_dst, cmd, addr, len) < 0)
+    return -1;
+  cmd[len] = 0;
+  if (len > 0 && cmd[len - 1] == '\n')
+    cmd[len - 1] = 0;
+
+  // per-process numbers belong to getrusage(2) and stay
+  if (strncmp(cmd, "reset", sizeof(cmd)) == 0) {
+    for (int c = 0; c < NCPU; c++) {
+      struct cpu_schedstat *cs = &schedstat_cpus[c];
+      cs->idle_time = 0;
+      cs->nidle = 0;
+      cs->queued_idle = 0;
+      cs->switches = 0;
+      memset(cs->qlen, 0, sizeof(cs->qlen));
+    }
+  } else {
+    __debug_warn("[schedstat] unknown command %s\n", cmd);
+    return -1;
+  }
+  return n;
+}
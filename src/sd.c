@@ -13,6 +13,7 @@
 
 #define SD_CMD_GO_IDLE_STATE 0
 #define SD_CMD_SEND_IF_COND 8
+#define SD_CMD_SEND_CSD 9
 #define SD_CMD_STOP_TRANSMISSION 12
 #define SD_CMD_SET_BLOCKLEN 16
 #define SD_CMD_READ_BLOCK_MULTIPLE 18
@@ -32,8 +33,11 @@
 
 // SD card initialization must happen at 100-400kHz
 #define SD_POWER_ON_FREQ_KHZ 400L
-// SD cards normally support reading/writing at 20MHz
+// SD cards normally support reading/writing at 20MHz; used when the CSD
+// doesn't say
 #define SD_POST_INIT_CLK_KHZ 20000L
+// Bytes of data before the CRC in a data block
+#define SD_BLOCK_SIZE 512
 
 
 // Command frame starts by asserting low and then high for first two clock edges
@@ -206,6 +210,51 @@ static int sd_cmd16(spi_ctrl* spi)
 }
 
 
+static uint64_t sd_nsect;
+
+/**
+ * Read the card-specific data register (CSD) for the fastest clock the card
+ * takes, in kHz, and its size for sd_size(). Returns 0 if it can't be read.
+ */
+static unsigned int sd_cmd9(spi_ctrl* spi)
+{
+  // TRAN_SPEED: bits 2:0 are the unit, 100kbit/s times a power of ten,
+  // bits 6:3 the multiplier in tenths
+  static const unsigned int unit_khz[8] = { 100, 1000, 10000, 100000 };
+  static const uint8_t mult[16] = {
+    0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+  };
+  uint8_t csd[16];
+  unsigned int khz = 0;
+  unsigned long n;
+
+  if (sd_cmd(spi, SD_CMD(SD_CMD_SEND_CSD), 0, 0xAF) == 0x00) {
+    n = 1000;
+    while (sd_dummy(spi) != SD_DATA_TOKEN && --n > 0);
+    if (n > 0) {
+      spi_txrx_buf(spi, NULL, csd, sizeof(csd));
+      sd_dummy(spi); /* CRC */
+      sd_dummy(spi);
+      khz = unit_khz[csd[3] & 0x7] * mult[(csd[3] >> 3) & 0xf] / 10;
+      if ((csd[0] >> 6) == 1) {
+        // CSD 2.0: C_SIZE, bits 69:48, counts 512KiB units less one
+        uint32_t c_size = ((uint32_t)(csd[7] & 0x3f) << 16) | (csd[8] << 8) | csd[9];
+        sd_nsect = ((uint64_t)c_size + 1) << 10;
+      } else {
+        // CSD 1.0: (C_SIZE + 1) << (C_SIZE_MULT + 2) blocks of
+        // 1 << READ_BL_LEN bytes
+        uint32_t c_size = ((csd[6] & 0x3) << 10) | (csd[7] << 2) | (csd[8] >> 6);
+        uint32_t c_size_mult = ((csd[9] & 0x3) << 1) | (csd[10] >> 7);
+        uint32_t read_bl_len = csd[5] & 0xf;
+        sd_nsect = (((uint64_t)c_size + 1) << (c_size_mult + 2 + read_bl_len)) >> 9;
+      }
+    }
+  }
+  sd_cmd_end(spi);
+  return khz;
+}
+
+
 static uint8_t crc7(uint8_t prev, uint8_t in)
 {
   // CRC polynomial 0x89
@@ -227,6 +276,28 @@ static uint16_t crc16(uint16_t crc, uint8_t data)
   return crc;
 }
 
+
+static uint16_t crc16_table[256];
+
+static void crc16_init(void)
+{
+  for (int i = 0; i < 256; i++) {
+    crc16_table[i] = crc16(0, i);
+  }
+}
+
+
+/**
+ * CRC16 of a buffer a byte at a time, from crc16_table.
+ */
+static uint16_t crc16_buf(uint16_t crc, const uint8_t* data, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
+
 //gpt_partition_range find_sd_gpt_partition(
 //        spi_ctrl* spictrl,
 //        uint64_t partition_entries_lba,
@@ -253,8 +324,20 @@ static uint16_t crc16(uint16_t crc, uint8_t data)
 //    return gpt_invalid_partition_range();
 //}
 
+/**
+ * Size of the card in 512-byte sectors, from its CSD. 0 if it couldn't be
+ * read.
+ */
+uint64_t sd_size(void)
+{
+  return sd_nsect;
+}
+
 int sd_init(spi_ctrl* spi, unsigned int input_clk_khz, int skip_sd_init_commands)
 {
+  unsigned int max_khz = 0;
+
+  crc16_init();
   // Skip SD initialization commands if already done earlier and only set the
   // clock divider for data transfer.
   if (!skip_sd_init_commands) {
@@ -264,16 +347,23 @@ int sd_init(spi_ctrl* spi, unsigned int input_clk_khz, int skip_sd_init_commands
     if (sd_acmd41(spi)) return SD_INIT_ERROR_ACMD41;
     if (sd_cmd58(spi)) return SD_INIT_ERROR_CMD58;
     if (sd_cmd16(spi)) return SD_INIT_ERROR_CMD16;
+    max_khz = sd_cmd9(spi);
+  }
+  if (max_khz == 0) {
+    max_khz = SD_POST_INIT_CLK_KHZ;
   }
   // Increase clock frequency after initialization for higher performance.
-  spi->sckdiv = spi_min_clk_divisor(input_clk_khz, SD_POST_INIT_CLK_KHZ);
+  spi->sckdiv = spi_min_clk_divisor(input_clk_khz, max_khz);
   return 0;
 }
 
 
-int sd_read_blocks(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size)
+/**
+ * Read size blocks from src_lba, block i into bufv[i], or if bufv is NULL
+ * one after another into dst.
+ */
+static int sd_read(spi_ctrl* spi, uint8_t* const* bufv, uint8_t* dst, uint32_t src_lba, size_t size)
 {
-  volatile uint8_t *p = dst;
   long i = size;
   int rc = 0;
 
@@ -290,16 +380,12 @@ int sd_read_blocks(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size)
   }
   do {
     uint16_t crc, crc_exp;
-    long n;
+    size_t j = size - i;
+    uint8_t *p = bufv ? bufv[j] : dst + j * SD_BLOCK_SIZE;
 
-    crc = 0;
-    n = 512;
     while (sd_dummy(spi) != SD_DATA_TOKEN);
-    do {
-      uint8_t x = sd_dummy(spi);
-      *p++ = x;
-      crc = crc16(crc, x);
-    } while (--n > 0);
+    spi_txrx_buf(spi, NULL, p, SD_BLOCK_SIZE);
+    crc = crc16_buf(0, p, SD_BLOCK_SIZE);
 
     crc_exp = ((uint16_t)sd_dummy(spi) << 8);
     crc_exp |= sd_dummy(spi);
@@ -319,9 +405,24 @@ int sd_read_blocks(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size)
 }
 
 
-int sd_write_blocks(spi_ctrl* spi, void* src, uint32_t dst_lba, size_t size)
+int sd_read_blocks(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size)
+{
+  return sd_read(spi, NULL, dst, src_lba, size);
+}
+
+
+int sd_read_blocksv(spi_ctrl* spi, uint8_t* const* buf, uint32_t src_lba, size_t size)
+{
+  return sd_read(spi, buf, NULL, src_lba, size);
+}
+
+
+/**
+ * Write size blocks to dst_lba, block i from bufv[i], or if bufv is NULL
+ * one after another from src.
+ */
+static int sd_write(spi_ctrl* spi, uint8_t* const* bufv, const uint8_t* src, uint32_t dst_lba, size_t size)
 {
-    volatile uint8_t *p = src;
     long i = size;
     int rc = 0;
 
@@ -343,17 +444,12 @@ int sd_write_blocks(spi_ctrl* spi, void* src, uint32_t dst_lba, size_t size)
 
     do {
         uint16_t crc;
-        long n;
-
-        crc = 0;
-        n = 512;
+        size_t j = size - i;
+        const uint8_t *p = bufv ? bufv[j] : src + j * SD_BLOCK_SIZE;
 
+        crc = crc16_buf(0, p, SD_BLOCK_SIZE);
         sd_txrx(spi, SD_START_BLOCK_TOKEN);
-        do {
-            uint8_t x = *p++;
-            sd_txrx(spi, x);
-            crc = crc16(crc, x);
-        } while (--n);
+        spi_txrx_buf(spi, p, NULL, SD_BLOCK_SIZE);
 
         sd_txrx(spi, crc >> 8);
         sd_txrx(spi, crc & 0xff);
@@ -377,3 +473,15 @@ int sd_write_blocks(spi_ctrl* spi, void* src, uint32_t dst_lba, size_t size)
     sd_cmd_end(spi);
     return rc;
 }
+
+
+int sd_write_blocks(spi_ctrl* spi, void* src, uint32_t dst_lba, size_t size)
+{
+    return sd_write(spi, NULL, src, dst_lba, size);
+}
+
+
+int sd_write_blocksv(spi_ctrl* spi, uint8_t* const* buf, uint32_t dst_lba, size_t size)
+{
+    return sd_write(spi, buf, NULL, dst_lba, size);
+}
@@ -17,30 +17,100 @@
 #include "include/string.h"
 #include "include/vm.h"
 #include "include/pm.h"
-extern struct proc* procs[NPROC];
-// Please be noticed that before we insert a new ksig into 
-// the list, we must make sure that there's no sigaction for 
-// the same signum in the sigaction list. 
+#include "include/utils/bitops.h"
 
-static void __insert_sig(struct proc *p, ksigaction_t *ksig) {
+extern char sig_trampoline[];
+extern char sig_handler[];
+
+struct sighand *sighand_alloc(void) {
+	struct sighand *sh = kmalloc(sizeof(struct sighand));
+
+	if (NULL == sh) {
+		__debug_warn("[sighand_alloc] fail to alloc\n");
+		return NULL;
+	}
+	memset(sh, 0, sizeof(struct sighand));
+	initlock(&sh->lock, "sighand");
+	sh->ref = 1;
+	return sh;
+}
+
+struct sighand *sighand_get(struct sighand *sh) {
+	acquire(&sh->lock);
+	sh->ref++;
+	release(&sh->lock);
+	return sh;
+}
+
+struct sighand *sighand_copy(struct sighand *sh) {
+	struct sighand *new = sighand_alloc();
 
-	// Create a new one 
-	ksig->next = p->sig_act;
-	p->sig_act = ksig;
+	if (NULL == new) {
+		return NULL;
+	}
+	acquire(&sh->lock);
+	memmove(new->action, sh->action, sizeof(sh->action));
+	release(&sh->lock);
+	return new;
 }
 
-static ksigaction_t *__search_sig(struct proc *p, int signum) {
+void sighand_put(struct sighand *sh) {
+	int ref;
 
-	ksigaction_t const* tmp = p->sig_act;
+	if (NULL == sh) {
+		return ;
+	}
+	acquire(&sh->lock);
+	ref = --sh->ref;
+	release(&sh->lock);
+	if (0 == ref) {
+		kfree(sh);
+	}
+}
 
-	while (NULL != tmp) {
-		if (tmp->signum == signum) {
-			break;
+int sighand_exec(struct proc *p) {
+	struct sighand *sh = p->sighand;
+	int shared;
+
+	acquire(&sh->lock);
+	shared = sh->ref > 1;
+	release(&sh->lock);
+	// don't touch the table still used by the rest of the thread group 
+	if (shared) {
+		if (NULL == (sh = sighand_copy(p->sighand))) {
+			return -1;
+		}
+		sighand_put(p->sighand);
+		p->sighand = sh;
+	}
+	acquire(&sh->lock);
+	for (int i = 0; i < NSIG; i ++) {
+		if (SIG_IGN != sh->action[i].__sigaction_handler.sa_handler) {
+			memset(&sh->action[i], 0, sizeof(struct sigaction));
 		}
-		tmp = tmp->next;
 	}
+	release(&sh->lock);
+	return 0;
+}
+
+int sig_next(struct proc *p) {
+	unsigned long ready = p->sig_pending.__val[0] & ~p->sig_set.__val[0];
+
+	return ready ? ctz64(ready) + 1 : 0;
+}
+
+int sig_catching(struct proc *p, int sig) {
+	__sighandler_t handler = p->sighand->action[sig - 1].__sigaction_handler.sa_handler;
+
+	if (SIG_DFL == handler || SIG_IGN == handler) {
+		return 0;
+	}
+	return !(p->sig_set.__val[0] & sigmask(sig));
+}
 
-	return (ksigaction_t*)tmp;
+void sig_raise(struct proc *p, int sig) {
+	p->sig_pending.__val[0] |= sigmask(sig);
+	p->killed = sig_next(p);
 }
 
 int set_sigaction(
@@ -48,36 +118,23 @@ int set_sigaction(
 	struct sigaction const *act, 
 	struct sigaction *oldact 
 ) {
-	struct proc *p = myproc();
-
-	ksigaction_t *tmp = __search_sig(p, signum);
-	// printf("pid %d search %d find %p\n", p->pid, signum, tmp);
+	struct sighand *sh = myproc()->sighand;
 
-	if (NULL != oldact && NULL != tmp) {
-		oldact->__sigaction_handler = tmp->sigact.__sigaction_handler;
-		// oldact->sa_flags = tmp->sigact.sa_flags;
-		// for (int i = 0; i < len; i ++) {
-		// 	oldact->sa_mask.__val[i] = tmp->sigact.sa_mask.__val[i];
-		// }
+	if (signum < 1 || signum > NSIG) {
+		return -1;
+	}
+	if (NULL != act && (SIGKILL == signum || SIGSTOP == signum)) {
+		return -1;
 	}
 
+	acquire(&sh->lock);
+	if (NULL != oldact) {
+		*oldact = sh->action[signum - 1];
+	}
 	if (NULL != act) {
-		if (NULL == tmp) {
-			// insert a new action into the proc 
-			// ksigaction_t *new = kmalloc(sizeof(ksigaction_t));
-            		ksigaction_t *new = kmalloc(sizeof(ksigaction_t));
-			__insert_sig(p, new);
-			tmp = new;
-		}
-
-		// tmp->sigact.sa_flags = act->sa_flags;
-		tmp->sigact.__sigaction_handler = act->__sigaction_handler;
-		// for (int i = 0; i < len; i ++) {
-		// 	tmp->sigact.sa_mask.__val[i] = act->sa_mask.__val[i];
-		// }
-		tmp->signum = signum;
+		sh->action[signum - 1] = *act;
 	}
-
+	release(&sh->lock);
 
 	return 0;
 }
@@ -94,6 +151,9 @@ int sigprocmask(
 		if (NULL != oldset) {
 			oldset->__val[i] = p->sig_set.__val[i];
 		}
+		if (NULL == set) {
+			continue;
+		}
 
 		switch (how) {
 			case SIG_BLOCK: 
@@ -106,99 +166,80 @@ int sigprocmask(
 				p->sig_set.__val[i] = set->__val[i];
 				break;
 			default: 
-                break;
-				// panic("invalid how\n");
+                return -1;
 		}
 	}
 
-	// SIGTERM cannot be masked 
-	p->sig_set.__val[0] &= 1ul << SIGTERM;
+	// SIGKILL and SIGTERM cannot be masked 
+	p->sig_set.__val[0] &= ~(sigmask(SIGKILL) | sigmask(SIGTERM));
+	// unblocking may have made something deliverable 
+	p->killed = sig_next(p);
 
 	return 0;
 }
 
-extern char sig_trampoline[];
-extern char sig_handler[];
-extern char default_sigaction[];
+// Signals whose default action is to be ignored. 
+static int sig_default_ignore(int signum) {
+	return SIGCHLD == signum || SIGURG == signum || SIGWINCH == signum;
+}
 
 void sighandle(void) {
 	struct proc *p = myproc();
-
-	int signum = 0;
-	if (p->killed) {
-		signum = p->killed;
-
-		const int len = sizeof(unsigned long) * 8;
-		int i = (unsigned long)(p->killed) / len;
-		int bit = (unsigned long)(p->killed) % len;
-		p->sig_pending.__val[i] &= ~(1ul << bit++);
-		p->killed = 0;
-
-		for (; i < SIGSET_LEN; i ++) {
-			while (bit < len) {
-				if (p->sig_pending.__val[i] & (1ul << bit)) {
-					p->killed = i * len + bit; // p->killed
-					goto start_handle;
-				}
-				bit ++;
-			}
+	struct sighand *sh = p->sighand;
+	struct sigaction act;
+	__sighandler_t handler;
+	int signum;
+
+	// drop signals that are ignored, until one needs the user 
+	while (0 != (signum = sig_next(p))) {
+		p->sig_pending.__val[0] &= ~sigmask(signum);
+		// a copy, as another thread may sigaction() meanwhile 
+		acquire(&sh->lock);
+		act = sh->action[signum - 1];
+		handler = act.__sigaction_handler.sa_handler;
+		if (SIG_IGN != handler && SIG_DFL != handler && (act.sa_flags & SA_RESETHAND)) {
+			sh->action[signum - 1].__sigaction_handler.sa_handler = SIG_DFL;
 		}
-
+		release(&sh->lock);
+		if (SIG_IGN == handler || 
+				(SIG_DFL == handler && sig_default_ignore(signum))) {
+			continue;
+		}
+		if (SIG_DFL == handler) {
+			exit(-1);
+		}
+		break;
 	}
-	else {
-		// no signal to handle
+	if (0 == signum) {
+		p->killed = 0;
 		return ;
 	}
 
-	struct sig_frame *frame;
-	struct trapframe *tf;
-	ksigaction_t *sigact;
-start_handle: 
-	// search for signal handler 
-	sigact = __search_sig(p, signum);
-
-	// fast skip 
-	// if (NULL == sigact && SIGCHLD == signum) {
-	// 	return ;
-	// }
-	if (SIGCHLD == signum && 
-		(NULL == sigact || NULL == sigact->sigact.__sigaction_handler.sa_handler)) {
-			return;
+	// save the user context, the trapframe page itself stays 
+	// in place as it's what TRAPFRAME maps 
+	struct sig_frame *frame = kmalloc(sizeof(struct sig_frame));
+	if (NULL == frame) {
+		__debug_warn("[sighandle] fail to alloc frame\n");
+		exit(-1);
+	}
+	frame->mask = p->sig_set;
+	frame->tf = *p->trapframe;
+	frame->next = p->sig_frame;
+	p->sig_frame = frame;
+
+	p->sig_set.__val[0] |= act.sa_mask.__val[0];
+	if (!(act.sa_flags & SA_NODEFER)) {
+		p->sig_set.__val[0] |= sigmask(signum);
 	}
 
-	// frame = kmalloc(sizeof(struct sig_frame));
-        frame = allocpage();
-	// tf = kmalloc(sizeof(struct trapframe));
-        tf = allocpage();
-	// copy mask 
-	// for (int i = 0; i < SIGSET_LEN; i ++) {
-	// 	frame->mask.__val[i] = p->sig_set.__val[i];
-	// 	if (NULL == sigact) {
-	// 		p->sig_set.__val[i] = 0;
-	// 	}
-	// 	else {
-	// 		p->sig_set.__val[i] &= sigact->sigact.sa_mask.__val[i];
-	// 	}
-	// }
-
-	// store proc's trapframe 
-	frame->tf = p->trapframe;
+	// sig_handler calls a1(a0), then rt_sigreturn 
+	struct trapframe *tf = p->trapframe;
 	tf->epc = (uint64)(SIG_TRAMPOLINE + ((uint64)sig_handler - (uint64)sig_trampoline));
-	tf->sp = p->trapframe->sp;
+	tf->sp &= ~0xful;
 	tf->a0 = signum;
-	if (NULL != sigact && sigact->sigact.__sigaction_handler.sa_handler) {
-		//temp way
-		tf->a1 = (uint64)(SIG_TRAMPOLINE + ((uint64)default_sigaction - (uint64)sig_trampoline));
-	}
-	else {
-		// use the default handler 
-		tf->a1 = (uint64)(SIG_TRAMPOLINE + ((uint64)default_sigaction - (uint64)sig_trampoline));
-	}
-	p->trapframe = tf;
+	tf->a1 = (uint64)handler;
 
-	// insert sig_frame into proc's sig_frame list 
-	frame->next = p->sig_frame;
-	p->sig_frame = frame;
+	p->killed = sig_next(p);
 }
 
 void sigframefree(struct sig_frame *head) {
@@ -208,47 +249,30 @@ void sigframefree(struct sig_frame *head) {
 		{
 		  __debug_warn("[sigframefree] loop!\n");
 		}
-		__debug_info("[sigframefree] free trapframe %p\n", head->tf);
-		kfree(head->tf);
-		__debug_info("[sigframefree] free %p\n", head);
-		kfree(head);
-		head = next;
-	}
-}
-
-void sigaction_free(ksigaction_t *head) {
-	while (NULL != head) {
-		ksigaction_t *next = head->next;
 		kfree(head);
 		head = next;
 	}
 }
 
-int sigaction_copy(ksigaction_t **pdst, ksigaction_t const *src) {
-	ksigaction_t *tmp = NULL;
+struct sig_frame *sigframe_copy(struct sig_frame const *head) {
+	struct sig_frame *first = NULL;
+	struct sig_frame **pnext = &first;
 
-	*pdst = NULL;
-	if (NULL == src) {
-		return 0;
-	}
-
-	while (NULL != src) {
-		tmp = kmalloc(sizeof(ksigaction_t));
+	while (NULL != head) {
+		struct sig_frame *tmp = kmalloc(sizeof(struct sig_frame));
 		if (NULL == tmp) {
-			__debug_warn("[sigaction_copy] fail to alloc\n");
-			sigaction_free(*pdst);
-			*pdst = NULL;
-			return -1;
+			__debug_warn("[sigframe_copy] fail to alloc\n");
+			sigframefree(first);
+			return NULL;
 		}
-
-		*tmp = *src;
-		tmp->next = *pdst;
-		*pdst = tmp;
-
-		src = src->next;
+		*tmp = *head;
+		tmp->next = NULL;
+		*pnext = tmp;
+		pnext = &tmp->next;
+		head = head->next;
 	}
 
-	return 0;
+	return first;
 }
 
 void sigreturn(void) {
@@ -259,14 +283,11 @@ void sigreturn(void) {
 	}
 
 	struct sig_frame *frame = p->sig_frame;
-	// for (int i = 0; i < SIGSET_LEN; i ++) {
-	// 	p->sig_set.__val[i] = frame->mask.__val[i];
-	// }
-	freepage(p->trapframe);
-	p->trapframe = frame->tf;
+	p->sig_set = frame->mask;
+	*p->trapframe = frame->tf;
 
 	// remove this frame from list 
 	p->sig_frame = frame->next;
-	freepage(frame);
+	kfree(frame);
+	p->killed = sig_next(p);
 }
-
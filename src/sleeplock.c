@@ -43,6 +43,20 @@ releasesleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Take lk if no one holds it. Returns 1 if it was taken, 0 if not.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if(r)
+    lk->locked = 1;
+  release(&lk->lk);
+  return r;
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
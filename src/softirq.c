@@ -0,0 +1,65 @@
+//
+// softirqs -- the part of interrupt handling that can wait until
+// the trap has been acknowledged.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/cpu.h"
+#include "include/printf.h"
+#include "include/softirq.h"
+#include "include/utils/bitops.h"
+
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+
+void
+open_softirq(int nr, void (*action)(void))
+{
+  if (nr < 0 || nr >= NR_SOFTIRQS)
+    panic("open_softirq");
+  softirq_vec[nr] = action;
+}
+
+void
+raise_softirq(int nr)
+{
+  mycpu()->softirq_pending |= 1ul << nr;
+}
+
+int
+in_softirq(void)
+{
+  push_off();
+  int ret = mycpu()->in_softirq;
+  pop_off();
+  return ret;
+}
+
+void
+do_softirq(void)
+{
+  struct cpu *c = mycpu();
+
+  // an interrupt taken while softirqs run leaves its own for the loop below
+  if (c->in_softirq || c->softirq_pending == 0)
+    return;
+
+  c->in_softirq = 1;
+  for (int restart = 0; c->softirq_pending && restart < MAX_SOFTIRQ_RESTART; restart++) {
+    uint64 pending = c->softirq_pending;
+    c->softirq_pending = 0;
+    intr_on();
+    while (pending) {
+      int nr = ctz64(pending);
+      pending &= pending - 1;
+      if (softirq_vec[nr])
+        softirq_vec[nr]();
+    }
+    intr_off();
+  }
+  // anything still pending waits for the next trap on this hart
+  c->in_softirq = 0;
+}
@@ -29,12 +29,20 @@ void spi_tx(spi_ctrl* spictrl, uint8_t in)
 }
 
 
+/**
+ * If set, called before spinning for received data, once rxmark is set
+ * to what is awaited. It may instead sleep until the rxwm interrupt.
+ */
+void (*spi_rx_wait)(spi_ctrl* spictrl);
+
+
 /**
  * Wait until SPI receive queue has data and read byte.
  */
 uint8_t spi_rx(spi_ctrl* spictrl)
 {
   int32_t out;
+  if (spi_rx_wait) spi_rx_wait(spictrl);
   while ((out = (int32_t) spictrl->rxdata.raw_bits) < 0);
   return (uint8_t) out;
 }
@@ -50,6 +58,47 @@ uint8_t spi_txrx(spi_ctrl* spictrl, uint8_t in)
 }
 
 
+/**
+ * Transmit and receive size bytes, keeping the FIFOs busy.
+ *
+ * Up to SPI_FIFO_DEPTH bytes are in flight at once, so neither FIFO can
+ * overflow and txdata never needs checking for full. With rxmark at half
+ * the depth, the receive FIFO is drained half a FIFO at a time while the
+ * other half is still being shifted. The last size % half bytes are read
+ * one at a time with rxmark back at 0. tx may be NULL to send all ones,
+ * rx NULL to drop what comes back.
+ */
+void spi_txrx_buf(spi_ctrl* spictrl, const uint8_t* tx, uint8_t* rx, uint32_t size)
+{
+  const uint32_t half = SPI_FIFO_DEPTH / 2;
+  uint32_t sent = 0, got = 0;
+
+  spictrl->rxmark.raw_bits = half - 1;
+  while (got < size) {
+    for (; sent < size && sent - got < SPI_FIFO_DEPTH; sent++) {
+      spictrl->txdata.raw_bits = tx ? tx[sent] : 0xFF;
+    }
+    if (sent - got >= half) {
+      // rxwm is up once more than rxmark bytes are waiting
+      if (spi_rx_wait) spi_rx_wait(spictrl);
+      while (!spictrl->ip.rxwm);
+      for (uint32_t i = 0; i < half; i++, got++) {
+        uint8_t x = (uint8_t) spictrl->rxdata.raw_bits;
+        if (rx) rx[got] = x;
+      }
+    } else {
+      // fewer than half are left, rxmark half - 1 would never be
+      // passed and spi_rx_wait would wait forever
+      spictrl->rxmark.raw_bits = 0;
+      uint8_t x = spi_rx(spictrl);
+      if (rx) rx[got] = x;
+      got++;
+    }
+  }
+  spictrl->rxmark.raw_bits = 0;
+}
+
+
 #define MICRON_SPI_FLASH_CMD_RESET_ENABLE        0x66
 #define MICRON_SPI_FLASH_CMD_MEMORY_RESET        0x99
 #define MICRON_SPI_FLASH_CMD_READ                0x03
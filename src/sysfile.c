@@ -7,22 +7,16 @@
 #include "include/copy.h"
 #include "include/pipe.h"
 #include "include/errno.h"
+#include "include/perf.h"
+#include "include/procfs.h"
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
 fdallocfrom(struct file *f,int start)
 {
-  int fd;
   struct proc *p = myproc();
-  //printf("[fdalloc]filelimit:%p\n",NOFILEMAX(p));
-  for(fd = start; fd < NOFILEMAX(p); fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -EMFILE;
+  return fdt_alloc(&p->fdt, f, start, NOFILEMAX(p));
 }
 
 // Allocate a file descriptor for the given file.
@@ -124,6 +118,22 @@ sys_openat()
     f->ep = ep;
     f->readable = !(flags & O_WRONLY);
     f->writable = (flags & O_WRONLY) || (flags & O_RDWR);
+    f->direct = (flags & O_DIRECT) != 0;
+  }else if(IS_PROCFS(devno)){
+    // ep is only the mount point, the file is all in the node
+    f->type = FD_PROC;
+    f->off = 0;
+    f->ep = NULL;
+    f->node = devno;
+    f->readable = 1;
+    f->writable = 0;
+    eunlock(ep);
+    eput(ep);
+    if(dp){
+      elock(dp);
+    }
+    fdt_set_cloexec(&p->fdt, fd, flags & O_CLOEXEC);
+    return fd;
   }else{
     f->type = FD_DEVICE;
     f->off = 0;
@@ -136,7 +146,7 @@ sys_openat()
   if(dp){
     elock(dp);  
   }
-  p->exec_close[fd] = 0;
+  fdt_set_cloexec(&p->fdt, fd, flags & O_CLOEXEC);
  // __debug_warn("[sys openat] fd:%d openat:%s\n",fd,path);
   return fd;
 }
@@ -197,20 +207,25 @@ sys_dup()
 uint64
 sys_dup3(void)
 {
-  struct file *f;
-  int newfd;
+  struct file *f, *old;
+  int oldfd, newfd, flags, err;
   struct proc* p = myproc();
-  if(argfd(0, 0, &f) < 0) 
+  if(argfd(0, &oldfd, &f) < 0) 
     return -1;
   if(argint(1, &newfd) < 0 || newfd < 0)
     return -1;
-  if(newfd >= NOFILEMAX(p)){
-    return -EMFILE;
-  }
-  if(p->ofile[newfd] != f) 
-  {
-    p->ofile[newfd] = filedup(f);
-  }
+  if(argint(2, &flags) < 0 || (flags & ~O_CLOEXEC))
+    return -EINVAL;
+  if(oldfd == newfd)
+    return -EINVAL;
+  old = fdt_get(&p->fdt, newfd);
+  if((err = fdt_install(&p->fdt, newfd, filedup(f), NOFILEMAX(p))) < 0){
+    fileclose(f);
+    return err;
+  }
+  if(old)
+    fileclose(old);
+  fdt_set_cloexec(&p->fdt, newfd, flags & O_CLOEXEC);
   return newfd;
 }
 
@@ -317,7 +332,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdt_remove(&myproc()->fdt, fd);
   fileclose(f);
   return 0;
 }
@@ -348,6 +363,11 @@ sys_unlinkat(void)
   if((ep = ename(dp,path,0)) == NULL){
     return -1;
   }
+  if(ep->mnt){
+    // a mount point, /proc among them, can't go
+    eput(ep);
+    return -EBUSY;
+  }
   elock(ep);
   if((ep->attribute & ATTR_DIRECTORY) && !isdirempty(ep)){
       eunlock(ep);
@@ -472,6 +492,12 @@ sys_fstatat(void)
     eunlock(ep);
     eput(ep);
   }
+  else if(IS_PROCFS(devno))
+  {
+    eput(ep);
+    if(procfs_kstat(devno, &kst) < 0)
+      return -ENOENT;
+  }
   else
   {
     if(devno < 0 || devno >= getdevnum())
@@ -633,6 +659,9 @@ sys_renameat2(void)
       || (name = formatname(old)) == NULL) {
     goto fail;          // src doesn't exist || dst parent doesn't exist || illegal new name
   }
+  if (olddevno != -1) {
+    goto fail;          // a /dev or /proc node, src is only the directory it's in
+  }
   for (struct dirent *ep = pdst; ep != NULL; ep = ep->parent) {
     if (ep == src) {    // In what universe can we move a directory into its child?
       goto fail;
@@ -738,6 +767,8 @@ sys_ioctl(void)
 	if (argfd(0, &fd, &f) < 0 || argaddr(1, &request) < 0 || argaddr(2, &argp) < 0)
 		return -1;
 	
+	if (f->type == FD_PERF)
+		return perf_event_ioctl(f->perf, request);
 	if (f->type != FD_DEVICE)
 		return -1;
 
@@ -788,9 +819,9 @@ sys_fcntl(void)
     return -1;
    //printf("[sys fcntl]fd:%d cmd:%d arg:%p\n",fd,cmd,arg);
   if(cmd == F_GETFD){
-    return p->exec_close[fd];
+    return fdt_get_cloexec(&p->fdt, fd) ? FD_CLOEXEC : 0;
   }else if(cmd == F_SETFD){
-    p->exec_close[fd] = arg;
+    fdt_set_cloexec(&p->fdt, fd, arg & FD_CLOEXEC);
   }else if(cmd == F_DUPFD){
     if((fd=fdallocfrom(f,arg)) < 0){
       return fd;
@@ -803,7 +834,7 @@ sys_fcntl(void)
       return fd;
     }
     filedup(f);
-    p->exec_close[fd] = 1;
+    fdt_set_cloexec(&p->fdt, fd, 1);
     //__debug_warn("[sys fcntl]return fd:%d\n",fd);
     return fd;
   }
@@ -826,22 +857,52 @@ sys_getdents64(void)
   return dirent_next(fp, buf, len);
 }
 
+#define PERF_FLAG_FD_CLOEXEC  (1UL << 3)
+
+uint64
+sys_perf_event_open(void)
+{
+  uint64 uattr;
+  struct perf_event_attr attr;
+  int pid, cpu, group_fd, flags, fd, ret;
+  struct file *f;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &uattr) < 0 || argint(1, &pid) < 0 || argint(2, &cpu) < 0 ||
+     argint(3, &group_fd) < 0 || argint(4, &flags) < 0)
+    return -1;
+  if(either_copyin(1, (char *)&attr, uattr, sizeof(attr)) < 0)
+    return -EFAULT;
+  // only the calling process, on whatever hart it runs, and no groups
+  if((pid != 0 && pid != p->pid) || cpu != -1 || group_fd != -1)
+    return -EINVAL;
+
+  if((ret = perf_event_alloc(&attr, p, &f)) < 0)
+    return ret;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -EMFILE;
+  }
+  fdt_set_cloexec(&p->fdt, fd, flags & PERF_FLAG_FD_CLOEXEC);
+  return fd;
+}
+
 uint64
 sys_pipe2(void)
 {
   uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
-  int fd0, fd1;
+  int fd0, fd1, flags;
   struct proc *p = myproc();
 
-  if(argaddr(0, &fdarray) < 0)
+  if(argaddr(0, &fdarray) < 0 || argint(1, &flags) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdt_remove(&p->fdt, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -850,13 +911,15 @@ sys_pipe2(void)
   //    copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
   if(either_copyout(1, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      either_copyout(1, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdt_remove(&p->fdt, fd0);
+    fdt_remove(&p->fdt, fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
-  printf("[pipe] fd0:%d fd1:%d\n",fd0,fd1);
+  fdt_set_cloexec(&p->fdt, fd0, flags & O_CLOEXEC);
+  fdt_set_cloexec(&p->fdt, fd1, flags & O_CLOEXEC);
+  //printf("[pipe] fd0:%d fd1:%d\n",fd0,fd1);
   return 0;
 }
 
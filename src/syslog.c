@@ -8,18 +8,11 @@
 #include "include/errno.h"
 #include "include/sysinfo.h"
 #include "include/pm.h"
+#include "include/klog.h"
+#include "include/memstat.h"
 
-char syslogbuf[1024];
-int logbuflen = 0;
-
-void
-logbufinit(){
-  logbuflen = 0;
-  strncpy(syslogbuf,
-  	"[log]init done\n",
-  	1024);
-  logbuflen+=strlen(syslogbuf);
-}
+// console level to go back to on SYSLOG_ACTION_CONSOLE_ON
+static int saved_console_level = -1;
 
 uint64
 sys_syslog(){
@@ -36,17 +29,46 @@ sys_syslog(){
     return -1;
   }
   switch(type){
+    case SYSLOG_ACTION_CLOSE:
+    case SYSLOG_ACTION_OPEN:
+      return 0;
+    case SYSLOG_ACTION_READ:
     case SYSLOG_ACTION_READ_ALL:
+    case SYSLOG_ACTION_READ_CLEAR:
     {
-      if(either_copyout(1,bufp,syslogbuf,logbuflen)<0){
-        return -1;
+      if(bufp == 0 || len < 0){
+        return -EINVAL;
+      }
+      if(type == SYSLOG_ACTION_READ){
+        return klog_read(bufp, len);
       }
-      return logbuflen;
+      return klog_read_all(bufp, len, type == SYSLOG_ACTION_READ_CLEAR);
     }
-    case SYSLOG_ACTION_SIZE_BUFFER: return sizeof(syslogbuf);
+    case SYSLOG_ACTION_CLEAR:
+      klog_clear();
+      return 0;
+    case SYSLOG_ACTION_CONSOLE_OFF:
+      if(saved_console_level == -1){
+        saved_console_level = klog_console_level(KLOG_ALERT);
+      }
+      return 0;
+    case SYSLOG_ACTION_CONSOLE_ON:
+      if(saved_console_level != -1){
+        klog_console_level(saved_console_level);
+        saved_console_level = -1;
+      }
+      return 0;
+    case SYSLOG_ACTION_CONSOLE_LEVEL:
+      if(len < 1 || len > KLOG_CONSOLE_DEFAULT){
+        return -EINVAL;
+      }
+      klog_console_level(len);
+      saved_console_level = -1;
+      return 0;
+    case SYSLOG_ACTION_SIZE_UNREAD: return klog_size_unread();
+    case SYSLOG_ACTION_SIZE_BUFFER: return klog_size_buffer();
   }
-  //printf("[syslog] type:%d bufp:%p len:%p\n",type,bufp,len);
-  return 0;
+  return -EINVAL;
 }
 
 uint64
@@ -63,11 +85,7 @@ sys_sysinfo(void)
 	memset(&info, 0, sizeof(info));
 
 	info.uptime = r_time() / CLK_FREQ;
-	info.totalram = PHYSTOP - RUSTSBI_BASE;
-	info.freeram = idlepages() << PGSHIFT;
-	info.bufferram = BSIZE * BNUM;
-	info.procs = NPROC;
-	info.mem_unit = PGSIZE;
+	memstat_sysinfo(&info);
 
 	// if (copyout(p->pagetable, addr, (char *)&info, sizeof(info)) < 0) {
 	if (either_copyout(1,addr, (char *)&info, sizeof(info)) < 0) {
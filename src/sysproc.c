@@ -6,6 +6,13 @@
 #include"include/pm.h"
 #include"include/uname.h"
 #include"include/copy.h"
+#include"include/errno.h"
+#include"include/schedstat.h"
+#include"include/memstat.h"
+#include"include/reboot.h"
+#include"include/sbi.h"
+#include"include/klog.h"
+#include"include/uart.h"
 
 uint64
 sys_execve()
@@ -136,6 +143,23 @@ sys_wait4()
   return wait4pid(pid,addr);
 }
 
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 addr;
+  struct rusage ru;
+
+  if(argint(0, &who) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  if(schedstat_rusage(myproc(), who, &ru) < 0)
+    return -EINVAL;
+  memstat_rusage(myproc(), who, &ru);
+  if(either_copyout(1, addr, (char *)&ru, sizeof(ru)) < 0)
+    return -EFAULT;
+  return 0;
+}
+
 uint64
 sys_set_tid_address(void){
   uint64 address;
@@ -180,6 +204,31 @@ sys_exit()
   return 0;
 }
 
+// Halting and powering off both end in an SBI shutdown, which on QEMU
+// ends the emulator. There is no way to restart.
+uint64
+sys_reboot(void)
+{
+  int magic1, magic2, cmd;
+
+  if(argint(0, &magic1) < 0 || argint(1, &magic2) < 0 || argint(2, &cmd) < 0)
+    return -1;
+  if(myproc()->uid != 0)
+    return -EPERM;
+  if((uint)magic1 != LINUX_REBOOT_MAGIC1 ||
+     (magic2 != LINUX_REBOOT_MAGIC2 && magic2 != LINUX_REBOOT_MAGIC2A &&
+      magic2 != LINUX_REBOOT_MAGIC2B && magic2 != LINUX_REBOOT_MAGIC2C))
+    return -EINVAL;
+  if((uint)cmd != LINUX_REBOOT_CMD_HALT && (uint)cmd != LINUX_REBOOT_CMD_POWER_OFF)
+    return -EINVAL;
+  printf("reboot: power down\n");
+  // SBI cuts the power at once, so print what is still buffered first
+  klog_flush();
+  uartflush();
+  shutdown();
+  return 0;
+}
+
 uint64 sys_nanosleep(void) {
 	uint64 addr_sec, addr_usec;
 
@@ -23,7 +23,8 @@ sys_exit_group(void){
 uint64
 sys_rt_sigreturn(void){
   sigreturn();
-  return 0;
+  // syscall() stores the return value into a0, hand back the restored one
+  return myproc()->trapframe->a0;
 }
 
 uint64 sys_rt_sigprocmask(void){
@@ -40,7 +41,7 @@ uint64 sys_rt_sigprocmask(void){
 		return -1;
 	}
 
-	if (sigprocmask(how, &set, uptr_oldset ? &oldset : NULL)) {
+	if (sigprocmask(how, uptr_set ? &set : NULL, uptr_oldset ? &oldset : NULL)) {
 		return -1;
 	}
 
@@ -65,9 +66,7 @@ uint64 sys_rt_sigaction(void) {
 	struct sigaction oldact;
 
 	if (uptr_act) {
-		if (
-			copyin2((char*)&(act.__sigaction_handler), uptr_act, sizeof(__sighandler_t)) < 0 
-		) {
+		if (copyin2((char*)&act, uptr_act, sizeof(struct sigaction)) < 0) {
 			return -1;
 		}
 	}
@@ -81,9 +80,7 @@ uint64 sys_rt_sigaction(void) {
 	}
 
 	if (uptr_oldact) {
-		if (
-			copyout2(uptr_oldact, (char*)&(act.__sigaction_handler), sizeof(__sighandler_t)) < 0 
-		) {
+		if (copyout2(uptr_oldact, (char*)&oldact, sizeof(struct sigaction)) < 0) {
 			return -1;
 		}
 	}
@@ -0,0 +1,217 @@
+//
+// sysstat -- per-syscall counts, errors and latency histograms.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/kalloc.h"
+#include "include/copy.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/syscall.h"
+#include "include/seqbuf.h"
+#include "include/sysstat.h"
+#include "include/utils/bitops.h"
+
+extern struct proc proc[NPROC];
+
+volatile int sysstat_on;
+
+// Each hart only updates its own table, with interrupts off.
+static struct sysstat sysstat_cpus[NCPU][NSYSCALL];
+
+static int view_pid;        // 0 for the system-wide view
+
+void
+sysstat_init(void)
+{
+  sysstat_on = 0;
+  view_pid = 0;
+}
+
+uint64
+sysstat_start(int *hart)
+{
+  uint64 t;
+
+  push_off();
+  *hart = cpuid();
+  t = r_cycle();
+  pop_off();
+  return t;
+}
+
+void
+sysstat_end(struct proc *p, int num, uint64 ret, uint64 start, int hart)
+{
+  if (start == 0 || num <= 0 || num >= NSYSCALL)
+    return;
+
+  push_off();
+  uint64 cycles = r_cycle() - start;
+  int timed = cpuid() == hart;
+  int b = cycles ? ilog2_64(cycles) : 0;
+  if (b >= SYSSTAT_NBUCKET)
+    b = SYSSTAT_NBUCKET - 1;
+
+  struct sysstat *s = &sysstat_cpus[cpuid()][num];
+  s->calls++;
+  // -1 or -errno
+  if ((int64)ret < 0 && (int64)ret >= -4095)
+    s->errors++;
+  if (timed) {
+    s->timed++;
+    s->cycles += cycles;
+    s->hist[b]++;
+  }
+  pop_off();
+
+  if (!timed)
+    return;
+  if (p->sysstat == NULL) {
+    if ((p->sysstat = kmalloc(sizeof(struct proc_sysstat))) == NULL)
+      return;
+    memset(p->sysstat, 0, sizeof(struct proc_sysstat));
+  }
+  p->sysstat->calls[num]++;
+  p->sysstat->cycles[num] += cycles;
+}
+
+void
+sysstat_free(struct proc *p)
+{
+  if (p->sysstat) {
+    kfree(p->sysstat);
+    p->sysstat = NULL;
+  }
+}
+
+static void
+report_all(struct seqbuf *sq)
+{
+  seq_printf(sq, "%-16s %10s %8s %10s %14s %10s\n", "syscall", "calls", "errors", "timed", "cycles", "avg");
+  for (int num = 1; num < NSYSCALL; num++) {
+    struct sysstat sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int c = 0; c < NCPU; c++) {
+      struct sysstat *s = &sysstat_cpus[c][num];
+      sum.calls += s->calls;
+      sum.errors += s->errors;
+      sum.timed += s->timed;
+      sum.cycles += s->cycles;
+      for (int b = 0; b < SYSSTAT_NBUCKET; b++)
+        sum.hist[b] += s->hist[b];
+    }
+    if (sum.calls == 0)
+      continue;
+
+    char *name = syscall_name(num);
+    seq_printf(sq, "%-16s %10lu %8lu %10lu %14lu %10lu\n", name ? name : "?",
+               sum.calls, sum.errors, sum.timed, sum.cycles,
+               sum.timed ? sum.cycles / sum.timed : 0);
+    // "b:n" means n calls took [2^b, 2^(b+1)) cycles
+    seq_printf(sq, "  log2(cycles)");
+    for (int b = 0; b < SYSSTAT_NBUCKET; b++) {
+      if (sum.hist[b])
+        seq_printf(sq, " %d:%u", b, sum.hist[b]);
+    }
+    seq_printf(sq, "\n");
+  }
+}
+
+static void
+report_pid(struct seqbuf *sq, int pid)
+{
+  struct proc *p = findproc(pid);
+  struct proc_sysstat *ps;
+  char name[16];
+
+  // too big for the stack
+  if (p == NULL || (ps = kmalloc(sizeof(struct proc_sysstat))) == NULL)
+    goto none;
+  // copy it out so we don't copyout with p->lock held
+  acquire(&p->lock);
+  if (p->pid != pid || p->sysstat == NULL) {
+    release(&p->lock);
+    kfree(ps);
+    goto none;
+  }
+  *ps = *p->sysstat;
+  memmove(name, p->name, sizeof(name));
+  release(&p->lock);
+  name[sizeof(name) - 1] = 0;
+
+  seq_printf(sq, "pid %d %s\n", pid, name);
+  seq_printf(sq, "%-16s %10s %14s %10s\n", "syscall", "timed", "cycles", "avg");
+  for (int num = 1; num < NSYSCALL; num++) {
+    if (ps->calls[num] == 0)
+      continue;
+    char *name = syscall_name(num);
+    seq_printf(sq, "%-16s %10u %14lu %10lu\n", name ? name : "?",
+               ps->calls[num], ps->cycles[num], ps->cycles[num] / ps->calls[num]);
+  }
+  kfree(ps);
+  return;
+
+none:
+  seq_printf(sq, "pid %d: no syscalls recorded\n", pid);
+}
+
+int
+sysstatread(int user_dst, uint64 addr, uint64 off, int n)
+{
+  struct seqbuf sq;
+
+  seq_init(&sq, user_dst, addr, off, n);
+  if (view_pid)
+    report_pid(&sq, view_pid);
+  else
+    report_all(&sq);
+  return seq_result(&sq);
+}
+
+static void
+sysstat_reset(void)
+{
+  memset(sysstat_cpus, 0, sizeof(sysstat_cpus));
+  for (struct proc *p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if (p->sysstat)
+      memset(p->sysstat, 0, sizeof(struct proc_sysstat));
+    release(&p->lock);
+  }
+}
+
+int
+sysstatwrite(int user_dst, uint64 addr, int n)
+{
+  char cmd[24];
+  int len = n < sizeof(cmd) - 1 ? n : sizeof(cmd) - 1;
+
+  if (either_copyin(user_dst, cmd, addr, len) < 0)
+    return -1;
+  cmd[len] = 0;
+  if (len > 0 && cmd[len - 1] == '\n')
+    cmd[len - 1] = 0;
+
+  if (strncmp(cmd, "on", sizeof(cmd)) == 0) {
+    sysstat_on = 1;
+  } else if (strncmp(cmd, "off", sizeof(cmd)) == 0) {
+    sysstat_on = 0;
+  } else if (strncmp(cmd, "reset", sizeof(cmd)) == 0) {
+    sysstat_reset();
+  } else if (strncmp(cmd, "pid ", 4) == 0) {
+    int pid = 0;
+    for (char *s = cmd + 4; *s >= '0' && *s <= '9'; s++)
+      pid = pid * 10 + *s - '0';
+    view_pid = pid;
+  } else {
+    __debug_warn("[sysstat] unknown command %s\n", cmd);
+    return -1;
+  }
+  return n;
+}
@@ -9,13 +9,22 @@
 #include "include/timer.h"
 #include "include/printf.h"
 #include "include/proc.h"
+#include "include/softirq.h"
+#include "include/klog.h"
+#include "include/schedstat.h"
 
 struct spinlock tickslock;
 uint ticks;
 
+static void timer_softirq() {
+    wakeup(&ticks);
+    klog_kick();
+}
+
 void timerinit() {
     initlock(&tickslock, "time");
     ticks = 0;
+    open_softirq(TIMER_SOFTIRQ, timer_softirq);
     #ifdef DEBUG
     printf("timerinit\n");
     #endif
@@ -35,9 +44,11 @@ set_next_timeout() {
 void timer_tick() {
     acquire(&tickslock);
     ticks++;
-    wakeup(&ticks);
     release(&tickslock);
     set_next_timeout();
+    schedstat_tick();
+    // sleepers are woken from the softirq, after the trap is done
+    raise_softirq(TIMER_SOFTIRQ);
 }
 
 uint64 get_time_ms() {
@@ -0,0 +1,150 @@
+//
+// trace -- per-hart binary event rings behind the trace() tracepoints.
+//
+// A hart appends to its own ring with interrupts off, so tracepoints
+// take no lock and can sit anywhere, the scheduler included. When a
+// ring is full new records are counted and dropped; the reader reports
+// the count as a TRACE_LOST record.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/copy.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/trace.h"
+
+volatile uint64 trace_mask;
+
+struct trace_cpu {
+  struct trace_rec ring[TRACE_NREC];
+  uint64 head;          // written by the hart itself
+  uint64 tail;          // written by the reader
+  uint64 lost;
+};
+
+static struct trace_cpu trace_cpus[NCPU];
+
+static struct spinlock trace_lock;    // serializes readers
+
+void
+trace_init(void)
+{
+  initlock(&trace_lock, "trace");
+  trace_mask = 0;
+}
+
+void
+__trace(int event, uint64 a0, uint64 a1)
+{
+  push_off();
+  struct cpu *c = mycpu();
+  struct trace_cpu *tc = &trace_cpus[cpuid()];
+  if (tc->head - __atomic_load_n(&tc->tail, __ATOMIC_ACQUIRE) == TRACE_NREC) {
+    tc->lost++;
+  } else {
+    struct trace_rec *r = &tc->ring[tc->head % TRACE_NREC];
+    r->time = r_time();
+    r->pid = c->proc ? c->proc->pid : 0;
+    r->event = event;
+    r->hart = cpuid();
+    r->pad = 0;
+    r->a0 = a0;
+    r->a1 = a1;
+    __atomic_store_n(&tc->head, tc->head + 1, __ATOMIC_RELEASE);
+  }
+  pop_off();
+}
+
+// Hand out whole records, one hart after the other; the decoder sorts
+// them by time. Returns the bytes copied. Records come off the rings
+// under trace_lock, TRACE_BATCH at a time, and are copied out after it
+// is released, as the copy may fault in a page and sleep; a batch that
+// fails to copy is lost.
+int
+traceread(int user_dst, uint64 addr, int n)
+{
+  struct trace_rec batch[TRACE_BATCH];
+  int sz = sizeof(struct trace_rec);
+  int ret = 0, k;
+
+  do {
+    k = 0;
+    acquire(&trace_lock);
+    for (int i = 0; i < NCPU && k < TRACE_BATCH && n - ret - k * sz >= sz; i++) {
+      struct trace_cpu *tc = &trace_cpus[i];
+      uint64 lost = __atomic_exchange_n(&tc->lost, 0, __ATOMIC_RELAXED);
+      if (lost)
+        batch[k++] = (struct trace_rec){ .time = r_time(), .event = TRACE_LOST, .hart = i, .a0 = lost };
+      uint64 head = __atomic_load_n(&tc->head, __ATOMIC_ACQUIRE);
+      while (tc->tail != head && k < TRACE_BATCH && n - ret - k * sz >= sz) {
+        batch[k++] = tc->ring[tc->tail % TRACE_NREC];
+        __atomic_store_n(&tc->tail, tc->tail + 1, __ATOMIC_RELEASE);
+      }
+    }
+    release(&trace_lock);
+    if (k && either_copyout(user_dst, addr + ret, batch, k * sz) < 0)
+      return ret ? ret : -1;
+    ret += k * sz;
+  } while (k);
+  return ret;
+}
+
+static uint64
+parse_mask(char *s)
+{
+  uint64 x = 0;
+
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    for (s += 2; *s; s++) {
+      int d;
+      if (*s >= '0' && *s <= '9')
+        d = *s - '0';
+      else if (*s >= 'a' && *s <= 'f')
+        d = *s - 'a' + 10;
+      else if (*s >= 'A' && *s <= 'F')
+        d = *s - 'A' + 10;
+      else
+        break;
+      x = x * 16 + d;
+    }
+  } else {
+    for (; *s >= '0' && *s <= '9'; s++)
+      x = x * 10 + *s - '0';
+  }
+  return x;
+}
+
+// "reset" throws away what's buffered, a number sets trace_mask,
+// e.g. "0x3fe" to trace everything.
+int
+tracewrite(int user_dst, uint64 addr, int n)
+{
+  char cmd[24];
+  int len = n < sizeof(cmd) - 1 ? n : sizeof(cmd) - 1;
+
+  if (either_copyin(user_dst, cmd, addr, len) < 0)
+    return -1;
+  cmd[len] = 0;
+  if (len > 0 && cmd[len - 1] == '\n')
+    cmd[len - 1] = 0;
+
+  if (strncmp(cmd, "reset", sizeof(cmd)) == 0) {
+    acquire(&trace_lock);
+    for (int i = 0; i < NCPU; i++) {
+      trace_cpus[i].tail = __atomic_load_n(&trace_cpus[i].head, __ATOMIC_ACQUIRE);
+      trace_cpus[i].lost = 0;
+    }
+    release(&trace_lock);
+  } else if (cmd[0] >= '0' && cmd[0] <= '9') {
+    trace_mask = parse_mask(cmd) & ((1ul << TRACE_NR_EVENTS) - 1);
+  } else {
+    __debug_warn("[trace] unknown command %s\n", cmd);
+    return -1;
+  }
+  return n;
+}
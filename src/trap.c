@@ -14,9 +14,17 @@
 #include "include/timer.h"
 #include "include/disk.h"
 #include "include/debug.h"
+#include "include/uart.h"
+#include "include/softirq.h"
+#include "include/kprof.h"
+#include "include/trace.h"
+#include "include/schedstat.h"
 
 extern char trampoline[], uservec[], userret[];
 
+// per hart, for /proc/interrupts
+static uint64 intr_counts[NCPU][NINTR_STAT];
+
 // in kernelvec.S, calls kerneltrap().
 extern void kernelvec();
 
@@ -35,6 +43,7 @@ int handle_excp(uint64 scause);
 #define EXCP_LOAD_ACCESS  0x5
 #define EXCP_STORE_ACCESS 0x7
 #define EXCP_ENV_CALL     0x8
+#define EXCP_INST_PAGE    0xc // 12
 #define EXCP_LOAD_PAGE    0xd // 13
 #define EXCP_STORE_PAGE   0xf // 15
 
@@ -59,6 +68,22 @@ trapinithart(void)
   __debug_info("trapinithart\n");
 }
 
+// A page fault from user space handle_page_fault() may resolve. It can
+// read the disk, so interrupts go on, after stval has been read.
+static int
+user_page_fault(uint64 cause)
+{
+  uint64 va = r_stval();
+  int kind = FAULT_READ;
+
+  if(cause == EXCP_STORE_PAGE)
+    kind = FAULT_WRITE;
+  else if(cause == EXCP_INST_PAGE)
+    kind = FAULT_EXEC;
+  intr_on();
+  return handle_page_fault(kind, va);
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -77,12 +102,15 @@ usertrap(void)
 
   //printf("user trap scause:%p\n",r_scause());
   struct proc *p = myproc();
+  schedstat_user_exit(p);
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
   //printf("[usertrap] enter epc:%p\n",p->trapframe->epc);
   
   uint64 cause = r_scause();
+  if(cause == EXCP_LOAD_PAGE || cause == EXCP_STORE_PAGE || cause == EXCP_INST_PAGE)
+    trace(TRACE_PAGE_FAULT, r_stval(), cause);
   if(cause == EXCP_ENV_CALL){
     // system call
     if(p->killed == SIGTERM)
@@ -96,7 +124,9 @@ usertrap(void)
     syscall();
   } 
   else if((which_dev = devintr()) != 0){
-    // ok
+    if(which_dev == 2)
+      kprof_tick(1, p->trapframe->epc, 0);
+    do_softirq();
   }
   /* 
   else if(handle_excp(cause) == 0)
@@ -104,6 +134,17 @@ usertrap(void)
 
   }
   */
+  else if((cause == EXCP_LOAD_PAGE || cause == EXCP_STORE_PAGE || cause == EXCP_INST_PAGE)
+          && user_page_fault(cause) == 0){
+    // paged in or copied on write, go back and redo the access
+  }
+  else if((cause == EXCP_LOAD_PAGE || cause == EXCP_STORE_PAGE || cause == EXCP_INST_PAGE)
+          && sig_catching(p, SIGSEGV)){
+    // let the user's SIGSEGV handler deal with it
+    acquire(&p->lock);
+    sig_raise(p, SIGSEGV);
+    release(&p->lock);
+  }
   else if(cause == 3){
     printf("ebreak\n");
     trapframedump(p->trapframe);
@@ -169,6 +210,7 @@ usertrapret(){
   // and switches to user mode with sret.
 
   uint64 fn = TRAMPOLINE + (userret - trampoline);
+  schedstat_user_enter(p);
   
   ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
 }
@@ -196,9 +238,16 @@ kerneltrap() {
     panic("kerneltrap");
   }
   // printf("which_dev: %d\n", which_dev);
+  // kernelvec leaves s0 alone, so the s0 our prologue saved is the
+  // interrupted code's frame pointer.
+  if(which_dev == 2)
+    kprof_tick(0, sepc, ((uint64 *)r_fp())[-2]);
+  do_softirq();
   
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING) {
+  // give up the CPU if this is a timer interrupt, unless it came
+  // in while this hart was running softirqs.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING
+     && !mycpu()->in_softirq) {
     //printf("[kerneltrap] hart %d time interrupt\n",mycpu()-cpus);
     yield();
   }
@@ -218,40 +267,30 @@ int devintr(void) {
 	//printf("devintr scause:%p\n",scause);
 
 	// handle external interrupt 
-	if ((0x8000000000000000L & scause) && 9 == (scause & 0xff)) 
+	if (INTR_EXTERNAL == scause) 
 	{
-		int irq =0;
-		// plic_claim();
-		printf("irq:%d\n",irq);
+		int irq = plic_claim();
 		if (UART0_IRQ == irq) {
-			//printf("cao\n");
-			// keyboard input 
-			int c = sbi_console_getchar();
-			if (-1 != c) {
-				//consoleintr(c);
-			}
+			intr_counts[cpuid()][INTR_STAT_UART]++;
+			uartintr();
 		}
-		/*
-		else if (DISK_IRQ == irq) {
+		else if (SPI2_IRQ == irq) {
+			intr_counts[cpuid()][INTR_STAT_SPI]++;
 			disk_intr();
 		}
-		*/
 		else if (irq) {
+			intr_counts[cpuid()][INTR_STAT_OTHER]++;
 			printf("unexpected interrupt irq = %d\n", irq);
 		}
 
 		if (irq) { 
-		  //plic_complete(irq);
+			plic_complete(irq);
 		}
 
-		#ifndef QEMU 
-		w_sip(r_sip() & ~2);    // clear pending bit
-		sbi_set_mie();
-		#endif 
-
 		return 1;
 	}
 	else if (0x8000000000000005L == scause) {
+		intr_counts[cpuid()][INTR_STAT_TIMER]++;
 		timer_tick();
                 //proc_tick();
 		return 2;
@@ -259,6 +298,11 @@ int devintr(void) {
 	else { return 0;}
 }
 
+uint64
+intr_count(int hart, int src)
+{
+  return intr_counts[hart][src];
+}
 
 void trapframedump(struct trapframe *tf)
 {
@@ -90,7 +90,7 @@ argfd(int n, int *pfd, struct file **pf)
     return -1;
   if(pfd)
     *pfd = fd;
-  if(fd < 0 || fd >= NOFILEMAX(p) || (f=p->ofile[fd]) == NULL)
+  if(fd < 0 || fd >= NOFILEMAX(p) || (f=fdt_get(&p->fdt, fd)) == NULL)
     return -1;
   if(pf)
     *pf = f;
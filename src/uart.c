@@ -0,0 +1,183 @@
+//
+// Interrupt-driven driver for the SiFive UART behind /dev/console.
+//
+// Received bytes are moved from the RX FIFO into a ring buffer by
+// the RX watermark interrupt, readers sleep until it is non-empty.
+// Writers fill the TX ring and the TX watermark interrupt keeps
+// the FIFO topped up, so a whole buffer goes out without an SBI
+// call per byte. Kernel printf() still uses the SBI console.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/memlayout.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/copy.h"
+#include "include/printf.h"
+#include "include/uart.h"
+#include "sifive/platform.h"
+
+#define Reg(reg) ((volatile uint32 *)(UART0_V + (reg)))
+#define ReadReg(reg) (*(Reg(reg)))
+#define WriteReg(reg, v) (*(Reg(reg)) = (v))
+
+#define UART_TXFULL   (1u << 31)  // txdata: fifo can't take more
+#define UART_RXEMPTY  (1u << 31)  // rxdata: nothing was read
+
+// the TX watermark interrupt fires while fewer than this many
+// bytes are left in the 8-entry fifo
+#define UART_TX_WM    2
+
+static struct {
+  struct spinlock lock;
+  char rx_buf[UART_RX_BUF_SIZE];
+  uint64 rx_r;    // read index, only ever grows
+  uint64 rx_w;    // write index, only ever grows
+  char tx_buf[UART_TX_BUF_SIZE];
+  uint64 tx_r;
+  uint64 tx_w;
+} uart;
+
+void
+uartinit(void)
+{
+  initlock(&uart.lock, "uart");
+  uart.rx_r = uart.rx_w = 0;
+  uart.tx_r = uart.tx_w = 0;
+
+  // the SBI firmware has already set the baud rate divisor.
+  WriteReg(UART_REG_TXCTRL, UART_TXEN | UART_TXWM(UART_TX_WM));
+  // interrupt as soon as there's one byte in the fifo.
+  WriteReg(UART_REG_RXCTRL, UART_RXEN | UART_RXWM(0));
+  WriteReg(UART_REG_IE, UART_IP_RXWM);
+  __debug_info("uartinit\n");
+}
+
+// Move bytes from the TX ring into the fifo until either
+// runs out, and ask for an interrupt if there's more to send.
+// uart.lock must be held.
+static void
+uartstart(void)
+{
+  int32 r;
+
+  while(uart.tx_r != uart.tx_w){
+    // amoor so the full check and the store are one access,
+    // the SBI console may be writing to the same fifo.
+    asm volatile (
+      "amoor.w %0, %2, %1\n"
+      : "=r" (r), "+A" (*Reg(UART_REG_TXFIFO))
+      : "r" ((uint32)(uchar)uart.tx_buf[uart.tx_r % UART_TX_BUF_SIZE])
+    );
+    if(r & UART_TXFULL)
+      break;
+    uart.tx_r++;
+  }
+  wakeup(&uart.tx_r);
+
+  if(uart.tx_r != uart.tx_w)
+    WriteReg(UART_REG_IE, UART_IP_RXWM | UART_IP_TXWM);
+  else
+    WriteReg(UART_REG_IE, UART_IP_RXWM);
+}
+
+// Append bytes to the TX ring, sleeping while it's full.
+// uart.lock must be held.
+static void
+uartqueue(char *buf, int n)
+{
+  int i = 0;
+
+  while(i < n){
+    while(uart.tx_w - uart.tx_r == UART_TX_BUF_SIZE){
+      uartstart();
+      sleep(&uart.tx_r, &uart.lock);
+    }
+    while(i < n && uart.tx_w - uart.tx_r < UART_TX_BUF_SIZE)
+      uart.tx_buf[uart.tx_w++ % UART_TX_BUF_SIZE] = buf[i++];
+  }
+  uartstart();
+}
+
+int
+uartwrite(int user_src, uint64 src, int n)
+{
+  char buf[128];
+  int ret = 0;
+
+  while(ret < n){
+    int len = MIN(n - ret, sizeof(buf));
+    if(either_copyin(user_src, buf, src + ret, len) < 0)
+      break;
+    acquire(&uart.lock);
+    uartqueue(buf, len);
+    release(&uart.lock);
+    ret += len;
+  }
+  return ret;
+}
+
+void
+uartputc(int c)
+{
+  char ch = c;
+
+  acquire(&uart.lock);
+  uartqueue(&ch, 1);
+  release(&uart.lock);
+}
+
+// Send everything queued, spinning rather than sleeping, and wait
+// for the fifo to empty as well. For shutdown.
+void
+uartflush(void)
+{
+  acquire(&uart.lock);
+  while(uart.tx_r != uart.tx_w)
+    uartstart();
+  // the watermark pending bit now means the fifo is empty
+  WriteReg(UART_REG_TXCTRL, UART_TXEN | UART_TXWM(1));
+  while(!(ReadReg(UART_REG_IP) & UART_IP_TXWM))
+    ;
+  WriteReg(UART_REG_TXCTRL, UART_TXEN | UART_TXWM(UART_TX_WM));
+  release(&uart.lock);
+}
+
+int
+uartgetc(void)
+{
+  int c;
+
+  acquire(&uart.lock);
+  while(uart.rx_r == uart.rx_w){
+    if(myproc()->killed){
+      release(&uart.lock);
+      return -1;
+    }
+    sleep(&uart.rx_r, &uart.lock);
+  }
+  c = (uchar)uart.rx_buf[uart.rx_r++ % UART_RX_BUF_SIZE];
+  release(&uart.lock);
+  return c;
+}
+
+// Handle a uart interrupt: drain the RX fifo into the ring,
+// then refill the TX fifo.
+void
+uartintr(void)
+{
+  uint32 c;
+
+  acquire(&uart.lock);
+  while(!((c = ReadReg(UART_REG_RXFIFO)) & UART_RXEMPTY)){
+    // drop input when nobody reads it
+    if(uart.rx_w - uart.rx_r < UART_RX_BUF_SIZE)
+      uart.rx_buf[uart.rx_w++ % UART_RX_BUF_SIZE] = c & 0xff;
+  }
+  if(uart.rx_r != uart.rx_w)
+    wakeup(&uart.rx_r);
+  uartstart();
+  release(&uart.lock);
+}
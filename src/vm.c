@@ -9,12 +9,15 @@
 #include "include/proc.h"
 #include "include/printf.h"
 #include "include/string.h"
+#include "include/vma.h"
+#include "include/memstat.h"
 #include "sifive/platform.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
+uint64 pgtbl_pages;       // page-table pages in use, kernel's and users'
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 extern char trampoline[]; // trampoline.S
 extern char sig_trampoline[]; //sig_trampoline.S
@@ -23,12 +26,17 @@ void
 kvminit()
 {
   kernel_pagetable = (pagetable_t) allocpage();
+  pgtbl_pages++;
   // printf("kernel_pagetable: %p\n", kernel_pagetable);
 
   memset(kernel_pagetable, 0, PGSIZE);
   #ifdef RAM
   kvmmap(RAMDISK, RAMDISK, 0x5000000, PTE_R | PTE_W);
   #endif
+  // uart registers
+  kvmmap(UART0_V, UART0, PGSIZE, PTE_R | PTE_W);
+  // PLIC
+  kvmmap(PLIC_V, PLIC, PLIC_SIZE, PTE_R | PTE_W);
   #ifdef SD
   // SPI
   kvmmap(SPI2_CTRL_ADDR, SPI2_CTRL_ADDR_P, SPI2_CTRL_SIZE, PTE_R | PTE_W);
@@ -42,7 +50,8 @@ kvminit()
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
   // map the trapoline for signal
-  kvmmap(SIG_TRAMPOLINE, (uint64)sig_trampoline, PGSIZE, PTE_R | PTE_X);
+  // user mode runs it to call handlers, so it needs PTE_U
+  kvmmap(SIG_TRAMPOLINE, (uint64)sig_trampoline, PGSIZE, PTE_R | PTE_X | PTE_U);
   
   __debug_info("kvminit\n");
 }
@@ -131,7 +140,7 @@ vmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       panic("vmunmap: not a leaf");
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      freepage((void*)pa);
     }
     *pte = 0;
   }
@@ -150,6 +159,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     } else {
       if(!alloc || (pagetable = (pde_t*)allocpage()) == NULL)
         return NULL;
+      __sync_fetch_and_add(&pgtbl_pages, 1);
       
       memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
@@ -206,6 +216,163 @@ experm(pagetable_t pagetable, uint64 va,uint64 perm)
   return pa;
 }
 
+// Give the PTE_COW page at va a copy of its own, or the page itself if
+// nothing else holds it, and make it writable.
+// Returns the physical address, or NULL if out of memory.
+uint64
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = walk(pagetable, va, 0);
+  uint64 pa = PTE2PA(*pte);
+  int flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  char *mem;
+
+  if(pageref((void*)pa) > 1){
+    if((mem = allocpage()) == NULL)
+      return NULL;
+    memmove(mem, (char*)pa, PGSIZE);
+    freepage((void*)pa);
+    pa = (uint64)mem;
+  }
+  *pte = PA2PTE(pa) | flags;
+  sfence_vma();
+  return pa;
+}
+
+// Fault in the page at va of the current process, as the kernel is
+// about to touch it for the user. 0 if it is there now.
+static int
+fault_in(pagetable_t pagetable, int kind, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == NULL || pagetable != p->pagetable)
+    return -1;
+  return handle_page_fault(kind, va);
+}
+
+// walkaddr() for a page the kernel is about to read for the user: an
+// ELF segment page nothing has touched yet is faulted in.
+uint64
+walkaddr_read(pagetable_t pagetable, uint64 va)
+{
+  uint64 pa = walkaddr(pagetable, va);
+
+  if(pa == NULL && va < MAXVA && fault_in(pagetable, FAULT_READ, va) == 0)
+    pa = walkaddr(pagetable, va);
+  return pa;
+}
+
+// Fault in the pages of [va, va + n) the kernel is about to copy to
+// (write) or from, so that the copy itself needn't. Stops at the first
+// page there is nothing to fault in at; the copy fails there.
+void
+uvm_prefault(pagetable_t pagetable, uint64 va, uint64 n, int write)
+{
+  for(uint64 a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    if((write ? walkaddr_write(pagetable, a) : walkaddr_read(pagetable, a)) == NULL)
+      break;
+  }
+}
+
+// Make the page at va of the current process one of its own, for a
+// MAP_FIXED mapping to read a file into: faulted in if a file-backed
+// vma hadn't yet, copied if it is a page cache or copy-on-write page.
+// Returns the physical address, or NULL if there is no page there.
+uint64
+uvmprivate(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct vma *vma;
+  pte_t *pte;
+  int w;
+
+  if(va >= MAXVA)
+    return NULL;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(pagetable != p->pagetable || (vma = addr_locate_vma(p->vma, va)) == NULL
+       || vma->ep == NULL || vma_fault_file(pagetable, vma, va, EP_SLEEP) < 0)
+      return NULL;
+    memstat_map(&p->mem, 1);
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & (PTE_SHARED | PTE_COW)) == 0)
+    return PTE2PA(*pte);
+  w = *pte & PTE_W;
+  *pte = (*pte & ~PTE_SHARED) | PTE_COW;
+  if(uvmcow(pagetable, PGROUNDDOWN(va)) == NULL)
+    return NULL;
+  if(!w)
+    *pte &= ~PTE_W;
+  return PTE2PA(*pte);
+}
+
+// walkaddr() for a page the kernel is about to write: a copy-on-write
+// page is copied first, and page cache pages can't be written at all.
+uint64
+walkaddr_write(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return NULL;
+  pte = walk(pagetable, va, 0);
+  if((pte == 0 || (*pte & PTE_V) == 0) && fault_in(pagetable, FAULT_WRITE, va) == 0)
+    pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return NULL;
+  if(*pte & PTE_SHARED)
+    return NULL;
+  if(*pte & PTE_COW)
+    return uvmcow(pagetable, PGROUNDDOWN(va));
+  return PTE2PA(*pte);
+}
+
+// A user page fault the process may be able to go on from: the first
+// touch of a page of an ELF segment, or a store to a copy-on-write page
+// of a writable mapping.
+// Returns 0 if it was resolved, -1 if the process is at fault.
+int
+handle_page_fault(int kind, uint64 va)
+{
+  static const int need[] = {
+    [FAULT_READ]  PTE_R,
+    [FAULT_WRITE] PTE_W,
+    [FAULT_EXEC]  PTE_X,
+  };
+  struct proc *p = myproc();
+  struct vma *vma;
+  pte_t *pte;
+  int major, how;
+
+  if(va >= MAXVA || (vma = addr_locate_vma(p->vma, va)) == NULL)
+    return -1;
+  if((vma->perm & need[kind]) == 0)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == NULL || (*pte & PTE_V) == 0){
+    if(vma->ep == NULL)
+      return -1;
+    how = vma->ep == p->elocked ? EP_HELD : p->elocked ? EP_TRY : EP_SLEEP;
+    if((major = vma_fault_file(p->pagetable, vma, va, how)) < 0)
+      return -1;
+    memstat_fault(&p->mem, major);
+    memstat_map(&p->mem, 1);
+    pte = walk(p->pagetable, va, 0);
+    if(kind != FAULT_WRITE || (*pte & PTE_COW) == 0)
+      return 0;
+    // a store to a data page: copy it now, not on the next fault
+    return uvmcow(p->pagetable, PGROUNDDOWN(va)) == NULL ? -1 : 0;
+  }
+  if(kind == FAULT_WRITE && (*pte & PTE_COW)){
+    if(uvmcow(p->pagetable, PGROUNDDOWN(va)) == NULL)
+      return -1;
+    memstat_fault(&p->mem, 0);
+    return 0;
+  }
+  return -1;
+}
 
 uint64
 kwalkaddr(pagetable_t kpt, uint64 va)
@@ -306,6 +473,49 @@ freewalk(pagetable_t pagetable)
     }
   }
   freepage((void*)pagetable);
+  __sync_fetch_and_sub(&pgtbl_pages, 1);
+}
+
+// Count the user pages mapped below one page-table page.
+static uint64
+rss_walk(pagetable_t pagetable, int level)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if(!(pte & PTE_V))
+      continue;
+    if(pte & (PTE_R|PTE_W|PTE_X)){
+      if(pte & PTE_U)
+        n += 1UL << (9 * level);
+      continue;
+    }
+    // another hart may be tearing this table down, don't follow
+    // anything that isn't RAM
+    uint64 child = PTE2PA(pte);
+    if(level > 0 && child >= KERNBASE && child < PHYSTOP)
+      n += rss_walk((pagetable_t)child, level - 1);
+  }
+  return n;
+}
+
+// Number of user pages mapped in a process page table, for statistics.
+uint64
+uvm_rss(pagetable_t pagetable)
+{
+  uint64 n = 0;
+
+  if(pagetable == NULL)
+    return 0;
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if(!(pte & PTE_V) || pte == kernel_pagetable[i])
+      continue;
+    if((pte & (PTE_R|PTE_W|PTE_X)) == 0 && PTE2PA(pte) >= KERNBASE && PTE2PA(pte) < PHYSTOP)
+      n += rss_walk((pagetable_t)PTE2PA(pte), 1);
+  }
+  return n;
 }
 
 // create an empty user page table.
@@ -317,6 +527,7 @@ kvmcreate()
   pagetable = (pagetable_t) allocpage();
   if(pagetable == NULL)
     return NULL;
+  __sync_fetch_and_add(&pgtbl_pages, 1);
   memset(pagetable, 0, PGSIZE);
   memmove(pagetable, kernel_pagetable, PGSIZE);
   return pagetable;
@@ -8,58 +8,148 @@
 #include "include/vma.h"
 #include "include/kalloc.h"
 #include "include/proc.h"
+#include "include/memstat.h"
 #include "include/printf.h"
 #include "include/string.h"
 #include "include/riscv.h"
 #include "include/mmap.h"
+#include "include/fat32.h"
+#include "include/sleeplock.h"
+#include "include/pagecache.h"
 
-struct vma *vma_list_init(struct proc *p)
+static void free_vmas(pagetable_t pagetable, struct vma *vma_head);
+
+static void mm_lock(struct mm *mm)
 {
-  if(p == NULL)
+  if(mm->lock != NULL)
   {
-    __debug_warn("[vma_list_init] proc is NULL\n");
-    return NULL;
+    acquire(mm->lock);
+  }
+}
+
+static void mm_unlock(struct mm *mm)
+{
+  if(mm->lock != NULL)
+  {
+    release(mm->lock);
   }
+}
+
+// The vmas every address space starts with: the trapframe, the stack
+// and the start of the mmap area. Whatever was made is left in mm->vma
+// when it fails, for the caller to free.
+static int mm_vma_init(struct mm *mm)
+{
   // alloc head
   struct vma *vma = (struct vma*)kmalloc(sizeof(struct vma));
   if(vma == NULL)
   {
-    __debug_warn("[vma_list_init] vma kmalloc failed\n");
-    return NULL;
+    __debug_warn("[mm_vma_init] vma kmalloc failed\n");
+    return -1;
   }
   vma->next = vma->prev = vma;
   vma->type = NONE;
-  p->vma = vma;
+  mm->vma = vma;
   
-  // printf("[vma list init] trapframe map\n");
   // alloc TRAPFRAME
-  if(alloc_vma(p, TRAP, TRAPFRAME, PGSIZE, PTE_R | PTE_W , 0, (uint64)p->trapframe) == NULL)
+  if(mm_alloc_vma(mm, TRAP, TRAPFRAME, PGSIZE, PTE_R | PTE_W , 0, (uint64)mm->trapframe) == NULL)
   {
-    __debug_warn("[vma_list_init] TRAPFRAME vma init fail\n");
-    goto bad;
+    __debug_warn("[mm_vma_init] TRAPFRAME vma init fail\n");
+    return -1;
   }
   
-  // printf("[vma list init] stack map\n");
   // alloc STACK
-  if(alloc_vma(p, STACK, PGROUNDDOWN(USER_STACK_BOTTOM - 35 * PGSIZE), 35 * PGSIZE, PTE_R|PTE_W|PTE_U, 1, NULL) == NULL)
+  if(mm_alloc_vma(mm, STACK, PGROUNDDOWN(USER_STACK_BOTTOM - 35 * PGSIZE), 35 * PGSIZE, PTE_R|PTE_W|PTE_U, 1, NULL) == NULL)
   {
-    __debug_warn("[vma_list_init] stack vma init fail\n");
-    goto bad;
+    __debug_warn("[mm_vma_init] stack vma init fail\n");
+    return -1;
   }
 
-  // printf("[vma list init] mmap map\n");
   // alloc MMAP
-  if(alloc_mmap_vma(p, 0, USER_MMAP_START, 0, 0, 0, 0) == NULL)
+  if((vma = mm_alloc_vma(mm, MMAP, USER_MMAP_START, 0, 0, 1, NULL)) == NULL)
   {
-    __debug_warn("[vma_list_init] mmap vma init fail\n");
-    goto bad;
+    __debug_warn("[mm_vma_init] mmap vma init fail\n");
+    return -1;
   }
-  
-  return vma;
+  vma->fd = 0;
+  return 0;
+}
 
-bad:
-  free_vma_list(p);
-  return NULL;
+struct vma *vma_list_init(struct proc *p)
+{
+  if(p == NULL)
+  {
+    __debug_warn("[vma_list_init] proc is NULL\n");
+    return NULL;
+  }
+  // allocproc() holds p->lock already
+  struct mm mm = { p->pagetable, NULL, p->trapframe, NULL };
+  int r = mm_vma_init(&mm);
+
+  p->vma = mm.vma;
+  if(r < 0)
+  {
+    free_vma_list(p);
+    return NULL;
+  }
+  return p->vma;
+}
+
+// A new address space in mm, with a trapframe page of its own and the
+// vmas every process has. exec() builds the image in it off to the
+// side, then installs it with mm_install().
+// Returns 0 on success, -1 on failure.
+int mm_init(struct mm *mm)
+{
+  mm->vma = NULL;
+  mm->lock = NULL;
+  if((mm->trapframe = allocpage()) == NULL)
+  {
+    return -1;
+  }
+  if((mm->pagetable = kvmcreate()) == NULL)
+  {
+    freepage(mm->trapframe);
+    return -1;
+  }
+  if(mm_vma_init(mm) < 0)
+  {
+    // the TRAP vma frees the trapframe, once it's made
+    if(mm->vma == NULL || type_locate_vma(mm->vma, TRAP) == NULL)
+    {
+      freepage(mm->trapframe);
+    }
+    mm_free(mm);
+    return -1;
+  }
+  return 0;
+}
+
+// Make mm the process's address space, and leave the one it had in mm
+// for the caller to free. procfs walks p->vma under p->lock, so the
+// switch is made under it.
+void mm_install(struct proc *p, struct mm *mm)
+{
+  struct mm old = { p->pagetable, p->vma, p->trapframe, NULL };
+
+  acquire(&p->lock);
+  p->pagetable = mm->pagetable;
+  p->vma = mm->vma;
+  p->trapframe = mm->trapframe;
+  w_satp(MAKE_SATP(p->pagetable));
+  sfence_vma();
+  release(&p->lock);
+  *mm = old;
+}
+
+// Free the pages, vmas and page table of an address space that isn't
+// any process's.
+void mm_free(struct mm *mm)
+{
+  free_vmas(mm->pagetable, mm->vma);
+  mm->vma = NULL;
+  freewalk(mm->pagetable);
+  mm->pagetable = NULL;
 }
 
 struct vma *alloc_vma(
@@ -77,12 +167,31 @@ struct vma *alloc_vma(
     __debug_warn("[alloc_vma] proc is null\n");
     return NULL;
   }
+  struct mm mm = { p->pagetable, p->vma, p->trapframe, &p->lock };
+  struct vma *vma = mm_alloc_vma(&mm, type, addr, sz, perm, alloc, pa);
 
+  if(vma != NULL && alloc == 1)
+  {
+    memstat_map(&p->mem, (vma->end - vma->addr) / PGSIZE);
+  }
+  return vma;
+}
+
+struct vma *mm_alloc_vma(
+  struct mm *mm,
+  enum segtype type,
+  uint64 addr,
+  uint64 sz,
+  int perm,
+  int alloc,
+  uint64 pa
+)
+{
   uint64 start = PGROUNDDOWN(addr);
   uint64 end = addr + sz;
   end = PGROUNDUP(end);
 
-  struct vma *vma_head = p->vma;
+  struct vma *vma_head = mm->vma;
   struct vma *nvma = vma_head->next;
 
   while(nvma != vma_head)
@@ -97,14 +206,14 @@ struct vma *alloc_vma(
     }
     else
     {
-      __debug_warn("[alloc_vma] vma address overflow\n");
+      __debug_warn("[mm_alloc_vma] vma address overflow\n");
       return NULL;
     }
   }
   struct vma *vma = (struct vma*)kmalloc(sizeof(struct vma));
   if(vma == NULL)
   {
-    __debug_warn("[alloc_vma] vma kmalloc failed\n");
+    __debug_warn("[mm_alloc_vma] vma kmalloc failed\n");
     return NULL;
   }
   
@@ -112,17 +221,17 @@ struct vma *alloc_vma(
   {
     if(alloc == 1)
     {
-      if(uvmalloc(p->pagetable, start, end, perm) != 0)
+      if(uvmalloc(mm->pagetable, start, end, perm) != 0)
       {
-        __debug_warn("[alloc_vma] uvmalloc start = %p, end = %p fail\n", start, end);
+        __debug_warn("[mm_alloc_vma] uvmalloc start = %p, end = %p fail\n", start, end);
         goto bad;
       }
     }
     else if(pa != 0)
     {
-      if(mappages(p->pagetable, start, sz, pa, perm) != 0)
+      if(mappages(mm->pagetable, start, sz, pa, perm) != 0)
       {
-        __debug_warn("[alloc_vma] mappages failed\n");
+        __debug_warn("[mm_alloc_vma] mappages failed\n");
         goto bad;
       }
     }
@@ -134,12 +243,16 @@ struct vma *alloc_vma(
   vma->perm = perm;
   vma->fd = -1;
   vma->f_off = 0;
+  vma->ep = NULL;
+  vma->f_start = vma->f_end = 0;
   vma->type = type;
 
+  mm_lock(mm);
   vma->prev = nvma->prev;
   vma->next = nvma;
   nvma->prev->next = vma;
   nvma->prev = vma;
+  mm_unlock(mm);
   return vma;
 
 bad:
@@ -194,7 +307,7 @@ struct vma *addr_locate_vma(struct vma*head, uint64 addr)
   return NULL;
 }
 
-struct vma* alloc_mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, int perm, int fd ,uint64 f_off)
+static struct vma* mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, int perm, int fd ,uint64 f_off, int alloc)
 {
   struct vma *vma = NULL;
 
@@ -205,15 +318,51 @@ struct vma* alloc_mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, in
     // __debug_info("[alloc_mmap_vma] addr = %p\n", addr);
   }
 
-  vma = alloc_vma(p, MMAP, addr, sz, perm, 1, NULL);
+  vma = alloc_vma(p, MMAP, addr, sz, perm, alloc, NULL);
   if(vma == NULL)
   {
     __debug_warn("[alloc_mmap_vma] alloc failed\n");
     return NULL;
   }
 
+  acquire(&p->lock);
+  vma->flags = flags;
   vma->fd = fd;
   vma->f_off = f_off;
+  release(&p->lock);
+  return vma;
+}
+
+struct vma* alloc_mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, int perm, int fd ,uint64 f_off)
+{
+  return mmap_vma(p, flags, addr, sz, perm, fd, f_off, 1);
+}
+
+// A MAP_PRIVATE mapping of ep from f_off, whose pages are paged in
+// from the page cache like an ELF segment's. f_off must be page-aligned.
+struct vma* alloc_file_mmap_vma(struct proc *p, int flags, uint64 addr, uint64 sz, int perm, int fd, uint64 f_off, struct dirent *ep)
+{
+  struct vma *vma = mmap_vma(p, flags, addr, sz, perm, fd, f_off, 0);
+  uint64 filesz = 0;
+
+  if(vma == NULL)
+  {
+    return NULL;
+  }
+  if(f_off < ep->file_size)
+  {
+    filesz = ep->file_size - f_off;
+  }
+  if(filesz > sz)
+  {
+    filesz = sz;
+  }
+  edup(ep);
+  acquire(&p->lock);
+  vma->ep = ep;
+  vma->f_start = vma->addr;
+  vma->f_end = vma->addr + filesz;
+  release(&p->lock);
   return vma;
 }
 
@@ -222,18 +371,21 @@ struct vma *alloc_stack_vma(struct proc *p, uint64 addr, int perm)
   struct vma *vma = type_locate_vma(p->vma, STACK);
   uint64 start = PGROUNDDOWN(addr);
   uint64 end = vma->addr;
-  vma->addr = start;
   if(start < USER_STACK_TOP)
   {
     __debug_warn("[alloc_stack_vma] stack address illegal\n");
     return NULL;
   }
+  acquire(&p->lock);
+  vma->addr = start;
   vma->sz += (end - start);
+  release(&p->lock);
   if(uvmalloc(p->pagetable, start, end, perm) != 0)
   {
     __debug_warn("[alloc_stack_vma] stack vma alloc fail\n");
     return NULL;
   }
+  memstat_map(&p->mem, (end - start) / PGSIZE);
   return vma;
 }
  
@@ -264,8 +416,11 @@ struct vma *alloc_addr_heap_vma(struct proc *p, uint64 addr, int perm)
         __debug_warn("[alloc_addr_heap_vma] uvmdealloc fail\n");
         return vma;
       }
+      acquire(&p->lock);
       vma->end = addr;
       vma->sz = (vma->end - vma->addr);
+      release(&p->lock);
+      memstat_rss(p);
       return vma;
     }
     
@@ -274,8 +429,11 @@ struct vma *alloc_addr_heap_vma(struct proc *p, uint64 addr, int perm)
       __debug_warn("[alloc_addr_heap_vma] uvmalloc fail\n");
       return vma;
     }
+    memstat_map(&p->mem, (addr - vma->end) / PGSIZE);
+    acquire(&p->lock);
     vma->end = addr;
     vma->sz = (vma->end - vma->addr);
+    release(&p->lock);
     return vma;
   }
 }
@@ -311,6 +469,7 @@ struct vma *alloc_sz_heap_vma(struct proc *p, uint64 sz, int perm)
         __debug_warn("[alloc_addr_heap_vma] uvmalloc fail\n");
         return NULL;
       }
+      memstat_map(&p->mem, (PGROUNDUP(vma->end + sz) - vma->end) / PGSIZE);
     }
     else
     {
@@ -319,24 +478,155 @@ struct vma *alloc_sz_heap_vma(struct proc *p, uint64 sz, int perm)
         __debug_warn("[alloc_addr_heap_vma] uvmdealloc fail\n");
         return NULL;
       }
+      memstat_rss(p);
     }
+    acquire(&p->lock);
     vma->end = PGROUNDUP(vma->end + sz);
     vma->sz = vma->end - vma->addr;
+    release(&p->lock);
   }
   return vma;
 }
 
+// For userinit(), which holds p->lock already.
 struct vma *alloc_load_vma(struct proc *p, uint64 addr, uint64 sz, int perm)
 {
-  return alloc_vma(p, LOAD, addr, sz, perm, 1, NULL);
+  struct mm mm = { p->pagetable, p->vma, p->trapframe, NULL };
+  struct vma *vma = mm_alloc_vma(&mm, LOAD, addr, sz, perm, 1, NULL);
+
+  if(vma != NULL)
+  {
+    memstat_map(&p->mem, (vma->end - vma->addr) / PGSIZE);
+  }
+  return vma;
 }
 
-int free_vma_list(struct proc *p)
+// Unmap and free the pages between start and end that are mapped;
+// a file-backed vma has holes where nothing touched it.
+static void unmap_present(pagetable_t pagetable, uint64 start, uint64 end)
+{
+  for(uint64 a = start; a < end; a += PGSIZE)
+  {
+    if(walkaddr(pagetable, a) != NULL)
+    {
+      vmunmap(pagetable, a, 1, 1);
+    }
+  }
+}
+
+// An ELF segment of ep at addr, filesz bytes of it from offset off,
+// whose pages are mapped by vma_fault_file() when they are first
+// touched. off and addr must be congruent modulo PGSIZE.
+struct vma *alloc_file_vma(struct mm *mm, uint64 addr, uint64 sz, int perm, struct dirent *ep, uint64 off, uint64 filesz)
+{
+  struct vma *vma = mm_alloc_vma(mm, LOAD, addr, sz, perm, 0, 0);
+
+  if(vma == NULL)
+  {
+    return NULL;
+  }
+  edup(ep);
+  mm_lock(mm);
+  vma->ep = ep;
+  vma->f_off = off;
+  vma->f_start = addr;
+  vma->f_end = addr + filesz;
+  mm_unlock(mm);
+  return vma;
+}
+
+// Map the page of file-backed vma at va. Pages wholly of the file are
+// ep's page cache pages, shared as they are if the segment is read-only
+// and copy-on-write if not. The page the file part ends in gets a copy
+// of its own if BSS follows, and pages past it are zeroed.
+// how says how to get ep's lock, see vma.h.
+// Returns 1 if the file had to be read, 0 if not, -1 on failure.
+int vma_fault_file(pagetable_t pagetable, const struct vma *vma, uint64 va, int how)
+{
+  struct dirent *ep = vma->ep;
+  uint64 a = PGROUNDDOWN(va);
+  uint64 mend = vma->f_start + vma->sz;
+  uint64 pgno = (vma->f_off + a - vma->f_start) / PGSIZE;
+  uint64 from = a > vma->f_start ? a : vma->f_start;
+  int perm = vma->perm, miss = 0;
+  uint64 pa = NULL;
+  char *mem = NULL;
+
+  if(how == EP_SLEEP)
+  {
+    elock(ep);
+  }
+  else if(how == EP_TRY && !etrylock(ep))
+  {
+    __debug_warn("[vma_fault_file] %s is busy, not waiting for it\n", ep->filename);
+    return -1;
+  }
+  if(a < vma->f_end && (a + PGSIZE <= vma->f_end || vma->f_end == mend))
+  {
+    perm = (perm & PTE_W) ? (perm & ~PTE_W) | PTE_COW : perm | PTE_SHARED;
+    pa = pcache_get(ep, pgno, &miss);
+  }
+  else if((mem = allocpage()) != NULL)
+  {
+    memset(mem, 0, PGSIZE);
+    pa = (uint64)mem;
+    if(from < vma->f_end)
+    {
+      uint64 fpa = pcache_get(ep, pgno, &miss);
+      if(fpa == NULL)
+      {
+        freepage(mem);
+        pa = NULL;
+      }
+      else
+      {
+        memmove(mem + (from - a), (char *)fpa + (from - a), vma->f_end - from);
+        freepage((void *)fpa);
+      }
+    }
+  }
+  if(how != EP_HELD)
+  {
+    eunlock(ep);
+  }
+
+  if(pa == NULL)
+  {
+    __debug_warn("[vma_fault_file] no page for %p of %s\n", va, ep->filename);
+    return -1;
+  }
+  if(mappages(pagetable, a, PGSIZE, pa, perm) != 0)
+  {
+    freepage((void *)pa);
+    return -1;
+  }
+  return miss;
+}
+
+// Let go of the files the process's segments are paged in from. exit()
+// does it while it can still sleep; the pages stay mapped.
+void vma_put_files(struct proc *p)
 {
   struct vma *vma_head = p->vma;
   if(vma_head == NULL)
   {
-    return 1;
+    return;
+  }
+  for(struct vma *vma = vma_head->next; vma != vma_head; vma = vma->next)
+  {
+    if(vma->ep != NULL)
+    {
+      eput(vma->ep);
+      vma->ep = NULL;
+    }
+  }
+}
+
+static void free_vmas(pagetable_t pagetable, struct vma *vma_head)
+{
+  if(vma_head == NULL)
+  {
+    return;
   }
   struct vma *vma = vma_head->next;
   
@@ -345,7 +635,7 @@ int free_vma_list(struct proc *p)
     uint64 a;
     pte_t *pte;
     for(a = vma->addr; a < vma->end; a += PGSIZE){
-      if((pte = walk(p->pagetable, a, 0)) == 0)
+      if((pte = walk(pagetable, a, 0)) == 0)
         continue;
       if((*pte & PTE_V) == 0)
         continue;
@@ -357,10 +647,20 @@ int free_vma_list(struct proc *p)
       //__debug_warn("[free vma list]free end\n");
       *pte = 0;
     }
+    if(vma->ep != NULL)
+    {
+      eput(vma->ep);
+    }
     vma = vma->next;
     kfree(vma->prev);
   }
   kfree(vma);
+}
+
+// p->lock is held, or p is no one else's to look at.
+int free_vma_list(struct proc *p)
+{
+  free_vmas(p->pagetable, p->vma);
   p->vma = NULL;
   return 1;
 }
@@ -399,15 +699,23 @@ int free_vma(struct proc *p, struct vma *del)
   
   struct vma *prev = del->prev;
   struct vma *next = del->next;
+  acquire(&p->lock);
   prev->next = next;
   next->prev = prev;
   del->next = del->prev = NULL;
-  if(uvmdealloc(p->pagetable, del->addr, del->end) != 0)
+  release(&p->lock);
+  if(del->ep != NULL)
+  {
+    unmap_present(p->pagetable, del->addr, del->end);
+    eput(del->ep);
+  }
+  else if(uvmdealloc(p->pagetable, del->addr, del->end) != 0)
   {
     __debug_warn("[free_vma] uvmdealloc fail\n");
     return 0;
   }
   kfree(del);
+  memstat_rss(p);
   return 1;
 }
 
@@ -422,13 +730,15 @@ struct vma* vma_copy(struct proc *np, struct vma *head)
   nvma_head->next = nvma_head->prev = nvma_head;
   nvma_head->type = NONE;
   np->vma = nvma_head;
+  // allocproc() holds np->lock already
+  struct mm mm = { np->pagetable, nvma_head, np->trapframe, NULL };
   struct vma *pvma = head->next;
   while(pvma != head)
   {
     struct vma *nvma = NULL;
     if(pvma->type == TRAP)
     {
-      if((nvma = alloc_vma(np, TRAP, TRAPFRAME, PGSIZE, PTE_R | PTE_W , 0, (uint64)np->trapframe)) == NULL)
+      if((nvma = mm_alloc_vma(&mm, TRAP, TRAPFRAME, PGSIZE, PTE_R | PTE_W , 0, (uint64)np->trapframe)) == NULL)
       {
         __debug_warn("[vma_list_init] TRAPFRAME vma init fail\n");
         goto err;
@@ -443,6 +753,10 @@ struct vma* vma_copy(struct proc *np, struct vma *head)
         goto err;
       }
       memmove(nvma, pvma, sizeof(struct vma));
+      if(nvma->ep != NULL)
+      {
+        edup(nvma->ep);
+      }
       nvma->next = nvma->prev = NULL;
       nvma->prev = nvma_head->prev;
       nvma->next = nvma_head;
@@ -471,7 +785,14 @@ int vma_deep_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
   
   while(start < vma->end)
   {
-    if((pte = walk(old, start, 0)) == NULL)
+    pte = walk(old, start, 0);
+    if(vma->ep != NULL && (pte == NULL || (*pte & PTE_V) == 0))
+    {
+      // not touched yet: the child faults it in on its own
+      start += PGSIZE;
+      continue;
+    }
+    if(pte == NULL)
     {
       panic("uvmcopy: pte should exist");
     }
@@ -482,6 +803,19 @@ int vma_deep_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
 
+    // page cache pages, and copy-on-write ones nobody has written,
+    // are shared
+    if(flags & (PTE_COW | PTE_SHARED))
+    {
+      if(mappages(new, start, PGSIZE, pa, flags) != 0)
+      {
+        goto err;
+      }
+      pagedup((void *)pa);
+      start += PGSIZE;
+      continue;
+    }
+
     mem = (char *)allocpage();
 
     if(mem == NULL)
@@ -499,14 +833,43 @@ int vma_deep_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
     }
     start += PGSIZE;
   }
-  pa = walkaddr(new, vma->addr);
   return 0;
   
 err:
-  vmunmap(new, vma->addr, (start - vma->addr) / PGSIZE, 1);
+  unmap_present(new, vma->addr, start);
   return -1;
 }
 
+// Fault in every page of p's file-backed vmas. A thread made with
+// CLONE_VM shares them, but vma_shallow_mapping() runs under the new
+// proc's lock and can't read the file, so clone() calls this first.
+int vma_populate(struct proc *p)
+{
+  pte_t *pte;
+
+  for(struct vma *vma = p->vma->next; vma != p->vma; vma = vma->next)
+  {
+    if(vma->ep == NULL)
+    {
+      continue;
+    }
+    for(uint64 a = vma->addr; a < vma->end; a += PGSIZE)
+    {
+      pte = walk(p->pagetable, a, 0);
+      if(pte != NULL && (*pte & PTE_V))
+      {
+        continue;
+      }
+      if(vma_fault_file(p->pagetable, vma, a, EP_SLEEP) < 0)
+      {
+        return -1;
+      }
+      memstat_map(&p->mem, 1);
+    }
+  }
+  return 0;
+}
+
 int vma_shallow_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
 {
   uint64 start = vma->addr;
@@ -516,7 +879,11 @@ int vma_shallow_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
 
   while(start < vma->end)
   {
-    if((pte = walk(old, start, 0)) == NULL)
+    pte = walk(old, start, 0);
+    // each thread has its own page table, so a page faulted in by one
+    // later would be a different copy from another's: vma_populate()
+    // has mapped them all
+    if(pte == NULL)
     {
       panic("uvmcopy: pte should exist");
     }
@@ -524,6 +891,12 @@ int vma_shallow_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
     {
       panic("uvmcopy: page not present");
     }
+    // threads have to see each other's stores, so nothing they share
+    // may be copied on write
+    if((*pte & PTE_COW) && uvmcow(old, start) == NULL)
+    {
+      goto err;
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
 
@@ -531,12 +904,13 @@ int vma_shallow_mapping(pagetable_t old, pagetable_t new, const struct vma *vma)
     {
       goto err;
     }
+    pagedup((void *)pa);
     start +=PGSIZE;
   }
   return 0;
 
 err:
-  vmunmap(new, vma->addr, (start - vma->addr) / PGSIZE, 1);
+  unmap_present(new, vma->addr, start);
   return -1;
 }
 
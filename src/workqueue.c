@@ -0,0 +1,88 @@
+//
+// workqueues -- a list of work items per hart and a kernel thread
+// to run them.
+//
+// The scheduler has a single ready queue, so a kworker may run on any
+// hart; keeping one queue per hart still lets interrupt handlers queue
+// work without fighting over one lock.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/workqueue.h"
+
+struct workqueue {
+  struct spinlock lock;
+  struct list works;
+  struct proc *worker;
+};
+
+static struct workqueue wqs[NCPU];
+
+static void
+worker_thread(void *arg)
+{
+  struct workqueue *wq = arg;
+  struct work_struct *w;
+
+  for (;;) {
+    acquire(&wq->lock);
+    while (list_empty(&wq->works))
+      sleep(wq, &wq->lock);
+    w = dlist_entry(list_next(&wq->works), struct work_struct, entry);
+    list_del(&w->entry);
+    // clear it first so that func() may queue it again
+    __sync_lock_release(&w->pending);
+    release(&wq->lock);
+
+    w->func(w);
+  }
+}
+
+void
+workqueue_init(void)
+{
+  char name[16];
+
+  for (int i = 0; i < NCPU; i++) {
+    struct workqueue *wq = &wqs[i];
+    initlock(&wq->lock, "workqueue");
+    list_init(&wq->works);
+    safestrcpy(name, "kworker/0", sizeof(name));
+    name[8] = '0' + i;
+    if ((wq->worker = kthread_create(name, worker_thread, wq)) == NULL)
+      panic("workqueue_init");
+  }
+  __debug_info("workqueue_init\n");
+}
+
+int
+queue_work_on(int hart, struct work_struct *w)
+{
+  struct workqueue *wq = &wqs[hart];
+
+  // `w` may be queued from several harts at once, only one of them wins
+  if (__sync_lock_test_and_set(&w->pending, 1))
+    return 0;
+
+  acquire(&wq->lock);
+  list_add_before(&wq->works, &w->entry);
+  wakeup(wq);
+  release(&wq->lock);
+  return 1;
+}
+
+int
+schedule_work(struct work_struct *w)
+{
+  push_off();
+  int hart = cpuid();
+  pop_off();
+  return queue_work_on(hart, w);
+}
@@ -57,9 +57,11 @@ entry   131 tgkill
 entry	134	rt_sigaction
 entry	135	rt_sigprocmask	
 entry	139	rt_sigreturn
+entry	142	reboot
 entry	144	setgid   
 entry	146	setuid 
 entry	160	uname 
+entry	165	getrusage
 entry	172	getpid 
 entry	173	getppid
 entry	174	getuid
@@ -73,6 +75,7 @@ entry	215	munmap
 entry	220	clone	
 entry	221	execve
 entry	222	mmap  
+entry	241	perf_event_open
 entry	260	wait4
 entry	276	renameat2
 
@@ -81,7 +84,9 @@ entry	276	renameat2
 echo "};">>$kfuntemp;
 echo "};">>$kstrtemp;
 
-echo "#include \"include/syscall.h\"\n">>$ksys;
+echo "#include \"include/syscall.h\"">>$ksys;
+echo "#include \"include/trace.h\"">>$ksys;
+echo "#include \"include/sysstat.h\"\n">>$ksys;
 cat $kextemp>>$ksys
 cat $kfuntemp>>$ksys
 cat $kstrtemp>>$ksys
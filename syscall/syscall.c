@@ -7,7 +7,12 @@ syscall(void)
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     //printf("syscall %d\n",num);
+    trace(TRACE_SYSCALL_ENTER, num, p->trapframe->a0);
+    int hart = 0;
+    uint64 start = sysstat_begin(&hart);
     p->trapframe->a0 = syscalls[num]();
+    sysstat_end(p, num, p->trapframe->a0, start, hart);
+    trace(TRACE_SYSCALL_EXIT, num, p->trapframe->a0);
         // trace
     if ((p->tmask & (1 << num)) != 0) {
       printf("pid %d: %s -> %d\n", p->pid, sysnames[num], p->trapframe->a0);
@@ -18,3 +23,11 @@ syscall(void)
     p->trapframe->a0 = -1;
   }
 }
+
+char *
+syscall_name(int num)
+{
+  if(num > 0 && num < NELEM(sysnames))
+    return sysnames[num];
+  return 0;
+}
@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+# Run the sd/ test suites in QEMU and check them against a baseline;
+# what `make bench` calls.
+#
+#   tools/bench.py --qemu 'qemu-system-riscv64 ...' -o bench.json
+#   tools/bench.py --log console.txt -o bench.json        parse a saved run
+#   tools/bench.py ... --save-baseline                    make it the baseline
+#
+# The kernel has to be built with BENCH=1, whose init script prints
+# "#### bench <suite>" before each suite and powers off at the end.
+# lmbench results are named by the command that printed them, which the
+# script traces with sh -x: "lat_syscall.null", "bw_file_rd.512k.io_only".
+# The busybox and lua suites give their pass and fail counts and, when
+# QEMU was run here, how long each suite took on the host's clock.
+#
+# Every metric knows whether lower or higher is better. One that got
+# worse than the baseline by more than its threshold, a fraction of the
+# baseline value, is a regression and makes the exit status 1. The
+# baseline keeps its thresholds when it is saved over, so they can be
+# tuned by hand.
+#
+
+import argparse
+import json
+import re
+import shlex
+import subprocess
+import sys
+import threading
+import time
+
+MARK = '#### bench '
+
+# default thresholds by unit
+THRESHOLDS = {
+    'us': 0.10,
+    'MB/s': 0.10,
+    'KB/s': 0.10,
+    'ops/s': 0.10,
+    's': 0.20,
+    'tests': 0.0,
+}
+
+UNITS = {
+    'microseconds': ('us', 'lower'),
+    'MB/sec': ('MB/s', 'higher'),
+    'KB/sec': ('KB/s', 'higher'),
+}
+
+LABELLED = re.compile(r'^(.*\S):?\s+([\d.]+)\s+(microseconds|MB/sec|KB/sec)\s*$')
+PAIR = re.compile(r'^([\d.]+)\s+([\d.]+)\s*$')
+LAT_FS = re.compile(r'^(\d+k)\s+(\d+)\s+(\d+)\s+(\d+)\s*$')
+TESTCASE = re.compile(r'^testcase (\w+) .* (success|fail)\s*$')
+
+
+def command_key(line):
+    # "+ lmbench_all lat_syscall -P 1 stat /var/tmp/lmbench" -> "lat_syscall.stat"
+    try:
+        words = shlex.split(line[2:])
+    except ValueError:
+        return None
+    if len(words) < 2 or not words[0].endswith('lmbench_all'):
+        return None
+    key = [words[1]]
+    skip = False
+    for w in words[2:]:
+        if skip:
+            skip = False
+        elif w.startswith('-'):
+            skip = True
+        elif '/' in w or '=' in w or w.isdigit():
+            continue
+        else:
+            key.append(w)
+    return '.'.join(key)
+
+
+class Results:
+    def __init__(self):
+        self.metrics = {}
+        self.suite = None
+        self.start = {}
+        self.stop = {}
+
+    def put(self, name, value, unit, better):
+        self.metrics[name] = {'value': value, 'unit': unit, 'better': better}
+
+    def count(self, suite, passed):
+        if passed:
+            name, better = suite + '.pass', 'higher'
+        else:
+            name, better = suite + '.fail', 'lower'
+        m = self.metrics.setdefault(name, {'value': 0, 'unit': 'tests', 'better': better})
+        m['value'] += 1
+
+    def suite_line(self, line, cmd):
+        m = LABELLED.match(line)
+        if m:
+            unit, better = UNITS[m.group(3)]
+            self.put('lmbench.' + cmd, float(m.group(2)), unit, better)
+            return
+        m = LAT_FS.match(line)
+        if m and cmd.startswith('lat_fs'):
+            self.put('lmbench.lat_fs.%s.create' % m.group(1), float(m.group(3)), 'ops/s', 'higher')
+            self.put('lmbench.lat_fs.%s.delete' % m.group(1), float(m.group(4)), 'ops/s', 'higher')
+            return
+        m = PAIR.match(line)
+        if m:
+            if cmd.startswith('lat_ctx'):
+                self.put('lmbench.%s.%s' % (cmd, m.group(1)), float(m.group(2)), 'us', 'lower')
+            elif cmd.startswith('bw_'):
+                self.put('lmbench.' + cmd, float(m.group(2)), 'MB/s', 'higher')
+            elif cmd.startswith('lat_'):
+                self.put('lmbench.' + cmd, float(m.group(2)), 'us', 'lower')
+
+    def parse(self, lines):
+        cmd = None
+        for t, line in lines:
+            line = line.rstrip('\r\n')
+            if line.startswith(MARK):
+                if self.suite:
+                    self.stop[self.suite] = t
+                self.suite = line[len(MARK):].strip()
+                self.start[self.suite] = t
+                cmd = None
+                continue
+            if self.suite is None or self.suite == 'end':
+                continue
+            m = TESTCASE.match(line)
+            if m:
+                self.count(m.group(1), m.group(2) == 'success')
+            elif self.suite == 'lmbench':
+                if line.startswith('+ '):
+                    cmd = command_key(line)
+                elif cmd:
+                    self.suite_line(line, cmd)
+        for s in self.start:
+            if s + '.pass' in self.metrics or s + '.fail' in self.metrics:
+                self.metrics.setdefault(s + '.pass', {'value': 0, 'unit': 'tests', 'better': 'higher'})
+                self.metrics.setdefault(s + '.fail', {'value': 0, 'unit': 'tests', 'better': 'lower'})
+        for s, t0 in self.start.items():
+            t1 = self.stop.get(s)
+            if s != 'end' and t0 is not None and t1 is not None:
+                self.put(s + '.time', round(t1 - t0, 3), 's', 'lower')
+        return self.suite == 'end'
+
+
+def run_qemu(cmd, timeout, log):
+    # Console lines with the time each arrived, echoed as they come.
+    # QEMU is killed at the timeout, or if it is still up a while after
+    # the end marker: the kernel hung, or didn't power off.
+    p = subprocess.Popen(shlex.split(cmd), stdin=subprocess.DEVNULL,
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    timers = [threading.Timer(timeout, p.kill)]
+    timers[0].start()
+    lines = []
+    try:
+        for raw in p.stdout:
+            line = raw.decode('utf-8', 'replace')
+            lines.append((time.monotonic(), line))
+            sys.stdout.write(line)
+            if log:
+                log.write(line)
+            if line.startswith(MARK + 'end'):
+                timers.append(threading.Timer(30, p.kill))
+                timers[-1].start()
+    finally:
+        for t in timers:
+            t.cancel()
+        if p.poll() is None:
+            p.kill()
+        p.wait()
+    return lines
+
+
+def compare(metrics, baseline):
+    bad = 0
+    print('%-44s %12s %12s %8s %6s' % ('metric', 'baseline', 'now', 'change', ''))
+    for name, b in sorted(baseline['metrics'].items()):
+        m = metrics.get(name)
+        if m is None:
+            print('%-44s %12g %12s %8s %6s' % (name, b['value'], '-', '', 'GONE'))
+            bad += 1
+            continue
+        if b['value']:
+            change = (m['value'] - b['value']) / b['value']
+        else:
+            change = 0.0 if m['value'] == 0 else float('inf')
+        worse = -change if b['better'] == 'higher' else change
+        threshold = b.get('threshold', THRESHOLDS.get(b['unit'], 0.10))
+        flag = ''
+        if worse > threshold:
+            flag = 'WORSE'
+            bad += 1
+        elif worse < -threshold:
+            flag = 'better'
+        print('%-44s %12g %12g %+7.1f%% %6s' % (name, b['value'], m['value'], change * 100, flag))
+    for name in sorted(set(metrics) - set(baseline['metrics'])):
+        print('%-44s %12s %12g %8s %6s' % (name, '-', metrics[name]['value'], '', 'NEW'))
+    return bad
+
+
+def main():
+    ap = argparse.ArgumentParser(description='run the sd/ suites in QEMU and compare with a baseline')
+    src = ap.add_mutually_exclusive_group(required=True)
+    src.add_argument('--qemu', help='QEMU command line booting a BENCH=1 kernel')
+    src.add_argument('--log', help='console output of an earlier run')
+    ap.add_argument('--timeout', type=int, default=3600, help='seconds to let QEMU run')
+    ap.add_argument('--console', help='save the console output here')
+    ap.add_argument('-o', '--output', default='bench.json', help='results as JSON')
+    ap.add_argument('--baseline', default='tools/bench-baseline.json')
+    ap.add_argument('--save-baseline', action='store_true', help='write the results as the baseline')
+    args = ap.parse_args()
+
+    if args.qemu:
+        log = open(args.console, 'w') if args.console else None
+        lines = run_qemu(args.qemu, args.timeout, log)
+        if log:
+            log.close()
+    else:
+        with open(args.log, errors='replace') as f:
+            lines = [(None, line) for line in f]
+
+    r = Results()
+    finished = r.parse(lines)
+    if not finished:
+        print('bench: the run did not reach its end', file=sys.stderr)
+    result = {'finished': finished, 'metrics': r.metrics}
+    with open(args.output, 'w') as f:
+        json.dump(result, f, indent=2, sort_keys=True)
+        f.write('\n')
+    print('\nbench: %d metrics written to %s' % (len(r.metrics), args.output))
+
+    try:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    except OSError:
+        baseline = None
+
+    if args.save_baseline:
+        if not finished:
+            return 1
+        old = baseline['metrics'] if baseline else {}
+        for name, m in r.metrics.items():
+            m['threshold'] = old.get(name, {}).get('threshold', THRESHOLDS.get(m['unit'], 0.10))
+        with open(args.baseline, 'w') as f:
+            json.dump({'metrics': r.metrics}, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('bench: baseline saved to %s' % args.baseline)
+        return 0
+
+    if baseline is None:
+        print('bench: no baseline at %s; make bench-baseline records one' % args.baseline)
+        return 0 if finished else 1
+    bad = compare(r.metrics, baseline)
+    if bad:
+        print('bench: %d regressions against %s' % (bad, args.baseline))
+    return 1 if bad or not finished else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,424 @@
+//
+// fsbench -- FAT32 and buffer cache benchmarks on the host.
+//
+// src/fat32.c, src/bio.c and src/string.c are built unchanged against
+// tools/hostshim and kshim.c, and replay workloads on a FAT32 image:
+//
+//   fsbench [-m] [-n count] [-s size] image [workload ...]
+//
+//   -m        map the image privately: it is left as it was
+//   -n count  files for latfs, readdir and lookup, I/Os for rand*
+//   -s size   bytes in the file seq* and rand* use
+//
+// Without -m the image is changed in place, though every workload
+// removes what it made. The workloads, all of them by default:
+//
+//   latfs      create and unlink count files each of 0, 1k, 4k and 10k,
+//              as lmbench's lat_fs
+//   seqwrite   write a file of size bytes, 4k at a time
+//   seqread    read it back
+//   randread   count reads of 4k at random 4k-aligned offsets
+//   randwrite  count writes of the same
+//   readdir    list a directory of count files
+//   lookup     look up each of the files in it by path
+//
+// Each reports operations a second and what the buffer cache and the
+// disk saw while it ran.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/stat.h"
+#include "include/buf.h"
+#include "include/fat32.h"
+#include "include/blkstat.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "host.h"
+
+#define DIR         "/fsbench"
+#define BIGFILE     DIR "/big"
+#define SUBDIR      DIR "/dir"
+#define CHUNK       4096
+#define READDIR_PASSES  10
+
+static struct {
+  int mmap;
+  int count;
+  uint size;
+} opt = { 0, 100, 512 * 1024 };
+
+static char chunk[CHUNK];
+static uint64 rand_state = 0x9e3779b97f4a7c15UL;
+
+struct sample {
+  uint64 start;
+  struct blkstat bs;
+};
+
+static uint64
+xorshift(void)
+{
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 7;
+  rand_state ^= rand_state << 17;
+  return rand_state;
+}
+
+static void
+begin(struct sample *s)
+{
+  blkstat_get(0, &s->bs);
+  s->start = host_now_ns();
+}
+
+// ops of bytes each done since begin()
+static void
+report(char *name, struct sample *s, uint64 ops, uint64 bytes)
+{
+  uint64 ns = host_now_ns() - s->start;
+  uint64 hits = 0, misses = 0;
+  struct blkstat bs;
+
+  blkstat_get(0, &bs);
+  for (int k = 0; k < BIO_NKIND; k++) {
+    hits += bs.hits[k] - s->bs.hits[k];
+    misses += bs.misses[k] - s->bs.misses[k];
+  }
+  if (ns == 0)
+    ns = 1;
+  printf("%-14s %8lu %12lu %10lu %10lu %10lu %5lu %8lu %8lu\n", name, ops,
+         ops * NSEC_PER_SEC / ns, bytes ? bytes * NSEC_PER_SEC / ns / 1024 : 0,
+         hits, misses, hits + misses ? hits * 100 / (hits + misses) : 0,
+         bs.ios[BLK_READ] - s->bs.ios[BLK_READ], bs.ios[BLK_WRITE] - s->bs.ios[BLK_WRITE]);
+}
+
+static struct dirent *
+mkfile(char *path, short type)
+{
+  struct dirent *ep = create(NULL, path, type, 0);
+
+  if (ep == NULL) {
+    __debug_error("fsbench: can't create %s\n", path);
+    host_exit(1);
+  }
+  eunlock(ep);
+  return ep;
+}
+
+// As unlinkat() does it.
+static void
+rmfile(char *path)
+{
+  struct dirent *ep = ename(NULL, path, 0);
+
+  if (ep == NULL)
+    return;
+  elock(ep);
+  if ((ep->attribute & ATTR_DIRECTORY) && !isdirempty(ep)) {
+    eunlock(ep);
+    eput(ep);
+    return;
+  }
+  elock(ep->parent);
+  eremove(ep);
+  eunlock(ep->parent);
+  eunlock(ep);
+  eput(ep);
+}
+
+static int
+writeat(struct dirent *ep, uint off, uint n)
+{
+  int r;
+
+  elock(ep);
+  r = ewrite(ep, 0, (uint64)chunk, off, n);
+  eunlock(ep);
+  return r;
+}
+
+static int
+readat(struct dirent *ep, uint off, uint n)
+{
+  int r;
+
+  elock(ep);
+  r = eread(ep, 0, (uint64)chunk, off, n);
+  eunlock(ep);
+  return r;
+}
+
+// Write ep up to size bytes, CHUNK at a time.
+static void
+fill(struct dirent *ep, uint size)
+{
+  for (uint off = ep->file_size; off < size; off += CHUNK)
+    writeat(ep, off, size - off < CHUNK ? size - off : CHUNK);
+}
+
+static void
+latfs(void)
+{
+  static const uint sizes[] = { 0, 1024, 4096, 10240 };
+  char path[FAT32_MAX_PATH], name[32];
+  struct sample s;
+
+  for (int k = 0; k < NELEM(sizes); k++) {
+    begin(&s);
+    for (int i = 0; i < opt.count; i++) {
+      snprintf(path, sizeof(path), DIR "/lat%d", i);
+      struct dirent *ep = mkfile(path, T_FILE);
+      fill(ep, sizes[k]);
+      eput(ep);
+    }
+    snprintf(name, sizeof(name), "create-%dk", sizes[k] / 1024);
+    report(name, &s, opt.count, (uint64)opt.count * sizes[k]);
+
+    begin(&s);
+    for (int i = 0; i < opt.count; i++) {
+      snprintf(path, sizeof(path), DIR "/lat%d", i);
+      rmfile(path);
+    }
+    snprintf(name, sizeof(name), "unlink-%dk", sizes[k] / 1024);
+    report(name, &s, opt.count, 0);
+  }
+}
+
+static struct dirent *
+bigfile(void)
+{
+  struct dirent *ep = mkfile(BIGFILE, T_FILE);
+
+  fill(ep, opt.size);
+  return ep;
+}
+
+static void
+seqwrite(void)
+{
+  struct sample s;
+  struct dirent *ep;
+  uint off;
+
+  rmfile(BIGFILE);
+  begin(&s);
+  ep = mkfile(BIGFILE, T_FILE);
+  for (off = 0; off < opt.size; off += CHUNK)
+    writeat(ep, off, CHUNK);
+  eput(ep);
+  report("seqwrite", &s, off / CHUNK, off);
+}
+
+static void
+seqread(void)
+{
+  struct dirent *ep = bigfile();
+  struct sample s;
+  uint off;
+
+  begin(&s);
+  for (off = 0; off < opt.size; off += CHUNK)
+    readat(ep, off, CHUNK);
+  report("seqread", &s, off / CHUNK, off);
+  eput(ep);
+}
+
+static void
+randio(int write)
+{
+  struct dirent *ep = bigfile();
+  uint nchunk = opt.size / CHUNK;
+  struct sample s;
+
+  begin(&s);
+  for (int i = 0; i < opt.count; i++) {
+    uint off = xorshift() % nchunk * CHUNK;
+    if (write)
+      writeat(ep, off, CHUNK);
+    else
+      readat(ep, off, CHUNK);
+  }
+  report(write ? "randwrite" : "randread", &s, opt.count, (uint64)opt.count * CHUNK);
+  eput(ep);
+}
+
+static void
+randread(void)
+{
+  randio(0);
+}
+
+static void
+randwrite(void)
+{
+  randio(1);
+}
+
+static void
+fill_subdir(void)
+{
+  char path[FAT32_MAX_PATH];
+
+  eput(mkfile(SUBDIR, T_DIR));
+  for (int i = 0; i < opt.count; i++) {
+    snprintf(path, sizeof(path), SUBDIR "/file%d", i);
+    eput(mkfile(path, T_FILE));
+  }
+}
+
+static void
+empty_subdir(void)
+{
+  char path[FAT32_MAX_PATH];
+
+  for (int i = 0; i < opt.count; i++) {
+    snprintf(path, sizeof(path), SUBDIR "/file%d", i);
+    rmfile(path);
+  }
+  rmfile(SUBDIR);
+}
+
+static void
+readdir(void)
+{
+  struct dirent *dp;
+  struct sample s;
+  uint64 n = 0;
+
+  fill_subdir();
+  dp = ename(NULL, SUBDIR, 0);
+  begin(&s);
+  for (int pass = 0; pass < READDIR_PASSES; pass++) {
+    struct dirent de;
+    uint off = 0;
+    int count, r;
+
+    elock(dp);
+    for (;;) {
+      de.valid = 0;
+      r = enext(dp, &de, off, &count);
+      off += count * 32;
+      if (r == -1)
+        break;
+      if (r == 1)
+        n++;
+    }
+    eunlock(dp);
+  }
+  report("readdir", &s, n, 0);
+  eput(dp);
+  empty_subdir();
+}
+
+static void
+lookup(void)
+{
+  char path[FAT32_MAX_PATH];
+  struct sample s;
+
+  fill_subdir();
+  begin(&s);
+  for (int i = 0; i < opt.count; i++) {
+    snprintf(path, sizeof(path), SUBDIR "/file%d", i);
+    struct dirent *ep = ename(NULL, path, 0);
+    if (ep)
+      eput(ep);
+  }
+  report("lookup", &s, opt.count, 0);
+  empty_subdir();
+}
+
+static struct {
+  char *name;
+  void (*fn)(void);
+} workloads[] = {
+  { "latfs",      latfs },
+  { "seqwrite",   seqwrite },
+  { "seqread",    seqread },
+  { "randread",   randread },
+  { "randwrite",  randwrite },
+  { "readdir",    readdir },
+  { "lookup",     lookup },
+};
+
+static void
+usage(void)
+{
+  __debug_error("usage: fsbench [-m] [-n count] [-s size] image [workload ...]\n");
+  host_exit(2);
+}
+
+static int
+atoi(char *s)
+{
+  int n = 0;
+
+  if (s == NULL || *s == '\0')
+    usage();
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9')
+      usage();
+    n = n * 10 + *s - '0';
+  }
+  return n;
+}
+
+static void (*find(char *name))(void)
+{
+  for (int i = 0; i < NELEM(workloads); i++) {
+    if (strncmp(name, workloads[i].name, 16) == 0)
+      return workloads[i].fn;
+  }
+  __debug_error("fsbench: no workload %s\n", name);
+  host_exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  uint64 hits, misses;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strncmp(argv[i], "-m", 3) == 0)
+      opt.mmap = 1;
+    else if (strncmp(argv[i], "-n", 3) == 0)
+      opt.count = atoi(argv[++i]);
+    else if (strncmp(argv[i], "-s", 3) == 0)
+      opt.size = (atoi(argv[++i]) + CHUNK - 1) / CHUNK * CHUNK;
+    else
+      usage();
+  }
+  if (i >= argc || opt.count == 0 || opt.size == 0)
+    usage();
+  for (int w = i + 1; w < argc; w++)
+    find(argv[w]);
+  if (host_disk_open(argv[i++], opt.mmap) < 0)
+    host_exit(1);
+
+  binit();
+  blkstat_init();
+  if (fs_init() < 0) {
+    __debug_error("fsbench: no FAT32 volume\n");
+    host_exit(1);
+  }
+  eput(mkfile(DIR, T_DIR));
+
+  printf("%-14s %8s %12s %10s %10s %10s %5s %8s %8s\n", "workload", "ops",
+         "ops/s", "KB/s", "hits", "misses", "hit%", "reads", "writes");
+  if (i == argc) {
+    for (int w = 0; w < NELEM(workloads); w++)
+      workloads[w].fn();
+  } else {
+    for (; i < argc; i++)
+      find(argv[i])();
+  }
+
+  rmfile(BIGFILE);
+  rmfile(DIR);
+  bstat(&hits, &misses);
+  printf("\nbuffer cache: %d buffers, %lu hits, %lu misses\n", NBUF, hits, misses);
+  return 0;
+}
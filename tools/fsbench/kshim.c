@@ -0,0 +1,319 @@
+//
+// The rest of what fat32.c and bio.c expect, past tools/hostshim: the
+// disk and its block layer, kmalloc, copies, one process, blkstat and
+// the page cache. Only paths starting at / are looked up, and there are
+// no image mounts, /dev or /proc.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/spinlock.h"
+#include "include/sleeplock.h"
+#include "include/buf.h"
+#include "include/blk.h"
+#include "include/kalloc.h"
+#include "include/vm.h"
+#include "include/pm.h"
+#include "include/proc.h"
+#include "include/fat32.h"
+#include "include/disk.h"
+#include "include/image.h"
+#include "include/dev.h"
+#include "include/copy.h"
+#include "include/procfs.h"
+#include "include/blkstat.h"
+#include "include/pagecache.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "host.h"
+
+struct dirent *dev;         // no /dev
+struct blkqueue disk_queue;
+static struct proc proc0;
+
+// bio's requests for breadahead() and bawrite(), which end before
+// blk_submit() returns here
+#define NREQ 64
+static struct {
+  struct spinlock lock;
+  struct blkreq req[NREQ];
+  char used[NREQ];
+} reqs;
+
+static struct {
+  struct spinlock lock;
+  struct blkstat s[FSNUM];
+} blkstats;
+
+struct proc *
+myproc(void)
+{
+  proc0.cwd = &rootfs->root;
+  return &proc0;
+}
+
+// The image was opened by main() before fs_init().
+void
+disk_init(void)
+{
+}
+
+void *
+kmalloc(uint size)
+{
+  if (size > sizeof(struct blkreq))
+    panic("fsbench: kmalloc of more than a blkreq");
+  acquire(&reqs.lock);
+  for (int i = 0; i < NREQ; i++) {
+    if (!reqs.used[i]) {
+      reqs.used[i] = 1;
+      release(&reqs.lock);
+      return &reqs.req[i];
+    }
+  }
+  release(&reqs.lock);
+  return NULL;
+}
+
+void
+kfree(void *addr)
+{
+  acquire(&reqs.lock);
+  reqs.used[(struct blkreq *)addr - reqs.req] = 0;
+  release(&reqs.lock);
+}
+
+// The block layer, without queueing: a request is done when it is
+// submitted, so there is nothing to merge, sort, plug or wait for.
+
+void
+blk_initreq(struct blkreq *r, int write, uint sector, void (*end_io)(struct blkreq *), void *private)
+{
+  r->write = write;
+  r->sector = sector;
+  r->nsect = 0;
+  r->error = 0;
+  r->end_io = end_io;
+  r->private = private;
+  r->done = 0;
+}
+
+int
+blk_addsect(struct blkreq *r, uchar *data)
+{
+  if (r->nsect == BLK_MAXSECT)
+    return -1;
+  r->data[r->nsect++] = data;
+  return 0;
+}
+
+void
+blk_submit(struct blkqueue *q, struct blkreq *r)
+{
+  uint64 submit = blkstat_submit(0);
+
+  for (int i = 0; i < r->nsect; i++) {
+    if (r->write)
+      host_disk_write(r->sector + i, r->data[i], BSIZE);
+    else
+      host_disk_read(r->sector + i, r->data[i], BSIZE);
+  }
+  blkstat_done(0, r->write ? BLK_WRITE : BLK_READ, r->nsect, submit, submit);
+  if (r->end_io)
+    r->end_io(r);
+  else
+    r->done = 1;
+}
+
+void
+blk_wait(struct blkreq *r)
+{
+}
+
+void
+blk_start_plug(struct blkplug *plug)
+{
+}
+
+void
+blk_finish_plug(struct blkplug *plug)
+{
+}
+
+void
+blk_flush_plug(void)
+{
+}
+
+void
+vdisk_read(struct buf *b)
+{
+  host_disk_read(b->sectorno, b->data, BSIZE);
+}
+
+void
+vdisk_write(struct buf *b)
+{
+  host_disk_write(b->sectorno, b->data, BSIZE);
+}
+
+void
+image_init(struct dirent *img)
+{
+  panic("fsbench: no image mounts");
+}
+
+void
+image_read(struct buf *b, struct dirent *img)
+{
+  panic("fsbench: no image mounts");
+}
+
+void
+image_write(struct buf *b, struct dirent *img)
+{
+  panic("fsbench: no image mounts");
+}
+
+int
+devlookup(char *name)
+{
+  return -1;
+}
+
+int
+procfs_lookup(char *name, char *path)
+{
+  return -1;
+}
+
+// Nothing execs here, so nothing is ever cached.
+void
+pcache_drop(struct dirent *ep)
+{
+}
+
+// Everything is in kernel memory here: bdirect() never looks up a
+// user page.
+uint64
+walkaddr_read(pagetable_t pagetable, uint64 va)
+{
+  panic("fsbench: no user memory");
+  return 0;
+}
+
+uint64
+walkaddr_write(pagetable_t pagetable, uint64 va)
+{
+  panic("fsbench: no user memory");
+  return 0;
+}
+
+void
+pagedup(void *pa)
+{
+  panic("fsbench: no user memory");
+}
+
+void
+freepage(void *pa)
+{
+  panic("fsbench: no user memory");
+}
+
+int
+either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
+{
+  memmove((void *)dst, src, len);
+  return 0;
+}
+
+int
+either_copyin(int user_src, void *dst, uint64 src, uint64 len)
+{
+  memmove(dst, (void *)src, len);
+  return 0;
+}
+
+// blkstat, on the host clock; the kernel's is tied to r_time().
+
+static uint64
+now_ticks(void)
+{
+  return host_now_ns() / (NSEC_PER_SEC / TICK_FREQ);
+}
+
+void
+blkstat_init(void)
+{
+  initlock(&blkstats.lock, "blkstat");
+  initlock(&reqs.lock, "fsbench_reqs");
+  memset(blkstats.s, 0, sizeof(blkstats.s));
+}
+
+void
+blkstat_cache(uint dev, int kind, int hit)
+{
+  if (hit)
+    __sync_fetch_and_add(&blkstats.s[dev].hits[kind], 1);
+  else
+    __sync_fetch_and_add(&blkstats.s[dev].misses[kind], 1);
+}
+
+uint64
+blkstat_submit(uint dev)
+{
+  acquire(&blkstats.lock);
+  blkstats.s[dev].in_flight++;
+  release(&blkstats.lock);
+  return now_ticks();
+}
+
+void
+blkstat_done(uint dev, int rw, int nsect, uint64 submit, uint64 dispatch)
+{
+  struct blkstat *bs = &blkstats.s[dev];
+  uint64 now = now_ticks();
+  uint64 us = TICK_TO_US(now - submit);
+  int b = 0;
+
+  while (us && b < BLK_NLAT - 1) {
+    us >>= 1;
+    b++;
+  }
+  acquire(&blkstats.lock);
+  bs->in_flight--;
+  bs->ios[rw]++;
+  bs->sectors[rw] += nsect;
+  bs->queue_time[rw] += dispatch - submit;
+  bs->service_time[rw] += now - dispatch;
+  bs->busy_time += now - submit;
+  bs->lat[rw][b]++;
+  release(&blkstats.lock);
+}
+
+void
+blkstat_merge(uint dev, int rw)
+{
+  __sync_fetch_and_add(&blkstats.s[dev].merges[rw], 1);
+}
+
+void
+blkstat_get(uint dev, struct blkstat *bs)
+{
+  acquire(&blkstats.lock);
+  *bs = blkstats.s[dev];
+  release(&blkstats.lock);
+}
+
+void
+blkstat_reset_cache(void)
+{
+  acquire(&blkstats.lock);
+  for (int i = 0; i < FSNUM; i++) {
+    memset(blkstats.s[i].hits, 0, sizeof(blkstats.s[i].hits));
+    memset(blkstats.s[i].misses, 0, sizeof(blkstats.s[i].misses));
+  }
+  release(&blkstats.lock);
+}
@@ -0,0 +1,213 @@
+//
+// The libc side of the host builds: pthreads for threads and sleep
+// locks, fixed memory, the disk image, the clock and stdio.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host.h"
+
+#define SECTOR  512
+
+static pthread_mutex_t sleep_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cv = PTHREAD_COND_INITIALIZER;
+
+static struct {
+  int fd;
+  char *map;            // the private mapping, or NULL for pread/pwrite
+  unsigned long size;
+} disk = { -1, NULL, 0 };
+
+void
+host_lock(void)
+{
+  pthread_mutex_lock(&sleep_mu);
+}
+
+void
+host_unlock(void)
+{
+  pthread_mutex_unlock(&sleep_mu);
+}
+
+void
+host_wait(void)
+{
+  pthread_cond_wait(&sleep_cv, &sleep_mu);
+}
+
+void
+host_wakeup(void)
+{
+  pthread_cond_broadcast(&sleep_cv);
+}
+
+void
+host_yield(void)
+{
+  sched_yield();
+}
+
+int
+host_tid(void)
+{
+  return syscall(SYS_gettid);
+}
+
+struct thread_arg {
+  void (*fn)(int);
+  int id;
+};
+
+static void *
+thread_main(void *p)
+{
+  struct thread_arg *a = p;
+
+  a->fn(a->id);
+  return NULL;
+}
+
+void
+host_run_threads(int n, void (*fn)(int))
+{
+  pthread_t tid[n];
+  struct thread_arg arg[n];
+
+  for (int i = 0; i < n; i++) {
+    arg[i].fn = fn;
+    arg[i].id = i;
+    if (pthread_create(&tid[i], NULL, thread_main, &arg[i]) != 0)
+      host_panic("pthread_create");
+  }
+  for (int i = 0; i < n; i++)
+    pthread_join(tid[i], NULL);
+}
+
+int
+host_map_fixed(unsigned long base, unsigned long len)
+{
+  void *p = mmap((void *)base, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+
+  if (p != (void *)base) {
+    fprintf(stderr, "map %#lx-%#lx: %s\n", base, base + len,
+            p == MAP_FAILED ? strerror(errno) : "taken");
+    return -1;
+  }
+  return 0;
+}
+
+int
+host_disk_open(const char *path, int use_mmap)
+{
+  struct stat st;
+
+  if ((disk.fd = open(path, use_mmap ? O_RDONLY : O_RDWR)) < 0 || fstat(disk.fd, &st) < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  disk.size = st.st_size;
+  if (use_mmap) {
+    disk.map = mmap(NULL, disk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, disk.fd, 0);
+    if (disk.map == MAP_FAILED) {
+      fprintf(stderr, "mmap %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+unsigned long
+host_disk_sectors(void)
+{
+  return disk.size / SECTOR;
+}
+
+static void
+check_range(unsigned long sector, int len)
+{
+  if ((sector + 1) * SECTOR > disk.size || len > SECTOR)
+    host_panic("sector out of range");
+}
+
+void
+host_disk_read(unsigned long sector, void *buf, int len)
+{
+  check_range(sector, len);
+  if (disk.map)
+    memcpy(buf, disk.map + sector * SECTOR, len);
+  else if (pread(disk.fd, buf, len, sector * SECTOR) != len)
+    host_panic("pread");
+}
+
+void
+host_disk_write(unsigned long sector, const void *buf, int len)
+{
+  check_range(sector, len);
+  if (disk.map)
+    memcpy(disk.map + sector * SECTOR, buf, len);
+  else if (pwrite(disk.fd, buf, len, sector * SECTOR) != len)
+    host_panic("pwrite");
+}
+
+int
+host_read_file(const char *path, char *buf, int max)
+{
+  int fd, n;
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  n = read(fd, buf, max);
+  close(fd);
+  return n;
+}
+
+unsigned long
+host_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void
+host_vprintf(int to_stderr, const char *fmt, va_list ap)
+{
+  vfprintf(to_stderr ? stderr : stdout, fmt, ap);
+}
+
+int
+host_vsnprintf(char *buf, int size, const char *fmt, va_list ap)
+{
+  return vsnprintf(buf, size, fmt, ap);
+}
+
+void
+host_panic(const char *s)
+{
+  fflush(stdout);
+  fprintf(stderr, "panic: %s\n", s);
+  abort();
+}
+
+void
+host_exit(int code)
+{
+  exit(code);
+}
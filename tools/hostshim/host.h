@@ -0,0 +1,42 @@
+#ifndef __HOSTSHIM_HOST_H
+#define __HOSTSHIM_HOST_H
+
+#include <stdarg.h>
+
+// What the host builds of kernel sources take from libc. Kernel
+// headers and libc's can't share a file, so everything built with
+// kernel headers sees the host only through these, which use no types
+// of either.
+
+// one mutex and condition variable for all sleep locks
+void            host_lock(void);
+void            host_unlock(void);
+void            host_wait(void);
+void            host_wakeup(void);
+void            host_yield(void);
+int             host_tid(void);
+
+// Run fn(0) .. fn(n - 1) on threads of their own, wait for them all.
+void            host_run_threads(int n, void (*fn)(int));
+
+// Back [base, base + len) with zeroed memory, for code that takes its
+// memory to be at fixed physical addresses.
+int             host_map_fixed(unsigned long base, unsigned long len);
+
+// The disk image. With use_mmap it is mapped privately and never
+// written back; otherwise it is read and written with pread/pwrite.
+int             host_disk_open(const char *path, int use_mmap);
+unsigned long   host_disk_sectors(void);
+void            host_disk_read(unsigned long sector, void *buf, int len);
+void            host_disk_write(unsigned long sector, const void *buf, int len);
+
+// Up to max bytes of the file at path; -1 if it can't be read.
+int             host_read_file(const char *path, char *buf, int max);
+
+unsigned long   host_now_ns(void);
+void            host_vprintf(int to_stderr, const char *fmt, va_list ap);
+int             host_vsnprintf(char *buf, int size, const char *fmt, va_list ap);
+void            host_panic(const char *s) __attribute__((noreturn));
+void            host_exit(int code) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,229 @@
+//
+// Kernel services every host build needs: locks, printing and panic.
+// Built like the kernel sources, with kernel headers; the host is
+// reached through host.h.
+//
+// Spin locks spin with sched_yield() in between, sleep locks wait on
+// one pthread condition variable. Threads are all the same process
+// and hart to the kernel code.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/spinlock.h"
+#include "include/sleeplock.h"
+#include "include/klog.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "kcommon.h"
+#include "host.h"
+
+#define NLOCKSTAT   32
+
+static struct lockstat lockstats[NLOCKSTAT];
+static int nlockstat;
+
+// The entry for lk's name, made on first use.
+static struct lockstat *
+lockstat_of(struct spinlock *lk)
+{
+  int i, n = __atomic_load_n(&nlockstat, __ATOMIC_ACQUIRE);
+
+  for (i = 0; i < n; i++) {
+    if (lockstats[i].name == lk->name)
+      return &lockstats[i];
+  }
+  host_lock();
+  for (i = 0; i < nlockstat; i++) {
+    if (lockstats[i].name == lk->name || strncmp(lockstats[i].name, lk->name, 32) == 0)
+      break;
+  }
+  if (i == nlockstat && nlockstat < NLOCKSTAT) {
+    lockstats[i].name = lk->name;
+    __atomic_store_n(&nlockstat, i + 1, __ATOMIC_RELEASE);
+  }
+  host_unlock();
+  return i < NLOCKSTAT ? &lockstats[i] : NULL;
+}
+
+int
+lockstat_get(struct lockstat *out, int max)
+{
+  int n = __atomic_load_n(&nlockstat, __ATOMIC_ACQUIRE);
+
+  if (n > max)
+    n = max;
+  for (int i = 0; i < n; i++)
+    out[i] = lockstats[i];
+  return n;
+}
+
+void
+lockstat_reset(void)
+{
+  for (int i = 0; i < nlockstat; i++)
+    lockstats[i].acquires = lockstats[i].contended = lockstats[i].spins = 0;
+}
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  lk->name = name;
+  lk->locked = 0;
+  lk->cpu = 0;
+}
+
+void
+acquire(struct spinlock *lk)
+{
+  struct lockstat *ls = lockstat_of(lk);
+  uint64 spins = 0;
+
+  while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+    spins++;
+    host_yield();
+  }
+  __sync_synchronize();
+  if (ls) {
+    __sync_fetch_and_add(&ls->acquires, 1);
+    if (spins) {
+      __sync_fetch_and_add(&ls->contended, 1);
+      __sync_fetch_and_add(&ls->spins, spins);
+    }
+  }
+}
+
+void
+release(struct spinlock *lk)
+{
+  __sync_synchronize();
+  __sync_lock_release(&lk->locked);
+}
+
+int
+holding(struct spinlock *lk)
+{
+  return lk->locked;
+}
+
+void
+initsleeplock(struct sleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+  lk->pid = 0;
+}
+
+void
+acquiresleep(struct sleeplock *lk)
+{
+  host_lock();
+  while (lk->locked)
+    host_wait();
+  lk->locked = 1;
+  lk->pid = host_tid();
+  host_unlock();
+}
+
+void
+releasesleep(struct sleeplock *lk)
+{
+  host_lock();
+  lk->locked = 0;
+  lk->pid = 0;
+  host_wakeup();
+  host_unlock();
+}
+
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  host_lock();
+  r = !lk->locked;
+  if (r) {
+    lk->locked = 1;
+    lk->pid = host_tid();
+  }
+  host_unlock();
+  return r;
+}
+
+int
+holdingsleep(struct sleeplock *lk)
+{
+  int r;
+
+  host_lock();
+  r = lk->locked && lk->pid == host_tid();
+  host_unlock();
+  return r;
+}
+
+int
+cpuid(void)
+{
+  return 0;
+}
+
+void
+printf(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  host_vprintf(0, fmt, ap);
+  va_end(ap);
+}
+
+int
+snprintf(char *buf, int size, char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = host_vsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+void
+__debug_info(char *fmt, ...)
+{
+}
+
+void
+__debug_warn(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  host_vprintf(1, fmt, ap);
+  va_end(ap);
+}
+
+void
+__debug_error(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  host_vprintf(1, fmt, ap);
+  va_end(ap);
+}
+
+// Warnings aren't what the host builds are for.
+int
+__ratelimit(struct ratelimit *rs)
+{
+  return 0;
+}
+
+void
+panic(char *s)
+{
+  host_panic(s);
+}
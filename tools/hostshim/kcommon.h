@@ -0,0 +1,20 @@
+#ifndef __HOSTSHIM_KCOMMON_H
+#define __HOSTSHIM_KCOMMON_H
+
+#include "include/types.h"
+
+// What kcommon.c adds to the kernel services it stands in for. Spin
+// locks are counted by name: every lock initlock() gave the same name
+// shares an entry.
+
+struct lockstat {
+  char *name;
+  uint64 acquires;
+  uint64 contended;     // acquires that found the lock held
+  uint64 spins;         // times they went round before getting it
+};
+
+int             lockstat_get(struct lockstat *out, int max);
+void            lockstat_reset(void);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __HOSTSHIM_KRENAME_H
+#define __HOSTSHIM_KRENAME_H
+
+// Forced into every kernel source built for the host, so the kernel's
+// string and print functions don't take the place of libc's.
+
+#define memcmp      k_memcmp
+#define memmove     k_memmove
+#define memcpy      k_memcpy
+#define memset      k_memset
+#define strlen      k_strlen
+#define strncmp     k_strncmp
+#define strncpy     k_strncpy
+#define strchr      k_strchr
+#define printf      k_printf
+#define snprintf    k_snprintf
+
+#endif
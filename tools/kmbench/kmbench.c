@@ -0,0 +1,432 @@
+//
+// kmbench -- pm.c and kmalloc.c under load, on the host.
+//
+// src/pm.c, src/kmalloc.c and src/string.c are built unchanged against
+// tools/hostshim. Physical memory is an arena mapped where the kernel
+// has it, from kernel_end, which the link sets, up to PHYSTOP.
+//
+//   kmbench [-t threads] [-n ops] [-w live] [-p profile | -d file]
+//
+//   -t threads  threads allocating at once, 4 by default
+//   -n ops      allocations and frees each thread does, 1000000
+//   -w live     slots each thread has for live objects, 1024
+//   -p profile  a built-in size distribution: kernel, small or uniform
+//   -d file     a size distribution of "size weight" lines; a size of
+//               "page" or 4096 is an allocpage() rather than a kmalloc()
+//
+// Each step a thread picks one of its slots at random, frees what is
+// there or fills it with an allocation of a size drawn from the
+// distribution. The report has throughput, contention on each lock,
+// and per size class the pages held at the end and at the peak; then
+// everything is freed and what wasn't given back is counted.
+//
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/memlayout.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/file.h"
+#include "include/pipe.h"
+#include "include/vma.h"
+#include "include/mmap.h"
+#include "include/signal.h"
+#include "include/perf.h"
+#include "include/sysstat.h"
+#include "include/pm.h"
+#include "include/kalloc.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "kcommon.h"
+#include "host.h"
+
+#define MAXTHREADS  64
+#define MAXLIVE     4096
+#define MAXDIST     256
+#define MAXCLASS    300
+#define NLOCK       16
+#define SAMPLE_OPS  1024        // thread 0 looks at the classes this often
+
+struct dist {
+  uint size;                    // PGSIZE for allocpage()
+  uint weight;
+};
+
+struct slot {
+  void *p;
+  uint size;                    // 0 if empty
+};
+
+struct worker {
+  uint64 rand;
+  uint64 allocs;
+  uint64 frees;
+  uint64 failed;
+  uint64 asked;                 // bytes asked for by what is live
+  char pad[24];                 // a cache line each
+};
+
+static struct {
+  int threads;
+  uint64 ops;
+  int live;
+} opt = { 4, 1000000, 1024 };
+
+extern char kernel_end[];
+
+static struct dist dist[MAXDIST];
+static uint64 cumweight[MAXDIST];
+static int ndist;
+
+static struct slot slots[MAXTHREADS][MAXLIVE];
+static struct worker workers[MAXTHREADS];
+
+static struct {
+  uint obj_size;
+  uint peak;
+} peaks[MAXCLASS];
+static int npeaks;
+static uint64 peak_used;        // pages, kmalloc's and the rest
+
+// What allocates in the kernel, weighted by a guess at how often:
+// files and vmas come and go with every open and mmap, argv strings
+// with every exec.
+static struct dist kernel_profile[] = {
+  { sizeof(struct file),          20 },
+  { sizeof(struct vma),           30 },
+  { sizeof(map_fix),               2 },
+  { sizeof(struct pipe),           5 },
+  { sizeof(struct sighand),        5 },
+  { sizeof(struct sig_frame),      5 },
+  { sizeof(struct perf_event),     1 },
+  { sizeof(struct proc_sysstat),   3 },
+  { sizeof(struct proc),           2 },
+  { 256,                          15 },
+  { PGSIZE,                       12 },
+};
+
+static struct dist small_profile[] = {
+  { 32, 1 }, { 48, 1 }, { 64, 1 }, { 96, 1 }, { 128, 1 },
+};
+
+static void
+usage(void)
+{
+  __debug_error("usage: kmbench [-t threads] [-n ops] [-w live] [-p kernel|small|uniform | -d file]\n");
+  host_exit(2);
+}
+
+static uint64
+atou(char *s)
+{
+  uint64 n = 0;
+
+  if (s == NULL || *s == '\0')
+    usage();
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9')
+      usage();
+    n = n * 10 + *s - '0';
+  }
+  return n;
+}
+
+static void
+add_dist(uint size, uint weight)
+{
+  if (ndist == MAXDIST) {
+    __debug_error("kmbench: more than %d sizes\n", MAXDIST);
+    host_exit(2);
+  }
+  if (size == 0 || size > PGSIZE || weight == 0)
+    return;
+  dist[ndist].size = size;
+  dist[ndist].weight = weight;
+  cumweight[ndist] = (ndist ? cumweight[ndist - 1] : 0) + weight;
+  ndist++;
+}
+
+static void
+load_profile(char *name)
+{
+  if (strncmp(name, "kernel", 8) == 0) {
+    for (int i = 0; i < NELEM(kernel_profile); i++)
+      add_dist(kernel_profile[i].size, kernel_profile[i].weight);
+  } else if (strncmp(name, "small", 8) == 0) {
+    for (int i = 0; i < NELEM(small_profile); i++)
+      add_dist(small_profile[i].size, small_profile[i].weight);
+  } else if (strncmp(name, "uniform", 8) == 0) {
+    for (uint sz = 32; sz <= 4048; sz += 16)
+      add_dist(sz, 1);
+  } else {
+    usage();
+  }
+}
+
+// The next blank-separated word on the line at *s, moving *s past it;
+// NULL at the end of the line or a comment.
+static char *
+word(char **s)
+{
+  char *w;
+
+  while (**s == ' ' || **s == '\t')
+    (*s)++;
+  if (**s == '\0' || **s == '#')
+    return NULL;
+  w = *s;
+  while (**s && **s != ' ' && **s != '\t' && **s != '#')
+    (*s)++;
+  if (**s == '#')
+    **s = '\0';
+  else if (**s)
+    *(*s)++ = '\0';
+  return w;
+}
+
+static void
+load_file(char *path)
+{
+  static char buf[16384];
+  int n = host_read_file(path, buf, sizeof(buf) - 1);
+  char *s = buf;
+
+  if (n < 0)
+    host_exit(2);
+  buf[n] = '\0';
+  while (*s) {
+    char *line = s, *size, *weight;
+    char *nl = strchr(s, '\n');
+
+    if (nl) {
+      *nl = '\0';
+      s = nl + 1;
+    } else {
+      s += strlen(s);
+    }
+    if ((size = word(&line)) == NULL)
+      continue;
+    if ((weight = word(&line)) == NULL) {
+      __debug_error("kmbench: %s: a line without a weight\n", path);
+      host_exit(2);
+    }
+    if (strncmp(size, "page", 5) == 0)
+      add_dist(PGSIZE, atou(weight));
+    else
+      add_dist(atou(size), atou(weight));
+  }
+}
+
+static uint64
+xorshift(uint64 *s)
+{
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+static uint
+draw(uint64 *rand)
+{
+  uint64 r = xorshift(rand) % cumweight[ndist - 1];
+  int lo = 0, hi = ndist - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cumweight[mid] > r)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return dist[lo].size;
+}
+
+static void
+release_slot(struct worker *w, struct slot *s)
+{
+  if (s->size == PGSIZE)
+    freepage(s->p);
+  else
+    kfree(s->p);
+  w->frees++;
+  w->asked -= s->size;
+  s->size = 0;
+  s->p = NULL;
+}
+
+static void
+sample_classes(void)
+{
+  struct kmalloc_class kc[MAXCLASS];
+  int n = kmalloc_classes(kc, MAXCLASS);
+  uint64 used = totalpages() - idlepages();
+
+  if (used > peak_used)
+    peak_used = used;
+  for (int i = 0; i < n; i++) {
+    int j;
+    for (j = 0; j < npeaks; j++) {
+      if (peaks[j].obj_size == kc[i].obj_size)
+        break;
+    }
+    if (j == npeaks) {
+      if (npeaks == MAXCLASS)
+        continue;
+      peaks[npeaks++].obj_size = kc[i].obj_size;
+    }
+    if (kc[i].npages > peaks[j].peak)
+      peaks[j].peak = kc[i].npages;
+  }
+}
+
+static void
+work(int id)
+{
+  struct worker *w = &workers[id];
+  struct slot *mine = slots[id];
+
+  for (uint64 op = 0; op < opt.ops; op++) {
+    struct slot *s = &mine[xorshift(&w->rand) % opt.live];
+
+    if (id == 0 && op % SAMPLE_OPS == 0)
+      sample_classes();
+    if (s->size) {
+      release_slot(w, s);
+      continue;
+    }
+    uint size = draw(&w->rand);
+    s->p = size == PGSIZE ? allocpage() : kmalloc(size);
+    if (s->p == NULL) {
+      w->failed++;
+      continue;
+    }
+    s->size = size;
+    w->allocs++;
+    w->asked += size;
+  }
+}
+
+static void
+report_locks(void)
+{
+  struct lockstat ls[NLOCK];
+  int n = lockstat_get(ls, NLOCK);
+
+  printf("\n%-12s %12s %10s %10s\n", "lock", "acquires", "contended%", "spins/c");
+  for (int i = 0; i < n; i++) {
+    if (ls[i].acquires == 0)
+      continue;
+    printf("%-12s %12lu %10lu %10lu\n", ls[i].name, ls[i].acquires,
+           ls[i].contended * 100 / ls[i].acquires,
+           ls[i].contended ? ls[i].spins / ls[i].contended : 0);
+  }
+}
+
+// used% is how full the pages a class holds are, waste what the rest
+// of them costs, as in /dev/meminfo.
+static void
+report_classes(uint64 asked)
+{
+  struct kmalloc_class kc[MAXCLASS];
+  int n = kmalloc_classes(kc, MAXCLASS);
+  uint64 objs = 0, bytes = 0, pages = 0;
+
+  sample_classes();
+  printf("\n%6s %8s %6s %6s %6s %6s %10s\n",
+         "size", "objs", "pages", "peak", "capa", "used%", "waste_kB");
+  for (int i = 0; i < n; i++) {
+    uint64 slotcnt = (uint64)kc[i].npages * kc[i].capa;
+    uint64 used = (uint64)kc[i].nobjs * kc[i].obj_size;
+    uint peak = 0;
+
+    for (int j = 0; j < npeaks; j++) {
+      if (peaks[j].obj_size == kc[i].obj_size)
+        peak = peaks[j].peak;
+    }
+    printf("%6u %8u %6u %6u %6u %6lu %10lu\n", kc[i].obj_size, kc[i].nobjs,
+           kc[i].npages, peak, kc[i].capa, slotcnt ? kc[i].nobjs * 100 / slotcnt : 0,
+           ((uint64)kc[i].npages * PGSIZE - used) / 1024);
+    objs += kc[i].nobjs;
+    bytes += used;
+    pages += kc[i].npages;
+  }
+  printf("\nkmalloc: %lu objects, %lu bytes asked for, %lu in objects, "
+         "%lu kB of pages, %lu%% of them used\n", objs, asked, bytes,
+         pages * PGSIZE / 1024, pages ? bytes * 100 / (pages * PGSIZE) : 0);
+  printf("pages: %lu in all, %lu used now, %lu at the peak\n",
+         totalpages(), totalpages() - idlepages(), peak_used);
+}
+
+int
+main(int argc, char **argv)
+{
+  uint64 allocs = 0, frees = 0, failed = 0, asked = 0, pagesdirect = 0;
+  uint64 start, ns, ops, before;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "-t", 3) == 0 && i + 1 < argc)
+      opt.threads = atou(argv[++i]);
+    else if (strncmp(argv[i], "-n", 3) == 0 && i + 1 < argc)
+      opt.ops = atou(argv[++i]);
+    else if (strncmp(argv[i], "-w", 3) == 0 && i + 1 < argc)
+      opt.live = atou(argv[++i]);
+    else if (strncmp(argv[i], "-p", 3) == 0 && i + 1 < argc)
+      load_profile(argv[++i]);
+    else if (strncmp(argv[i], "-d", 3) == 0 && i + 1 < argc)
+      load_file(argv[++i]);
+    else
+      usage();
+  }
+  if (opt.threads < 1 || opt.threads > MAXTHREADS || opt.live < 1 || opt.live > MAXLIVE)
+    usage();
+  if (ndist == 0)
+    load_profile("kernel");
+
+  if (host_map_fixed((uint64)kernel_end, PHYSTOP - (uint64)kernel_end) < 0)
+    host_exit(1);
+  kpminit();
+  kmallocinit();
+  before = totalpages() - idlepages();
+  for (i = 0; i < opt.threads; i++)
+    workers[i].rand = 0x9e3779b97f4a7c15UL * (i + 1);
+  lockstat_reset();
+
+  start = host_now_ns();
+  host_run_threads(opt.threads, work);
+  ns = host_now_ns() - start;
+
+  for (i = 0; i < opt.threads; i++) {
+    allocs += workers[i].allocs;
+    frees += workers[i].frees;
+    failed += workers[i].failed;
+    asked += workers[i].asked;
+    for (int j = 0; j < opt.live; j++) {
+      if (slots[i][j].size == PGSIZE)
+        pagesdirect++;
+    }
+  }
+  ops = allocs + frees + failed;
+  if (ns == 0)
+    ns = 1;
+  printf("%d threads, %d sizes: %lu ops in %lu ms, %lu ops/s, %lu ns/op a thread\n",
+         opt.threads, ndist, ops, ns / 1000000, ops * NSEC_PER_SEC / ns,
+         ns * opt.threads / (ops ? ops : 1));
+  printf("%lu allocs, %lu frees, %lu failed\n", allocs, frees, failed);
+  report_locks();
+  report_classes(asked - pagesdirect * PGSIZE);
+
+  for (i = 0; i < opt.threads; i++) {
+    for (int j = 0; j < opt.live; j++) {
+      if (slots[i][j].size)
+        release_slot(&workers[i], &slots[i][j]);
+    }
+  }
+  // the allocators themselves are never freed
+  printf("after freeing all: %lu pages still used, %lu before the run\n",
+         totalpages() - idlepages(), before);
+  return 0;
+}
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+# Turn samples read from /dev/kprof into profiles.
+#
+#   (on the board)  echo start > /dev/kprof; <workload>; echo stop > /dev/kprof
+#                   cat /dev/kprof > /kprof.bin
+#   (on the host)   tools/kprof.py kprof.bin                   flat profile
+#                   tools/kprof.py --callgraph kprof.bin       callers/callees
+#                   tools/kprof.py --folded kprof.bin > out.folded
+#
+# --folded writes one "frame;frame;frame count" line per stack, the input
+# flamegraph.pl and speedscope take. Kernel addresses are looked up in
+# src/kernel.sym; the call chains come from the kernel's frame pointers.
+#
+
+import argparse
+import bisect
+import collections
+import struct
+import sys
+
+DEPTH = 6
+SAMPLE = struct.Struct('<QIBBBx%dQ' % DEPTH)   # struct kprof_sample
+
+
+class Symbols:
+    def __init__(self, path):
+        syms = []
+        with open(path) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) != 2:
+                    continue
+                try:
+                    addr = int(parts[0], 16)
+                except ValueError:
+                    continue
+                # skip local labels the assembler leaves behind
+                if parts[1].startswith('.L'):
+                    continue
+                syms.append((addr, parts[1]))
+        syms.sort()
+        self.addrs = [a for a, _ in syms]
+        self.names = [n for _, n in syms]
+
+    def lookup(self, pc):
+        i = bisect.bisect_right(self.addrs, pc) - 1
+        if i < 0:
+            return '0x%x' % pc
+        return self.names[i]
+
+
+def read_samples(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    n = len(data) // SAMPLE.size
+    if len(data) % SAMPLE.size:
+        print('warning: %d trailing bytes ignored' % (len(data) % SAMPLE.size),
+              file=sys.stderr)
+    for i in range(n):
+        pc, pid, hart, user, depth, *chain = SAMPLE.unpack_from(data, i * SAMPLE.size)
+        yield pc, pid, hart, user, chain[:depth]
+
+
+def stack_of(sample, syms):
+    """Innermost frame first."""
+    pc, pid, hart, user, chain = sample
+    if user:
+        return ['[user pid %d]' % pid]
+    frames = [syms.lookup(pc)] + [syms.lookup(ra) for ra in chain]
+    if pid == 0:
+        frames.append('[idle]')
+    return frames
+
+
+def flat(samples, syms, top):
+    total = len(samples)
+    self_cnt = collections.Counter()
+    incl_cnt = collections.Counter()
+    for s in samples:
+        frames = stack_of(s, syms)
+        self_cnt[frames[0]] += 1
+        for fn in set(frames):
+            incl_cnt[fn] += 1
+    user = sum(1 for s in samples if s[3])
+    print('%d samples, %d kernel, %d user' % (total, total - user, user))
+    print('%8s %7s %8s %7s  %s' % ('self', '%', 'total', '%', 'function'))
+    for fn, n in self_cnt.most_common(top):
+        print('%8d %6.2f%% %8d %6.2f%%  %s' %
+              (n, 100.0 * n / total, incl_cnt[fn], 100.0 * incl_cnt[fn] / total, fn))
+
+
+def callgraph(samples, syms, top):
+    total = len(samples)
+    incl_cnt = collections.Counter()
+    callers = collections.defaultdict(collections.Counter)
+    callees = collections.defaultdict(collections.Counter)
+    for s in samples:
+        frames = stack_of(s, syms)
+        for fn in set(frames):
+            incl_cnt[fn] += 1
+        for callee, caller in zip(frames, frames[1:]):
+            callers[callee][caller] += 1
+            callees[caller][callee] += 1
+    for fn, n in incl_cnt.most_common(top):
+        print('-' * 60)
+        for caller, m in callers[fn].most_common():
+            print('%16d   %s' % (m, caller))
+        print('%6.2f%% %8d %s' % (100.0 * n / total, n, fn))
+        for callee, m in callees[fn].most_common():
+            print('%16d   %s' % (m, callee))
+
+
+def folded(samples, syms):
+    stacks = collections.Counter()
+    for s in samples:
+        stacks[';'.join(reversed(stack_of(s, syms)))] += 1
+    for stack, n in stacks.most_common():
+        print('%s %d' % (stack, n))
+
+
+def main():
+    ap = argparse.ArgumentParser(description='symbolize /dev/kprof samples')
+    ap.add_argument('samples', help='file copied from /dev/kprof')
+    ap.add_argument('--sym', default='src/kernel.sym', help='kernel symbol table')
+    ap.add_argument('--pid', type=int, help='only samples taken while pid ran')
+    ap.add_argument('--hart', type=int, help='only samples from this hart')
+    ap.add_argument('--top', type=int, default=40, help='rows to print')
+    mode = ap.add_mutually_exclusive_group()
+    mode.add_argument('--callgraph', action='store_true')
+    mode.add_argument('--folded', action='store_true')
+    args = ap.parse_args()
+
+    syms = Symbols(args.sym)
+    samples = [s for s in read_samples(args.samples)
+               if (args.pid is None or s[1] == args.pid)
+               and (args.hart is None or s[2] == args.hart)]
+    if not samples:
+        print('no samples', file=sys.stderr)
+        return 1
+    if args.callgraph:
+        callgraph(samples, syms, args.top)
+    elif args.folded:
+        folded(samples, syms)
+    else:
+        flat(samples, syms, args.top)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Decode records read from /dev/trace into Chrome trace event JSON,
+# which chrome://tracing and ui.perfetto.dev both open.
+#
+#   (on the board)  echo 0x3fe > /dev/trace; <workload>; echo 0 > /dev/trace
+#                   cat /dev/trace > /trace.bin
+#   (on the host)   tools/trace2json.py trace.bin > trace.json
+#
+# Harts show up as one process each, with a track of what ran on them.
+# Each user process gets its own process with its syscalls, file system
+# and block I/O slices, and page faults as instant events. Syscall names
+# come from syscall/sys.sh.
+#
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+REC = struct.Struct('<QIHBxQQ')     # struct trace_rec
+
+(LOST, SCHED_SWITCH, SCHED_WAKEUP, SYSCALL_ENTER, SYSCALL_EXIT, PAGE_FAULT,
+ BIO_SUBMIT, BIO_COMPLETE, FAT32_RW_START, FAT32_RW_END) = range(10)
+
+HART_PID = 1000000      # keeps hart tracks apart from real pids
+
+
+def syscall_names(path):
+    names = {}
+    try:
+        with open(path) as f:
+            for line in f:
+                m = re.match(r'\s*entry\s+(\d+)\s+(\w+)', line)
+                if m:
+                    names[int(m.group(1))] = m.group(2)
+    except OSError:
+        pass
+    return names
+
+
+def read_records(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) % REC.size:
+        print('warning: %d trailing bytes ignored' % (len(data) % REC.size),
+              file=sys.stderr)
+    recs = [REC.unpack_from(data, off)
+            for off in range(0, len(data) - REC.size + 1, REC.size)]
+    recs.sort(key=lambda r: r[0])
+    return recs
+
+
+def convert(recs, freq, sysnames):
+    events = []
+    if not recs:
+        return events
+    t0 = recs[0][0]
+
+    def ts(t):
+        return (t - t0) * 1e6 / freq
+
+    harts = set()
+    pids = set()
+    running = {}        # hart -> (pid, start)
+
+    for time, pid, event, hart, a0, a1 in recs:
+        harts.add(hart)
+        if pid:
+            pids.add(pid)
+        t = ts(time)
+        if event == LOST:
+            events.append({'name': 'lost %d records' % a0, 'ph': 'i', 's': 'p',
+                           'ts': t, 'pid': HART_PID + hart, 'tid': 0})
+        elif event == SCHED_SWITCH:
+            prev = running.pop(hart, None)
+            if prev is not None:
+                events.append({'name': 'pid %d' % prev[0], 'ph': 'X', 'ts': prev[1],
+                               'dur': t - prev[1], 'pid': HART_PID + hart, 'tid': 0})
+            if a0:
+                running[hart] = (a0, t)
+        elif event == SCHED_WAKEUP:
+            events.append({'name': 'wakeup', 'ph': 'i', 's': 't', 'ts': t,
+                           'pid': HART_PID + hart, 'tid': 0, 'args': {'pid': a0}})
+        elif event in (SYSCALL_ENTER, SYSCALL_EXIT):
+            name = sysnames.get(a0, 'syscall %d' % a0)
+            ev = {'name': name, 'cat': 'syscall', 'ph': 'B' if event == SYSCALL_ENTER else 'E',
+                  'ts': t, 'pid': pid, 'tid': pid}
+            ev['args'] = {'arg0' if event == SYSCALL_ENTER else 'ret': '%#x' % a1}
+            events.append(ev)
+        elif event == PAGE_FAULT:
+            events.append({'name': 'page fault', 'cat': 'mm', 'ph': 'i', 's': 't', 'ts': t,
+                           'pid': pid, 'tid': pid,
+                           'args': {'addr': '%#x' % a0, 'scause': a1}})
+        elif event in (BIO_SUBMIT, BIO_COMPLETE):
+            write = a1 >> 32
+            events.append({'name': 'bio write' if write else 'bio read', 'cat': 'bio',
+                           'ph': 'B' if event == BIO_SUBMIT else 'E', 'ts': t,
+                           'pid': pid, 'tid': pid,
+                           'args': {'sector': a0, 'dev': a1 & 0xffffffff}})
+        elif event == FAT32_RW_START:
+            events.append({'name': 'fat32 write' if a1 >> 32 else 'fat32 read', 'cat': 'fat32',
+                           'ph': 'B', 'ts': t, 'pid': pid, 'tid': pid,
+                           'args': {'cluster': a0, 'bytes': a1 & 0xffffffff}})
+        elif event == FAT32_RW_END:
+            events.append({'ph': 'E', 'cat': 'fat32', 'ts': t, 'pid': pid, 'tid': pid,
+                           'args': {'done': a1}})
+
+    # close what was still running when the trace stopped
+    end = ts(recs[-1][0])
+    for hart, (pid, start) in running.items():
+        events.append({'name': 'pid %d' % pid, 'ph': 'X', 'ts': start,
+                       'dur': end - start, 'pid': HART_PID + hart, 'tid': 0})
+
+    for hart in sorted(harts):
+        events.append({'name': 'process_name', 'ph': 'M', 'pid': HART_PID + hart,
+                       'args': {'name': 'hart %d' % hart}})
+        events.append({'name': 'process_sort_index', 'ph': 'M', 'pid': HART_PID + hart,
+                       'args': {'sort_index': -1}})
+    events.append({'name': 'process_name', 'ph': 'M', 'pid': 0,
+                   'args': {'name': 'kernel (no process)'}})
+    for pid in sorted(pids):
+        events.append({'name': 'process_name', 'ph': 'M', 'pid': pid,
+                       'args': {'name': 'pid %d' % pid}})
+    return events
+
+
+def main():
+    ap = argparse.ArgumentParser(description='decode /dev/trace into Chrome trace JSON')
+    ap.add_argument('trace', help='file copied from /dev/trace')
+    ap.add_argument('--freq', type=int, default=1000000, help='r_time() frequency in Hz')
+    ap.add_argument('--syscalls', default='syscall/sys.sh', help='syscall table')
+    ap.add_argument('-o', '--output', help='write here instead of stdout')
+    args = ap.parse_args()
+
+    events = convert(read_records(args.trace), args.freq, syscall_names(args.syscalls))
+    out = open(args.output, 'w') if args.output else sys.stdout
+    json.dump({'traceEvents': events, 'displayTimeUnit': 'us'}, out)
+    out.write('\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
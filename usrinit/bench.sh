@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# /mytest.sh under make bench: run the suites from sd/ with markers for
+# tools/bench.py and power off. lmbench's commands are traced (-x) so
+# each result can be told apart by the command that printed it.
+
+export PATH=/
+./busybox echo "#### bench lmbench"
+./busybox sh -x ./lmbench_testcode.sh
+./busybox echo "#### bench busybox"
+./busybox sh ./busybox_testcode.sh
+./busybox echo "#### bench lua"
+./busybox sh ./lua_testcode.sh
+./busybox echo "#### bench end"
+./busybox poweroff -f